@@ -0,0 +1,247 @@
+/*  buf-bench.c - Bandwidth benchmark of cached and non-cached DMA buffer mappings
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "pb-zybo-buf.h"
+
+#define BUF_DEV_PATH			"/dev/pb-zybo-buf"
+#define DEFAULT_SIZE			(4UL << 20)
+#define DEFAULT_ITERATIONS		20
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+/**
+ * @brief One measured memory region
+ *
+ */
+struct region {
+    const char *name;
+    uint8_t *mem;               /* Mapping of the region */
+    int sync;                   /* Buffer ID for cache syncs, -1 if the sync is not needed */
+    struct pb_zybo_buf_alloc info;
+};
+
+/**
+ * @brief Best results of one region in MB/s and the average sync time
+ *
+ */
+struct result {
+    double write_mbs;
+    double read_mbs;
+    double sync_us;
+};
+
+static void print_help() {
+    printf("Bandwidth benchmark of memcpy into/from the cached and the non-cached (coherent) DMA buffer\n");
+    printf("allocated by the pb-zybo-buf module. The heap is measured as the baseline, so the tool runs\n");
+    printf("without the module too.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-d = buffer device (default %s)\n", BUF_DEV_PATH);
+    printf("\t-s = buffer size in bytes (default %lu)\n", DEFAULT_SIZE);
+    printf("\t-n = number of iterations (default %d)\n", DEFAULT_ITERATIONS);
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double mbs(size_t size, uint64_t ns) {
+    return ns ? (double)size * 1000.0 / ns : 0.0;
+}
+
+static int buf_sync(int fd, int id, uint16_t op, uint16_t dir) {
+    struct pb_zybo_buf_sync s;
+
+    memset(&s, 0, sizeof(s));
+    s.id = id;
+    s.op = op;
+    s.dir = dir;
+    return ioctl(fd, PB_ZYBO_BUF_IOCTL_SYNC, &s);
+}
+
+static int buf_map(int fd, struct region *r, size_t size, uint32_t flags) {
+    memset(&r->info, 0, sizeof(r->info));
+    r->info.size = size;
+    r->info.flags = flags;
+    if (ioctl(fd, PB_ZYBO_BUF_IOCTL_ALLOC, &r->info) != 0) {
+        printf("Allocation of the %s buffer failed (%s)!\n", r->name, strerror(errno));
+        return RET_ERR;
+    }
+
+    r->mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, r->info.mmap_offset);
+    if (r->mem == MAP_FAILED) {
+        printf("Mapping of the %s buffer failed (%s)!\n", r->name, strerror(errno));
+        r->mem = NULL;
+        return RET_ERR;
+    }
+
+    r->sync = (r->info.out_flags & PB_ZYBO_BUF_F_CACHED) ? (int)r->info.id : -1;
+    printf("%-10s id %u, dma_addr 0x%llx, %s\n", r->name, r->info.id,
+        (unsigned long long)r->info.dma_addr,
+        (r->info.out_flags & PB_ZYBO_BUF_F_CACHED) ? "cached (explicit syncs)" :
+        (r->info.out_flags & PB_ZYBO_BUF_F_DMA_COHERENT) ? "coherent (cached, DMA coherent platform)" :
+        "coherent (non-cached)");
+    return RET_OK;
+}
+
+/* Write (CPU -> buffer, sync for the device) and read (sync for the CPU, buffer -> CPU) */
+static void measure(int fd, struct region *r, uint8_t *src, uint8_t *dst, size_t size,
+    unsigned long iterations, struct result *res) {
+    uint64_t start, t_write, t_read, t_sync = 0, best_write = UINT64_MAX, best_read = UINT64_MAX;
+    unsigned long i;
+
+    for (i = 0; i < iterations; i++) {
+        src[i % size] = (uint8_t)i;
+
+        start = now_ns();
+        memcpy(r->mem, src, size);
+        t_write = now_ns() - start;
+        if (r->sync >= 0) {
+            start = now_ns();
+            buf_sync(fd, r->sync, PB_ZYBO_BUF_SYNC_FOR_DEVICE, PB_ZYBO_BUF_DIR_BIDIR);
+            t_sync += now_ns() - start;
+        }
+
+        if (r->sync >= 0) {
+            start = now_ns();
+            buf_sync(fd, r->sync, PB_ZYBO_BUF_SYNC_FOR_CPU, PB_ZYBO_BUF_DIR_BIDIR);
+            t_sync += now_ns() - start;
+        }
+        start = now_ns();
+        memcpy(dst, r->mem, size);
+        t_read = now_ns() - start;
+
+        if (t_write < best_write)
+            best_write = t_write;
+        if (t_read < best_read)
+            best_read = t_read;
+    }
+
+    if (memcmp(src, dst, size) != 0)
+        printf("WARNING: data read from the %s region differ!\n", r->name);
+
+    res->write_mbs = mbs(size, best_write);
+    res->read_mbs = mbs(size, best_read);
+    res->sync_us = (double)t_sync / iterations / 2 / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    const char *dev_path = BUF_DEV_PATH;
+    size_t size = DEFAULT_SIZE;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    struct region regions[3];
+    struct result res;
+    unsigned int nregions = 0, i;
+    uint8_t *src, *dst, *heap;
+    int fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hd:s:n:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dev_path = optarg;
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (size == 0 || iterations == 0) {
+        printf("The size and the number of iterations have to be positive!\n");
+        return RET_ERR;
+    }
+
+    src = malloc(size);
+    dst = malloc(size);
+    heap = malloc(size);
+    if (src == NULL || dst == NULL || heap == NULL) {
+        printf("Unable to allocate %zu bytes!\n", size);
+        return RET_ERR;
+    }
+    memset(src, 0x5a, size);
+    memset(dst, 0, size);
+    memset(heap, 0, size);
+
+    print_box("Buffers");
+    regions[nregions++] = (struct region){ .name = "heap", .mem = heap, .sync = -1 };
+    printf("%-10s malloc, cached\n", "heap");
+
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0) {
+        printf("Unable to open %s (%s), only the heap is measured.\n", dev_path, strerror(errno));
+    } else {
+        regions[nregions] = (struct region){ .name = "cached" };
+        if (buf_map(fd, &regions[nregions], size, PB_ZYBO_BUF_CACHED) == RET_OK)
+            nregions++;
+        regions[nregions] = (struct region){ .name = "coherent" };
+        if (buf_map(fd, &regions[nregions], size, 0) == RET_OK)
+            nregions++;
+    }
+
+    print_box("memcpy bandwidth (best of all iterations)");
+    printf("Size %zu bytes, %lu iterations\n\n", size, iterations);
+    printf("%-10s %14s %14s %16s\n", "region", "write MB/s", "read MB/s", "sync us/call");
+    for (i = 0; i < nregions; i++) {
+        measure(fd, &regions[i], src, dst, size, iterations, &res);
+        printf("%-10s %14.1f %14.1f %16.1f\n", regions[i].name, res.write_mbs, res.read_mbs,
+            regions[i].sync >= 0 ? res.sync_us : 0.0);
+    }
+
+    /* Buffers are released by the close */
+    for (i = 1; i < nregions; i++)
+        munmap(regions[i].mem, size);
+    if (fd >= 0)
+        close(fd);
+    free(src);
+    free(dst);
+    free(heap);
+    return RET_OK;
+}
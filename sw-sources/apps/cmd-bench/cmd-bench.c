@@ -0,0 +1,259 @@
+/*  cmd-bench.c - Benchmark of the batched pb-zybo command queue
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "pb-zybo-cmd.h"
+
+/* Per-device IOCTL commands (see the driver sources) */
+#define LED_IOCTL_MAGIC				'l'
+#define LED_IOCTL_SET_VALUE			_IOW(LED_IOCTL_MAGIC, 4, int)
+
+#define RGB_IOCTL_MAGIC				'l'
+#define RGB_IOCTL_SET_VAL			_IOW(RGB_IOCTL_MAGIC, 1, unsigned long)
+
+#define SW_IOCTL_MAGIC				'l'
+#define SW_IOCTL_GET_VALUE			_IOW(SW_IOCTL_MAGIC, 2, int)
+
+#define CMD_DEV_PATH				"/dev/pb-zybo-cmd"
+#define DEFAULT_ITERATIONS			10000
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+/* Number of commands sent in one control tick */
+#define TICK_CMDS 3
+
+struct bench_conf {
+    const char *led_path;
+    const char *rgb_path;
+    const char *sw_path;
+    unsigned long iterations;
+};
+
+struct bench_res {
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+static void print_help() {
+    printf("Tool for comparison of the per-device IOCTL path and the batched command queue.\n");
+    printf("Each iteration sets the LED value, sets the RGB value and reads the switch value.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-l = LED device (default /dev/led_module-0)\n");
+    printf("\t-r = RGB LED device (default /dev/rgb-led-module-0)\n");
+    printf("\t-s = switch device (default /dev/switch_module-0)\n");
+    printf("\t-n = number of iterations (default %d)\n", DEFAULT_ITERATIONS);
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void res_init(struct bench_res *res) {
+    res->total_ns = 0;
+    res->min_ns = UINT64_MAX;
+    res->max_ns = 0;
+}
+
+static void res_add(struct bench_res *res, uint64_t ns) {
+    res->total_ns += ns;
+    if (ns < res->min_ns)
+        res->min_ns = ns;
+    if (ns > res->max_ns)
+        res->max_ns = ns;
+}
+
+static void res_print(const char *name, const struct bench_res *res, unsigned long iterations) {
+    printf("%-10s avg %8llu ns, min %8llu ns, max %8llu ns per tick (%lu ticks)\n", name,
+        (unsigned long long)(res->total_ns / iterations), (unsigned long long)res->min_ns,
+        (unsigned long long)res->max_ns, iterations);
+}
+
+/* Returns the minor number of the device, the command queue addresses devices this way */
+static int dev_minor(int fd, uint16_t *minor) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode)) {
+        printf("Unable to get the minor number of the device!\n");
+        return RET_ERR;
+    }
+    *minor = minor(st.st_rdev);
+    return RET_OK;
+}
+
+static int run_per_device(int led_fd, int rgb_fd, int sw_fd, unsigned long iterations,
+        struct bench_res *res) {
+    unsigned long i;
+    unsigned long rgb;
+    int sw;
+
+    res_init(res);
+    for (i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+
+        rgb = i & 0xffffff;
+        if (ioctl(led_fd, LED_IOCTL_SET_VALUE, (int)(i & 0xf)) != 0 ||
+            ioctl(rgb_fd, RGB_IOCTL_SET_VAL, &rgb) != 0 ||
+            ioctl(sw_fd, SW_IOCTL_GET_VALUE, &sw) != 0) {
+            printf("Per-device IOCTL failed (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+        res_add(res, now_ns() - start);
+    }
+    return RET_OK;
+}
+
+static int run_batched(int cmd_fd, uint16_t led, uint16_t rgb, uint16_t sw,
+        unsigned long iterations, struct bench_res *res) {
+    struct pb_zybo_cmd cmds[TICK_CMDS];
+    struct pb_zybo_cmd_batch batch;
+    unsigned long i;
+    int j;
+
+    memset(cmds, 0, sizeof(cmds));
+    cmds[0].op = PB_ZYBO_CMD_LED_SET;
+    cmds[0].dev = led;
+    cmds[1].op = PB_ZYBO_CMD_RGB_SET;
+    cmds[1].dev = rgb;
+    cmds[2].op = PB_ZYBO_CMD_SW_GET;
+    cmds[2].dev = sw;
+
+    res_init(res);
+    for (i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+
+        cmds[0].arg = i & 0xf;
+        cmds[1].arg = i & 0xffffff;
+        batch.cmds = (uintptr_t)cmds;
+        batch.count = TICK_CMDS;
+        batch.done = 0;
+        if (ioctl(cmd_fd, PB_ZYBO_CMD_IOCTL_SUBMIT, &batch) != 0) {
+            printf("Batch submission failed (%s)!\n", strerror(errno));
+            for (j = 0; j < TICK_CMDS; j++)
+                printf("\tcommand %d: op %u, dev %u, res %d\n", j, cmds[j].op, cmds[j].dev, cmds[j].res);
+            return RET_ERR;
+        }
+        res_add(res, now_ns() - start);
+    }
+    return RET_OK;
+}
+
+int main(int argc, char** argv) {
+    struct bench_conf conf = {
+        .led_path = "/dev/led_module-0",
+        .rgb_path = "/dev/rgb-led-module-0",
+        .sw_path = "/dev/switch_module-0",
+        .iterations = DEFAULT_ITERATIONS,
+    };
+    struct bench_res per_dev, batched;
+    uint16_t led_minor, rgb_minor, sw_minor;
+    int led_fd = -1, rgb_fd = -1, sw_fd = -1, cmd_fd = -1;
+    int ret = RET_ERR;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hl:r:s:n:")) != -1) {
+        switch (opt) {
+            case 'l':
+                conf.led_path = optarg;
+                break;
+            case 'r':
+                conf.rgb_path = optarg;
+                break;
+            case 's':
+                conf.sw_path = optarg;
+                break;
+            case 'n':
+                conf.iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (conf.iterations == 0) {
+        printf("The number of iterations has to be positive!\n");
+        return RET_ERR;
+    }
+
+    led_fd = open(conf.led_path, O_RDWR);
+    rgb_fd = open(conf.rgb_path, O_RDWR);
+    sw_fd = open(conf.sw_path, O_RDWR);
+    cmd_fd = open(CMD_DEV_PATH, O_RDWR);
+    if (led_fd < 0 || rgb_fd < 0 || sw_fd < 0 || cmd_fd < 0) {
+        printf("Unable to open devices (%s)!\n", strerror(errno));
+        goto cleanup;
+    }
+
+    if (dev_minor(led_fd, &led_minor) != RET_OK || dev_minor(rgb_fd, &rgb_minor) != RET_OK ||
+        dev_minor(sw_fd, &sw_minor) != RET_OK)
+        goto cleanup;
+
+    print_box("Per-device IOCTL path (3 system calls per tick)");
+    if (run_per_device(led_fd, rgb_fd, sw_fd, conf.iterations, &per_dev) != RET_OK)
+        goto cleanup;
+    res_print("per-device", &per_dev, conf.iterations);
+
+    print_box("Batched command queue (1 system call per tick)");
+    if (run_batched(cmd_fd, led_minor, rgb_minor, sw_minor, conf.iterations, &batched) != RET_OK)
+        goto cleanup;
+    res_print("batched", &batched, conf.iterations);
+
+    printf("\nSpeedup of the batched path: %.2fx\n",
+        (double)per_dev.total_ns / (double)(batched.total_ns ? batched.total_ns : 1));
+    ret = RET_OK;
+
+cleanup:
+    if (led_fd >= 0)
+        close(led_fd);
+    if (rgb_fd >= 0)
+        close(rgb_fd);
+    if (sw_fd >= 0)
+        close(sw_fd);
+    if (cmd_fd >= 0)
+        close(cmd_fd);
+    return ret;
+}
@@ -0,0 +1,271 @@
+/*  pbzybo-test.c - Test of the PB Zybo client library
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "pbzybo.h"
+
+#define DEFAULT_ITERATIONS 10000
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+#define CHECK(cond, msg) do { \
+        if (!(cond)) { \
+            printf("FAILED: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+            return RET_ERR; \
+        } \
+    } while (0)
+
+static const char *kind_names[PBZ_KIND_COUNT] = { "LED", "RGB", "switch" };
+
+static void print_help() {
+    printf("Test of the PB Zybo client library. Devices are listed and the switch to LED/RGB loop\n");
+    printf("is executed via batches and via single calls.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-f = self-test of the device lookup and batch checks in a temporary directory (no HW)\n");
+    printf("\t-r = directory with device nodes (default /dev)\n");
+    printf("\t-n = number of iterations (default %d)\n", DEFAULT_ITERATIONS);
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int touch(const char *dir, const char *name) {
+    char path[256];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    if (fd < 0)
+        return RET_ERR;
+    close(fd);
+    return RET_OK;
+}
+
+static void cleanup(const char *dir) {
+    static const char *names[] = { "led_module-0", "led_module-1", "led_module-x", "rgb-led-module-0",
+        "switch_module-0", "switch_module-" };
+    char path[256];
+    unsigned int i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+/* Regular files stand for device nodes - the lookup, persistent handles and batch checks
+ * are tested, ioctl calls fail with ENOTTY */
+static int run_self_test_dir(const char *dir) {
+    struct pbz p;
+    struct pbz_op ops[2];
+    unsigned long calls;
+    uint32_t val;
+    int fd;
+
+    CHECK(touch(dir, "led_module-1") == RET_OK && touch(dir, "led_module-0") == RET_OK &&
+        touch(dir, "led_module-x") == RET_OK && touch(dir, "rgb-led-module-0") == RET_OK &&
+        touch(dir, "switch_module-0") == RET_OK && touch(dir, "switch_module-") == RET_OK,
+        "Creation of fake nodes");
+
+    CHECK(pbz_open(&p, dir) == 0, "Open of the library");
+    CHECK(pbz_count(&p, PBZ_LED) == 2, "Two LED devices");
+    CHECK(pbz_count(&p, PBZ_RGB) == 1, "One RGB device");
+    CHECK(pbz_count(&p, PBZ_SW) == 1, "One switch device");
+    CHECK(p.cmd_fd < 0, "No command queue");
+
+    /* Persistent handle */
+    fd = pbz_fd(&p, PBZ_SW, 0);
+    CHECK(fd >= 0, "Handle of the switch device");
+    calls = p.syscalls;
+    CHECK(pbz_fd(&p, PBZ_SW, 0) == fd && p.syscalls == calls, "Handle is opened once");
+    CHECK(pbz_fd(&p, PBZ_SW, 1) < 0 && errno == ENODEV, "Unknown device");
+
+    /* Batches are checked before any call */
+    ops[0] = (struct pbz_op){ .op = PB_ZYBO_CMD_SW_GET, .idx = 0 };
+    ops[1] = (struct pbz_op){ .op = PB_ZYBO_CMD_SW_GET, .idx = 3 };
+    CHECK(pbz_batch(&p, ops, 2) < 0 && errno == ENODEV, "Invalid device index");
+    CHECK(ops[1].res == -ENODEV && ops[0].res == -ECANCELED, "Result of the invalid batch");
+    ops[1] = (struct pbz_op){ .op = PB_ZYBO_CMD_DELAY, .arg = PB_ZYBO_CMD_MAX_DELAY_US + 1 };
+    CHECK(pbz_batch(&p, ops, 2) < 0 && errno == EINVAL, "Too long delay");
+    CHECK(p.syscalls == calls, "Checks don't issue any call");
+
+    /* Cached capability */
+    p.can_write = 0;
+    CHECK(pbz_led_set(&p, 0, 1) < 0 && errno == EPERM && p.syscalls == calls, "Setter without capability");
+    ops[0] = (struct pbz_op){ .op = PB_ZYBO_CMD_RGB_SET, .idx = 0, .arg = 0xff };
+    CHECK(pbz_batch(&p, ops, 1) < 0 && errno == EPERM && p.syscalls == calls, "Batch without capability");
+
+    /* The fallback issues the per-device call */
+    CHECK(pbz_sw_get(&p, 0, &val) < 0 && errno == ENOTTY, "Call of the regular file");
+    ops[0] = (struct pbz_op){ .op = PB_ZYBO_CMD_DELAY, .arg = 10 };
+    ops[1] = (struct pbz_op){ .op = PB_ZYBO_CMD_SW_GET, .idx = 0 };
+    CHECK(pbz_batch(&p, ops, 2) < 0 && ops[0].res == 0 && ops[1].res == -ENOTTY, "Fallback batch");
+
+    pbz_close(&p);
+    CHECK(pbz_count(&p, PBZ_LED) == 0 && p.cmd_fd < 0, "Close of the library");
+    return RET_OK;
+}
+
+static int run_self_test() {
+    char dir[] = "/tmp/pbzybo-XXXXXX";
+    int ret;
+
+    print_box("Library self-test (fake nodes)");
+    if (mkdtemp(dir) == NULL) {
+        printf("Unable to create the temporary directory (%s)!\n", strerror(errno));
+        return RET_ERR;
+    }
+
+    ret = run_self_test_dir(dir);
+    cleanup(dir);
+    if (ret == RET_OK)
+        printf("Self-test passed.\n");
+    return ret;
+}
+
+static int run_loop(const char *root, unsigned long iterations) {
+    struct pbz p;
+    struct pbz_op ops[3];
+    unsigned long i, calls;
+    uint64_t start, ns;
+    uint32_t sw = 0;
+    int kind;
+    unsigned int idx;
+
+    if (pbz_open(&p, root) != 0) {
+        printf("Unable to read devices in %s (%s)!\n", root ? root : "/dev", strerror(errno));
+        return RET_ERR;
+    }
+
+    print_box("Devices");
+    for (kind = 0; kind < PBZ_KIND_COUNT; kind++) {
+        for (idx = 0; idx < pbz_count(&p, kind); idx++)
+            printf("%-7s %u: %s (minor %u)\n", kind_names[kind], idx, p.devs[kind][idx].path,
+                p.devs[kind][idx].minor);
+    }
+    printf("Command queue: %s, write capability: %s\n", p.cmd_fd >= 0 ? "yes" : "no",
+        pbz_can_write(&p) ? "yes" : "no");
+
+    if (pbz_count(&p, PBZ_SW) == 0 || pbz_count(&p, PBZ_LED) == 0 || pbz_count(&p, PBZ_RGB) == 0) {
+        printf("The loop needs the LED, RGB and switch device.\n");
+        pbz_close(&p);
+        return RET_ERR;
+    }
+    if (!pbz_can_write(&p)) {
+        printf("The loop needs the CAP_SYS_ADMIN capability.\n");
+        pbz_close(&p);
+        return RET_ERR;
+    }
+
+    print_box("Switch to LED/RGB loop");
+
+    /* Single calls - one call per operation */
+    calls = p.syscalls;
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        if (pbz_sw_get(&p, 0, &sw) != 0 || pbz_led_set(&p, 0, sw) != 0 ||
+            pbz_rgb_set(&p, 0, (sw & 0x1 ? 0xff0000 : 0) | (sw & 0x2 ? 0xff00 : 0) | (sw & 0x4 ? 0xff : 0)) != 0) {
+            printf("Single call failed (%s)!\n", strerror(errno));
+            pbz_close(&p);
+            return RET_ERR;
+        }
+    }
+    ns = now_ns() - start;
+    printf("single:  %8.1f ns per iteration, %.2f calls per iteration\n", (double)ns / iterations,
+        (double)(p.syscalls - calls) / iterations);
+
+    /* Batches - the LED and RGB show the switch value of the previous iteration */
+    calls = p.syscalls;
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        ops[0] = (struct pbz_op){ .op = PB_ZYBO_CMD_SW_GET, .idx = 0 };
+        ops[1] = (struct pbz_op){ .op = PB_ZYBO_CMD_LED_SET, .idx = 0, .arg = sw };
+        ops[2] = (struct pbz_op){ .op = PB_ZYBO_CMD_RGB_SET, .idx = 0,
+            .arg = (sw & 0x1 ? 0xff0000 : 0) | (sw & 0x2 ? 0xff00 : 0) | (sw & 0x4 ? 0xff : 0) };
+        if (pbz_batch(&p, ops, 3) < 0) {
+            printf("Batch failed (%s)!\n", strerror(errno));
+            pbz_close(&p);
+            return RET_ERR;
+        }
+        sw = ops[0].val;
+    }
+    ns = now_ns() - start;
+    printf("batched: %8.1f ns per iteration, %.2f calls per iteration\n", (double)ns / iterations,
+        (double)(p.syscalls - calls) / iterations);
+
+    pbz_close(&p);
+    return RET_OK;
+}
+
+int main(int argc, char** argv) {
+    const char *root = NULL;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    int self_test = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hfr:n:")) != -1) {
+        switch (opt) {
+            case 'f':
+                self_test = 1;
+                break;
+            case 'r':
+                root = optarg;
+                break;
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                if (iterations == 0) {
+                    printf("Invalid number of iterations \"%s\"!\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (self_test)
+        return run_self_test();
+    return run_loop(root, iterations);
+}
@@ -0,0 +1,396 @@
+/*  pbzybo.c - User space client library of the PB Zybo LED, RGB LED and switch drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <linux/capability.h>
+
+#include "pbzybo.h"
+
+#define PBZ_DEV_ROOT		"/dev"
+#define PBZ_CMD_DEV			"pb-zybo-cmd"
+
+/* Device node names (prefixes of pb-zybo-ioctl.h without the /dev/ part) */
+static const char *pbz_names[PBZ_KIND_COUNT] = {
+    [PBZ_LED] = PB_ZYBO_LED_DEV_PREFIX + 5,
+    [PBZ_RGB] = PB_ZYBO_RGB_DEV_PREFIX + 5,
+    [PBZ_SW] = PB_ZYBO_SW_DEV_PREFIX + 5,
+};
+
+/* ==================================================================
+ 		Device lookup
+   ================================================================== */
+
+/* Check the "<name>-<number>" format of the device node */
+static int pbz_match(const char *entry, const char *name) {
+    size_t len = strlen(name);
+    const char *num;
+
+    if (strncmp(entry, name, len) != 0 || entry[len] != '-')
+        return 0;
+
+    num = entry + len + 1;
+    if (*num == '\0')
+        return 0;
+    for (; *num != '\0'; num++) {
+        if (*num < '0' || *num > '9')
+            return 0;
+    }
+    return 1;
+}
+
+/* Devices are kept in the order of minor numbers, so the index is stable */
+static void pbz_add(struct pbz *p, enum pbz_kind kind, const char *root, const char *entry) {
+    struct pbz_dev dev, *devs = p->devs[kind];
+    struct stat st;
+    unsigned int i;
+
+    if (p->count[kind] == PBZ_MAX_DEVS)
+        return;
+
+    /* Too long paths are skipped */
+    if (snprintf(dev.path, sizeof(dev.path), "%s/%s", root, entry) >= (int)sizeof(dev.path))
+        return;
+    dev.fd = -1;
+    /* Nodes which are not character devices (e.g. simulated ones) are indexed in the
+     * order of the lookup */
+    if (stat(dev.path, &st) == 0 && S_ISCHR(st.st_mode))
+        dev.minor = minor(st.st_rdev);
+    else
+        dev.minor = p->count[kind];
+
+    i = p->count[kind]++;
+    while (i > 0 && devs[i - 1].minor > dev.minor) {
+        devs[i] = devs[i - 1];
+        i--;
+    }
+    devs[i] = dev;
+}
+
+/* CAP_SYS_ADMIN in the effective set of the process */
+static int pbz_check_cap(void) {
+    struct __user_cap_header_struct hdr = { .version = _LINUX_CAPABILITY_VERSION_3, .pid = 0 };
+    struct __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3];
+
+    memset(data, 0, sizeof(data));
+    if (syscall(SYS_capget, &hdr, data) != 0)
+        return geteuid() == 0;
+    return (data[CAP_TO_INDEX(CAP_SYS_ADMIN)].effective & CAP_TO_MASK(CAP_SYS_ADMIN)) != 0;
+}
+
+int pbz_open(struct pbz *p, const char *dev_root) {
+    char path[288];
+    struct dirent *de;
+    DIR *dir;
+    int kind;
+
+    memset(p, 0, sizeof(*p));
+    p->cmd_fd = -1;
+    if (dev_root == NULL)
+        dev_root = PBZ_DEV_ROOT;
+
+    dir = opendir(dev_root);
+    if (dir == NULL)
+        return -1;
+    while ((de = readdir(dir)) != NULL) {
+        for (kind = 0; kind < PBZ_KIND_COUNT; kind++) {
+            if (pbz_match(de->d_name, pbz_names[kind]))
+                pbz_add(p, kind, dev_root, de->d_name);
+        }
+    }
+    closedir(dir);
+
+    /* The command queue is optional, operations fall back to per-device calls */
+    snprintf(path, sizeof(path), "%s/" PBZ_CMD_DEV, dev_root);
+    p->cmd_fd = open(path, O_RDWR | O_CLOEXEC);
+    p->syscalls++;
+    p->can_write = pbz_check_cap();
+    return 0;
+}
+
+void pbz_close(struct pbz *p) {
+    unsigned int i;
+    int kind;
+
+    for (kind = 0; kind < PBZ_KIND_COUNT; kind++) {
+        for (i = 0; i < p->count[kind]; i++) {
+            if (p->devs[kind][i].fd >= 0)
+                close(p->devs[kind][i].fd);
+            p->devs[kind][i].fd = -1;
+        }
+        p->count[kind] = 0;
+    }
+
+    if (p->cmd_fd >= 0)
+        close(p->cmd_fd);
+    p->cmd_fd = -1;
+}
+
+unsigned int pbz_count(const struct pbz *p, enum pbz_kind kind) {
+    return kind < PBZ_KIND_COUNT ? p->count[kind] : 0;
+}
+
+int pbz_fd(struct pbz *p, enum pbz_kind kind, unsigned int idx) {
+    struct pbz_dev *dev;
+
+    if (kind >= PBZ_KIND_COUNT || idx >= p->count[kind]) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    dev = &p->devs[kind][idx];
+    if (dev->fd < 0) {
+        dev->fd = open(dev->path, O_RDWR | O_CLOEXEC);
+        p->syscalls++;
+    }
+    return dev->fd;
+}
+
+int pbz_can_write(const struct pbz *p) {
+    return p->can_write;
+}
+
+/* ==================================================================
+ 		Single device calls
+   ================================================================== */
+
+static int pbz_ioctl(struct pbz *p, enum pbz_kind kind, unsigned int idx, unsigned long req,
+    unsigned long arg) {
+    int fd = pbz_fd(p, kind, idx);
+
+    if (fd < 0)
+        return -1;
+    p->syscalls++;
+    return ioctl(fd, req, arg) == 0 ? 0 : -1;
+}
+
+/* Setters are rejected without the system call if the process isn't capable */
+static int pbz_ioctl_wr(struct pbz *p, enum pbz_kind kind, unsigned int idx, unsigned long req,
+    unsigned long arg) {
+    if (!p->can_write) {
+        errno = EPERM;
+        return -1;
+    }
+    return pbz_ioctl(p, kind, idx, req, arg);
+}
+
+int pbz_led_set(struct pbz *p, unsigned int idx, uint32_t val) {
+    return pbz_ioctl_wr(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_SET_VALUE, val);
+}
+
+int pbz_led_reset(struct pbz *p, unsigned int idx) {
+    return pbz_ioctl(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_RESET, 0);
+}
+
+int pbz_led_get_mask(struct pbz *p, unsigned int idx, uint32_t *mask) {
+    *mask = 0;
+    return pbz_ioctl(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_GET_MASK, (unsigned long)mask);
+}
+
+int pbz_led_set_mask(struct pbz *p, unsigned int idx, uint32_t mask) {
+    return pbz_ioctl_wr(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_SET_MASK, mask);
+}
+
+int pbz_led_get_init(struct pbz *p, unsigned int idx, uint32_t *val) {
+    *val = 0;
+    return pbz_ioctl(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_GET_INIT, (unsigned long)val);
+}
+
+int pbz_led_set_init(struct pbz *p, unsigned int idx, uint32_t val) {
+    return pbz_ioctl_wr(p, PBZ_LED, idx, PB_ZYBO_LED_IOCTL_SET_INIT, val);
+}
+
+int pbz_rgb_set(struct pbz *p, unsigned int idx, uint32_t rgb) {
+    return pbz_ioctl_wr(p, PBZ_RGB, idx, PB_ZYBO_RGB_IOCTL_SET_VAL, (unsigned long)&rgb);
+}
+
+int pbz_rgb_get(struct pbz *p, unsigned int idx, uint32_t *rgb) {
+    return pbz_ioctl(p, PBZ_RGB, idx, PB_ZYBO_RGB_IOCTL_GET_VAL, (unsigned long)rgb);
+}
+
+int pbz_rgb_set_period(struct pbz *p, unsigned int idx, uint32_t period) {
+    return pbz_ioctl_wr(p, PBZ_RGB, idx, PB_ZYBO_RGB_IOCTL_SET_PERIOD, (unsigned long)&period);
+}
+
+int pbz_rgb_get_period(struct pbz *p, unsigned int idx, uint32_t *period) {
+    return pbz_ioctl(p, PBZ_RGB, idx, PB_ZYBO_RGB_IOCTL_GET_PERIOD, (unsigned long)period);
+}
+
+int pbz_rgb_init(struct pbz *p, unsigned int idx) {
+    return pbz_ioctl(p, PBZ_RGB, idx, PB_ZYBO_RGB_IOCTL_INIT, 0);
+}
+
+int pbz_sw_get(struct pbz *p, unsigned int idx, uint32_t *val) {
+    *val = 0;
+    return pbz_ioctl(p, PBZ_SW, idx, PB_ZYBO_SW_IOCTL_GET_VALUE, (unsigned long)val);
+}
+
+int pbz_sw_get_mask(struct pbz *p, unsigned int idx, uint32_t *mask) {
+    *mask = 0;
+    return pbz_ioctl(p, PBZ_SW, idx, PB_ZYBO_SW_IOCTL_GET_MASK, (unsigned long)mask);
+}
+
+int pbz_sw_set_mask(struct pbz *p, unsigned int idx, uint32_t mask) {
+    return pbz_ioctl_wr(p, PBZ_SW, idx, PB_ZYBO_SW_IOCTL_SET_MASK, mask);
+}
+
+/* ==================================================================
+ 		Batches
+   ================================================================== */
+
+/* Kind of the target device, -1 for the delay */
+static int pbz_op_kind(uint16_t op) {
+    switch (op) {
+        case PB_ZYBO_CMD_LED_SET:
+            return PBZ_LED;
+        case PB_ZYBO_CMD_RGB_SET:
+        case PB_ZYBO_CMD_RGB_PERIOD_SET:
+            return PBZ_RGB;
+        case PB_ZYBO_CMD_SW_GET:
+            return PBZ_SW;
+        default:
+            return -1;
+    }
+}
+
+/* The whole batch is checked before the execution (the same as the kernel does) */
+static int pbz_check_op(const struct pbz *p, const struct pbz_op *o) {
+    int kind = pbz_op_kind(o->op);
+
+    if (kind < 0) {
+        if (o->op != PB_ZYBO_CMD_DELAY || o->arg > PB_ZYBO_CMD_MAX_DELAY_US)
+            return -EINVAL;
+        return 0;
+    }
+    if (o->idx >= p->count[kind])
+        return -ENODEV;
+    if (o->op != PB_ZYBO_CMD_SW_GET && !p->can_write)
+        return -EPERM;
+    return 0;
+}
+
+static void pbz_delay_us(uint32_t us) {
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 < (long)us);
+}
+
+/* Fallback without the command queue - one call per operation */
+static int pbz_exec_op(struct pbz *p, struct pbz_op *o) {
+    int rc;
+
+    switch (o->op) {
+        case PB_ZYBO_CMD_LED_SET:
+            rc = pbz_led_set(p, o->idx, o->arg);
+            break;
+        case PB_ZYBO_CMD_RGB_SET:
+            rc = pbz_rgb_set(p, o->idx, o->arg);
+            break;
+        case PB_ZYBO_CMD_RGB_PERIOD_SET:
+            rc = pbz_rgb_set_period(p, o->idx, o->arg);
+            break;
+        case PB_ZYBO_CMD_SW_GET:
+            rc = pbz_sw_get(p, o->idx, &o->val);
+            break;
+        default:
+            pbz_delay_us(o->arg);
+            rc = 0;
+            break;
+    }
+    return rc == 0 ? 0 : -errno;
+}
+
+/* One submission of up to PB_ZYBO_CMD_MAX operations */
+static int pbz_submit(struct pbz *p, struct pbz_op *ops, unsigned int count) {
+    struct pb_zybo_cmd cmds[PB_ZYBO_CMD_MAX];
+    struct pb_zybo_cmd_batch batch;
+    unsigned int i;
+    int kind, rc;
+
+    for (i = 0; i < count; i++) {
+        kind = pbz_op_kind(ops[i].op);
+        cmds[i].op = ops[i].op;
+        cmds[i].dev = kind < 0 ? 0 : p->devs[kind][ops[i].idx].minor;
+        cmds[i].arg = ops[i].arg;
+        cmds[i].val = 0;
+        cmds[i].res = -ECANCELED;
+    }
+
+    batch.cmds = (uintptr_t)cmds;
+    batch.count = count;
+    batch.done = 0;
+    p->syscalls++;
+    rc = ioctl(p->cmd_fd, PB_ZYBO_CMD_IOCTL_SUBMIT, &batch);
+
+    for (i = 0; i < count; i++) {
+        ops[i].val = cmds[i].val;
+        ops[i].res = cmds[i].res;
+    }
+    return rc == 0 ? 0 : -1;
+}
+
+int pbz_batch(struct pbz *p, struct pbz_op *ops, unsigned int count) {
+    unsigned int i, n;
+    int rc;
+
+    for (i = 0; i < count; i++) {
+        ops[i].val = 0;
+        ops[i].res = -ECANCELED;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = pbz_check_op(p, &ops[i]);
+        if (rc) {
+            ops[i].res = rc;
+            errno = -rc;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < count; i += n) {
+        n = count - i;
+        if (p->cmd_fd >= 0) {
+            if (n > PB_ZYBO_CMD_MAX)
+                n = PB_ZYBO_CMD_MAX;
+            if (pbz_submit(p, ops + i, n) != 0)
+                return -1;
+        } else {
+            n = 1;
+            ops[i].res = pbz_exec_op(p, &ops[i]);
+            if (ops[i].res) {
+                errno = -ops[i].res;
+                return -1;
+            }
+        }
+    }
+    return count;
+}
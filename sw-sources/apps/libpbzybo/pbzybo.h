@@ -0,0 +1,116 @@
+/*  pbzybo.h - User space client library of the PB Zybo LED, RGB LED and switch drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Devices are found once during pbz_open and each device is opened on the first use only,
+ * the handle is kept until pbz_close. Batches are executed by /dev/pb-zybo-cmd in one
+ * system call per PB_ZYBO_CMD_MAX operations. Functions return 0 on success and -1 with errno
+ * on the error. */
+
+#ifndef __PBZYBO_H__
+#define __PBZYBO_H__
+
+#include <stdint.h>
+
+#include "pb-zybo-ioctl.h"
+#include "pb-zybo-cmd.h"
+
+/* Maximal number of device instances of one kind */
+#define PBZ_MAX_DEVS		16
+
+/* Device kinds */
+enum pbz_kind {
+    PBZ_LED = 0,
+    PBZ_RGB,
+    PBZ_SW,
+    PBZ_KIND_COUNT
+};
+
+/**
+ * @brief One device instance
+ *
+ */
+struct pbz_dev {
+    char path[64];          /* Device node */
+    uint16_t minor;         /* Instance index of the command queue */
+    int fd;                 /* Persistent handle, -1 until the first use */
+};
+
+/**
+ * @brief Library handle
+ *
+ */
+struct pbz {
+    struct pbz_dev devs[PBZ_KIND_COUNT][PBZ_MAX_DEVS];
+    unsigned int count[PBZ_KIND_COUNT];
+    int cmd_fd;             /* /dev/pb-zybo-cmd, -1 if it isn't available (per-device calls are used) */
+    int can_write;          /* CAP_SYS_ADMIN of the process (checked once in pbz_open) */
+    unsigned long syscalls; /* Number of issued open and ioctl calls */
+};
+
+/**
+ * @brief One operation of the batch, the result (val, res) is written back
+ *
+ */
+struct pbz_op {
+    uint16_t op;            /* PB_ZYBO_CMD_LED_SET, _RGB_SET, _RGB_PERIOD_SET, _SW_GET or _DELAY */
+    uint16_t idx;           /* Index of the device (of the kind given by the operation) */
+    uint32_t arg;           /* Input argument */
+    uint32_t val;           /* Output value (PB_ZYBO_CMD_SW_GET) */
+    int32_t res;            /* 0 or -errno, -ECANCELED if the operation wasn't executed */
+};
+
+/* Find devices in dev_root (NULL = /dev) and open the command queue if it exists */
+int pbz_open(struct pbz *p, const char *dev_root);
+void pbz_close(struct pbz *p);
+
+/* Number of devices of the kind and the persistent handle of the device (opened on the first use) */
+unsigned int pbz_count(const struct pbz *p, enum pbz_kind kind);
+int pbz_fd(struct pbz *p, enum pbz_kind kind, unsigned int idx);
+
+/* Cached capability check - setters fail with EPERM without any system call */
+int pbz_can_write(const struct pbz *p);
+
+/* Execute operations in order until the first failure, the batch is split into the fewest system
+ * calls (one per PB_ZYBO_CMD_MAX operations). Returns the count or -1 with errno, the res field
+ * tells executed (0), failed (-errno) and not executed (-ECANCELED) operations. The whole batch is
+ * checked first, so the invalid operation (device index, permission) fails before any call. */
+int pbz_batch(struct pbz *p, struct pbz_op *ops, unsigned int count);
+
+/* ==================================================================
+ 		Single device calls
+   ================================================================== */
+
+int pbz_led_set(struct pbz *p, unsigned int idx, uint32_t val);
+int pbz_led_reset(struct pbz *p, unsigned int idx);
+int pbz_led_get_mask(struct pbz *p, unsigned int idx, uint32_t *mask);
+int pbz_led_set_mask(struct pbz *p, unsigned int idx, uint32_t mask);
+int pbz_led_get_init(struct pbz *p, unsigned int idx, uint32_t *val);
+int pbz_led_set_init(struct pbz *p, unsigned int idx, uint32_t val);
+
+int pbz_rgb_set(struct pbz *p, unsigned int idx, uint32_t rgb);
+int pbz_rgb_get(struct pbz *p, unsigned int idx, uint32_t *rgb);
+int pbz_rgb_set_period(struct pbz *p, unsigned int idx, uint32_t period);
+int pbz_rgb_get_period(struct pbz *p, unsigned int idx, uint32_t *period);
+int pbz_rgb_init(struct pbz *p, unsigned int idx);
+
+int pbz_sw_get(struct pbz *p, unsigned int idx, uint32_t *val);
+int pbz_sw_get_mask(struct pbz *p, unsigned int idx, uint32_t *mask);
+int pbz_sw_set_mask(struct pbz *p, unsigned int idx, uint32_t mask);
+
+#endif /* __PBZYBO_H__ */
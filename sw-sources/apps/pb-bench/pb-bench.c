@@ -0,0 +1,593 @@
+/*  pb-bench.c - Latency and throughput benchmark of the LED, RGB LED and switch drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+/* IOCTL handlers of drivers */
+#include "pb-zybo-ioctl.h"
+
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_WARMUP 100
+#define MAX_THREADS 64
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+/* Default PWM period of the RGB driver, the period setter keeps it */
+#define RGB_DEFAULT_PERIOD 4096
+
+enum bench_dev {
+    DEV_LED = 0,
+    DEV_RGB,
+    DEV_SW,
+    DEV_COUNT
+};
+
+static const char *dev_names[DEV_COUNT] = { "led", "rgb", "switch" };
+
+/* One measured operation - returns 0 on success */
+struct bench_op {
+    const char *name;
+    enum bench_dev dev;
+    int (*run)(int fd, unsigned long i);
+};
+
+/* Output formats */
+enum bench_fmt {
+    FMT_TEXT = 0,
+    FMT_CSV,
+    FMT_JSON
+};
+
+/* CPU pinning of benchmark threads */
+enum bench_pin {
+    PIN_NONE = 0,       /* The scheduler places threads */
+    PIN_SPREAD,         /* Thread i runs on the i-th allowed CPU */
+    PIN_SINGLE,         /* All threads share the first allowed CPU */
+    PIN_COUNT
+};
+
+static const char *pin_names[PIN_COUNT] = { "none", "spread", "single" };
+
+struct bench_conf {
+    const char *paths[DEV_COUNT];
+    unsigned long iterations;
+    unsigned long warmup;
+    unsigned int threads[MAX_THREADS];
+    unsigned int thread_cnt;
+    enum bench_pin pins[PIN_COUNT];
+    unsigned int pin_cnt;
+    enum bench_fmt fmt;
+    const char *filter;
+};
+
+/* Result of one benchmark case */
+struct bench_res {
+    double ops_per_s;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    unsigned long errors;
+};
+
+/* Context of one benchmark thread */
+struct bench_thread {
+    pthread_t tid;
+    const struct bench_conf *conf;
+    const struct bench_op *op;
+    pthread_barrier_t *barrier;
+    int cpu;                /* CPU to pin or -1 */
+    int fd;
+    uint64_t *lat;          /* Latency of each operation */
+    uint64_t start_ns;      /* Start and end of the measured part */
+    uint64_t end_ns;
+    unsigned long errors;
+};
+
+/* ==================================================================
+ 		Measured operations
+   ================================================================== */
+
+static int op_led_set_value(int fd, unsigned long i) {
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_SET_VALUE, i & 0xf);
+}
+
+static int op_led_reset(int fd, unsigned long i) {
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_RESET);
+}
+
+static int op_led_get_init(int fd, unsigned long i) {
+    int val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_GET_INIT, &val);
+}
+
+static int op_led_set_init(int fd, unsigned long i) {
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_SET_INIT, 0);
+}
+
+static int op_led_get_mask(int fd, unsigned long i) {
+    int val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_GET_MASK, &val);
+}
+
+static int op_led_set_mask(int fd, unsigned long i) {
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_SET_MASK, 0xf);
+}
+
+/* One character is one LED value, the driver doesn't move the position on lseek,
+ * so the text paths use the offset 0 of pread/pwrite */
+static int op_led_write(int fd, unsigned long i) {
+    const char val = '0' + (i & 0xf);
+    return pwrite(fd, &val, 1, 0) == 1 ? 0 : -1;
+}
+
+static int op_rgb_get_val(int fd, unsigned long i) {
+    uint32_t val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &val);
+}
+
+static int op_rgb_set_val(int fd, unsigned long i) {
+    uint32_t val = (i & 0xff) << 8;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_VAL, &val);
+}
+
+static int op_rgb_get_period(int fd, unsigned long i) {
+    uint32_t val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_PERIOD, &val);
+}
+
+static int op_rgb_set_period(int fd, unsigned long i) {
+    uint32_t val = RGB_DEFAULT_PERIOD;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &val);
+}
+
+static int op_rgb_init(int fd, unsigned long i) {
+    (void)i;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
+}
+
+static int op_rgb_write(int fd, unsigned long i) {
+    static const char *colors[] = { "0x00 0x40 0x00\n", "0x00 0x00 0x40\n" };
+    const char *text = colors[i & 0x1];
+    ssize_t len = strlen(text);
+
+    return pwrite(fd, text, len, 0) == len ? 0 : -1;
+}
+
+static int op_rgb_read(int fd, unsigned long i) {
+    char buf[32];
+    (void)i;
+    return pread(fd, buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+static int op_sw_get_value(int fd, unsigned long i) {
+    int val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &val);
+}
+
+static int op_sw_get_mask(int fd, unsigned long i) {
+    int val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_SW_IOCTL_GET_MASK, &val);
+}
+
+static int op_sw_set_mask(int fd, unsigned long i) {
+    (void)i;
+    return ioctl(fd, PB_ZYBO_SW_IOCTL_SET_MASK, 0xf);
+}
+
+static int op_sw_read(int fd, unsigned long i) {
+    char buf[8];
+    (void)i;
+    return pread(fd, buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+/* Setters keep default values of drivers (mask 0xf, init 0, period 4096) */
+static const struct bench_op bench_ops[] = {
+    { "led_set_value",  DEV_LED, op_led_set_value },
+    { "led_reset",      DEV_LED, op_led_reset },
+    { "led_get_init",   DEV_LED, op_led_get_init },
+    { "led_set_init",   DEV_LED, op_led_set_init },
+    { "led_get_mask",   DEV_LED, op_led_get_mask },
+    { "led_set_mask",   DEV_LED, op_led_set_mask },
+    { "led_write",      DEV_LED, op_led_write },
+    { "rgb_get_val",    DEV_RGB, op_rgb_get_val },
+    { "rgb_set_val",    DEV_RGB, op_rgb_set_val },
+    { "rgb_get_period", DEV_RGB, op_rgb_get_period },
+    { "rgb_set_period", DEV_RGB, op_rgb_set_period },
+    { "rgb_init",       DEV_RGB, op_rgb_init },
+    { "rgb_write",      DEV_RGB, op_rgb_write },
+    { "rgb_read",       DEV_RGB, op_rgb_read },
+    { "sw_get_value",   DEV_SW,  op_sw_get_value },
+    { "sw_get_mask",    DEV_SW,  op_sw_get_mask },
+    { "sw_set_mask",    DEV_SW,  op_sw_set_mask },
+    { "sw_read",        DEV_SW,  op_sw_read },
+};
+
+#define BENCH_OPS (sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+/* ==================================================================
+ 		Benchmark
+   ================================================================== */
+
+static void print_help() {
+    printf("Latency and throughput benchmark of the LED, RGB LED and switch drivers. Each IOCTL call and\n");
+    printf("the text read/write path is measured for each number of threads and CPU pinning.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-l = LED device (default %s-0)\n", PB_ZYBO_LED_DEV_PREFIX);
+    printf("\t-r = RGB LED device (default %s-0)\n", PB_ZYBO_RGB_DEV_PREFIX);
+    printf("\t-s = switch device (default %s-0)\n", PB_ZYBO_SW_DEV_PREFIX);
+    printf("\t-n = number of operations per thread (default %d)\n", DEFAULT_ITERATIONS);
+    printf("\t-w = number of warm-up operations per thread (default %d)\n", DEFAULT_WARMUP);
+    printf("\t-t = list of thread counts (default 1), e.g. 1,2,4\n");
+    printf("\t-p = list of CPU pinning modes - none, spread, single (default none)\n");
+    printf("\t-o = run operations which contain the text (e.g. led_, _read)\n");
+    printf("\t-f = output format - text, csv or json (default text)\n");
+    printf("\t-L = list operations\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/* Nearest-rank percentile of the sorted array */
+static uint64_t percentile(const uint64_t *sorted, unsigned long n, double p) {
+    unsigned long idx = (unsigned long)(p * n + 0.999999);
+    return sorted[idx > 0 ? idx - 1 : 0];
+}
+
+/* Allowed CPUs of the process */
+static int cpu_list(int *cpus, int max) {
+    cpu_set_t set;
+    int cpu, n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return 0;
+    for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+            cpus[n++] = cpu;
+    }
+    return n;
+}
+
+static void *bench_thread_run(void *arg) {
+    struct bench_thread *t = arg;
+    unsigned long i;
+    uint64_t start;
+    cpu_set_t set;
+
+    if (t->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(t->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    for (i = 0; i < t->conf->warmup; i++)
+        t->op->run(t->fd, i);
+
+    pthread_barrier_wait(t->barrier);
+    t->start_ns = now_ns();
+    for (i = 0; i < t->conf->iterations; i++) {
+        start = now_ns();
+        if (t->op->run(t->fd, i) != 0)
+            t->errors++;
+        t->lat[i] = now_ns() - start;
+    }
+    t->end_ns = now_ns();
+    return NULL;
+}
+
+/* Each thread has its own file descriptor, so the driver lock is the only shared part */
+static int bench_case(const struct bench_conf *conf, const struct bench_op *op, unsigned int threads,
+        enum bench_pin pin, struct bench_res *res) {
+    struct bench_thread t[MAX_THREADS];
+    pthread_barrier_t barrier;
+    int cpus[CPU_SETSIZE];
+    int ncpu = cpu_list(cpus, CPU_SETSIZE);
+    unsigned long i, total = (unsigned long)threads * conf->iterations;
+    unsigned int j, opened = 0;
+    uint64_t *lat, sum = 0, start = UINT64_MAX, end = 0;
+    int ret = RET_ERR;
+
+    lat = malloc(total * sizeof(*lat));
+    if (lat == NULL) {
+        fprintf(stderr, "Unable to allocate the latency buffer!\n");
+        return RET_ERR;
+    }
+
+    for (j = 0; j < threads; j++) {
+        t[j].conf = conf;
+        t[j].op = op;
+        t[j].barrier = &barrier;
+        t[j].cpu = -1;
+        if (pin == PIN_SPREAD && ncpu > 0)
+            t[j].cpu = cpus[j % ncpu];
+        else if (pin == PIN_SINGLE && ncpu > 0)
+            t[j].cpu = cpus[0];
+        t[j].lat = lat + (unsigned long)j * conf->iterations;
+        t[j].errors = 0;
+        t[j].fd = open(conf->paths[op->dev], O_RDWR);
+        if (t[j].fd < 0) {
+            fprintf(stderr, "Unable to open %s (%s)!\n", conf->paths[op->dev], strerror(errno));
+            goto bench_cleanup;
+        }
+        opened++;
+    }
+
+    /* Started threads wait for the barrier, the failure can't be recovered */
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (j = 0; j < threads; j++) {
+        if (pthread_create(&t[j].tid, NULL, bench_thread_run, &t[j]) != 0) {
+            fprintf(stderr, "Unable to create the benchmark thread!\n");
+            exit(RET_ERR);
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+    for (j = 0; j < threads; j++)
+        pthread_join(t[j].tid, NULL);
+    pthread_barrier_destroy(&barrier);
+
+    /* Throughput is taken from the first start to the last end of threads */
+    memset(res, 0, sizeof(*res));
+    for (j = 0; j < threads; j++) {
+        res->errors += t[j].errors;
+        if (t[j].start_ns < start)
+            start = t[j].start_ns;
+        if (t[j].end_ns > end)
+            end = t[j].end_ns;
+    }
+    for (i = 0; i < total; i++)
+        sum += lat[i];
+    qsort(lat, total, sizeof(*lat), cmp_u64);
+
+    res->ops_per_s = (double)total * 1e9 / (double)(end > start ? end - start : 1);
+    res->mean_ns = sum / total;
+    res->p50_ns = percentile(lat, total, 0.5);
+    res->p99_ns = percentile(lat, total, 0.99);
+    res->p999_ns = percentile(lat, total, 0.999);
+    res->max_ns = lat[total - 1];
+    ret = RET_OK;
+
+bench_cleanup:
+    for (j = 0; j < opened; j++)
+        close(t[j].fd);
+    free(lat);
+    return ret;
+}
+
+/* The operation is executed once before the measurement - unsupported operations (missing
+ * device, permission) are skipped */
+static int bench_probe(const struct bench_conf *conf, const struct bench_op *op) {
+    int fd, rc;
+
+    fd = open(conf->paths[op->dev], O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "Skipping %s - unable to open %s (%s)\n", op->name, conf->paths[op->dev],
+            strerror(errno));
+        return RET_ERR;
+    }
+    rc = op->run(fd, 0);
+    if (rc != 0)
+        fprintf(stderr, "Skipping %s (%s)\n", op->name, strerror(errno));
+    close(fd);
+    return rc == 0 ? RET_OK : RET_ERR;
+}
+
+static void print_res(const struct bench_conf *conf, const struct bench_op *op, unsigned int threads,
+        enum bench_pin pin, const struct bench_res *res, int first) {
+    switch (conf->fmt) {
+        case FMT_CSV:
+            if (first)
+                printf("op,device,threads,pin,iterations,ops_per_s,mean_ns,p50_ns,p99_ns,p999_ns,max_ns,errors\n");
+            printf("%s,%s,%u,%s,%lu,%.0f,%llu,%llu,%llu,%llu,%llu,%lu\n", op->name, dev_names[op->dev],
+                threads, pin_names[pin], conf->iterations, res->ops_per_s, (unsigned long long)res->mean_ns,
+                (unsigned long long)res->p50_ns, (unsigned long long)res->p99_ns,
+                (unsigned long long)res->p999_ns, (unsigned long long)res->max_ns, res->errors);
+            break;
+        case FMT_JSON:
+            printf("%s  {\"op\": \"%s\", \"device\": \"%s\", \"threads\": %u, \"pin\": \"%s\", "
+                "\"iterations\": %lu, \"ops_per_s\": %.0f, \"mean_ns\": %llu, \"p50_ns\": %llu, "
+                "\"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu, \"errors\": %lu}",
+                first ? "" : ",\n", op->name, dev_names[op->dev], threads, pin_names[pin],
+                conf->iterations, res->ops_per_s, (unsigned long long)res->mean_ns,
+                (unsigned long long)res->p50_ns, (unsigned long long)res->p99_ns,
+                (unsigned long long)res->p999_ns, (unsigned long long)res->max_ns, res->errors);
+            break;
+        default:
+            if (first)
+                printf("%-16s %7s %-7s %12s %9s %9s %9s %9s %9s %7s\n", "operation", "threads", "pin",
+                    "ops/s", "mean ns", "p50 ns", "p99 ns", "p999 ns", "max ns", "errors");
+            printf("%-16s %7u %-7s %12.0f %9llu %9llu %9llu %9llu %9llu %7lu\n", op->name, threads,
+                pin_names[pin], res->ops_per_s, (unsigned long long)res->mean_ns,
+                (unsigned long long)res->p50_ns, (unsigned long long)res->p99_ns,
+                (unsigned long long)res->p999_ns, (unsigned long long)res->max_ns, res->errors);
+            break;
+    }
+    fflush(stdout);
+}
+
+/* Parse the comma separated list of thread counts */
+static int parse_threads(struct bench_conf *conf, char *arg) {
+    char *tok, *save = NULL;
+    unsigned long val;
+
+    conf->thread_cnt = 0;
+    for (tok = strtok_r(arg, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        val = strtoul(tok, NULL, 0);
+        if (val == 0 || val > MAX_THREADS || conf->thread_cnt == MAX_THREADS) {
+            printf("Invalid thread count \"%s\" (1 - %d)!\n", tok, MAX_THREADS);
+            return RET_ERR;
+        }
+        conf->threads[conf->thread_cnt++] = val;
+    }
+    return conf->thread_cnt ? RET_OK : RET_ERR;
+}
+
+/* Parse the comma separated list of pinning modes */
+static int parse_pins(struct bench_conf *conf, char *arg) {
+    char *tok, *save = NULL;
+    int pin;
+
+    conf->pin_cnt = 0;
+    for (tok = strtok_r(arg, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        for (pin = 0; pin < PIN_COUNT; pin++) {
+            if (strcmp(tok, pin_names[pin]) == 0)
+                break;
+        }
+        if (pin == PIN_COUNT || conf->pin_cnt == PIN_COUNT) {
+            printf("Invalid pinning mode \"%s\"!\n", tok);
+            return RET_ERR;
+        }
+        conf->pins[conf->pin_cnt++] = pin;
+    }
+    return conf->pin_cnt ? RET_OK : RET_ERR;
+}
+
+int main(int argc, char** argv) {
+    struct bench_conf conf = {
+        .paths = { PB_ZYBO_LED_DEV_PREFIX "-0", PB_ZYBO_RGB_DEV_PREFIX "-0", PB_ZYBO_SW_DEV_PREFIX "-0" },
+        .iterations = DEFAULT_ITERATIONS,
+        .warmup = DEFAULT_WARMUP,
+        .threads = { 1 },
+        .thread_cnt = 1,
+        .pins = { PIN_NONE },
+        .pin_cnt = 1,
+        .fmt = FMT_TEXT,
+    };
+    struct bench_res res;
+    unsigned int i, t, p;
+    int first = 1, failed = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hl:r:s:n:w:t:p:o:f:L")) != -1) {
+        switch (opt) {
+            case 'l':
+                conf.paths[DEV_LED] = optarg;
+                break;
+            case 'r':
+                conf.paths[DEV_RGB] = optarg;
+                break;
+            case 's':
+                conf.paths[DEV_SW] = optarg;
+                break;
+            case 'n':
+                conf.iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                conf.warmup = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                if (parse_threads(&conf, optarg) != RET_OK)
+                    return RET_ERR;
+                break;
+            case 'p':
+                if (parse_pins(&conf, optarg) != RET_OK)
+                    return RET_ERR;
+                break;
+            case 'o':
+                conf.filter = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "csv") == 0) {
+                    conf.fmt = FMT_CSV;
+                } else if (strcmp(optarg, "json") == 0) {
+                    conf.fmt = FMT_JSON;
+                } else if (strcmp(optarg, "text") == 0) {
+                    conf.fmt = FMT_TEXT;
+                } else {
+                    printf("Unknown output format \"%s\"!\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'L':
+                for (i = 0; i < BENCH_OPS; i++)
+                    printf("%-16s %s\n", bench_ops[i].name, dev_names[bench_ops[i].dev]);
+                return RET_OK;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (conf.iterations == 0) {
+        printf("The number of operations has to be positive!\n");
+        return RET_ERR;
+    }
+
+    if (conf.fmt == FMT_JSON)
+        printf("[\n");
+    for (i = 0; i < BENCH_OPS; i++) {
+        if (conf.filter != NULL && strstr(bench_ops[i].name, conf.filter) == NULL)
+            continue;
+        if (bench_probe(&conf, &bench_ops[i]) != RET_OK)
+            continue;
+
+        for (t = 0; t < conf.thread_cnt; t++) {
+            for (p = 0; p < conf.pin_cnt; p++) {
+                if (bench_case(&conf, &bench_ops[i], conf.threads[t], conf.pins[p], &res) != RET_OK) {
+                    failed = 1;
+                    continue;
+                }
+                print_res(&conf, &bench_ops[i], conf.threads[t], conf.pins[p], &res, first);
+                first = 0;
+            }
+        }
+    }
+    if (conf.fmt == FMT_JSON)
+        printf("%s]\n", first ? "" : "\n");
+
+    return failed ? RET_ERR : RET_OK;
+}
@@ -0,0 +1,714 @@
+/*  pb-react.c - End-to-end switch to output reaction latency of the PB Zybo drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+
+/* IOCTL handlers of drivers */
+#include "pb-zybo-ioctl.h"
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_WARMUP 20
+#define DEFAULT_GAP_US 1000
+/* Maximal wait for one switch change */
+#define WAIT_TIMEOUT_MS 1000
+/* Consecutive stimuli without the change which end the run */
+#define MAX_TIMEOUTS 3
+/* Number of switches (the default mask of the switch and LED drivers) */
+#define SW_MASK 0xf
+
+/* Log2 histogram buckets - < 1 us, [1, 2) us, [2, 4) us, ... */
+#define HIST_BUCKETS 32
+/* Width of the histogram bar */
+#define HIST_BAR 40
+
+/**
+ * @brief Stages of the reaction, each one is the difference of two timestamps
+ *
+ */
+enum react_stage {
+    ST_DETECT = 0,  /* Switch change -> the driver sample which detected it */
+    ST_WAKEUP,      /* Driver detection -> the application is running */
+    ST_REACT,       /* Application running -> the output call (event read and the reaction logic) */
+    ST_OUTPUT,      /* Output call -> the output register write */
+    ST_TOTAL,       /* Switch change -> the output register write */
+    ST_COUNT
+};
+
+static const char *stage_names[ST_COUNT] = { "detect", "wakeup", "react", "output", "total" };
+
+static const char *stage_desc[ST_COUNT] = {
+    "switch change -> driver sample which detected it",
+    "driver detection -> application running",
+    "application running -> output call (event read and reaction logic)",
+    "output call -> output register write",
+    "switch change -> output register write",
+};
+
+/**
+ * @brief Wait modes - the driver poll (epoll on the device) or sampling of the event
+ * in the application
+ *
+ */
+enum wait_mode {
+    WAIT_AUTO,
+    WAIT_POLL,
+    WAIT_SAMPLE,
+};
+
+enum out_kind {
+    OUT_RGB,
+    OUT_LED,
+};
+
+struct react_conf {
+    const char *sw_dev;
+    const char *stim_dev;       /* LED device wired to switches (loopback) */
+    const char *out_dev;
+    enum out_kind out;
+    enum wait_mode mode;
+    unsigned long iterations;
+    unsigned long warmup;
+    unsigned int gap_us;        /* Maximal random gap between iterations */
+    int external;               /* Switches are changed by somebody else */
+    const char *csv;            /* Per-iteration stages */
+    unsigned int spec_us;       /* Maximal total latency, 0 = no check */
+    int prio;                   /* SCHED_FIFO priority, 0 = don't change */
+};
+
+struct react_ctx {
+    int sw_fd;
+    int stim_fd;
+    int out_fd;
+    int epfd;                   /* Epoll set with the switch device (poll mode) */
+    int stim_stamp;             /* Drivers stamp register writes (GET_STAMP) */
+    int out_stamp;
+    uint32_t seq;               /* Last seen switch event */
+    uint32_t value;             /* Switch value of the event */
+    FILE *csv;
+};
+
+struct react_stats {
+    unsigned long done;         /* Measured iterations */
+    unsigned long timeouts;     /* Stimuli without the detected change */
+    unsigned long mismatch;     /* Detected value differs from the stimulus */
+    unsigned long merged;       /* Changes merged by the driver */
+    unsigned long over_spec;
+    uint64_t *lat[ST_COUNT];    /* Stage latencies (ns) */
+    unsigned long hist[HIST_BUCKETS];
+};
+
+/* Detection of the interrupt signal */
+static volatile sig_atomic_t sig_int = 0;
+
+static void sig_handler(int s) {
+    (void)s;
+    sig_int = 1;
+}
+
+static void print_help() {
+    printf("Tool for measuring of the reaction latency - the switch change is detected through the switch\n");
+    printf("driver, the application reacts and the new value is written to the LED or RGB LED registers.\n");
+    printf("The switch change is created by the stimulus LED wired to switches (pb-zybo-mock loopback=1,\n");
+    printf("PB_SIM_LOOPBACK=1 of the simulator), stages are timed by driver timestamps.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-s = switch device (default %s-0)\n", PB_ZYBO_SW_DEV_PREFIX);
+    printf("\t-l = stimulus LED device wired to switches (default %s-0)\n", PB_ZYBO_LED_DEV_PREFIX);
+    printf("\t-o = output - rgb (default, %s-0) or led (%s-1)\n", PB_ZYBO_RGB_DEV_PREFIX, PB_ZYBO_LED_DEV_PREFIX);
+    printf("\t-d = output device (default is given by -o)\n");
+    printf("\t-m = wait mode - auto (default), poll or sample\n");
+    printf("\t-n = number of measured iterations (default %d)\n", DEFAULT_ITERATIONS);
+    printf("\t-w = number of warm-up iterations (default %d)\n", DEFAULT_WARMUP);
+    printf("\t-g = maximal random gap between iterations in us (default %d)\n", DEFAULT_GAP_US);
+    printf("\t-E = switches are changed externally (no stimulus), the change time is the previous driver sample\n");
+    printf("\t-c = store stages of each iteration to the CSV file\n");
+    printf("\t-S = maximal allowed total latency in us, the tool fails if it is exceeded\n");
+    printf("\t-p = run with the SCHED_FIFO priority\n");
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/* Nearest-rank percentile of the sorted array */
+static uint64_t percentile(const uint64_t *sorted, unsigned long n, double p) {
+    unsigned long idx = (unsigned long)(p * n + 0.999999);
+    return sorted[idx > 0 ? idx - 1 : 0];
+}
+
+/* Histogram bucket of the time in ns */
+static int hist_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = 0;
+
+    while (us && b < HIST_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* Difference of timestamps - the driver can sample the change before the stimulus write is stamped */
+static uint64_t stage_ns(uint64_t from, uint64_t to) {
+    return to > from ? to - from : 0;
+}
+
+/* ==================================================================
+ 		Devices
+   ================================================================== */
+
+/**
+ * @brief Register the switch device in the epoll set
+ *
+ * @return int Epoll descriptor or -1 iff the driver doesn't support poll (errno is set)
+ */
+static int wait_poll_open(int fd) {
+    struct epoll_event ev;
+    int epfd, err;
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        err = errno;
+        close(epfd);
+        errno = err;
+        return -1;
+    }
+    return epfd;
+}
+
+static int react_open(const struct react_conf *conf, struct react_ctx *ctx) {
+    struct pb_zybo_sw_event ev;
+    struct pb_zybo_out_stamp stamp;
+    unsigned long out_cmd = conf->out == OUT_RGB ? PB_ZYBO_RGB_IOCTL_GET_STAMP : PB_ZYBO_LED_IOCTL_GET_STAMP;
+
+    ctx->sw_fd = open(conf->sw_dev, O_RDWR);
+    if (ctx->sw_fd < 0) {
+        printf("Unable to open the switch device %s (%s)\n", conf->sw_dev, strerror(errno));
+        return RET_ERR;
+    }
+    ctx->out_fd = open(conf->out_dev, O_RDWR);
+    if (ctx->out_fd < 0) {
+        printf("Unable to open the output device %s (%s)\n", conf->out_dev, strerror(errno));
+        return RET_ERR;
+    }
+    if (!conf->external) {
+        ctx->stim_fd = open(conf->stim_dev, O_RDWR);
+        if (ctx->stim_fd < 0) {
+            printf("Unable to open the stimulus device %s (%s)\n", conf->stim_dev, strerror(errno));
+            return RET_ERR;
+        }
+        ctx->stim_stamp = ioctl(ctx->stim_fd, PB_ZYBO_LED_IOCTL_GET_STAMP, &stamp) == 0;
+    }
+    ctx->out_stamp = ioctl(ctx->out_fd, out_cmd, &stamp) == 0;
+
+    /* Older drivers don't know the event */
+    if (ioctl(ctx->sw_fd, PB_ZYBO_SW_IOCTL_GET_EVENT, &ev)) {
+        printf("Unable to read the switch event (%s), the driver doesn't detect changes\n", strerror(errno));
+        return RET_ERR;
+    }
+    ctx->seq = ev.seq;
+    ctx->value = ev.value;
+
+    if (conf->mode != WAIT_SAMPLE) {
+        ctx->epfd = wait_poll_open(ctx->sw_fd);
+        if (ctx->epfd < 0 && conf->mode == WAIT_POLL) {
+            printf("The switch driver doesn't support poll (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+        if (ctx->epfd < 0) {
+            printf("* The switch driver doesn't support poll (%s), sampling the event.\n", strerror(errno));
+        }
+    }
+    return RET_OK;
+}
+
+static void react_close(struct react_ctx *ctx) {
+    if (ctx->epfd >= 0) {
+        close(ctx->epfd);
+    }
+    if (ctx->stim_fd >= 0) {
+        close(ctx->stim_fd);
+    }
+    if (ctx->out_fd >= 0) {
+        close(ctx->out_fd);
+    }
+    if (ctx->sw_fd >= 0) {
+        close(ctx->sw_fd);
+    }
+}
+
+/**
+ * @brief Wait for the next switch change - the epoll wait is woken up by the driver
+ * sampler, the sampling mode reads the event (each call is a driver sample)
+ *
+ * @param ev Detected event
+ * @param t_run Time when the application runs with the change (after the wakeup
+ * or the sampling call)
+ * @return int RET_OK, RET_ERR or ETIMEDOUT
+ */
+static int wait_change(struct react_ctx *ctx, struct pb_zybo_sw_event *ev, uint64_t *t_run) {
+    uint64_t deadline = now_ns() + WAIT_TIMEOUT_MS * 1000000ULL;
+    struct epoll_event pev;
+    int n;
+
+    while (!sig_int) {
+        if (ctx->epfd >= 0) {
+            n = epoll_wait(ctx->epfd, &pev, 1, WAIT_TIMEOUT_MS);
+            *t_run = now_ns();
+            if (n < 0 && errno != EINTR) {
+                printf("Unable to wait for the switch change (%s)!\n", strerror(errno));
+                return RET_ERR;
+            }
+            if (n <= 0) {
+                if (*t_run >= deadline) {
+                    return ETIMEDOUT;
+                }
+                continue;
+            }
+        }
+
+        if (ioctl(ctx->sw_fd, PB_ZYBO_SW_IOCTL_GET_EVENT, ev)) {
+            printf("Unable to read the switch event (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+        if (ctx->epfd < 0) {
+            *t_run = now_ns();
+        }
+        if (ev->seq != ctx->seq) {
+            return RET_OK;
+        }
+        if (now_ns() >= deadline) {
+            return ETIMEDOUT;
+        }
+    }
+    return ETIMEDOUT;
+}
+
+/**
+ * @brief Reaction of the application - switches are shown on the output, the RGB
+ * brightness follows the switch value
+ *
+ * @return int RET_OK iff the output was written
+ */
+static int react_output(const struct react_conf *conf, struct react_ctx *ctx, uint32_t sw, uint32_t *out) {
+    if (conf->out == OUT_RGB) {
+        *out = sw * 0x101010;
+        return ioctl(ctx->out_fd, PB_ZYBO_RGB_IOCTL_SET_VAL, out) ? RET_ERR : RET_OK;
+    }
+
+    *out = sw;
+    return ioctl(ctx->out_fd, PB_ZYBO_LED_IOCTL_SET_VALUE, *out) ? RET_ERR : RET_OK;
+}
+
+/* ==================================================================
+ 		Measurement
+   ================================================================== */
+
+/**
+ * @brief Record stages of one iteration
+ *
+ * @param t Timestamps - the change, detection, running application, output call and output write
+ */
+static void react_record(const struct react_conf *conf, struct react_ctx *ctx, struct react_stats *st,
+    uint32_t val, const uint64_t *t) {
+    uint64_t lat[ST_COUNT];
+    int s;
+
+    lat[ST_DETECT] = stage_ns(t[0], t[1]);
+    lat[ST_WAKEUP] = stage_ns(t[1], t[2]);
+    lat[ST_REACT] = stage_ns(t[2], t[3]);
+    lat[ST_OUTPUT] = stage_ns(t[3], t[4]);
+    lat[ST_TOTAL] = stage_ns(t[0], t[4]);
+
+    for (s = 0; s < ST_COUNT; s++) {
+        st->lat[s][st->done] = lat[s];
+    }
+    st->hist[hist_bucket(lat[ST_TOTAL])]++;
+    if (conf->spec_us && lat[ST_TOTAL] > conf->spec_us * 1000ULL) {
+        st->over_spec++;
+    }
+    if (ctx->csv) {
+        fprintf(ctx->csv, "%lu,0x%x,%lu,%lu,%lu,%lu,%lu\n", st->done, val, (unsigned long)lat[ST_DETECT],
+            (unsigned long)lat[ST_WAKEUP], (unsigned long)lat[ST_REACT], (unsigned long)lat[ST_OUTPUT],
+            (unsigned long)lat[ST_TOTAL]);
+    }
+    st->done++;
+}
+
+/**
+ * @brief One stimulus and reaction. The loop runs in one thread - the stimulus call returns
+ * before the switch driver samples the change, so the application really waits for it.
+ *
+ * @param measure Iteration is recorded (not a warm-up)
+ * @return int RET_OK, RET_ERR or ETIMEDOUT
+ */
+static int react_iteration(const struct react_conf *conf, struct react_ctx *ctx, struct react_stats *st,
+    unsigned int *seed, int measure) {
+    struct pb_zybo_sw_event ev;
+    struct pb_zybo_out_stamp stamp;
+    uint32_t stim = 0, out;
+    uint64_t t[5] = { 0 };    /* Stage timestamps - change, detection, wakeup, reaction, output */
+    int rc;
+
+    /* Stimulus - a different switch value each time */
+    if (!conf->external) {
+        stim = (ctx->value + 1 + rand_r(seed) % SW_MASK) & SW_MASK;
+        t[0] = now_ns();
+        if (ioctl(ctx->stim_fd, PB_ZYBO_LED_IOCTL_SET_VALUE, stim)) {
+            printf("Unable to write the stimulus (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+    }
+
+    rc = wait_change(ctx, &ev, &t[2]);
+    if (rc != RET_OK) {
+        return rc;
+    }
+
+    /* Reaction */
+    t[3] = now_ns();
+    if (react_output(conf, ctx, ev.value, &out)) {
+        printf("Unable to write the output (%s)!\n", strerror(errno));
+        return RET_ERR;
+    }
+    t[4] = now_ns();
+
+    if (ctx->out_stamp) {
+        unsigned long cmd = conf->out == OUT_RGB ? PB_ZYBO_RGB_IOCTL_GET_STAMP : PB_ZYBO_LED_IOCTL_GET_STAMP;
+        if (ioctl(ctx->out_fd, cmd, &stamp) == 0 && stamp.value == out) {
+            t[4] = stamp.ts_ns;
+        }
+    }
+
+    /* The change time - the stimulus register write or the last sample with the old value */
+    if (conf->external) {
+        t[0] = ev.prev_ns;
+    } else if (ctx->stim_stamp && ioctl(ctx->stim_fd, PB_ZYBO_LED_IOCTL_GET_STAMP, &stamp) == 0) {
+        t[0] = stamp.ts_ns;
+    }
+    t[1] = ev.ts_ns;
+
+    if (measure) {
+        st->merged += ev.seq - ctx->seq - 1;
+    }
+    ctx->seq = ev.seq;
+    ctx->value = ev.value;
+    if (!conf->external && ev.value != stim) {
+        st->mismatch += measure;
+        return RET_OK;
+    }
+    if (measure) {
+        react_record(conf, ctx, st, ev.value, t);
+    }
+    return RET_OK;
+}
+
+/* Random gap, so stimuli aren't synchronized with the driver sampling period */
+static void react_gap(const struct react_conf *conf, unsigned int *seed) {
+    struct timespec ts;
+    unsigned int us;
+
+    if (conf->external || conf->gap_us == 0) {
+        return;
+    }
+    us = rand_r(seed) % (conf->gap_us + 1);
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000L;
+    clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+static void print_hist(const char *title, const unsigned long *hist) {
+    unsigned long max = 0;
+    int b, first = -1, last = -1;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b]) {
+            first = first < 0 ? b : first;
+            last = b;
+            max = hist[b] > max ? hist[b] : max;
+        }
+    }
+
+    printf("%s:\n", title);
+    if (first < 0) {
+        printf("\t(no data)\n");
+        return;
+    }
+
+    for (b = first; b <= last; b++) {
+        char bar[HIST_BAR + 1];
+        int len = (int)(hist[b] * HIST_BAR / max);
+
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        if (b == 0) {
+            printf("\t%10s < %-10lu us : %8lu %s\n", "", 1UL, hist[b], bar);
+        } else {
+            printf("\t%10lu - %-10lu us : %8lu %s\n", 1UL << (b - 1), 1UL << b, hist[b], bar);
+        }
+    }
+}
+
+static void print_summary(const struct react_conf *conf, const struct react_ctx *ctx, struct react_stats *st,
+    double run) {
+    uint64_t sum;
+    unsigned long i;
+    int s;
+
+    print_box("Reaction latency summary");
+    printf("* Wait mode: %s\n", ctx->epfd >= 0 ? "poll (driver sampling)" : "sampling of the event");
+    printf("* Stimulus: %s\n", conf->external ? "external (change time is the previous driver sample)" :
+        conf->stim_dev);
+    printf("* Output: %s (%s)\n", conf->out_dev, ctx->out_stamp ? "driver timestamp" : "return of the call");
+    printf("* Run time: %.3f s\n", run);
+    printf("* Iterations: %lu (timeouts %lu, value mismatches %lu, merged changes %lu)\n", st->done,
+        st->timeouts, st->mismatch, st->merged);
+    if (!conf->external && !ctx->stim_stamp) {
+        printf("* The stimulus driver doesn't stamp writes, the change time is the start of the stimulus call\n");
+    }
+    if (st->done == 0) {
+        return;
+    }
+
+    printf("\n%-8s %10s %10s %10s %10s %10s %10s  [us]\n", "Stage", "min", "avg", "p50", "p99", "p999", "max");
+    for (s = 0; s < ST_COUNT; s++) {
+        uint64_t *lat = st->lat[s];
+
+        sum = 0;
+        for (i = 0; i < st->done; i++) {
+            sum += lat[i];
+        }
+        qsort(lat, st->done, sizeof(uint64_t), cmp_u64);
+        printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[s], lat[0] / 1e3,
+            sum / 1e3 / st->done, percentile(lat, st->done, 0.50) / 1e3, percentile(lat, st->done, 0.99) / 1e3,
+            percentile(lat, st->done, 0.999) / 1e3, lat[st->done - 1] / 1e3);
+    }
+    printf("\n");
+    for (s = 0; s < ST_COUNT; s++) {
+        printf("\t%-8s = %s\n", stage_names[s], stage_desc[s]);
+    }
+    printf("\n");
+
+    if (conf->spec_us) {
+        printf("* Latency spec %u us: %lu iterations over the limit - %s\n", conf->spec_us, st->over_spec,
+            st->over_spec ? "FAIL" : "PASS");
+    }
+    print_hist("Total latency histogram", st->hist);
+}
+
+static int react_run(const struct react_conf *conf) {
+    struct react_ctx ctx = { .sw_fd = -1, .stim_fd = -1, .out_fd = -1, .epfd = -1 };
+    struct react_stats st;
+    unsigned int seed = (unsigned int)now_ns() | 1;
+    unsigned long i, lost = 0;
+    uint64_t start;
+    int s, rc = RET_OK;
+
+    memset(&st, 0, sizeof(st));
+    for (s = 0; s < ST_COUNT; s++) {
+        st.lat[s] = malloc(conf->iterations * sizeof(uint64_t));
+        if (!st.lat[s]) {
+            printf("Unable to allocate latency buffers\n");
+            rc = RET_ERR;
+            goto react_run_end;
+        }
+    }
+
+    if (react_open(conf, &ctx)) {
+        rc = RET_ERR;
+        goto react_run_end;
+    }
+    if (conf->csv) {
+        ctx.csv = fopen(conf->csv, "w");
+        if (!ctx.csv) {
+            printf("Unable to create %s (%s)\n", conf->csv, strerror(errno));
+            rc = RET_ERR;
+            goto react_run_end;
+        }
+        fprintf(ctx.csv, "iteration,value,detect_ns,wakeup_ns,react_ns,output_ns,total_ns\n");
+    }
+
+    print_box("Starting the reaction loop");
+    if (conf->external) {
+        printf("* Waiting for %lu switch changes, press the CTRL + C if you want to end.\n", conf->iterations);
+    }
+    signal(SIGINT, sig_handler);
+
+    start = now_ns();
+    for (i = 0; !sig_int && st.done < conf->iterations; i++) {
+        int measure = conf->external || i >= conf->warmup;
+
+        rc = react_iteration(conf, &ctx, &st, &seed, measure);
+        if (rc == ETIMEDOUT && !conf->external && !sig_int) {
+            /* The external change can take any time, the stimulus is lost */
+            st.timeouts++;
+            if (++lost == MAX_TIMEOUTS) {
+                printf("Switches don't follow the stimulus LED, is the loopback enabled?\n");
+                rc = RET_ERR;
+                break;
+            }
+            rc = RET_OK;
+            continue;
+        }
+        if (rc == ETIMEDOUT) {
+            rc = RET_OK;
+        } else if (rc != RET_OK) {
+            break;
+        }
+        lost = 0;
+        react_gap(conf, &seed);
+    }
+    signal(SIGINT, SIG_DFL);
+
+    print_summary(conf, &ctx, &st, (now_ns() - start) / 1e9);
+    if (rc == RET_OK && (st.done == 0 || st.timeouts || st.over_spec)) {
+        rc = RET_ERR;
+    }
+
+react_run_end:
+    if (ctx.csv) {
+        fclose(ctx.csv);
+    }
+    react_close(&ctx);
+    for (s = 0; s < ST_COUNT; s++) {
+        free(st.lat[s]);
+    }
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    struct react_conf conf = {
+        .sw_dev = PB_ZYBO_SW_DEV_PREFIX "-0",
+        .stim_dev = PB_ZYBO_LED_DEV_PREFIX "-0",
+        .out = OUT_RGB,
+        .mode = WAIT_AUTO,
+        .iterations = DEFAULT_ITERATIONS,
+        .warmup = DEFAULT_WARMUP,
+        .gap_us = DEFAULT_GAP_US,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hs:l:o:d:m:n:w:g:Ec:S:p:")) != -1) {
+        switch (opt) {
+            case 'h' : print_help(); return RET_OK;
+            case 's' : conf.sw_dev = optarg; break;
+            case 'l' : conf.stim_dev = optarg; break;
+            case 'o' :
+                if (strcmp(optarg, "rgb") == 0) {
+                    conf.out = OUT_RGB;
+                } else if (strcmp(optarg, "led") == 0) {
+                    conf.out = OUT_LED;
+                } else {
+                    printf("Unknown output %s\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'd' : conf.out_dev = optarg; break;
+            case 'm' :
+                if (strcmp(optarg, "auto") == 0) {
+                    conf.mode = WAIT_AUTO;
+                } else if (strcmp(optarg, "poll") == 0) {
+                    conf.mode = WAIT_POLL;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    conf.mode = WAIT_SAMPLE;
+                } else {
+                    printf("Unknown wait mode %s\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'n' : conf.iterations = strtoul(optarg, NULL, 0); break;
+            case 'w' : conf.warmup = strtoul(optarg, NULL, 0); break;
+            case 'g' : conf.gap_us = strtoul(optarg, NULL, 0); break;
+            case 'E' : conf.external = 1; break;
+            case 'c' : conf.csv = optarg; break;
+            case 'S' : conf.spec_us = strtoul(optarg, NULL, 0); break;
+            case 'p' : conf.prio = strtoul(optarg, NULL, 0); break;
+            default:
+                print_help();
+                return RET_ERR;
+        }
+    }
+
+    if (!conf.out_dev) {
+        conf.out_dev = conf.out == OUT_RGB ? PB_ZYBO_RGB_DEV_PREFIX "-0" : PB_ZYBO_LED_DEV_PREFIX "-1";
+    }
+    if (conf.iterations == 0) {
+        printf("Invalid number of iterations\n");
+        return RET_ERR;
+    }
+    if (!conf.external && strcmp(conf.out_dev, conf.stim_dev) == 0) {
+        printf("The output device has to differ from the stimulus device\n");
+        return RET_ERR;
+    }
+
+    if (conf.prio) {
+        struct sched_param sp = { .sched_priority = conf.prio };
+
+        if (sched_setscheduler(0, SCHED_FIFO, &sp)) {
+            printf("* Unable to set the SCHED_FIFO priority %d (%s), using the default policy.\n", conf.prio,
+                strerror(errno));
+        }
+    }
+
+    printf("Reaction latency utility is starting.\n");
+    printf("\t* Switch device: %s\n", conf.sw_dev);
+    printf("\t* Output device: %s\n", conf.out_dev);
+    return react_run(&conf);
+}
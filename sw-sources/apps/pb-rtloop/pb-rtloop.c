@@ -0,0 +1,508 @@
+/*  pb-rtloop.c - Real-time control loop reference application of the PB Zybo drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+/* IOCTL handlers of drivers */
+#include "pb-zybo-ioctl.h"
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+#define DEFAULT_RATE_HZ 1000
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_PRIO 80
+#define MIN_RATE_HZ 1
+#define MAX_RATE_HZ 20000
+/* Period of the brightness waveform */
+#define WAVE_PERIOD_MS 1000
+/* Stack which is touched before the loop, so it doesn't page fault */
+#define PREFAULT_STACK (64 * 1024)
+/* Pin to the last allowed CPU */
+#define CPU_LAST -2
+#define CPU_NONE -1
+
+/* Log2 histogram buckets - < 1 us, [1, 2) us, [2, 4) us, ... */
+#define HIST_BUCKETS 32
+/* Width of the histogram bar */
+#define HIST_BAR 40
+
+/**
+ * @brief Measured parts of one tick
+ *
+ */
+enum tick_stage {
+    ST_JITTER = 0,  /* Deadline -> the loop is running (wakeup latency) */
+    ST_READ,        /* Switch read */
+    ST_COMPUTE,     /* Control law */
+    ST_WRITE,       /* RGB duty cycle write */
+    ST_WORK,        /* Wakeup -> end of the tick */
+    ST_COUNT
+};
+
+static const char *stage_names[ST_COUNT] = { "jitter", "read", "compute", "write", "work" };
+
+static const char *stage_desc[ST_COUNT] = {
+    "deadline -> loop running (wakeup jitter)",
+    "switch read (PB_ZYBO_SW_IOCTL_GET_VALUE)",
+    "control law",
+    "RGB duty cycle write (PB_ZYBO_RGB_IOCTL_SET_VAL)",
+    "loop running -> end of the tick",
+};
+
+struct loop_conf {
+    const char *sw_dev;
+    const char *rgb_dev;
+    unsigned int rate_hz;
+    unsigned int duration_s;
+    int cpu;                    /* CPU_LAST, CPU_NONE or the CPU number */
+    int prio;                   /* SCHED_FIFO priority, 0 = don't change */
+    long max_misses;            /* Allowed deadline misses, -1 = no check */
+};
+
+struct loop_stats {
+    unsigned long ticks;        /* Executed ticks */
+    unsigned long misses;       /* Ticks which ended after the next deadline */
+    unsigned long skipped;      /* Deadlines skipped after misses */
+    uint32_t *lat[ST_COUNT];    /* Stage times (ns) */
+    unsigned long hist[HIST_BUCKETS];
+};
+
+/* Detection of the interrupt signal */
+static volatile sig_atomic_t sig_int = 0;
+
+static void sig_handler(int s) {
+    (void)s;
+    sig_int = 1;
+}
+
+static void print_help() {
+    printf("Reference real-time control loop - each tick reads switches and writes RGB duty cycles. Switches\n");
+    printf("0 - 2 enable R, G and B channels which breathe with the %d ms period, switch 3 selects the full\n", WAVE_PERIOD_MS);
+    printf("brightness. The loop reports deadline misses, the wakeup jitter and the cost of each stage.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-s = switch device (default %s-0)\n", PB_ZYBO_SW_DEV_PREFIX);
+    printf("\t-r = RGB LED device (default %s-0)\n", PB_ZYBO_RGB_DEV_PREFIX);
+    printf("\t-f = loop rate in Hz, %d - %d (default %d)\n", MIN_RATE_HZ, MAX_RATE_HZ, DEFAULT_RATE_HZ);
+    printf("\t-t = run time in seconds (default %d, 0 = until CTRL + C)\n", DEFAULT_DURATION_S);
+    printf("\t-c = CPU of the loop (default the last allowed CPU, -1 = no pinning)\n");
+    printf("\t-p = SCHED_FIFO priority (default %d, 0 = default policy)\n", DEFAULT_PRIO);
+    printf("\t-M = maximal allowed number of deadline misses, the loop fails if it is exceeded\n");
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t ts_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_ns(&ts);
+}
+
+static void ts_add(struct timespec *ts, uint64_t ns) {
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t va = *(const uint32_t *)a;
+    uint32_t vb = *(const uint32_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/* Nearest-rank percentile of the sorted array */
+static uint32_t percentile(const uint32_t *sorted, unsigned long n, double p) {
+    unsigned long idx = (unsigned long)(p * n + 0.999999);
+    return sorted[idx > 0 ? idx - 1 : 0];
+}
+
+/* Histogram bucket of the time in ns */
+static int hist_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = 0;
+
+    while (us && b < HIST_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* ==================================================================
+ 		Real-time setup
+   ================================================================== */
+
+/* Touch the stack, so the loop doesn't page fault on the first deep call */
+static void prefault_stack(void) {
+    volatile char buf[PREFAULT_STACK];
+
+    memset((char *)buf, 0, sizeof(buf));
+}
+
+static int last_cpu(void) {
+    cpu_set_t set;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    for (cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--) {
+        if (CPU_ISSET(cpu, &set)) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Memory locking, CPU pinning, the SCHED_FIFO policy and the minimal timer slack. The loop runs without
+ * them too (e.g., without the CAP_SYS_NICE capability), failures are reported.
+ *
+ */
+static void rt_setup(struct loop_conf *conf) {
+    struct sched_param sp = { .sched_priority = conf->prio };
+    cpu_set_t set;
+
+    /* Locked memory - stats buffers are allocated and touched before */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        printf("\t* mlockall: failed (%s)\n", strerror(errno));
+    } else {
+        printf("\t* mlockall: ok\n");
+    }
+    prefault_stack();
+
+    if (conf->cpu == CPU_LAST) {
+        conf->cpu = last_cpu();
+    }
+    if (conf->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(conf->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            printf("\t* CPU %d: failed (%s)\n", conf->cpu, strerror(errno));
+            conf->cpu = CPU_NONE;
+        } else {
+            printf("\t* CPU %d: ok\n", conf->cpu);
+        }
+    }
+
+    if (conf->prio) {
+        if (sched_setscheduler(0, SCHED_FIFO, &sp)) {
+            printf("\t* SCHED_FIFO %d: failed (%s), using the default policy\n", conf->prio, strerror(errno));
+            conf->prio = 0;
+        } else {
+            printf("\t* SCHED_FIFO %d: ok\n", conf->prio);
+        }
+    }
+
+    /* The default timer slack (50 us) of normal tasks delays each wakeup */
+    if (prctl(PR_SET_TIMERSLACK, 1UL)) {
+        printf("\t* Timer slack: failed (%s)\n", strerror(errno));
+    }
+}
+
+/* ==================================================================
+ 		Control loop
+   ================================================================== */
+
+/**
+ * @brief Control law - switches 0 - 2 enable R, G and B channels, the brightness follows
+ * the triangle wave and switch 3 selects the full brightness (half otherwise)
+ *
+ * @param sw Switch value
+ * @param t Time of the tick (ns)
+ * @return uint32_t Color (0xRRGGBB)
+ */
+static uint32_t control_law(uint32_t sw, uint64_t t) {
+    const uint64_t wave = WAVE_PERIOD_MS * 1000000ULL;
+    uint64_t phase = t % wave;
+    uint32_t level, color = 0;
+
+    /* Triangle 0 -> 255 -> 0 */
+    level = (uint32_t)((phase < wave / 2 ? phase : wave - phase) * 510 / wave);
+    if (!(sw & 0x8)) {
+        level /= 2;
+    }
+
+    if (sw & 0x1) {
+        color |= level << 16;
+    }
+    if (sw & 0x2) {
+        color |= level << 8;
+    }
+    if (sw & 0x4) {
+        color |= level;
+    }
+    return color;
+}
+
+/**
+ * @brief Run the loop with absolute deadlines. The tick which ends after the next deadline
+ * is a miss, deadlines which already passed are skipped (the loop doesn't catch up).
+ *
+ */
+static int loop_run(const struct loop_conf *conf, int sw_fd, int rgb_fd, struct loop_stats *st,
+    unsigned long max_ticks) {
+    const uint64_t period = 1000000000ULL / conf->rate_hz;
+    struct timespec next;
+    uint64_t deadline, t_wake, t_read, t_comp, t_end, end;
+    uint32_t sw, color;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    ts_add(&next, period);
+    end = conf->duration_s ? ts_ns(&next) + conf->duration_s * 1000000000ULL : UINT64_MAX;
+
+    while (!sig_int && st->ticks < max_ticks) {
+        deadline = ts_ns(&next);
+        if (deadline >= end) {
+            break;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR && !sig_int)
+            ;
+        t_wake = now_ns();
+
+        if (ioctl(sw_fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &sw)) {
+            printf("Unable to read switches (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+        t_read = now_ns();
+        color = control_law(sw, t_read);
+        t_comp = now_ns();
+        if (ioctl(rgb_fd, PB_ZYBO_RGB_IOCTL_SET_VAL, &color)) {
+            printf("Unable to write the RGB value (%s)!\n", strerror(errno));
+            return RET_ERR;
+        }
+        t_end = now_ns();
+
+        st->lat[ST_JITTER][st->ticks] = t_wake - deadline;
+        st->lat[ST_READ][st->ticks] = t_read - t_wake;
+        st->lat[ST_COMPUTE][st->ticks] = t_comp - t_read;
+        st->lat[ST_WRITE][st->ticks] = t_end - t_comp;
+        st->lat[ST_WORK][st->ticks] = t_end - t_wake;
+        st->hist[hist_bucket(t_wake - deadline)]++;
+        st->ticks++;
+
+        /* Next deadline, the missed ones are skipped */
+        ts_add(&next, period);
+        if (t_end > deadline + period) {
+            uint64_t late = (t_end - deadline - period) / period;
+
+            st->misses++;
+            st->skipped += late;
+            ts_add(&next, late * period);
+        }
+    }
+    return RET_OK;
+}
+
+static void print_hist(const char *title, const unsigned long *hist) {
+    unsigned long max = 0;
+    int b, first = -1, last = -1;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b]) {
+            first = first < 0 ? b : first;
+            last = b;
+            max = hist[b] > max ? hist[b] : max;
+        }
+    }
+
+    printf("%s:\n", title);
+    if (first < 0) {
+        printf("\t(no data)\n");
+        return;
+    }
+
+    for (b = first; b <= last; b++) {
+        char bar[HIST_BAR + 1];
+        int len = (int)(hist[b] * HIST_BAR / max);
+
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        if (b == 0) {
+            printf("\t%10s < %-10lu us : %8lu %s\n", "", 1UL, hist[b], bar);
+        } else {
+            printf("\t%10lu - %-10lu us : %8lu %s\n", 1UL << (b - 1), 1UL << b, hist[b], bar);
+        }
+    }
+}
+
+static void print_summary(const struct loop_conf *conf, struct loop_stats *st, double run) {
+    uint32_t work_p99 = 0, work_max = 0;
+    unsigned long i;
+    uint64_t sum;
+    int s;
+
+    print_box("Control loop summary");
+    printf("* Rate: %u Hz (period %.1f us), run time %.3f s\n", conf->rate_hz, 1e6 / conf->rate_hz, run);
+    printf("* Ticks: %lu, deadline misses: %lu (%.3f %%), skipped deadlines: %lu\n", st->ticks, st->misses,
+        st->ticks ? st->misses * 100.0 / st->ticks : 0.0, st->skipped);
+    if (st->ticks == 0) {
+        return;
+    }
+
+    printf("\n%-8s %10s %10s %10s %10s %10s %10s  [us]\n", "Stage", "min", "avg", "p50", "p99", "p999", "max");
+    for (s = 0; s < ST_COUNT; s++) {
+        uint32_t *lat = st->lat[s];
+
+        sum = 0;
+        for (i = 0; i < st->ticks; i++) {
+            sum += lat[i];
+        }
+        qsort(lat, st->ticks, sizeof(uint32_t), cmp_u32);
+        printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[s], lat[0] / 1e3,
+            sum / 1e3 / st->ticks, percentile(lat, st->ticks, 0.50) / 1e3, percentile(lat, st->ticks, 0.99) / 1e3,
+            percentile(lat, st->ticks, 0.999) / 1e3, lat[st->ticks - 1] / 1e3);
+    }
+    printf("\n");
+    for (s = 0; s < ST_COUNT; s++) {
+        printf("\t%-8s = %s\n", stage_names[s], stage_desc[s]);
+    }
+    printf("\n");
+
+    /* The tick has to fit the period including the wakeup jitter */
+    work_p99 = percentile(st->lat[ST_WORK], st->ticks, 0.99) + percentile(st->lat[ST_JITTER], st->ticks, 0.99);
+    work_max = st->lat[ST_WORK][st->ticks - 1] + st->lat[ST_JITTER][st->ticks - 1];
+    if (work_p99 && work_max) {
+        printf("* Maximal loop rate: %.0f Hz (p99 of jitter + work), %.0f Hz (worst case)\n", 1e9 / work_p99,
+            1e9 / work_max);
+    }
+    if (conf->max_misses >= 0) {
+        printf("* Allowed deadline misses %ld: %s\n", conf->max_misses,
+            (long)st->misses > conf->max_misses ? "FAIL" : "PASS");
+    }
+    print_hist("Wakeup jitter histogram", st->hist);
+}
+
+int main(int argc, char **argv) {
+    struct loop_conf conf = {
+        .sw_dev = PB_ZYBO_SW_DEV_PREFIX "-0",
+        .rgb_dev = PB_ZYBO_RGB_DEV_PREFIX "-0",
+        .rate_hz = DEFAULT_RATE_HZ,
+        .duration_s = DEFAULT_DURATION_S,
+        .cpu = CPU_LAST,
+        .prio = DEFAULT_PRIO,
+        .max_misses = -1,
+    };
+    struct loop_stats st;
+    unsigned long max_ticks;
+    int opt, s, sw_fd, rgb_fd, rc = RET_ERR;
+    uint64_t start;
+
+    while ((opt = getopt(argc, argv, "hs:r:f:t:c:p:M:")) != -1) {
+        switch (opt) {
+            case 'h' : print_help(); return RET_OK;
+            case 's' : conf.sw_dev = optarg; break;
+            case 'r' : conf.rgb_dev = optarg; break;
+            case 'f' : conf.rate_hz = strtoul(optarg, NULL, 0); break;
+            case 't' : conf.duration_s = strtoul(optarg, NULL, 0); break;
+            case 'c' : conf.cpu = strtol(optarg, NULL, 0); break;
+            case 'p' : conf.prio = strtoul(optarg, NULL, 0); break;
+            case 'M' : conf.max_misses = strtol(optarg, NULL, 0); break;
+            default:
+                print_help();
+                return RET_ERR;
+        }
+    }
+
+    if (conf.rate_hz < MIN_RATE_HZ || conf.rate_hz > MAX_RATE_HZ) {
+        printf("The loop rate has to be %d - %d Hz\n", MIN_RATE_HZ, MAX_RATE_HZ);
+        return RET_ERR;
+    }
+
+    /* Stage buffers of the whole run (an hour of ticks until CTRL + C), touched before mlockall */
+    max_ticks = (unsigned long)conf.rate_hz * (conf.duration_s ? conf.duration_s : 3600);
+    memset(&st, 0, sizeof(st));
+    for (s = 0; s < ST_COUNT; s++) {
+        st.lat[s] = calloc(max_ticks, sizeof(uint32_t));
+        if (!st.lat[s]) {
+            printf("Unable to allocate stage buffers\n");
+            goto main_end;
+        }
+        memset(st.lat[s], 0, max_ticks * sizeof(uint32_t));
+    }
+
+    sw_fd = open(conf.sw_dev, O_RDWR);
+    if (sw_fd < 0) {
+        printf("Unable to open the switch device %s (%s)\n", conf.sw_dev, strerror(errno));
+        goto main_end;
+    }
+    rgb_fd = open(conf.rgb_dev, O_RDWR);
+    if (rgb_fd < 0) {
+        printf("Unable to open the RGB LED device %s (%s)\n", conf.rgb_dev, strerror(errno));
+        close(sw_fd);
+        goto main_end;
+    }
+
+    printf("Real-time control loop is starting.\n");
+    printf("\t* Switch device: %s\n", conf.sw_dev);
+    printf("\t* RGB LED device: %s\n", conf.rgb_dev);
+    rt_setup(&conf);
+
+    print_box("Starting the control loop");
+    if (conf.duration_s == 0) {
+        printf("* Press the CTRL + C if you want to end.\n");
+    }
+    signal(SIGINT, sig_handler);
+    start = now_ns();
+    rc = loop_run(&conf, sw_fd, rgb_fd, &st, max_ticks);
+    signal(SIGINT, SIG_DFL);
+
+    print_summary(&conf, &st, (now_ns() - start) / 1e9);
+    if (rc == RET_OK && conf.max_misses >= 0 && (long)st.misses > conf.max_misses) {
+        rc = RET_ERR;
+    }
+
+    /* Leave the LED dark */
+    ioctl(rgb_fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
+    close(rgb_fd);
+    close(sw_fd);
+
+main_end:
+    for (s = 0; s < ST_COUNT; s++) {
+        free(st.lat[s]);
+    }
+    return rc;
+}
@@ -0,0 +1,1288 @@
+/*  pb-sim.c - LD_PRELOAD simulator of the PB Zybo LED, RGB LED and switch devices
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The library replaces open, close, read, write, pread, pwrite, lseek, ioctl and stat calls of
+ * /dev/led_module-N, /dev/rgb-led-module-N, /dev/switch_module-N and /dev/pb-zybo-cmd, so
+ * test applications and benchmarks run on any Linux host. Calls follow the driver code
+ * (see led-module.c, rgb-led-module.c, switch-module.c and pb-zybo-core.c), including
+ * the per-device lock, O_NONBLOCK, permission checks and the text formats.
+ *
+ * Each simulated file is backed by a real descriptor, so poll, select and epoll behave like
+ * on the real devices and dup, fork and close work as usual. LED, RGB and command files are
+ * backed by /dev/null (the driver doesn't implement poll - the device is always ready and
+ * epoll_ctl fails with EPERM). Switch files are backed by an eventfd which the sampling thread
+ * signals when the file didn't read the last change, like the poll of switch-module.c. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "pb-zybo-ioctl.h"
+#include "pb-zybo-cmd.h"
+
+/* Original IOCTL handlers of drivers (the same 'l' numbers are routed by the device kind) */
+#define LED_IOCTL_MAGIC				'l'
+#define LED_IOCTL_GET_INIT			_IOR(LED_IOCTL_MAGIC, 0, int)
+#define LED_IOCTL_SET_INIT			_IOW(LED_IOCTL_MAGIC, 1, int)
+#define LED_IOCTL_GET_MASK			_IOR(LED_IOCTL_MAGIC, 2, int)
+#define LED_IOCTL_SET_MASK			_IOW(LED_IOCTL_MAGIC, 3, int)
+#define LED_IOCTL_SET_VALUE			_IOW(LED_IOCTL_MAGIC, 4, int)
+#define LED_IOCTL_RESET				_IO(LED_IOCTL_MAGIC, 5)
+
+#define RGB_IOCTL_GET_VAL			_IOR(LED_IOCTL_MAGIC, 0, unsigned long)
+#define RGB_IOCTL_SET_VAL			_IOW(LED_IOCTL_MAGIC, 1, unsigned long)
+#define RGB_IOCTL_SET_PERIOD		_IOW(LED_IOCTL_MAGIC, 2, unsigned long)
+#define RGB_IOCTL_GET_PERIOD		_IOR(LED_IOCTL_MAGIC, 3, unsigned long)
+#define RGB_IOCTL_INIT				_IO(LED_IOCTL_MAGIC, 4)
+
+#define SW_IOCTL_GET_MASK			_IOR(LED_IOCTL_MAGIC, 0, int)
+#define SW_IOCTL_SET_MASK			_IOW(LED_IOCTL_MAGIC, 1, int)
+#define SW_IOCTL_GET_VALUE			_IOW(LED_IOCTL_MAGIC, 2, int)
+
+/* Driver constants */
+#define LED_BUFF_SIZE				32
+#define LED_INIT_MASK				0xf
+#define LED_INIT_VALUE				0x0
+#define SW_BUFF_SIZE				32
+#define SW_INIT_MASK				0xf
+#define SW_POLL_MS					10
+#define RGB_BUFF_SIZE				512
+#define RGB_CONF_STR_LEN			15
+#define RGB_PERIOD_CLK				4096
+#define RGB_MAX_DIV					8
+#define RGB_CHANNELS				3
+
+/* Simulator limits, major numbers are taken from the local/experimental range */
+#define SIM_MAX_DEVS				8
+#define SIM_MAX_FDS					1024
+#define SIM_MAJOR_BASE				240
+#define SIM_CMD_MINOR				255
+#define SIM_STATE_MAGIC				0x70627a31
+
+/* Simulated file kinds */
+enum sim_kind {
+	SIM_LED = 0,
+	SIM_RGB,
+	SIM_SW,
+	SIM_CMD,
+	SIM_KIND_COUNT
+};
+
+static const char *sim_names[SIM_KIND_COUNT] = { "led_module", "rgb-led-module", "switch_module", "pb-zybo-cmd" };
+
+/**
+ * @brief State of one device - shared by all processes which use the same state file
+ * (or by forked children)
+ *
+ */
+struct sim_dev {
+	pthread_mutex_t lock;		/* Device semaphore (pb_zybo_down/up) */
+	uint32_t reg;				/* LED data register or switch data register */
+	uint8_t mask;				/* LED or switch mask */
+	uint8_t init;				/* LED init value */
+	uint32_t rgb[RGB_CHANNELS];	/* RGB color (R, G, B) */
+	uint32_t period;			/* PWM period */
+	uint32_t duty[RGB_CHANNELS];	/* PWM duty cycle registers (B, G, R) */
+	uint32_t enabled;			/* PWM control register */
+	char loc_buff[SW_BUFF_SIZE];	/* Switch read buffer (per device in the driver) */
+	uint64_t ops;				/* Number of executed operations */
+	struct pb_zybo_out_stamp stamp;	/* Last LED or RGB update */
+	pthread_mutex_t ev_lock;	/* Switch sample lock (ev_lock of the driver) */
+	struct pb_zybo_sw_event ev;	/* Last detected switch change */
+	uint64_t last_ns;			/* Last switch sample (0 = not sampled yet) */
+};
+
+struct sim_state {
+	uint32_t magic;
+	uint32_t count[SIM_KIND_COUNT];
+	struct sim_dev devs[SIM_CMD][SIM_MAX_DEVS];
+};
+
+/**
+ * @brief One opened simulated file
+ *
+ */
+struct sim_file {
+	enum sim_kind kind;
+	unsigned int idx;			/* Device instance */
+	int accmode;				/* O_RDONLY, O_WRONLY or O_RDWR given to open */
+	int nonblock;				/* O_NONBLOCK given to open */
+	int can_write;				/* CAP_SYS_ADMIN captured during the open (RGB, command queue) */
+	int fd;						/* Backing descriptor (eventfd of the switch) */
+	uint32_t seen;				/* Last switch change read by the file */
+	int signalled;				/* The eventfd of the switch is signalled */
+	off_t pos;					/* File position */
+	char wr_buf[RGB_BUFF_SIZE];	/* RGB write buffer */
+	char rd_buff[RGB_BUFF_SIZE];	/* RGB read buffer */
+};
+
+/* Configuration (environment) */
+static struct {
+	const char *dir;			/* PB_SIM_DIR - second root of device nodes */
+	unsigned long call_ns;		/* PB_SIM_CALL_NS - injected cost of each call (system call entry) */
+	unsigned long latency_ns;	/* PB_SIM_LATENCY_NS - injected latency of each device access */
+	unsigned long jitter_ns;	/* PB_SIM_JITTER_NS - random extra latency (0 - jitter) */
+	int cap;					/* PB_SIM_CAP - simulated CAP_SYS_ADMIN */
+	const char *switch_file;	/* PB_SIM_SWITCH_FILE - switch value is read from the file */
+	unsigned long switch_period_us;	/* PB_SIM_SWITCH_PERIOD_US - switches count with the period */
+	unsigned long poll_ms;		/* PB_SIM_POLL_MS - sampling period of opened switch files */
+	int trace;					/* PB_SIM_TRACE - print output changes to stderr */
+	int loopback;				/* PB_SIM_LOOPBACK - LED values are written to switches */
+} conf;
+
+static struct sim_state *state;
+static struct sim_file *files[SIM_MAX_FDS];
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t sw_watch_pid;		/* Process which runs the switch sampling thread */
+
+/* Original functions */
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+static off_t (*real_lseek)(int, off_t, int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_stat)(const char *, struct stat *);
+static int (*real_fstat)(int, struct stat *);
+static int (*real_xstat)(int, const char *, struct stat *);
+static int (*real_fxstat)(int, int, struct stat *);
+
+/* ==================================================================
+ 		Initialization
+   ================================================================== */
+
+static unsigned long env_ulong(const char *name, unsigned long def) {
+	const char *val = getenv(name);
+	return val ? strtoul(val, NULL, 0) : def;
+}
+
+static void sim_dev_init(struct sim_dev *dev) {
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&dev->lock, &attr);
+	pthread_mutex_init(&dev->ev_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	dev->mask = LED_INIT_MASK;
+	dev->init = LED_INIT_VALUE;
+	dev->period = RGB_PERIOD_CLK;
+}
+
+/* The state is shared with forked children, PB_SIM_STATE shares it between processes */
+static struct sim_state *sim_state_map(void) {
+	const char *path = getenv("PB_SIM_STATE");
+	struct sim_state *st;
+	int fd, kind, i, fresh = 1;
+
+	if (path == NULL) {
+		st = mmap(NULL, sizeof(*st), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	} else {
+		fd = real_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (fd < 0)
+			return NULL;
+		if (real_lseek(fd, 0, SEEK_END) == sizeof(*st))
+			fresh = 0;
+		else if (ftruncate(fd, sizeof(*st)) != 0) {
+			real_close(fd);
+			return NULL;
+		}
+		st = mmap(NULL, sizeof(*st), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		real_close(fd);
+	}
+	if (st == MAP_FAILED)
+		return NULL;
+
+	if (fresh || st->magic != SIM_STATE_MAGIC) {
+		memset(st, 0, sizeof(*st));
+		for (kind = 0; kind < SIM_CMD; kind++) {
+			for (i = 0; i < SIM_MAX_DEVS; i++)
+				sim_dev_init(&st->devs[kind][i]);
+		}
+		for (i = 0; i < SIM_MAX_DEVS; i++) {
+			st->devs[SIM_SW][i].mask = SW_INIT_MASK;
+			st->devs[SIM_SW][i].reg = env_ulong("PB_SIM_SWITCH", 0);
+			st->devs[SIM_RGB][i].enabled = 1;
+		}
+		st->magic = SIM_STATE_MAGIC;
+	}
+
+	/* The number of instances is taken from the environment of each process */
+	st->count[SIM_LED] = env_ulong("PB_SIM_LED", 1);
+	st->count[SIM_RGB] = env_ulong("PB_SIM_RGB", 1);
+	st->count[SIM_SW] = env_ulong("PB_SIM_SW", 1);
+	st->count[SIM_CMD] = env_ulong("PB_SIM_CMD", 1) ? 1 : 0;
+	for (kind = 0; kind < SIM_CMD; kind++) {
+		if (st->count[kind] > SIM_MAX_DEVS)
+			st->count[kind] = SIM_MAX_DEVS;
+	}
+	return st;
+}
+
+/* Placeholder files in PB_SIM_DIR, so the directory lookup (libpbzybo) finds simulated nodes */
+static void sim_dir_create(void) {
+	char path[256];
+	unsigned int i;
+	int kind, fd;
+
+	if (conf.dir == NULL)
+		return;
+	mkdir(conf.dir, 0700);
+	for (kind = 0; kind < SIM_KIND_COUNT; kind++) {
+		for (i = 0; i < state->count[kind]; i++) {
+			if (kind == SIM_CMD)
+				snprintf(path, sizeof(path), "%s/%s", conf.dir, sim_names[kind]);
+			else
+				snprintf(path, sizeof(path), "%s/%s-%u", conf.dir, sim_names[kind], i);
+			fd = real_open(path, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+			if (fd >= 0)
+				real_close(fd);
+		}
+	}
+}
+
+/* Original functions are resolved before the first use (constructors of other libraries
+ * can call them before sim_init) */
+static void sim_resolve(void) {
+	if (real_open != NULL)
+		return;
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_pread = dlsym(RTLD_NEXT, "pread");
+	real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+	real_lseek = dlsym(RTLD_NEXT, "lseek");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_stat = dlsym(RTLD_NEXT, "stat");
+	real_fstat = dlsym(RTLD_NEXT, "fstat");
+	real_xstat = dlsym(RTLD_NEXT, "__xstat");
+	real_fxstat = dlsym(RTLD_NEXT, "__fxstat");
+	real_open = dlsym(RTLD_NEXT, "open");
+}
+
+__attribute__((constructor))
+static void sim_init(void) {
+	sim_resolve();
+	conf.dir = getenv("PB_SIM_DIR");
+	conf.call_ns = env_ulong("PB_SIM_CALL_NS", 0);
+	conf.latency_ns = env_ulong("PB_SIM_LATENCY_NS", 0);
+	conf.jitter_ns = env_ulong("PB_SIM_JITTER_NS", 0);
+	conf.cap = env_ulong("PB_SIM_CAP", 1) != 0;
+	conf.switch_file = getenv("PB_SIM_SWITCH_FILE");
+	conf.switch_period_us = env_ulong("PB_SIM_SWITCH_PERIOD_US", 0);
+	conf.poll_ms = env_ulong("PB_SIM_POLL_MS", SW_POLL_MS);
+	if (conf.poll_ms == 0)
+		conf.poll_ms = 1;
+	conf.trace = env_ulong("PB_SIM_TRACE", 0) != 0;
+	conf.loopback = env_ulong("PB_SIM_LOOPBACK", 0) != 0;
+
+	state = sim_state_map();
+	if (state == NULL) {
+		fprintf(stderr, "pb-sim: unable to create the device state (%s)\n", strerror(errno));
+		return;
+	}
+	sim_dir_create();
+}
+
+/* ==================================================================
+ 		Helpers
+   ================================================================== */
+
+static uint64_t sim_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Injected latency - busy wait, the device access occupies the CPU like the MMIO access */
+static void sim_delay_ns(uint64_t ns) {
+	uint64_t end;
+
+	if (ns == 0)
+		return;
+	end = sim_now_ns() + ns;
+	while (sim_now_ns() < end)
+		;
+}
+
+static void sim_latency(void) {
+	static __thread unsigned int seed;
+	uint64_t ns = conf.latency_ns;
+
+	if (conf.jitter_ns) {
+		if (seed == 0)
+			seed = (unsigned int)sim_now_ns() | 1;
+		ns += rand_r(&seed) % (conf.jitter_ns + 1);
+	}
+	sim_delay_ns(ns);
+}
+
+/* Recognize the simulated node - returns the kind and the instance or -1 */
+static int sim_match(const char *path, unsigned int *idx) {
+	const char *name = NULL;
+	size_t len;
+	char *end;
+	int kind;
+
+	if (state == NULL || path == NULL)
+		return -1;
+	if (strncmp(path, "/dev/", 5) == 0) {
+		name = path + 5;
+	} else if (conf.dir != NULL) {
+		len = strlen(conf.dir);
+		if (strncmp(path, conf.dir, len) == 0 && path[len] == '/')
+			name = path + len + 1;
+	}
+	if (name == NULL)
+		return -1;
+
+	for (kind = 0; kind < SIM_KIND_COUNT; kind++) {
+		len = strlen(sim_names[kind]);
+		if (strncmp(name, sim_names[kind], len) != 0)
+			continue;
+		if (kind == SIM_CMD) {
+			if (name[len] != '\0' || state->count[SIM_CMD] == 0)
+				return -1;
+			*idx = 0;
+			return kind;
+		}
+		if (name[len] != '-' || name[len + 1] < '0' || name[len + 1] > '9')
+			continue;
+		*idx = strtoul(name + len + 1, &end, 10);
+		if (*end != '\0' || *idx >= state->count[kind])
+			return -1;
+		return kind;
+	}
+	return -1;
+}
+
+static struct sim_file *sim_file(int fd) {
+	if (fd < 0 || fd >= SIM_MAX_FDS)
+		return NULL;
+	return files[fd];
+}
+
+static struct sim_dev *sim_dev(const struct sim_file *f) {
+	return &state->devs[f->kind][f->idx];
+}
+
+/* pb_zybo_down - O_NONBLOCK returns -EAGAIN instead of waiting */
+static int sim_down(struct sim_dev *dev, int nonblock) {
+	if (nonblock)
+		return pthread_mutex_trylock(&dev->lock) ? -EAGAIN : 0;
+	pthread_mutex_lock(&dev->lock);
+	return 0;
+}
+
+static void sim_up(struct sim_dev *dev) {
+	dev->ops++;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+static void sim_fill_stat(enum sim_kind kind, unsigned int idx, struct stat *st) {
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFCHR | 0600;
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_rdev = makedev(SIM_MAJOR_BASE + kind, kind == SIM_CMD ? SIM_CMD_MINOR : idx);
+	st->st_blksize = 4096;
+}
+
+static long sim_ret(long rc) {
+	if (rc < 0) {
+		errno = -rc;
+		return -1;
+	}
+	return rc;
+}
+
+/* ==================================================================
+ 		LED device (led-module.c)
+   ================================================================== */
+
+/* Like the stamp in the driver, the time is taken after the register write */
+static void sim_stamp(struct sim_dev *dev, uint32_t val) {
+	dev->stamp.value = val;
+	dev->stamp.seq++;
+	dev->stamp.ts_ns = sim_now_ns();
+}
+
+static void led_write_data(struct sim_file *f, struct sim_dev *dev, uint8_t val) {
+	uint32_t reg = val & dev->mask & 0xff;
+
+	if (conf.trace && reg != dev->reg)
+		fprintf(stderr, "pb-sim: %s-%u = 0x%x\n", sim_names[SIM_LED], f->idx, reg);
+	dev->reg = reg;
+
+	/* The LED output wired to the switch input of the same index (pb-zybo-mock loopback=1) */
+	if (conf.loopback && f->idx < state->count[SIM_SW])
+		__atomic_store_n(&state->devs[SIM_SW][f->idx].reg, reg & SW_INIT_MASK, __ATOMIC_RELEASE);
+	sim_stamp(dev, reg);
+}
+
+static long led_ioctl(struct sim_file *f, unsigned long cmd, unsigned long arg) {
+	struct sim_dev *dev = sim_dev(f);
+	long rc;
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+
+	switch (cmd) {
+	case LED_IOCTL_GET_INIT:
+	case PB_ZYBO_LED_IOCTL_GET_INIT:
+		rc = arg ? (*(int *)arg = dev->init, 0) : -EFAULT;
+		break;
+	case LED_IOCTL_SET_INIT:
+	case PB_ZYBO_LED_IOCTL_SET_INIT:
+		rc = conf.cap ? (dev->init = arg, 0) : -EPERM;
+		break;
+	case LED_IOCTL_GET_MASK:
+	case PB_ZYBO_LED_IOCTL_GET_MASK:
+		rc = arg ? (*(int *)arg = dev->mask, 0) : -EFAULT;
+		break;
+	case LED_IOCTL_SET_MASK:
+	case PB_ZYBO_LED_IOCTL_SET_MASK:
+		rc = conf.cap ? (dev->mask = arg, 0) : -EPERM;
+		break;
+	case LED_IOCTL_SET_VALUE:
+	case PB_ZYBO_LED_IOCTL_SET_VALUE:
+		if (!conf.cap) {
+			rc = -EPERM;
+			break;
+		}
+		led_write_data(f, dev, arg);
+		rc = 0;
+		break;
+	case LED_IOCTL_RESET:
+	case PB_ZYBO_LED_IOCTL_RESET:
+		led_write_data(f, dev, dev->init);
+		rc = 0;
+		break;
+	case PB_ZYBO_LED_IOCTL_GET_STAMP:
+		rc = arg ? (*(struct pb_zybo_out_stamp *)arg = dev->stamp, 0) : -EFAULT;
+		break;
+	default:
+		rc = -ENOTTY;
+		break;
+	}
+
+	sim_up(dev);
+	return rc;
+}
+
+/* Up to 32 bytes are taken, each byte (except '\0' and '\n') is written to LEDs */
+static long led_write(struct sim_file *f, const char *buf, size_t count) {
+	struct sim_dev *dev = sim_dev(f);
+	size_t i, to_copy = count < LED_BUFF_SIZE ? count : LED_BUFF_SIZE;
+	long rc;
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+
+	for (i = 0; i < to_copy; i++) {
+		if (buf[i] != '\0' && buf[i] != '\n')
+			led_write_data(f, dev, buf[i]);
+		f->pos++;
+	}
+
+	sim_up(dev);
+	return to_copy;
+}
+
+/* ==================================================================
+ 		RGB LED device (rgb-led-module.c)
+   ================================================================== */
+
+static uint32_t rgb_scale(uint32_t period, uint32_t val) {
+	return (period / RGB_MAX_DIV / 256) * val;
+}
+
+static void rgb_set_config(struct sim_file *f, struct sim_dev *dev, uint32_t r, uint32_t g, uint32_t b) {
+	dev->duty[0] = rgb_scale(dev->period, b);
+	dev->duty[1] = rgb_scale(dev->period, g);
+	dev->duty[2] = rgb_scale(dev->period, r);
+
+	if (conf.trace && (dev->rgb[0] != r || dev->rgb[1] != g || dev->rgb[2] != b))
+		fprintf(stderr, "pb-sim: %s-%u = 0x%x 0x%x 0x%x\n", sim_names[SIM_RGB], f->idx, r, g, b);
+	dev->rgb[0] = r;
+	dev->rgb[1] = g;
+	dev->rgb[2] = b;
+	sim_stamp(dev, (r << 16) | (g << 8) | b);
+}
+
+static uint32_t rgb_encode(const struct sim_dev *dev) {
+	return (dev->rgb[0] << 16) | (dev->rgb[1] << 8) | dev->rgb[2];
+}
+
+static void rgb_set_val(struct sim_file *f, struct sim_dev *dev, uint32_t val) {
+	rgb_set_config(f, dev, (val >> 16) & 0xff, (val >> 8) & 0xff, val & 0xff);
+}
+
+static long rgb_ioctl(struct sim_file *f, unsigned long cmd, unsigned long arg) {
+	struct sim_dev *dev = sim_dev(f);
+	uint32_t usr_val = 0;
+	long rc;
+
+	/* Setters are checked before the lock, the user value is fetched there too */
+	if (cmd == RGB_IOCTL_SET_VAL || cmd == RGB_IOCTL_SET_PERIOD ||
+		cmd == PB_ZYBO_RGB_IOCTL_SET_VAL || cmd == PB_ZYBO_RGB_IOCTL_SET_PERIOD) {
+		if (!f->can_write)
+			return -EPERM;
+		if (!arg)
+			return -EFAULT;
+		usr_val = *(uint32_t *)arg;
+	}
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+
+	switch (cmd) {
+	case RGB_IOCTL_GET_VAL:
+	case PB_ZYBO_RGB_IOCTL_GET_VAL:
+		rc = arg ? (*(uint32_t *)arg = rgb_encode(dev), 0) : -EFAULT;
+		break;
+	case RGB_IOCTL_SET_VAL:
+	case PB_ZYBO_RGB_IOCTL_SET_VAL:
+		rgb_set_val(f, dev, usr_val);
+		break;
+	case RGB_IOCTL_GET_PERIOD:
+	case PB_ZYBO_RGB_IOCTL_GET_PERIOD:
+		rc = arg ? (*(uint32_t *)arg = dev->period, 0) : -EFAULT;
+		break;
+	case RGB_IOCTL_SET_PERIOD:
+	case PB_ZYBO_RGB_IOCTL_SET_PERIOD:
+		dev->period = usr_val;
+		break;
+	case RGB_IOCTL_INIT:
+	case PB_ZYBO_RGB_IOCTL_INIT:
+		rgb_set_config(f, dev, 0, 0, 0);
+		dev->enabled = 1;
+		break;
+	case PB_ZYBO_RGB_IOCTL_GET_STAMP:
+		rc = arg ? (*(struct pb_zybo_out_stamp *)arg = dev->stamp, 0) : -EFAULT;
+		break;
+	default:
+		rc = -ENOTTY;
+		break;
+	}
+
+	sim_up(dev);
+	return rc;
+}
+
+/* The text "0xRR 0xGG 0xBB\n" is created at the offset 0 and read in parts */
+static long rgb_read(struct sim_file *f, char *buf, size_t count) {
+	struct sim_dev *dev = sim_dev(f);
+	uint32_t rgb[RGB_CHANNELS];
+	size_t to_send;
+	long rc;
+
+	if (f->pos >= RGB_BUFF_SIZE)
+		return 0;
+
+	if (f->pos == 0) {
+		rc = sim_down(dev, f->nonblock);
+		if (rc)
+			return rc;
+		sim_latency();
+		memcpy(rgb, dev->rgb, sizeof(rgb));
+		sim_up(dev);
+		snprintf(f->rd_buff, RGB_BUFF_SIZE, "0x%x 0x%x 0x%x\n", rgb[0], rgb[1], rgb[2]);
+	}
+
+	to_send = strnlen(f->rd_buff + f->pos, RGB_BUFF_SIZE - f->pos);
+	if (to_send > count)
+		to_send = count;
+	memcpy(buf, f->rd_buff + f->pos, to_send);
+	f->pos += to_send;
+	return to_send;
+}
+
+/* The text "0xAA 0xBB 0xCC" is collected in the per-open buffer from the current offset,
+ * the shorter text fails with EINVAL (and isn't taken) */
+static long rgb_write(struct sim_file *f, const char *buf, size_t count) {
+	struct sim_dev *dev = sim_dev(f);
+	unsigned int r, g, b;
+	size_t to_copy;
+	long rc;
+
+	if (f->pos >= RGB_BUFF_SIZE - 1)
+		return -ENOSPC;
+
+	to_copy = RGB_BUFF_SIZE - 1 - f->pos;
+	if (count < to_copy)
+		to_copy = count;
+	memcpy(f->wr_buf + f->pos, buf, to_copy);
+
+	if (strnlen(f->wr_buf, RGB_BUFF_SIZE) < RGB_CONF_STR_LEN)
+		return -EINVAL;
+	if (sscanf(f->wr_buf, "%x %x %x\n", &r, &g, &b) != 3)
+		return -EINVAL;
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+	rgb_set_config(f, dev, r, g, b);
+	sim_up(dev);
+
+	f->pos += to_copy;
+	return to_copy;
+}
+
+/* ==================================================================
+ 		Switch device (switch-module.c)
+   ================================================================== */
+
+/* Value of switches - the file, the counter or the stored value */
+static uint32_t sw_read_reg(struct sim_dev *dev) {
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	if (conf.switch_file != NULL) {
+		fd = real_open(conf.switch_file, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			len = real_read(fd, buf, sizeof(buf) - 1);
+			real_close(fd);
+			if (len > 0) {
+				buf[len] = '\0';
+				dev->reg = strtoul(buf, NULL, 0);
+			}
+		}
+	} else if (conf.switch_period_us) {
+		dev->reg = sim_now_ns() / 1000 / conf.switch_period_us;
+	}
+	return __atomic_load_n(&dev->reg, __ATOMIC_ACQUIRE) & dev->mask;
+}
+
+/* Change detection of the driver sampler (switch_module_sample), the first sample isn't a change */
+static void sw_sample(struct sim_dev *dev, struct pb_zybo_sw_event *ev) {
+	uint32_t val;
+	uint64_t now;
+
+	pthread_mutex_lock(&dev->ev_lock);
+	val = (uint8_t)sw_read_reg(dev);
+	now = sim_now_ns();
+	if (dev->last_ns == 0) {
+		dev->ev.value = val;
+	} else if (val != dev->ev.value) {
+		dev->ev.value = val;
+		dev->ev.seq++;
+		dev->ev.ts_ns = now;
+		dev->ev.prev_ns = dev->last_ns;
+	}
+	dev->last_ns = now;
+	*ev = dev->ev;
+	pthread_mutex_unlock(&dev->ev_lock);
+}
+
+/* The file read the change (ctx->seen of the driver), POLLIN is cleared */
+static void sw_seen(struct sim_file *f, uint32_t seq) {
+	eventfd_t cnt;
+
+	__atomic_store_n(&f->seen, seq, __ATOMIC_RELEASE);
+	if (__atomic_exchange_n(&f->signalled, 0, __ATOMIC_ACQ_REL))
+		eventfd_read(f->fd, &cnt);
+}
+
+/* Sampling thread - the driver samples switches while poll waiters are present, the simulator
+ * samples all opened switch files each PB_SIM_POLL_MS and signals files with an unread change.
+ * The sample doesn't take the device lock, so O_NONBLOCK calls don't fail because of it. */
+static void *sw_watch(void *arg) {
+	struct timespec period = { conf.poll_ms / 1000, (conf.poll_ms % 1000) * 1000000L };
+	struct pb_zybo_sw_event ev;
+	struct sim_file *f;
+	int fd;
+
+	(void)arg;
+	for (;;) {
+		nanosleep(&period, NULL);
+		pthread_mutex_lock(&files_lock);
+		for (fd = 0; fd < SIM_MAX_FDS; fd++) {
+			f = files[fd];
+			if (f == NULL || f->kind != SIM_SW)
+				continue;
+			sw_sample(sim_dev(f), &ev);
+			if (ev.seq != __atomic_load_n(&f->seen, __ATOMIC_ACQUIRE) &&
+				!__atomic_exchange_n(&f->signalled, 1, __ATOMIC_ACQ_REL))
+				eventfd_write(fd, 1);
+		}
+		pthread_mutex_unlock(&files_lock);
+	}
+	return NULL;
+}
+
+/* The thread is started by the first switch open of the process (forked children start their own) */
+static void sw_watch_start(void) {
+	pthread_t thread;
+
+	pthread_mutex_lock(&files_lock);
+	if (sw_watch_pid != getpid() && pthread_create(&thread, NULL, sw_watch, NULL) == 0) {
+		pthread_detach(thread);
+		sw_watch_pid = getpid();
+	}
+	pthread_mutex_unlock(&files_lock);
+}
+
+static long sw_ioctl(struct sim_file *f, unsigned long cmd, unsigned long arg) {
+	struct sim_dev *dev = sim_dev(f);
+	struct pb_zybo_sw_event ev;
+	long rc;
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+
+	switch (cmd) {
+	case SW_IOCTL_GET_MASK:
+	case PB_ZYBO_SW_IOCTL_GET_MASK:
+		rc = arg ? (*(int *)arg = dev->mask, 0) : -EFAULT;
+		break;
+	case SW_IOCTL_SET_MASK:
+	case PB_ZYBO_SW_IOCTL_SET_MASK:
+		rc = conf.cap ? (dev->mask = arg, 0) : -EPERM;
+		break;
+	case SW_IOCTL_GET_VALUE:
+	case PB_ZYBO_SW_IOCTL_GET_VALUE:
+		sw_sample(dev, &ev);
+		sw_seen(f, ev.seq);
+		rc = arg ? (*(int *)arg = ev.value, 0) : -EFAULT;
+		break;
+	case PB_ZYBO_SW_IOCTL_GET_EVENT:
+		sw_sample(dev, &ev);
+		sw_seen(f, ev.seq);
+		rc = arg ? (*(struct pb_zybo_sw_event *)arg = ev, 0) : -EFAULT;
+		break;
+	default:
+		rc = -ENOTTY;
+		break;
+	}
+
+	sim_up(dev);
+	return rc;
+}
+
+/* The decimal value with the new line is created at the offset 0 */
+static long sw_read(struct sim_file *f, char *buf, size_t count) {
+	struct sim_dev *dev = sim_dev(f);
+	struct pb_zybo_sw_event ev;
+	size_t len;
+	long rc;
+
+	if (f->pos > 1)
+		return 0;
+
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return rc;
+	sim_latency();
+
+	if (f->pos == 0) {
+		sw_sample(dev, &ev);
+		sw_seen(f, ev.seq);
+		snprintf(dev->loc_buff, SW_BUFF_SIZE, "%d\n", ev.value);
+	}
+
+	len = strnlen(dev->loc_buff + f->pos, SW_BUFF_SIZE);
+	if (len > count)
+		len = count;
+	memcpy(buf, dev->loc_buff + f->pos, len);
+	f->pos += len;
+
+	sim_up(dev);
+	return len;
+}
+
+/* ==================================================================
+ 		Command queue (pb-zybo-core.c)
+   ================================================================== */
+
+static enum sim_kind cmd_kind(uint16_t op) {
+	switch (op) {
+	case PB_ZYBO_CMD_LED_SET:
+		return SIM_LED;
+	case PB_ZYBO_CMD_RGB_SET:
+	case PB_ZYBO_CMD_RGB_PERIOD_SET:
+		return SIM_RGB;
+	case PB_ZYBO_CMD_SW_GET:
+		return SIM_SW;
+	default:
+		return SIM_CMD;
+	}
+}
+
+static long cmd_exec(struct pb_zybo_cmd *c) {
+	struct sim_file tf = { .kind = cmd_kind(c->op), .idx = c->dev };
+	struct sim_dev *dev = &state->devs[tf.kind][tf.idx];
+	struct pb_zybo_sw_event ev;
+
+	sim_latency();
+	switch (c->op) {
+	case PB_ZYBO_CMD_LED_SET:
+		led_write_data(&tf, dev, c->arg);
+		break;
+	case PB_ZYBO_CMD_RGB_SET:
+		rgb_set_val(&tf, dev, c->arg);
+		break;
+	case PB_ZYBO_CMD_RGB_PERIOD_SET:
+		dev->period = c->arg;
+		break;
+	case PB_ZYBO_CMD_SW_GET:
+		sw_sample(dev, &ev);
+		c->val = ev.value;
+		break;
+	}
+	dev->ops++;
+	return 0;
+}
+
+/* The whole batch is checked first, devices are locked in the (kind, minor) order and
+ * commands are executed until the first failure */
+static long cmd_submit(struct sim_file *f, struct pb_zybo_cmd_batch *batch) {
+	uint8_t used[SIM_CMD][SIM_MAX_DEVS];
+	struct pb_zybo_cmd *cmds;
+	enum sim_kind kind;
+	long rc = 0;
+	int k, i;
+	uint32_t n;
+
+	if (batch == NULL)
+		return -EFAULT;
+	if (batch->count == 0 || batch->count > PB_ZYBO_CMD_MAX)
+		return -EINVAL;
+	cmds = (struct pb_zybo_cmd *)(uintptr_t)batch->cmds;
+	if (cmds == NULL)
+		return -EFAULT;
+
+	batch->done = 0;
+	memset(used, 0, sizeof(used));
+	for (n = 0; n < batch->count; n++) {
+		cmds[n].res = -ECANCELED;
+		cmds[n].val = 0;
+	}
+
+	for (n = 0; n < batch->count; n++) {
+		kind = cmd_kind(cmds[n].op);
+		if (kind == SIM_CMD) {
+			if (cmds[n].op != PB_ZYBO_CMD_DELAY || cmds[n].arg > PB_ZYBO_CMD_MAX_DELAY_US) {
+				cmds[n].res = -EINVAL;
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (cmds[n].op != PB_ZYBO_CMD_SW_GET && !f->can_write) {
+			cmds[n].res = -EPERM;
+			return -EPERM;
+		}
+		if (cmds[n].dev >= state->count[kind]) {
+			cmds[n].res = -ENODEV;
+			return -ENODEV;
+		}
+		used[kind][cmds[n].dev] = 1;
+	}
+
+	for (k = 0; k < SIM_CMD && !rc; k++) {
+		for (i = 0; i < SIM_MAX_DEVS && !rc; i++) {
+			if (used[k][i] && sim_down(&state->devs[k][i], f->nonblock)) {
+				used[k][i] = 0;
+				rc = -EAGAIN;
+			}
+		}
+	}
+
+	for (n = 0; n < batch->count && !rc; n++) {
+		if (cmd_kind(cmds[n].op) == SIM_CMD) {
+			sim_delay_ns((uint64_t)cmds[n].arg * 1000);
+			cmds[n].res = 0;
+		} else {
+			cmds[n].res = cmd_exec(&cmds[n]);
+		}
+		rc = cmds[n].res;
+		if (!rc)
+			batch->done++;
+	}
+
+	for (k = SIM_CMD - 1; k >= 0; k--) {
+		for (i = SIM_MAX_DEVS - 1; i >= 0; i--) {
+			if (used[k][i])
+				pthread_mutex_unlock(&state->devs[k][i].lock);
+		}
+	}
+	return rc;
+}
+
+/* ==================================================================
+ 		Intercepted calls
+   ================================================================== */
+
+static int sim_open(const char *path, int flags, mode_t mode, int dirfd, int at) {
+	struct sim_file *f;
+	unsigned int idx;
+	int kind, fd;
+
+	sim_resolve();
+	kind = sim_match(path, &idx);
+	if (kind < 0) {
+		if (at)
+			return real_openat(dirfd, path, flags, mode);
+		return real_open(path, flags, mode);
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (kind == SIM_SW)
+		fd = eventfd(0, (flags & O_NONBLOCK ? EFD_NONBLOCK : 0) | (flags & O_CLOEXEC ? EFD_CLOEXEC : 0));
+	else
+		fd = real_open("/dev/null", (flags & (O_ACCMODE | O_NONBLOCK | O_CLOEXEC)) | O_NOCTTY);
+	if (fd < 0 || fd >= SIM_MAX_FDS) {
+		if (fd >= 0)
+			real_close(fd);
+		free(f);
+		errno = fd < 0 ? errno : EMFILE;
+		return -1;
+	}
+
+	f->kind = kind;
+	f->idx = idx;
+	f->accmode = flags & O_ACCMODE;
+	f->nonblock = (flags & O_NONBLOCK) != 0;
+	f->can_write = conf.cap;
+	f->fd = fd;
+
+	/* Changes before the open are not reported */
+	if (kind == SIM_SW) {
+		pthread_mutex_lock(&state->devs[SIM_SW][idx].ev_lock);
+		f->seen = state->devs[SIM_SW][idx].ev.seq;
+		pthread_mutex_unlock(&state->devs[SIM_SW][idx].ev_lock);
+		sw_watch_start();
+	}
+
+	pthread_mutex_lock(&files_lock);
+	free(files[fd]);
+	files[fd] = f;
+	pthread_mutex_unlock(&files_lock);
+	return fd;
+}
+
+int open(const char *path, int flags, ...) {
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return sim_open(path, flags, mode, AT_FDCWD, 0);
+}
+int open64(const char *path, int flags, ...) __attribute__((alias("open")));
+
+int openat(int dirfd, const char *path, int flags, ...) {
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return sim_open(path, flags, mode, dirfd, 1);
+}
+int openat64(int dirfd, const char *path, int flags, ...) __attribute__((alias("openat")));
+
+/* Fortified variants (_FORTIFY_SOURCE) */
+int __open_2(const char *path, int flags) {
+	return sim_open(path, flags, 0, AT_FDCWD, 0);
+}
+int __open64_2(const char *path, int flags) __attribute__((alias("__open_2")));
+
+int close(int fd) {
+	struct sim_file *f = sim_file(fd);
+
+	sim_resolve();
+	if (f != NULL) {
+		pthread_mutex_lock(&files_lock);
+		files[fd] = NULL;
+		pthread_mutex_unlock(&files_lock);
+		free(f);
+	}
+	return real_close(fd);
+}
+
+static ssize_t sim_read(struct sim_file *f, void *buf, size_t count) {
+	sim_delay_ns(conf.call_ns);
+	if (f->accmode == O_WRONLY)
+		return sim_ret(-EBADF);
+
+	switch (f->kind) {
+	case SIM_RGB:
+		return sim_ret(rgb_read(f, buf, count));
+	case SIM_SW:
+		return sim_ret(sw_read(f, buf, count));
+	case SIM_LED:
+		/* End of file, nothing can be read */
+		return 0;
+	default:
+		return sim_ret(-EINVAL);
+	}
+}
+
+static ssize_t sim_write(struct sim_file *f, const void *buf, size_t count) {
+	sim_delay_ns(conf.call_ns);
+	if (f->accmode == O_RDONLY)
+		return sim_ret(-EBADF);
+
+	switch (f->kind) {
+	case SIM_LED:
+		return sim_ret(led_write(f, buf, count));
+	case SIM_RGB:
+		return sim_ret(rgb_write(f, buf, count));
+	default:
+		return sim_ret(-EINVAL);
+	}
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+	struct sim_file *f = sim_file(fd);
+
+	sim_resolve();
+	if (f == NULL)
+		return real_read(fd, buf, count);
+	return sim_read(f, buf, count);
+}
+
+ssize_t __read_chk(int fd, void *buf, size_t count, size_t buflen) {
+	if (count > buflen)
+		abort();
+	return read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+	struct sim_file *f = sim_file(fd);
+
+	sim_resolve();
+	if (f == NULL)
+		return real_write(fd, buf, count);
+	return sim_write(f, buf, count);
+}
+
+/* Drivers get the given offset instead of the file position (the position isn't changed) */
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+	struct sim_file *f = sim_file(fd);
+	off_t pos;
+	ssize_t rc;
+
+	sim_resolve();
+	if (f == NULL)
+		return real_pread(fd, buf, count, offset);
+	if (offset < 0)
+		return sim_ret(-EINVAL);
+
+	pos = f->pos;
+	f->pos = offset;
+	rc = sim_read(f, buf, count);
+	f->pos = pos;
+	return rc;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+	struct sim_file *f = sim_file(fd);
+	off_t pos;
+	ssize_t rc;
+
+	sim_resolve();
+	if (f == NULL)
+		return real_pwrite(fd, buf, count, offset);
+	if (offset < 0)
+		return sim_ret(-EINVAL);
+
+	pos = f->pos;
+	f->pos = offset;
+	rc = sim_write(f, buf, count);
+	f->pos = pos;
+	return rc;
+}
+
+/* Drivers return the new offset without changing the file position, the LED and RGB
+ * devices are reset */
+off_t lseek(int fd, off_t offset, int whence) {
+	struct sim_file *f = sim_file(fd);
+	struct sim_dev *dev;
+	long rc;
+
+	sim_resolve();
+	if (f == NULL)
+		return real_lseek(fd, offset, whence);
+	sim_delay_ns(conf.call_ns);
+	if (f->kind == SIM_CMD)
+		return sim_ret(-ESPIPE);
+
+	dev = sim_dev(f);
+	rc = sim_down(dev, f->nonblock);
+	if (rc)
+		return sim_ret(rc);
+	sim_latency();
+
+	if (f->kind == SIM_LED) {
+		led_write_data(f, dev, dev->init);
+	} else if (f->kind == SIM_RGB) {
+		rgb_set_config(f, dev, 0, 0, 0);
+		memset(f->wr_buf, 0, sizeof(f->wr_buf));
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		rc = offset;
+		break;
+	case SEEK_CUR:
+		rc = f->pos + offset;
+		break;
+	default:
+		rc = -EINVAL;
+		break;
+	}
+
+	sim_up(dev);
+	return sim_ret(rc);
+}
+
+int ioctl(int fd, unsigned long cmd, ...) {
+	struct sim_file *f;
+	unsigned long arg;
+	va_list ap;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	sim_resolve();
+	f = sim_file(fd);
+	if (f == NULL)
+		return real_ioctl(fd, cmd, arg);
+	sim_delay_ns(conf.call_ns);
+
+	switch (f->kind) {
+	case SIM_LED:
+		return sim_ret(led_ioctl(f, cmd, arg));
+	case SIM_RGB:
+		return sim_ret(rgb_ioctl(f, cmd, arg));
+	case SIM_SW:
+		return sim_ret(sw_ioctl(f, cmd, arg));
+	default:
+		if (cmd == PB_ZYBO_CMD_IOCTL_SUBMIT)
+			return sim_ret(cmd_submit(f, (struct pb_zybo_cmd_batch *)arg));
+		/* Reaction rules are not simulated */
+		return sim_ret(-ENOTTY);
+	}
+}
+
+/* Simulated nodes are character devices, the minor number is the instance index */
+int stat(const char *path, struct stat *st) {
+	unsigned int idx;
+	int kind;
+
+	sim_resolve();
+	kind = sim_match(path, &idx);
+	if (kind < 0)
+		return real_stat(path, st);
+	sim_fill_stat(kind, idx, st);
+	return 0;
+}
+
+int fstat(int fd, struct stat *st) {
+	struct sim_file *f = sim_file(fd);
+
+	sim_resolve();
+	if (f == NULL)
+		return real_fstat(fd, st);
+	sim_fill_stat(f->kind, f->idx, st);
+	return 0;
+}
+
+/* Stat calls of glibc older than 2.33 */
+int __xstat(int ver, const char *path, struct stat *st) {
+	unsigned int idx;
+	int kind;
+
+	sim_resolve();
+	kind = sim_match(path, &idx);
+	if (kind < 0)
+		return real_xstat(ver, path, st);
+	sim_fill_stat(kind, idx, st);
+	return 0;
+}
+
+int __fxstat(int ver, int fd, struct stat *st) {
+	struct sim_file *f = sim_file(fd);
+
+	sim_resolve();
+	if (f == NULL)
+		return real_fxstat(ver, fd, st);
+	sim_fill_stat(f->kind, f->idx, st);
+	return 0;
+}
+
+/* The 64-bit variants have the same layout on 64-bit hosts */
+#if defined(__LP64__)
+ssize_t pread64(int fd, void *buf, size_t count, off_t offset) __attribute__((alias("pread")));
+ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset) __attribute__((alias("pwrite")));
+off_t lseek64(int fd, off_t offset, int whence) __attribute__((alias("lseek")));
+int stat64(const char *path, struct stat64 *st) {
+	return stat(path, (struct stat *)st);
+}
+
+int fstat64(int fd, struct stat64 *st) {
+	return fstat(fd, (struct stat *)st);
+}
+
+int __xstat64(int ver, const char *path, struct stat *st) __attribute__((alias("__xstat")));
+int __fxstat64(int ver, int fd, struct stat *st) __attribute__((alias("__fxstat")));
+#endif
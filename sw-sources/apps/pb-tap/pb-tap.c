@@ -0,0 +1,838 @@
+/*  pb-tap.c - TAP test harness of the LED, RGB LED and switch drivers with performance baselines
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+
+/* IOCTL handlers of drivers */
+#include "pb-zybo-ioctl.h"
+
+#define DEFAULT_BASELINE "/usr/share/pb-tap/baseline.txt"
+#define DEFAULT_ITERATIONS 20000
+#define DEFAULT_WARMUP 1000
+#define DEFAULT_REPEATS 3
+#define DEFAULT_THR_PCT 25     /* Allowed drop of ops/s and rise of p50 */
+#define DEFAULT_TAIL_PCT 100   /* Allowed rise of p99 */
+
+/* Format version of the baseline file */
+#define BASELINE_VERSION 1
+#define BASELINE_MAX 256
+#define NAME_LEN 64
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+/* Default values of drivers, checks and measured setters keep them */
+#define LED_DEFAULT_MASK 0xf
+#define SW_DEFAULT_MASK 0xf
+#define RGB_DEFAULT_PERIOD 4096
+
+enum tap_dev {
+    DEV_LED = 0,
+    DEV_RGB,
+    DEV_SW,
+    DEV_COUNT
+};
+
+static const char *dev_names[DEV_COUNT] = { "led", "rgb", "switch" };
+
+struct tap_conf {
+    const char *paths[DEV_COUNT];
+    const char *baseline;
+    const char *board;
+    const char *sim;            /* Simulator library (LD_PRELOAD) */
+    unsigned long iterations;
+    unsigned long warmup;
+    unsigned int repeats;
+    unsigned int thr_pct;
+    unsigned int tail_pct;
+    int update;                 /* Store results as the new baseline */
+    int no_perf;                /* Functional checks only */
+};
+
+/* Result of one measured operation (or the baseline) */
+struct perf_res {
+    char board[NAME_LEN];
+    char op[NAME_LEN];
+    double ops_per_s;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+};
+
+/* TAP state - test numbers and failures */
+static unsigned int tap_num;
+static unsigned int tap_failed;
+
+/* Device descriptors, -1 iff the device is missing */
+static int dev_fd[DEV_COUNT] = { -1, -1, -1 };
+
+/* ==================================================================
+ 		TAP output
+   ================================================================== */
+
+/**
+ * @brief Print the test result line, the description is the printf format
+ *
+ * @param ok Test result
+ */
+static void tap_result(int ok, const char *fmt, ...) {
+    va_list ap;
+
+    tap_num++;
+    if (!ok) {
+        tap_failed++;
+    }
+
+    printf("%s %u - ", ok ? "ok" : "not ok", tap_num);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+static void tap_skip(const char *name, const char *reason) {
+    tap_num++;
+    printf("ok %u - %s # SKIP %s\n", tap_num, name, reason);
+}
+
+/* Diagnostic line (ignored by TAP consumers) */
+static void tap_diag(const char *fmt, ...) {
+    va_list ap;
+
+    printf("# ");
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+/* ==================================================================
+ 		Functional checks (from ledmodule-test, rgb-led-test and switchmodule-test)
+   ================================================================== */
+
+/* One functional check - returns NULL iff passed, otherwise the reason */
+struct tap_check {
+    const char *name;
+    enum tap_dev dev;
+    const char *(*run)(int fd);
+};
+
+static const char *check_led_init(int fd) {
+    int val = 0;
+
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_SET_INIT, 0xf)) {
+        return strerror(errno);
+    }
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_GET_INIT, &val)) {
+        return strerror(errno);
+    }
+    ioctl(fd, PB_ZYBO_LED_IOCTL_SET_INIT, 0);
+    return val == 0xf ? NULL : "read init value differs";
+}
+
+static const char *check_led_mask(int fd) {
+    int val = 0;
+
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_SET_MASK, 0x3)) {
+        return strerror(errno);
+    }
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_GET_MASK, &val)) {
+        return strerror(errno);
+    }
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_SET_MASK, LED_DEFAULT_MASK)) {
+        return strerror(errno);
+    }
+    return val == 0x3 ? NULL : "read mask value differs";
+}
+
+static const char *check_led_values(int fd) {
+    static const int values[] = { 2, 1, 3, 4, 5, 0 };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        if (ioctl(fd, PB_ZYBO_LED_IOCTL_SET_VALUE, values[i])) {
+            return strerror(errno);
+        }
+    }
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_RESET) ? strerror(errno) : NULL;
+}
+
+static const char *check_led_write(int fd) {
+    static const char text[] = "abc13302";
+    ssize_t rc = write(fd, text, sizeof(text) - 1);
+
+    if (rc < 0) {
+        return strerror(errno);
+    }
+    ioctl(fd, PB_ZYBO_LED_IOCTL_RESET);
+    return rc == sizeof(text) - 1 ? NULL : "short write";
+}
+
+static const char *check_rgb_val(int fd) {
+    static const __u32 colors[] = { 0xFF00FF, 0xFF0000, 0x0000FF, 0x00FF00 };
+    __u32 val;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(colors) / sizeof(colors[0]); i++) {
+        if (ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_VAL, &colors[i]) || ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &val)) {
+            return strerror(errno);
+        }
+        if (val != colors[i]) {
+            return "read color differs";
+        }
+    }
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_INIT, 0) ? strerror(errno) : NULL;
+}
+
+static const char *check_rgb_period(int fd) {
+    const __u32 ref = 8192;
+    const __u32 def = RGB_DEFAULT_PERIOD;
+    __u32 val = 0;
+
+    if (ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &ref) || ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_PERIOD, &val)) {
+        return strerror(errno);
+    }
+    if (ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &def)) {
+        return strerror(errno);
+    }
+    return val == ref ? NULL : "read period differs";
+}
+
+static const char *check_rgb_text(int fd) {
+    static const char text[] = "0xff 0x00 0x00\n";
+    char buf[64];
+    unsigned int r, g, b;
+    __u32 val = 0;
+    ssize_t rc;
+
+    rc = pwrite(fd, text, sizeof(text) - 1, 0);
+    if (rc != sizeof(text) - 1) {
+        return rc < 0 ? strerror(errno) : "short write";
+    }
+    if (ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &val)) {
+        return strerror(errno);
+    }
+    if (val != 0xff0000) {
+        return "written color differs";
+    }
+
+    rc = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (rc <= 0) {
+        return rc < 0 ? strerror(errno) : "empty read";
+    }
+    buf[rc] = '\0';
+    if (sscanf(buf, "%x %x %x", &r, &g, &b) != 3 || r != 0xff || g != 0 || b != 0) {
+        return "read text differs";
+    }
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_INIT, 0) ? strerror(errno) : NULL;
+}
+
+static const char *check_rgb_short_text(int fd) {
+    static const char text[] = "0xff 0x00\n";
+
+    /* The seek clears the text collected by the file (and initializes the device) */
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        return strerror(errno);
+    }
+    if (pwrite(fd, text, sizeof(text) - 1, 0) >= 0) {
+        return "short text accepted";
+    }
+    return errno == EINVAL ? NULL : strerror(errno);
+}
+
+static const char *check_sw_mask(int fd) {
+    __u32 val = 0;
+
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_SET_MASK, 0x2) || ioctl(fd, PB_ZYBO_SW_IOCTL_GET_MASK, &val)) {
+        return strerror(errno);
+    }
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_SET_MASK, SW_DEFAULT_MASK)) {
+        return strerror(errno);
+    }
+    return val == 0x2 ? NULL : "read mask value differs";
+}
+
+static const char *check_sw_value(int fd) {
+    char buf[16];
+    __u32 val = 0;
+    ssize_t rc;
+
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &val)) {
+        return strerror(errno);
+    }
+    if (val & ~SW_DEFAULT_MASK) {
+        return "value out of the mask";
+    }
+
+    rc = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (rc <= 0) {
+        return rc < 0 ? strerror(errno) : "empty read";
+    }
+    buf[rc] = '\0';
+    return (unsigned long)atoi(buf) <= SW_DEFAULT_MASK ? NULL : "read text out of the mask";
+}
+
+/* The LED call on the switch device has to be rejected (own 'z' range of each driver) */
+static const char *check_sw_wrong_ioctl(int fd) {
+    if (ioctl(fd, PB_ZYBO_LED_IOCTL_RESET) == 0) {
+        return "LED IOCTL accepted";
+    }
+    return errno == ENOTTY ? NULL : strerror(errno);
+}
+
+static const struct tap_check tap_checks[] = {
+    { "led init set/get",           DEV_LED, check_led_init },
+    { "led mask set/get",           DEV_LED, check_led_mask },
+    { "led set values and reset",   DEV_LED, check_led_values },
+    { "led text write",             DEV_LED, check_led_write },
+    { "rgb color set/get",          DEV_RGB, check_rgb_val },
+    { "rgb period set/get",         DEV_RGB, check_rgb_period },
+    { "rgb text write/read",        DEV_RGB, check_rgb_text },
+    { "rgb short text rejected",    DEV_RGB, check_rgb_short_text },
+    { "switch mask set/get",        DEV_SW,  check_sw_mask },
+    { "switch value read",          DEV_SW,  check_sw_value },
+    { "switch rejects LED IOCTL",   DEV_SW,  check_sw_wrong_ioctl },
+};
+
+#define TAP_CHECKS (sizeof(tap_checks) / sizeof(tap_checks[0]))
+
+/* ==================================================================
+ 		Measured operations
+   ================================================================== */
+
+/* One measured operation - returns 0 on success */
+struct perf_op {
+    const char *name;
+    enum tap_dev dev;
+    int (*run)(int fd, unsigned long i);
+};
+
+static int op_led_set_value(int fd, unsigned long i) {
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_SET_VALUE, i & 0xf);
+}
+
+static int op_led_get_mask(int fd, unsigned long i) {
+    int val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_LED_IOCTL_GET_MASK, &val);
+}
+
+static int op_led_write(int fd, unsigned long i) {
+    char c = '0' + (i & 0xf);
+    return write(fd, &c, 1) == 1 ? 0 : -1;
+}
+
+static int op_rgb_set_val(int fd, unsigned long i) {
+    __u32 val = (i & 1) ? 0x004000 : 0x000040;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_VAL, &val);
+}
+
+static int op_rgb_get_val(int fd, unsigned long i) {
+    __u32 val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &val);
+}
+
+static int op_rgb_write(int fd, unsigned long i) {
+    static const char *colors[] = { "0x00 0x40 0x00\n", "0x00 0x00 0x40\n" };
+    const char *c = colors[i & 1];
+    ssize_t len = strlen(c);
+    return pwrite(fd, c, len, 0) == len ? 0 : -1;
+}
+
+static int op_rgb_read(int fd, unsigned long i) {
+    char buf[64];
+    (void)i;
+    return pread(fd, buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+static int op_sw_get_value(int fd, unsigned long i) {
+    __u32 val;
+    (void)i;
+    return ioctl(fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &val);
+}
+
+static int op_sw_read(int fd, unsigned long i) {
+    char buf[8];
+    (void)i;
+    return pread(fd, buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+/* Operations on the control path of applications, names match pb-bench */
+static const struct perf_op perf_ops[] = {
+    { "led_set_value",  DEV_LED, op_led_set_value },
+    { "led_get_mask",   DEV_LED, op_led_get_mask },
+    { "led_write",      DEV_LED, op_led_write },
+    { "rgb_set_val",    DEV_RGB, op_rgb_set_val },
+    { "rgb_get_val",    DEV_RGB, op_rgb_get_val },
+    { "rgb_write",      DEV_RGB, op_rgb_write },
+    { "rgb_read",       DEV_RGB, op_rgb_read },
+    { "sw_get_value",   DEV_SW,  op_sw_get_value },
+    { "sw_read",        DEV_SW,  op_sw_read },
+};
+
+#define PERF_OPS (sizeof(perf_ops) / sizeof(perf_ops[0]))
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/* Nearest-rank percentile of the sorted array */
+static uint64_t percentile(const uint64_t *sorted, unsigned long n, double p) {
+    unsigned long idx = (unsigned long)(p * n + 0.999999);
+    return sorted[idx > 0 ? idx - 1 : 0];
+}
+
+/**
+ * @brief Measure the operation - the best of repeated runs is taken, so a short
+ * disturbance of the system doesn't fail the gate
+ *
+ * @return int RET_OK iff all calls passed
+ */
+static int perf_measure(const struct tap_conf *conf, const struct perf_op *op, uint64_t *lat,
+    struct perf_res *res) {
+    unsigned long i;
+    unsigned int r;
+    uint64_t start, t;
+
+    memset(res, 0, sizeof(*res));
+    snprintf(res->op, NAME_LEN, "%s", op->name);
+
+    for (i = 0; i < conf->warmup; i++) {
+        if (op->run(dev_fd[op->dev], i)) {
+            return RET_ERR;
+        }
+    }
+
+    for (r = 0; r < conf->repeats; r++) {
+        double ops_per_s;
+
+        start = now_ns();
+        for (i = 0; i < conf->iterations; i++) {
+            t = now_ns();
+            if (op->run(dev_fd[op->dev], i)) {
+                return RET_ERR;
+            }
+            lat[i] = now_ns() - t;
+        }
+        ops_per_s = conf->iterations / ((now_ns() - start) / 1e9);
+        if (ops_per_s <= res->ops_per_s) {
+            continue;
+        }
+
+        qsort(lat, conf->iterations, sizeof(uint64_t), cmp_u64);
+        res->ops_per_s = ops_per_s;
+        res->p50_ns = percentile(lat, conf->iterations, 0.50);
+        res->p99_ns = percentile(lat, conf->iterations, 0.99);
+        res->p999_ns = percentile(lat, conf->iterations, 0.999);
+    }
+    return RET_OK;
+}
+
+/* ==================================================================
+ 		Baseline file
+   ================================================================== */
+
+/**
+ * @brief Load the baseline file - lines "<board> <op> <ops/s> <p50> <p99> <p999>" (ns),
+ * the first line which isn't a comment is "version <n>"
+ *
+ * @return int Number of loaded entries or -1 (missing file is an empty baseline)
+ */
+static int baseline_load(const char *path, struct perf_res *base, int max) {
+    char line[256];
+    int cnt = 0, version = -1;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        struct perf_res *b = &base[cnt];
+
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (version < 0) {
+            if (sscanf(line, "version %d", &version) != 1 || version != BASELINE_VERSION) {
+                tap_diag("Unsupported baseline format in %s (expected version %d)", path, BASELINE_VERSION);
+                fclose(f);
+                return -1;
+            }
+            continue;
+        }
+        if (cnt >= max) {
+            break;
+        }
+        if (sscanf(line, "%63s %63s %lf %lu %lu %lu", b->board, b->op, &b->ops_per_s,
+                (unsigned long *)&b->p50_ns, (unsigned long *)&b->p99_ns, (unsigned long *)&b->p999_ns) == 6) {
+            cnt++;
+        }
+    }
+    fclose(f);
+    return cnt;
+}
+
+static const struct perf_res *baseline_find(const struct perf_res *base, int cnt, const char *board,
+    const char *op) {
+    int i;
+
+    for (i = 0; i < cnt; i++) {
+        if (strcmp(base[i].board, board) == 0 && strcmp(base[i].op, op) == 0) {
+            return &base[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Store the baseline file - entries of other boards are kept, entries of the board
+ * are replaced by the results
+ *
+ * @return int RET_OK iff the file was written
+ */
+static int baseline_store(const char *path, const char *board, const struct perf_res *base, int cnt,
+    const struct perf_res *res, int res_cnt) {
+    struct utsname un;
+    char tmp[512];
+    time_t now = time(NULL);
+    FILE *f;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        return RET_ERR;
+    }
+
+    uname(&un);
+    fprintf(f, "# Performance baselines of pb-tap, one line per board and operation:\n");
+    fprintf(f, "# <board> <operation> <ops/s> <p50 ns> <p99 ns> <p999 ns>\n");
+    fprintf(f, "version %d\n", BASELINE_VERSION);
+    for (i = 0; i < cnt; i++) {
+        if (strcmp(base[i].board, board) == 0) {
+            continue;
+        }
+        fprintf(f, "%s %s %.0f %lu %lu %lu\n", base[i].board, base[i].op, base[i].ops_per_s,
+            (unsigned long)base[i].p50_ns, (unsigned long)base[i].p99_ns, (unsigned long)base[i].p999_ns);
+    }
+    fprintf(f, "# %s: kernel %s, %s", board, un.release, ctime(&now));
+    for (i = 0; i < res_cnt; i++) {
+        fprintf(f, "%s %s %.0f %lu %lu %lu\n", board, res[i].op, res[i].ops_per_s,
+            (unsigned long)res[i].p50_ns, (unsigned long)res[i].p99_ns, (unsigned long)res[i].p999_ns);
+    }
+
+    if (fclose(f) || rename(tmp, path)) {
+        unlink(tmp);
+        return RET_ERR;
+    }
+    return RET_OK;
+}
+
+/* ==================================================================
+ 		Harness
+   ================================================================== */
+
+static void print_help() {
+    printf("TAP test harness of the LED, RGB LED and switch drivers. Functional checks are followed by\n");
+    printf("performance checks which fail when the operation is slower than the stored baseline of the board.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-l = LED device (default %s-0)\n", PB_ZYBO_LED_DEV_PREFIX);
+    printf("\t-r = RGB LED device (default %s-0)\n", PB_ZYBO_RGB_DEV_PREFIX);
+    printf("\t-s = switch device (default %s-0)\n", PB_ZYBO_SW_DEV_PREFIX);
+    printf("\t-b = baseline file (default %s)\n", DEFAULT_BASELINE);
+    printf("\t-B = board name in the baseline (default from the device tree model or the host name)\n");
+    printf("\t-u = store results as the new baseline of the board\n");
+    printf("\t-t = allowed drop of ops/s and rise of the p50 latency in %% (default %d)\n", DEFAULT_THR_PCT);
+    printf("\t-T = allowed rise of the p99 latency in %% (default %d)\n", DEFAULT_TAIL_PCT);
+    printf("\t-n = number of measured operations (default %d)\n", DEFAULT_ITERATIONS);
+    printf("\t-R = number of measurement repeats, the best is taken (default %d)\n", DEFAULT_REPEATS);
+    printf("\t-S = run against the device simulator library (e.g. ../pb-sim/libpbsim.so), the board is pb-sim\n");
+    printf("\t-F = functional checks only\n");
+    return;
+}
+
+/**
+ * @brief Board name - the device tree model (spaces are replaced) or the host name
+ *
+ * @return int RET_OK or RET_ERR iff the host name doesn't fit into the baseline field
+ */
+static int board_name(char *name, size_t len) {
+    struct utsname un;
+    FILE *f;
+    size_t i;
+
+    name[0] = '\0';
+    f = fopen("/proc/device-tree/model", "r");
+    if (f) {
+        if (!fgets(name, len, f)) {
+            name[0] = '\0';
+        }
+        fclose(f);
+    }
+    if (name[0] == '\0' && uname(&un) == 0) {
+        if (snprintf(name, len, "%s", un.nodename) >= (int)len) {
+            return RET_ERR;
+        }
+    }
+
+    for (i = 0; name[i]; i++) {
+        if (isspace((unsigned char)name[i])) {
+            name[i] = '-';
+        }
+    }
+    return RET_OK;
+}
+
+/**
+ * @brief Restart the harness with the simulator library preloaded
+ *
+ */
+static int exec_sim(const char *lib, char **argv) {
+    char path[4096];
+
+    if (getenv("PB_TAP_SIM")) {
+        return RET_OK;
+    }
+    if (!realpath(lib, path)) {
+        printf("Bail out! Simulator library %s is missing\n", lib);
+        return RET_ERR;
+    }
+
+    setenv("LD_PRELOAD", path, 1);
+    setenv("PB_TAP_SIM", "1", 1);
+    execv("/proc/self/exe", argv);
+    printf("Bail out! Unable to start the harness with the simulator (%s)\n", strerror(errno));
+    return RET_ERR;
+}
+
+static void run_checks(void) {
+    unsigned int i;
+
+    for (i = 0; i < TAP_CHECKS; i++) {
+        const struct tap_check *c = &tap_checks[i];
+        const char *err;
+
+        if (dev_fd[c->dev] < 0) {
+            tap_skip(c->name, "device is missing");
+            continue;
+        }
+        err = c->run(dev_fd[c->dev]);
+        if (err) {
+            tap_result(0, "%s (%s)", c->name, err);
+        } else {
+            tap_result(1, "%s", c->name);
+        }
+    }
+}
+
+/* Compare the result with the baseline, the YAML block describes the failure */
+static void perf_gate(const struct tap_conf *conf, const struct perf_res *res, const struct perf_res *b) {
+    double min_ops = b->ops_per_s * (100 - conf->thr_pct) / 100.0;
+    double max_p50 = b->p50_ns * (100 + conf->thr_pct) / 100.0;
+    double max_p99 = b->p99_ns * (100 + conf->tail_pct) / 100.0;
+    const char *reason = NULL;
+
+    if (res->ops_per_s < min_ops) {
+        reason = "throughput";
+    } else if (res->p50_ns > max_p50) {
+        reason = "p50 latency";
+    } else if (res->p99_ns > max_p99) {
+        reason = "p99 latency";
+    }
+
+    if (reason) {
+        tap_result(0, "perf %s (%s regression)", res->op, reason);
+    } else {
+        tap_result(1, "perf %s", res->op);
+    }
+    printf("  ---\n");
+    printf("  ops_per_s: %.0f\n", res->ops_per_s);
+    printf("  baseline_ops_per_s: %.0f\n", b->ops_per_s);
+    printf("  change_pct: %+.1f\n", (res->ops_per_s / b->ops_per_s - 1) * 100);
+    printf("  p50_ns: [%lu, %lu]\n", (unsigned long)res->p50_ns, (unsigned long)b->p50_ns);
+    printf("  p99_ns: [%lu, %lu]\n", (unsigned long)res->p99_ns, (unsigned long)b->p99_ns);
+    printf("  p999_ns: [%lu, %lu]\n", (unsigned long)res->p999_ns, (unsigned long)b->p999_ns);
+    printf("  ...\n");
+}
+
+static int run_perf(const struct tap_conf *conf) {
+    static struct perf_res base[BASELINE_MAX];
+    struct perf_res res[PERF_OPS];
+    int base_cnt, res_cnt = 0;
+    uint64_t *lat;
+    unsigned int i;
+
+    base_cnt = baseline_load(conf->baseline, base, BASELINE_MAX);
+    if (base_cnt < 0) {
+        tap_result(0, "baseline %s can be loaded", conf->baseline);
+        return RET_ERR;
+    }
+    tap_diag("Board %s, %d baseline entries in %s", conf->board, base_cnt, conf->baseline);
+
+    lat = malloc(conf->iterations * sizeof(uint64_t));
+    if (!lat) {
+        printf("Bail out! Unable to allocate latency buffers\n");
+        return RET_ERR;
+    }
+
+    for (i = 0; i < PERF_OPS; i++) {
+        const struct perf_op *op = &perf_ops[i];
+        const struct perf_res *b;
+
+        if (dev_fd[op->dev] < 0) {
+            tap_skip(op->name, "device is missing");
+            continue;
+        }
+        if (perf_measure(conf, op, lat, &res[res_cnt])) {
+            tap_result(0, "perf %s (%s)", op->name, strerror(errno));
+            continue;
+        }
+
+        b = baseline_find(base, base_cnt, conf->board, op->name);
+        if (conf->update || !b) {
+            tap_skip(op->name, conf->update ? "recording the baseline" : "no baseline for the board");
+            tap_diag("%s: %.0f ops/s, p50 %lu ns, p99 %lu ns, p999 %lu ns", op->name, res[res_cnt].ops_per_s,
+                (unsigned long)res[res_cnt].p50_ns, (unsigned long)res[res_cnt].p99_ns,
+                (unsigned long)res[res_cnt].p999_ns);
+        } else {
+            perf_gate(conf, &res[res_cnt], b);
+        }
+        res_cnt++;
+    }
+    free(lat);
+
+    if (conf->update) {
+        int rc = baseline_store(conf->baseline, conf->board, base, base_cnt, res, res_cnt);
+        tap_result(rc == RET_OK, "baseline of %s stored to %s", conf->board, conf->baseline);
+    }
+    return RET_OK;
+}
+
+int main(int argc, char **argv) {
+    struct tap_conf conf = {
+        .paths = {
+            PB_ZYBO_LED_DEV_PREFIX "-0",
+            PB_ZYBO_RGB_DEV_PREFIX "-0",
+            PB_ZYBO_SW_DEV_PREFIX "-0",
+        },
+        .baseline = DEFAULT_BASELINE,
+        .iterations = DEFAULT_ITERATIONS,
+        .warmup = DEFAULT_WARMUP,
+        .repeats = DEFAULT_REPEATS,
+        .thr_pct = DEFAULT_THR_PCT,
+        .tail_pct = DEFAULT_TAIL_PCT,
+    };
+    char board[NAME_LEN];
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hl:r:s:b:B:ut:T:n:R:S:F")) != -1) {
+        switch (opt) {
+            case 'h' : print_help(); return RET_OK;
+            case 'l' : conf.paths[DEV_LED] = optarg; break;
+            case 'r' : conf.paths[DEV_RGB] = optarg; break;
+            case 's' : conf.paths[DEV_SW] = optarg; break;
+            case 'b' : conf.baseline = optarg; break;
+            case 'B' : conf.board = optarg; break;
+            case 'u' : conf.update = 1; break;
+            case 't' : conf.thr_pct = strtoul(optarg, NULL, 0); break;
+            case 'T' : conf.tail_pct = strtoul(optarg, NULL, 0); break;
+            case 'n' : conf.iterations = strtoul(optarg, NULL, 0); break;
+            case 'R' : conf.repeats = strtoul(optarg, NULL, 0); break;
+            case 'S' : conf.sim = optarg; break;
+            case 'F' : conf.no_perf = 1; break;
+            default:
+                print_help();
+                return RET_ERR;
+        }
+    }
+
+    if (conf.iterations == 0 || conf.repeats == 0 || conf.thr_pct >= 100) {
+        printf("Invalid number of iterations, repeats or threshold\n");
+        return RET_ERR;
+    }
+    if (conf.board && strlen(conf.board) >= NAME_LEN) {
+        printf("The board name is longer than %d characters\n", NAME_LEN - 1);
+        return RET_ERR;
+    }
+    if (conf.sim && exec_sim(conf.sim, argv)) {
+        return RET_ERR;
+    }
+    if (!conf.board) {
+        if (conf.sim) {
+            conf.board = "pb-sim";
+        } else {
+            if (board_name(board, sizeof(board))) {
+                printf("The host name is longer than %d characters, select the board name (-B)\n", NAME_LEN - 1);
+                return RET_ERR;
+            }
+            conf.board = board;
+        }
+    }
+
+    /* Line buffered output, so the TAP stream isn't mixed with messages of other processes */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("TAP version 13\n");
+    for (i = 0; i < DEV_COUNT; i++) {
+        dev_fd[i] = open(conf.paths[i], O_RDWR);
+        tap_result(dev_fd[i] >= 0, "%s device %s opened", dev_names[i], conf.paths[i]);
+    }
+
+    run_checks();
+    if (!conf.no_perf) {
+        run_perf(&conf);
+    }
+
+    for (i = 0; i < DEV_COUNT; i++) {
+        if (dev_fd[i] >= 0) {
+            close(dev_fd[i]);
+        }
+    }
+
+    printf("1..%u\n", tap_num);
+    tap_diag("%u of %u tests failed", tap_failed, tap_num);
+    return tap_failed ? RET_ERR : RET_OK;
+}
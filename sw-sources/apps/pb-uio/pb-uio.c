@@ -0,0 +1,178 @@
+/*  pb-uio.c - User space access to PB Zybo register windows via UIO
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "pb-uio.h"
+
+#define UIO_SYSFS_PATH "/sys/class/uio"
+
+/* Read one number from the sysfs file */
+static int read_sysfs_ul(const char *path, unsigned long *val) {
+    FILE *f;
+    int ret;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    ret = fscanf(f, "%lx", val) == 1 ? 0 : -1;
+    fclose(f);
+    if (ret != 0)
+        errno = EINVAL;
+    return ret;
+}
+
+int pb_uio_find(unsigned long addr, char *path, size_t len) {
+    char attr[288];
+    struct dirent *de;
+    unsigned long map_addr;
+    DIR *dir;
+    int ret = -1;
+
+    dir = opendir(UIO_SYSFS_PATH);
+    if (dir == NULL)
+        return -1;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "uio", 3) != 0)
+            continue;
+
+        snprintf(attr, sizeof(attr), UIO_SYSFS_PATH "/%s/maps/map0/addr", de->d_name);
+        if (read_sysfs_ul(attr, &map_addr) != 0 || map_addr != addr)
+            continue;
+
+        snprintf(path, len, "/dev/%s", de->d_name);
+        ret = 0;
+        break;
+    }
+
+    closedir(dir);
+    if (ret != 0)
+        errno = ENODEV;
+    return ret;
+}
+
+int pb_uio_open_fd(struct pb_uio *u, int mem_fd, size_t size, off_t off, int irq_fd) {
+    void *regs;
+
+    regs = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, off);
+    if (regs == MAP_FAILED) {
+        close(mem_fd);
+        if (irq_fd >= 0 && irq_fd != mem_fd)
+            close(irq_fd);
+        return -1;
+    }
+
+    u->regs = regs;
+    u->size = size;
+    u->mem_fd = mem_fd;
+    u->irq_fd = irq_fd;
+    return 0;
+}
+
+int pb_uio_open(struct pb_uio *u, const char *path) {
+    char attr[288];
+    unsigned long size;
+    int fd;
+
+    /* The size of the first region is in sysfs (/sys/class/uio/uioN/maps/map0/size) */
+    snprintf(attr, sizeof(attr), UIO_SYSFS_PATH "/%s/maps/map0/size",
+        strncmp(path, "/dev/", 5) == 0 ? path + 5 : path);
+    if (read_sysfs_ul(attr, &size) != 0)
+        size = PB_UIO_WINDOW_SIZE;
+
+    fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* Region N of the UIO device is mapped at the offset N * page size, the UIO fd
+     * is used for the IRQ too */
+    return pb_uio_open_fd(u, fd, size, 0, fd);
+}
+
+void pb_uio_close(struct pb_uio *u) {
+    if (u->regs != NULL)
+        munmap((void *)u->regs, u->size);
+    if (u->irq_fd >= 0 && u->irq_fd != u->mem_fd)
+        close(u->irq_fd);
+    if (u->mem_fd >= 0)
+        close(u->mem_fd);
+    u->regs = NULL;
+    u->irq_fd = -1;
+    u->mem_fd = -1;
+}
+
+int pb_uio_irq_enable(const struct pb_uio *u) {
+    uint32_t unmask = 1;
+
+    if (u->irq_fd < 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (write(u->irq_fd, &unmask, sizeof(unmask)) != sizeof(unmask))
+        return -1;
+    return 0;
+}
+
+int pb_uio_irq_wait(const struct pb_uio *u, int timeout_ms, uint32_t *count) {
+    struct pollfd pfd;
+    uint32_t cnt;
+    int ret;
+
+    if (u->irq_fd < 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    pfd.fd = u->irq_fd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0)
+        return ret;
+
+    /* UIO devices without the IRQ return EIO here */
+    if (read(u->irq_fd, &cnt, sizeof(cnt)) != sizeof(cnt))
+        return -1;
+    if (count != NULL)
+        *count = cnt;
+    return 1;
+}
+
+uint32_t pb_uio_pwm_scale(uint32_t period, uint32_t val) {
+    uint32_t max_clk_cycles = period / PB_UIO_PWM_MAX_DIV;
+    return (max_clk_cycles / 256) * val;
+}
+
+void pb_uio_pwm_set_rgb(const struct pb_uio *u, uint32_t rgb, uint32_t period) {
+    pb_uio_pwm_set_duty(u, PB_UIO_PWM_B, pb_uio_pwm_scale(period, rgb & 0xff));
+    pb_uio_pwm_set_duty(u, PB_UIO_PWM_G, pb_uio_pwm_scale(period, (rgb >> 8) & 0xff));
+    pb_uio_pwm_set_duty(u, PB_UIO_PWM_R, pb_uio_pwm_scale(period, (rgb >> 16) & 0xff));
+    pb_uio_pwm_set_period(u, period);
+    pb_uio_pwm_enable(u, 1);
+}
@@ -0,0 +1,150 @@
+/*  pb-uio.h - User space access to PB Zybo register windows via UIO
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* Registers are accessed by plain loads and stores into the mapped window, only
+ * the open, close and IRQ calls enter the kernel. */
+
+#ifndef __PB_UIO_H__
+#define __PB_UIO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Physical addresses of register windows in the Zybo base design */
+#define PB_UIO_LED_ADDR			0x41210000UL
+#define PB_UIO_SW_ADDR			0x41200000UL
+#define PB_UIO_PWM_ADDR			0x42220000UL
+#define PB_UIO_WINDOW_SIZE		0x10000UL
+
+/* AXI GPIO registers (LEDs and switches) */
+#define PB_UIO_GPIO_DATA		0x000
+#define PB_UIO_GPIO_TRI			0x004
+#define PB_UIO_GPIO_GIER		0x11C
+#define PB_UIO_GPIO_ISR			0x120
+#define PB_UIO_GPIO_IER			0x128
+#define PB_UIO_GPIO_GIER_EN		0x80000000U
+#define PB_UIO_GPIO_CH1			0x1U
+
+/* PWM registers of the RGB LED (same layout as in rgb-led-module) */
+#define PB_UIO_PWM_CTRL			0x00
+#define PB_UIO_PWM_PERIOD		0x08
+#define PB_UIO_PWM_DUTY			0x40
+#define PB_UIO_PWM_DUTY_STRIDE	0x04
+#define PB_UIO_PWM_PERIOD_CLK	4096
+#define PB_UIO_PWM_MAX_DIV		8
+
+/* PWM channels - the duty registers are in the B, G, R order */
+enum pb_uio_pwm_ch {
+    PB_UIO_PWM_B = 0,
+    PB_UIO_PWM_G = 1,
+    PB_UIO_PWM_R = 2,
+};
+
+/**
+ * @brief Mapped register window
+ *
+ */
+struct pb_uio {
+    volatile uint32_t *regs;    /* Mapped registers */
+    size_t size;                /* Size of the mapping in bytes */
+    int irq_fd;                 /* UIO device (IRQ), -1 if not available */
+    int mem_fd;                 /* File descriptor of the mapping, -1 if it was closed */
+};
+
+/* Find /dev/uioN of the window with the given physical address (map0 in sysfs) */
+int pb_uio_find(unsigned long addr, char *path, size_t len);
+
+/* Open the UIO device (e.g. /dev/uio0) and map its first memory region */
+int pb_uio_open(struct pb_uio *u, const char *path);
+
+/* Map the window from any file (e.g. a memfd fake window). The irq_fd follows the UIO
+ * protocol (4-byte unmask writes and 4-byte count reads) or it is -1. The library takes
+ * both file descriptors. */
+int pb_uio_open_fd(struct pb_uio *u, int mem_fd, size_t size, off_t off, int irq_fd);
+
+void pb_uio_close(struct pb_uio *u);
+
+/* Unmask the IRQ and wait for it (timeout in ms, -1 = forever). Returns 1 and the
+ * total IRQ count on the IRQ, 0 on the timeout and -1 on the error (errno). */
+int pb_uio_irq_enable(const struct pb_uio *u);
+int pb_uio_irq_wait(const struct pb_uio *u, int timeout_ms, uint32_t *count);
+
+/* Scale the 8-bit color to the PWM duty cycle (the same as the kernel driver) */
+uint32_t pb_uio_pwm_scale(uint32_t period, uint32_t val);
+
+/* Set the 0xRRGGBB color with the given PWM period and enable the PWM */
+void pb_uio_pwm_set_rgb(const struct pb_uio *u, uint32_t rgb, uint32_t period);
+
+/* ==================================================================
+ 		Register accessors (no system calls)
+   ================================================================== */
+
+/* Order the register access with other memory accesses (the window is mapped uncached) */
+static inline void pb_uio_barrier(void) {
+    __sync_synchronize();
+}
+
+static inline uint32_t pb_uio_read32(const struct pb_uio *u, uint32_t off) {
+    return u->regs[off / sizeof(uint32_t)];
+}
+
+static inline void pb_uio_write32(const struct pb_uio *u, uint32_t off, uint32_t val) {
+    u->regs[off / sizeof(uint32_t)] = val;
+}
+
+/* AXI GPIO - LED value and switch value of the first channel */
+static inline uint32_t pb_uio_gpio_get(const struct pb_uio *u) {
+    return pb_uio_read32(u, PB_UIO_GPIO_DATA);
+}
+
+static inline void pb_uio_gpio_set(const struct pb_uio *u, uint32_t val) {
+    pb_uio_write32(u, PB_UIO_GPIO_DATA, val);
+}
+
+/* Enable the channel interrupt of the AXI GPIO (input change) */
+static inline void pb_uio_gpio_irq_setup(const struct pb_uio *u) {
+    pb_uio_write32(u, PB_UIO_GPIO_ISR, pb_uio_read32(u, PB_UIO_GPIO_ISR));
+    pb_uio_write32(u, PB_UIO_GPIO_IER, PB_UIO_GPIO_CH1);
+    pb_uio_write32(u, PB_UIO_GPIO_GIER, PB_UIO_GPIO_GIER_EN);
+}
+
+/* Acknowledge the channel interrupt (the ISR is toggle-on-write) */
+static inline void pb_uio_gpio_irq_ack(const struct pb_uio *u) {
+    pb_uio_write32(u, PB_UIO_GPIO_ISR, pb_uio_read32(u, PB_UIO_GPIO_ISR) & PB_UIO_GPIO_CH1);
+}
+
+/* PWM of the RGB LED */
+static inline void pb_uio_pwm_enable(const struct pb_uio *u, int enable) {
+    pb_uio_write32(u, PB_UIO_PWM_CTRL, enable ? 1 : 0);
+}
+
+static inline void pb_uio_pwm_set_period(const struct pb_uio *u, uint32_t period) {
+    pb_uio_write32(u, PB_UIO_PWM_PERIOD, period);
+}
+
+static inline uint32_t pb_uio_pwm_get_duty(const struct pb_uio *u, enum pb_uio_pwm_ch ch) {
+    return pb_uio_read32(u, PB_UIO_PWM_DUTY + ch * PB_UIO_PWM_DUTY_STRIDE);
+}
+
+static inline void pb_uio_pwm_set_duty(const struct pb_uio *u, enum pb_uio_pwm_ch ch, uint32_t duty) {
+    pb_uio_write32(u, PB_UIO_PWM_DUTY + ch * PB_UIO_PWM_DUTY_STRIDE, duty);
+}
+
+#endif /* __PB_UIO_H__ */
@@ -0,0 +1,269 @@
+/*  uio-test.c - Test of the UIO register access library
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "pb-uio.h"
+
+#define DEFAULT_ITERATIONS 1000000
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+#define CHECK(cond, msg) do { \
+        if (!(cond)) { \
+            printf("FAILED: %s (%s:%d)\n", msg, __FILE__, __LINE__); \
+            return RET_ERR; \
+        } \
+    } while (0)
+
+static void print_help() {
+    printf("Test of the UIO register access library. Registers are accessed by plain loads and\n");
+    printf("stores into the mapped window, no system call is used on the data path.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-f = self-test against the memfd-backed fake register window (no HW is needed)\n");
+    printf("\t-l = LED UIO device (default: found by the address 0x%lx)\n", PB_UIO_LED_ADDR);
+    printf("\t-s = switch UIO device (default: found by the address 0x%lx)\n", PB_UIO_SW_ADDR);
+    printf("\t-p = PWM UIO device (default: found by the address 0x%lx)\n", PB_UIO_PWM_ADDR);
+    printf("\t-n = number of iterations of the switch to LED/RGB loop (default %d)\n", DEFAULT_ITERATIONS);
+    printf("\t-i = wait for the switch IRQ between iterations (needs the GPIO interrupt in the PL)\n");
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Fake window - the memfd is the register window and one end of the socket pair
+ * emulates the UIO IRQ protocol */
+static int open_fake(struct pb_uio *u, int *mem_fd, int *irq_peer) {
+    int sv[2];
+    int fd;
+
+    fd = memfd_create("pb-uio-fake", MFD_CLOEXEC);
+    if (fd < 0)
+        return RET_ERR;
+    if (ftruncate(fd, PB_UIO_WINDOW_SIZE) != 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        close(fd);
+        return RET_ERR;
+    }
+
+    /* The second descriptor of the memfd is the independent view of the test */
+    *mem_fd = dup(fd);
+    *irq_peer = sv[1];
+    if (pb_uio_open_fd(u, fd, PB_UIO_WINDOW_SIZE, 0, sv[0]) != 0)
+        return RET_ERR;
+    return RET_OK;
+}
+
+static uint32_t fake_reg(int mem_fd, uint32_t off) {
+    uint32_t val = 0;
+    if (pread(mem_fd, &val, sizeof(val), off) != sizeof(val))
+        return 0xdeadbeef;
+    return val;
+}
+
+static int run_fake() {
+    struct pb_uio u;
+    int mem_fd, irq_peer;
+    uint32_t val, cnt;
+    uint64_t start, ns;
+    unsigned long i;
+
+    print_box("UIO library self-test (memfd fake window)");
+    CHECK(open_fake(&u, &mem_fd, &irq_peer) == RET_OK, "Creation of the fake window");
+
+    /* Accessors */
+    pb_uio_gpio_set(&u, 0x5);
+    CHECK(fake_reg(mem_fd, PB_UIO_GPIO_DATA) == 0x5, "GPIO store is visible in the window");
+    val = 0xa;
+    CHECK(pwrite(mem_fd, &val, sizeof(val), PB_UIO_GPIO_DATA) == sizeof(val), "Window update");
+    CHECK(pb_uio_gpio_get(&u) == 0xa, "GPIO load returns the window value");
+
+    pb_uio_gpio_irq_setup(&u);
+    CHECK(fake_reg(mem_fd, PB_UIO_GPIO_IER) == PB_UIO_GPIO_CH1, "GPIO channel interrupt enable");
+    CHECK(fake_reg(mem_fd, PB_UIO_GPIO_GIER) == PB_UIO_GPIO_GIER_EN, "GPIO global interrupt enable");
+
+    pb_uio_pwm_set_rgb(&u, 0xff8001, PB_UIO_PWM_PERIOD_CLK);
+    CHECK(fake_reg(mem_fd, PB_UIO_PWM_DUTY + 2 * PB_UIO_PWM_DUTY_STRIDE) == 510, "Red duty cycle");
+    CHECK(fake_reg(mem_fd, PB_UIO_PWM_DUTY + 1 * PB_UIO_PWM_DUTY_STRIDE) == 256, "Green duty cycle");
+    CHECK(pb_uio_pwm_get_duty(&u, PB_UIO_PWM_B) == 2, "Blue duty cycle");
+    CHECK(fake_reg(mem_fd, PB_UIO_PWM_PERIOD) == PB_UIO_PWM_PERIOD_CLK, "PWM period");
+    CHECK(fake_reg(mem_fd, PB_UIO_PWM_CTRL) == 1, "PWM enable");
+    CHECK(pb_uio_pwm_scale(1000, 0xff) == 0, "Short period turns the LED off");
+
+    /* IRQ protocol - 4-byte unmask write and 4-byte count read */
+    CHECK(pb_uio_irq_enable(&u) == 0, "IRQ unmask");
+    CHECK(read(irq_peer, &val, sizeof(val)) == sizeof(val) && val == 1, "Unmask value");
+    CHECK(pb_uio_irq_wait(&u, 10, &cnt) == 0, "IRQ wait timeout");
+    val = 7;
+    CHECK(write(irq_peer, &val, sizeof(val)) == sizeof(val), "IRQ injection");
+    CHECK(pb_uio_irq_wait(&u, 1000, &cnt) == 1 && cnt == 7, "IRQ wait returns the count");
+    printf("Accessors and the IRQ protocol are OK.\n");
+
+    /* Cost of plain accesses (memory of the fake window, the AXI access is slower) */
+    start = now_ns();
+    for (i = 0; i < DEFAULT_ITERATIONS; i++)
+        pb_uio_gpio_set(&u, pb_uio_gpio_get(&u) + 1);
+    ns = now_ns() - start;
+    printf("Load + store: %.2f ns per iteration\n", (double)ns / DEFAULT_ITERATIONS);
+
+    pb_uio_close(&u);
+    close(mem_fd);
+    close(irq_peer);
+    printf("Self-test passed.\n");
+    return RET_OK;
+}
+
+static int open_window(struct pb_uio *u, const char *path, unsigned long addr, const char *name) {
+    char found[64];
+
+    if (path == NULL) {
+        if (pb_uio_find(addr, found, sizeof(found)) != 0) {
+            printf("UIO device of the %s window (0x%lx) not found - is uio_pdrv_genirq loaded with "
+                "of_id=generic-uio instead of the cdev driver?\n", name, addr);
+            return RET_ERR;
+        }
+        path = found;
+    }
+
+    if (pb_uio_open(u, path) != 0) {
+        printf("Unable to open %s (%s)!\n", path, strerror(errno));
+        return RET_ERR;
+    }
+    printf("%s window: %s\n", name, path);
+    return RET_OK;
+}
+
+static int run_hw(const char *led_path, const char *sw_path, const char *pwm_path,
+    unsigned long iterations, int use_irq) {
+    struct pb_uio led, sw, pwm;
+    uint32_t val, cnt;
+    uint64_t start, ns;
+    unsigned long i;
+    int ret = RET_ERR;
+
+    print_box("Switch to LED/RGB loop over UIO");
+    if (open_window(&led, led_path, PB_UIO_LED_ADDR, "LED") != RET_OK)
+        return RET_ERR;
+    if (open_window(&sw, sw_path, PB_UIO_SW_ADDR, "Switch") != RET_OK)
+        goto err_led;
+    if (open_window(&pwm, pwm_path, PB_UIO_PWM_ADDR, "PWM") != RET_OK)
+        goto err_sw;
+
+    if (use_irq) {
+        pb_uio_gpio_irq_setup(&sw);
+        if (pb_uio_irq_enable(&sw) != 0) {
+            printf("The switch window has no IRQ (%s)!\n", strerror(errno));
+            goto err_pwm;
+        }
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        if (use_irq) {
+            if (pb_uio_irq_wait(&sw, -1, &cnt) != 1) {
+                printf("IRQ wait failed (%s)!\n", strerror(errno));
+                goto err_pwm;
+            }
+            pb_uio_gpio_irq_ack(&sw);
+            pb_uio_irq_enable(&sw);
+        }
+
+        val = pb_uio_gpio_get(&sw) & 0xf;
+        pb_uio_gpio_set(&led, val);
+        pb_uio_pwm_set_rgb(&pwm, (val & 0x1 ? 0xff0000 : 0) | (val & 0x2 ? 0xff00 : 0) |
+            (val & 0x4 ? 0xff : 0), PB_UIO_PWM_PERIOD_CLK);
+    }
+    ns = now_ns() - start;
+    printf("%lu iterations, %.1f ns per iteration\n", iterations, (double)ns / iterations);
+    ret = RET_OK;
+
+err_pwm:
+    pb_uio_close(&pwm);
+err_sw:
+    pb_uio_close(&sw);
+err_led:
+    pb_uio_close(&led);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    const char *led_path = NULL, *sw_path = NULL, *pwm_path = NULL;
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    int fake = 0, use_irq = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hfl:s:p:n:i")) != -1) {
+        switch (opt) {
+            case 'f':
+                fake = 1;
+                break;
+            case 'l':
+                led_path = optarg;
+                break;
+            case 's':
+                sw_path = optarg;
+                break;
+            case 'p':
+                pwm_path = optarg;
+                break;
+            case 'n':
+                iterations = strtoul(optarg, NULL, 0);
+                if (iterations == 0) {
+                    printf("Invalid number of iterations \"%s\"!\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'i':
+                use_irq = 1;
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (fake)
+        return run_fake();
+    return run_hw(led_path, sw_path, pwm_path, iterations, use_irq);
+}
@@ -19,17 +19,21 @@
 
 #include <stdio.h>
 #include <linux/ioctl.h>
-#include <linux/fcntl.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <string.h>
-
-/* Declare IOCTL handlers */
-#define LED_IOCTL_MAGIC			'l'
-#define LED_IOCTL_GET_VAL		_IOR(LED_IOCTL_MAGIC, 0, unsigned long)
-#define LED_IOCTL_SET_VAL		_IOW(LED_IOCTL_MAGIC, 1, unsigned long)
-#define LED_IOCTL_SET_PERIOD	_IOW(LED_IOCTL_MAGIC, 2, unsigned long)
-#define LED_IOCTL_GET_PERIOD	_IOR(LED_IOCTL_MAGIC, 3, unsigned long)
-#define LED_IOCTL_INIT			_IO (LED_IOCTL_MAGIC, 4)
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/* IOCTL handlers of the driver */
+#include "pb-zybo-ioctl.h"
 
 /* Some helping macros */
 #define RET_OK 0
@@ -50,6 +54,10 @@ static void print_help() {
     printf("\n\n");
     printf("\t-h = prints this help\n");
     printf("\t-d = device to open\n");
+    printf("\t-S, --stress = run the non-interactive stress test instead of the demo\n");
+    printf("\t-w = number of stress test workers (default 4)\n");
+    printf("\t-t = stress test time in seconds (default 5)\n");
+    printf("\t-P = stress test workers are processes instead of threads\n");
     return;
 }
 
@@ -80,14 +88,14 @@ static int test_ioctl_period(int fd) {
 
     print_box("Get/Set period test");
     printf("Trying to set the period = %u\n", ref_period);
-    rc = ioctl(fd, LED_IOCTL_SET_PERIOD, &ref_period);
+    rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &ref_period);
     if (rc) {
         printf("Error during the setting of new period value!\n");
         return RET_ERR;
     }
 
     printf("Trying to read the already set value back");
-    rc = ioctl(fd, LED_IOCTL_GET_PERIOD, &period);
+    rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_PERIOD, &period);
     if (rc) {
         printf("Error during the reading of current value ");
         return RET_ERR;
@@ -104,7 +112,7 @@ static int test_ioctl_period(int fd) {
     }
 
     printf("Setting the default period value...\n");
-    rc = ioctl(fd, LED_IOCTL_SET_PERIOD, &def_period);
+    rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &def_period);
     if (rc) {
         printf("Unable to se the period value!\n");
         return RET_ERR;
@@ -141,12 +149,12 @@ static int test_ioctl_blink(int fd) {
     for (int i = 0; i < tests; i++) {
         printf("Setting RGB = "); print_rgb(rgb_test[i]); printf("\n");
 
-        rc = ioctl(fd, LED_IOCTL_SET_VAL , rgb_test + i);
+        rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_SET_VAL , rgb_test + i);
         if (rc) {
             printf("Unable to set the color value!\n");
             return RET_ERR;
         }
-        rc = ioctl(fd, LED_IOCTL_GET_VAL, &ret_val);
+        rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &ret_val);
         if (rc) {
             printf("Unable to read RGB value!");
             return RET_ERR;
@@ -201,7 +209,7 @@ static int  test_device_write(int fd) {
 
 int reset_device(int fd) {
     print_box("Device reset");
-    int rc = ioctl(fd, LED_IOCTL_INIT, 0);
+    int rc = ioctl(fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
     if (rc) {
         printf("Error during the device reset!\n");
         return RET_ERR;
@@ -209,17 +217,466 @@ int reset_device(int fd) {
     return RET_OK;
 }
 
+/* ==================================================================
+ 		Stress test
+   ================================================================== */
+
+/* Maximal number of workers */
+#define STRESS_MAX_WORKERS 64
+/* Latency histogram - LAT_SUB linear buckets per power of two (12.5 % resolution) */
+#define LAT_SUB 8
+#define LAT_BUCKETS (40 * LAT_SUB)
+/* Maximal number of reported consistency errors per worker */
+#define STRESS_MAX_REPORTS 3
+
+/**
+ * @brief Operations of the stress test, each worker picks them randomly
+ * 
+ */
+enum stress_op {
+    OP_SET_VAL,
+    OP_GET_VAL,
+    OP_SET_PERIOD,
+    OP_GET_PERIOD,
+    OP_INIT,
+    OP_WRITE,
+    OP_READ,
+    OP_COUNT
+};
+
+static const char *stress_op_names[OP_COUNT] = {
+    "set_val", "get_val", "set_period", "get_period", "init", "write", "read",
+};
+
+/* Number of tracked color and period values */
+#define STRESS_COLORS (1 << 24)
+#define STRESS_PERIODS (1 << 16)
+
+struct stress_conf {
+    const char *dev;
+    unsigned int workers;       /* Number of threads or processes */
+    unsigned int duration_s;    /* Test time */
+    int processes;              /* Fork processes instead of threads */
+};
+
+struct stress_stat {
+    unsigned long count;
+    unsigned long errors;
+    uint64_t max;
+    unsigned long hist[LAT_BUCKETS];
+};
+
+struct stress_shared;
+
+struct stress_worker {
+    struct stress_shared *sh;   /* Shared state */
+    int id;
+    int fd;
+    unsigned long ops;
+    unsigned long checks;       /* Checked read values */
+    unsigned long violations;   /* Read values which no writer set */
+    uint64_t start_ns;
+    uint64_t end_ns;
+    struct stress_stat stat[OP_COUNT];
+};
+
+/**
+ * @brief State shared by workers (mapped as shared memory, so it works for processes too).
+ * Writers mark each value in the bitmap before they write it into the device, so the read
+ * value has to be marked.
+ * 
+ */
+struct stress_shared {
+    volatile int stop;
+    pthread_barrier_t barrier;
+    uint64_t color_set[STRESS_COLORS / 64];     /* Written colors */
+    uint64_t period_set[STRESS_PERIODS / 64];   /* Written periods */
+    struct stress_worker worker[STRESS_MAX_WORKERS];
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int lat_bucket(uint64_t ns) {
+    int exp, idx;
+
+    if (ns < LAT_SUB) {
+        return ns;
+    }
+    exp = 63 - __builtin_clzll(ns);
+    idx = (exp - 2) * LAT_SUB + ((ns >> (exp - 3)) & (LAT_SUB - 1));
+    return idx < LAT_BUCKETS ? idx : LAT_BUCKETS - 1;
+}
+
+/* Upper bound of the bucket */
+static uint64_t lat_bucket_max(int idx) {
+    int exp;
+
+    if (idx < LAT_SUB) {
+        return idx + 1;
+    }
+    exp = idx / LAT_SUB + 2;
+    return (uint64_t)(LAT_SUB + idx % LAT_SUB + 1) << (exp - 3);
+}
+
+/* Percentile of the histogram (the upper bound of the bucket) */
+static uint64_t lat_percentile(const struct stress_stat *st, double p) {
+    unsigned long target = (unsigned long)(p * st->count + 0.999999);
+    unsigned long sum = 0;
+    int b;
+
+    for (b = 0; b < LAT_BUCKETS; b++) {
+        sum += st->hist[b];
+        if (sum >= target && sum) {
+            return lat_bucket_max(b) < st->max ? lat_bucket_max(b) : st->max;
+        }
+    }
+    return st->max;
+}
+
+static void stress_mark(uint64_t *set, unsigned int val) {
+    __atomic_fetch_or(&set[val / 64], 1ULL << (val % 64), __ATOMIC_SEQ_CST);
+}
+
+static int stress_marked(const uint64_t *set, unsigned int val) {
+    return (__atomic_load_n(&set[val / 64], __ATOMIC_SEQ_CST) >> (val % 64)) & 1;
+}
+
+static void stress_check(struct stress_worker *w, const uint64_t *set, unsigned int size, int op, unsigned int val) {
+    w->checks++;
+    if (val < size && stress_marked(set, val)) {
+        return;
+    }
+    if (w->violations++ < STRESS_MAX_REPORTS) {
+        fprintf(stderr, "Worker %d: %s returned 0x%x which no writer set!\n", w->id, stress_op_names[op], val);
+    }
+}
+
+/**
+ * @brief Color of the tag - the blue part is derived from red and green, so the color
+ * mixed from different writes is detected
+ * 
+ */
+static __u32 stress_color(unsigned int tag) {
+    __u32 r = (tag >> 8) & 0xff;
+    __u32 g = tag & 0xff;
+    __u32 b = (r ^ g ^ 0xa5) & 0xff;
+    return (r << 16) | (g << 8) | b;
+}
+
+/**
+ * @brief Execute one operation, written values are tagged with the worker and iteration.
+ * Text calls use the offset 0, so each call is one complete value.
+ * 
+ * @return int Return code of the call
+ */
+static int stress_exec(struct stress_shared *sh, struct stress_worker *w, int op, unsigned int tag) {
+    char buf[64];
+    unsigned int r, g, b;
+    __u32 val = 0;
+    int rc;
+
+    switch (op) {
+        case OP_SET_VAL:
+            val = stress_color(tag);
+            stress_mark(sh->color_set, val);
+            return ioctl(w->fd, PB_ZYBO_RGB_IOCTL_SET_VAL, &val);
+        case OP_GET_VAL:
+            rc = ioctl(w->fd, PB_ZYBO_RGB_IOCTL_GET_VAL, &val);
+            if (rc == 0) {
+                stress_check(w, sh->color_set, STRESS_COLORS, op, val);
+            }
+            return rc;
+        case OP_SET_PERIOD:
+            val = 1024 + (tag & 0xfff);
+            stress_mark(sh->period_set, val);
+            return ioctl(w->fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &val);
+        case OP_GET_PERIOD:
+            rc = ioctl(w->fd, PB_ZYBO_RGB_IOCTL_GET_PERIOD, &val);
+            if (rc == 0) {
+                stress_check(w, sh->period_set, STRESS_PERIODS, op, val);
+            }
+            return rc;
+        case OP_INIT:
+            return ioctl(w->fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
+        case OP_WRITE:
+            val = stress_color(tag);
+            stress_mark(sh->color_set, val);
+            rc = snprintf(buf, sizeof(buf), "0x%02x 0x%02x 0x%02x\n", val >> 16, (val >> 8) & 0xff, val & 0xff);
+            return pwrite(w->fd, buf, rc, 0) == rc ? 0 : -1;
+        case OP_READ:
+            rc = pread(w->fd, buf, sizeof(buf) - 1, 0);
+            if (rc <= 0) {
+                return -1;
+            }
+            buf[rc] = '\0';
+            if (sscanf(buf, "%x %x %x", &r, &g, &b) != 3) {
+                return -1;
+            }
+            stress_check(w, sh->color_set, STRESS_COLORS, op, (r << 16) | (g << 8) | b);
+            return 0;
+    }
+    return -1;
+}
+
+static void *stress_worker_run(void *arg) {
+    struct stress_worker *w = arg;
+    struct stress_shared *sh = w->sh;
+    unsigned int seed = w->id * 7919 + 1;
+    unsigned int tag;
+    uint64_t t0, t1;
+    int op, rc;
+
+    pthread_barrier_wait(&sh->barrier);
+    w->start_ns = now_ns();
+    while (!sh->stop) {
+        op = rand_r(&seed) % OP_COUNT;
+        tag = (w->id << 10) + (w->ops & 0x3ff);
+
+        t0 = now_ns();
+        rc = stress_exec(sh, w, op, tag);
+        t1 = now_ns();
+
+        w->stat[op].count++;
+        w->stat[op].hist[lat_bucket(t1 - t0)]++;
+        if (t1 - t0 > w->stat[op].max) {
+            w->stat[op].max = t1 - t0;
+        }
+        if (rc) {
+            w->stat[op].errors++;
+        }
+        w->ops++;
+    }
+    w->end_ns = now_ns();
+    return NULL;
+}
+
+static void stress_report(const struct stress_conf *conf, struct stress_shared *sh) {
+    struct stress_stat *total;
+    unsigned long ops = 0, checks = 0, violations = 0, errors = 0, min_ops = ~0UL, max_ops = 0;
+    uint64_t start = ~0ULL, end = 0;
+    double sum = 0, sum_sq = 0, run;
+    unsigned int i, op;
+    int b;
+
+    total = calloc(OP_COUNT, sizeof(*total));
+    if (!total) {
+        return;
+    }
+
+    for (i = 0; i < conf->workers; i++) {
+        struct stress_worker *w = &sh->worker[i];
+
+        start = w->start_ns < start ? w->start_ns : start;
+        end = w->end_ns > end ? w->end_ns : end;
+        for (op = 0; op < OP_COUNT; op++) {
+            total[op].count += w->stat[op].count;
+            total[op].errors += w->stat[op].errors;
+            total[op].max = w->stat[op].max > total[op].max ? w->stat[op].max : total[op].max;
+            for (b = 0; b < LAT_BUCKETS; b++) {
+                total[op].hist[b] += w->stat[op].hist[b];
+            }
+        }
+    }
+    run = (end - start) / 1e9;
+
+    print_box("Stress test - latency per operation [us]");
+    printf("%-10s %10s %8s %8s %8s %8s %8s\n", "op", "count", "errors", "p50", "p99", "p99.9", "max");
+    for (op = 0; op < OP_COUNT; op++) {
+        struct stress_stat *st = &total[op];
+
+        printf("%-10s %10lu %8lu %8.1f %8.1f %8.1f %8.1f\n", stress_op_names[op], st->count, st->errors,
+            lat_percentile(st, 0.50) / 1e3, lat_percentile(st, 0.99) / 1e3, lat_percentile(st, 0.999) / 1e3,
+            st->max / 1e3);
+        errors += st->errors;
+    }
+
+    print_box("Stress test - workers");
+    printf("%-6s %10s %12s %8s %8s\n", "worker", "ops", "ops/s", "share", "max [us]");
+    for (i = 0; i < conf->workers; i++) {
+        struct stress_worker *w = &sh->worker[i];
+
+        ops += w->ops;
+        checks += w->checks;
+        violations += w->violations;
+        min_ops = w->ops < min_ops ? w->ops : min_ops;
+        max_ops = w->ops > max_ops ? w->ops : max_ops;
+        sum += w->ops;
+        sum_sq += (double)w->ops * w->ops;
+    }
+    for (i = 0; i < conf->workers; i++) {
+        struct stress_worker *w = &sh->worker[i];
+        uint64_t max = 0;
+
+        for (op = 0; op < OP_COUNT; op++) {
+            max = w->stat[op].max > max ? w->stat[op].max : max;
+        }
+        printf("%-6u %10lu %12.0f %7.1f%% %8.1f\n", i, w->ops, w->ops / ((w->end_ns - w->start_ns) / 1e9),
+            ops ? 100.0 * w->ops / ops : 0.0, max / 1e3);
+    }
+
+    print_box("Stress test - summary");
+    printf("* %u %s, %.3f s, %lu ops (%.0f ops/s)\n", conf->workers, conf->processes ? "processes" : "threads",
+        run, ops, ops / run);
+    printf("* Fairness: Jain index %.3f, min/max worker ops %.3f\n", sum_sq > 0 ? sum * sum / (conf->workers * sum_sq) : 0.0,
+        max_ops ? (double)min_ops / max_ops : 0.0);
+    printf("* Errors: %lu\n", errors);
+    printf("* Consistency: %lu checked values, %lu values which no writer set\n", checks, violations);
+    free(total);
+}
+
+/**
+ * @brief Run the stress test - workers hammer the same device via their own descriptors
+ * for the given time. The period is restored and the device is initialized at the end.
+ * 
+ * @return int RET_OK iff no call failed and all read values were set by some writer
+ */
+static int stress_test(const struct stress_conf *conf) {
+    struct stress_shared *sh;
+    pthread_barrierattr_t attr;
+    pthread_t threads[STRESS_MAX_WORKERS];
+    pid_t pids[STRESS_MAX_WORKERS];
+    unsigned int i, op, started = 0;
+    int ctl_fd, rc = RET_OK;
+    __u32 period;
+
+    if (conf->workers == 0 || conf->workers > STRESS_MAX_WORKERS) {
+        printf("The number of workers has to be 1 - %d\n", STRESS_MAX_WORKERS);
+        return RET_ERR;
+    }
+
+    ctl_fd = open(conf->dev, O_RDWR);
+    if (ctl_fd < 0) {
+        printf("Unable to open the device %s\n", conf->dev);
+        return RET_ERR;
+    }
+    if (ioctl(ctl_fd, PB_ZYBO_RGB_IOCTL_GET_PERIOD, &period)) {
+        printf("Unable to read the device configuration!\n");
+        close(ctl_fd);
+        return RET_ERR;
+    }
+    if (ioctl(ctl_fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &period)) {
+        printf("Unable to write the device, the stress test needs the CAP_SYS_ADMIN capability!\n");
+        close(ctl_fd);
+        return RET_ERR;
+    }
+
+    sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        printf("Unable to allocate the shared state!\n");
+        close(ctl_fd);
+        return RET_ERR;
+    }
+    /* Initialized device (black) and the current period */
+    stress_mark(sh->color_set, 0);
+    if (period < STRESS_PERIODS) {
+        stress_mark(sh->period_set, period);
+    }
+    ioctl(ctl_fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
+
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&sh->barrier, &attr, conf->workers + 1);
+    pthread_barrierattr_destroy(&attr);
+
+    /* Each worker has its own descriptor, like independent applications */
+    for (i = 0; i < conf->workers; i++) {
+        sh->worker[i].sh = sh;
+        sh->worker[i].id = i;
+        sh->worker[i].fd = open(conf->dev, O_RDWR);
+        if (sh->worker[i].fd < 0) {
+            printf("Unable to open the device %s\n", conf->dev);
+            exit(RET_ERR);
+        }
+    }
+
+    print_box("Starting the stress test");
+    printf("* %u %s for %u s\n", conf->workers, conf->processes ? "processes" : "threads", conf->duration_s);
+    for (i = 0; i < conf->workers; i++) {
+        if (conf->processes) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                stress_worker_run(&sh->worker[i]);
+                _exit(0);
+            }
+            if (pids[i] < 0) {
+                printf("Unable to start the worker process!\n");
+                while (started--) {
+                    kill(pids[started], SIGKILL);
+                }
+                exit(RET_ERR);
+            }
+        } else if (pthread_create(&threads[i], NULL, stress_worker_run, &sh->worker[i])) {
+            /* Started workers wait on the barrier */
+            printf("Unable to start the worker thread!\n");
+            exit(RET_ERR);
+        }
+        started++;
+    }
+
+    pthread_barrier_wait(&sh->barrier);
+    sleep(conf->duration_s);
+    sh->stop = 1;
+    for (i = 0; i < started; i++) {
+        if (conf->processes) {
+            waitpid(pids[i], NULL, 0);
+        } else {
+            pthread_join(threads[i], NULL);
+        }
+        close(sh->worker[i].fd);
+    }
+
+    stress_report(conf, sh);
+    for (i = 0; i < conf->workers; i++) {
+        for (op = 0; op < OP_COUNT; op++) {
+            if (sh->worker[i].stat[op].errors) {
+                rc = RET_ERR;
+            }
+        }
+        if (sh->worker[i].violations) {
+            rc = RET_ERR;
+        }
+    }
+
+    /* Restore the period and turn the LED off */
+    ioctl(ctl_fd, PB_ZYBO_RGB_IOCTL_SET_PERIOD, &period);
+    ioctl(ctl_fd, PB_ZYBO_RGB_IOCTL_INIT, 0);
+    close(ctl_fd);
+
+    pthread_barrier_destroy(&sh->barrier);
+    munmap(sh, sizeof(*sh));
+    printf("Stress test %s.\n", rc == RET_OK ? "passed" : "FAILED");
+    return rc;
+}
+
 int main(int argc, char **argv) {
     /* Parse input arguments */
     int opt;
+    int stress = 0;
     const char* dev = NULL;
+    struct stress_conf conf = {
+        .workers = 4,
+        .duration_s = 5,
+    };
+    static const struct option long_opts[] = {
+        { "stress", no_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 },
+    };
 
-    while ((opt = getopt(argc, argv, "hd:" )) != -1) {
+    while ((opt = getopt_long(argc, argv, "hd:Sw:t:P", long_opts, NULL)) != -1) {
         switch (opt) {
             case 'h' : print_help(); break;
             case 'd' : dev = optarg; break;
+            case 'S' : stress = 1; break;
+            case 'w' : conf.workers = strtoul(optarg, NULL, 0); break;
+            case 't' : conf.duration_s = strtoul(optarg, NULL, 0); break;
+            case 'P' : conf.processes = 1; break;
             default:
-                printf("Unknown option %s\n", optopt);
+                print_help();
                 return RET_ERR;
         }
     }
@@ -229,11 +686,16 @@ int main(int argc, char **argv) {
         return RET_ERR;
     }
 
+    if (stress) {
+        conf.dev = dev;
+        return stress_test(&conf);
+    }
+
     printf("Welcome the to the test utility for the LED module device driver.\n");
     printf("\t* Using the device: %s\n", dev);  
     
     int fd = open(dev, O_RDWR);
-    if (!fd) {
+    if (fd < 0) {
         printf("Unable to open the device %s\n", dev);
         return RET_ERR;
     }
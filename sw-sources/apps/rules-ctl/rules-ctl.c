@@ -0,0 +1,233 @@
+/*  rules-ctl.c - Upload of pb-zybo reaction rules
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+
+#include "pb-zybo-cmd.h"
+
+#define CMD_DEV_PATH				"/dev/pb-zybo-cmd"
+#define RULES_DBG_PATH				"/sys/kernel/debug/pb-zybo/rules"
+#define DEFAULT_PERIOD_US			1000
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+
+/* Number of comma-separated fields of one rule */
+#define RULE_FIELDS 7
+
+static void print_help() {
+    printf("Tool for the upload of reaction rules which are evaluated by the pb-zybo core.\n");
+    printf("The kernel samples switches and executes actions without the user space.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-r = add the rule type,switch,mask,value,action,dev,arg where\n");
+    printf("\t     type is match (masked switch bits equal to value) or toggle (any masked bit changes),\n");
+    printf("\t     action is led, rgb or period and switch/dev are device indexes (e.g., 0 for *-0)\n");
+    printf("\t-p = sampling period in microseconds (default %d, range %d-%d)\n", DEFAULT_PERIOD_US,
+        PB_ZYBO_RULES_MIN_PERIOD_US, PB_ZYBO_RULES_MAX_PERIOD_US);
+    printf("\t-c = remove all rules\n");
+    printf("\t-s = show active rules and their hit counters (debugfs)\n");
+    printf("\n");
+    printf("Example: rules-ctl -r match,0,0x1,0x1,led,0,0xf -r toggle,0,0x2,0,rgb,0,0xff0000\n");
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static int parse_num(const char *str, uint32_t *val) {
+    char *end;
+    unsigned long tmp;
+
+    errno = 0;
+    tmp = strtoul(str, &end, 0);
+    if (errno != 0 || end == str || *end != '\0' || tmp > UINT32_MAX)
+        return RET_ERR;
+    *val = (uint32_t)tmp;
+    return RET_OK;
+}
+
+/* Parse the rule in the type,switch,mask,value,action,dev,arg format */
+static int parse_rule(const char *str, struct pb_zybo_rule *rule) {
+    char buf[128];
+    char *fields[RULE_FIELDS];
+    char *save = NULL;
+    char *tok;
+    uint32_t sw, mask, value, dev, arg;
+    int n = 0;
+
+    if (strlen(str) >= sizeof(buf)) {
+        printf("The rule \"%s\" is too long!\n", str);
+        return RET_ERR;
+    }
+    strcpy(buf, str);
+
+    for (tok = strtok_r(buf, ",", &save); tok && n < RULE_FIELDS; tok = strtok_r(NULL, ",", &save))
+        fields[n++] = tok;
+    if (n != RULE_FIELDS || tok != NULL) {
+        printf("The rule \"%s\" has to have %d fields!\n", str, RULE_FIELDS);
+        return RET_ERR;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+    if (strcmp(fields[0], "match") == 0) {
+        rule->type = PB_ZYBO_RULE_MATCH;
+    } else if (strcmp(fields[0], "toggle") == 0) {
+        rule->type = PB_ZYBO_RULE_TOGGLE;
+    } else {
+        printf("Unknown rule type \"%s\"!\n", fields[0]);
+        return RET_ERR;
+    }
+
+    if (strcmp(fields[4], "led") == 0) {
+        rule->op = PB_ZYBO_CMD_LED_SET;
+    } else if (strcmp(fields[4], "rgb") == 0) {
+        rule->op = PB_ZYBO_CMD_RGB_SET;
+    } else if (strcmp(fields[4], "period") == 0) {
+        rule->op = PB_ZYBO_CMD_RGB_PERIOD_SET;
+    } else {
+        printf("Unknown action \"%s\"!\n", fields[4]);
+        return RET_ERR;
+    }
+
+    if (parse_num(fields[1], &sw) != RET_OK || parse_num(fields[2], &mask) != RET_OK ||
+        parse_num(fields[3], &value) != RET_OK || parse_num(fields[5], &dev) != RET_OK ||
+        parse_num(fields[6], &arg) != RET_OK || sw > UINT16_MAX || dev > UINT16_MAX) {
+        printf("Invalid number in the rule \"%s\"!\n", str);
+        return RET_ERR;
+    }
+
+    rule->sw_dev = sw;
+    rule->mask = mask;
+    rule->value = value;
+    rule->dev = dev;
+    rule->arg = arg;
+    return RET_OK;
+}
+
+static int show_rules() {
+    char line[256];
+    FILE *f;
+
+    f = fopen(RULES_DBG_PATH, "r");
+    if (f == NULL) {
+        printf("Unable to open %s (%s)!\n", RULES_DBG_PATH, strerror(errno));
+        return RET_ERR;
+    }
+
+    print_box("Active reaction rules");
+    while (fgets(line, sizeof(line), f) != NULL)
+        fputs(line, stdout);
+    fclose(f);
+    return RET_OK;
+}
+
+int main(int argc, char** argv) {
+    struct pb_zybo_rule rules[PB_ZYBO_RULES_MAX];
+    struct pb_zybo_rule_table table;
+    uint32_t period = DEFAULT_PERIOD_US;
+    unsigned int count = 0;
+    int clear = 0, show = 0;
+    int ret = RET_ERR;
+    int fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hr:p:cs")) != -1) {
+        switch (opt) {
+            case 'r':
+                if (count == PB_ZYBO_RULES_MAX) {
+                    printf("At most %d rules are supported!\n", PB_ZYBO_RULES_MAX);
+                    return RET_ERR;
+                }
+                if (parse_rule(optarg, &rules[count]) != RET_OK)
+                    return RET_ERR;
+                count++;
+                break;
+            case 'p':
+                if (parse_num(optarg, &period) != RET_OK) {
+                    printf("Invalid period \"%s\"!\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'c':
+                clear = 1;
+                break;
+            case 's':
+                show = 1;
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    if (count == 0 && !clear) {
+        if (show)
+            return show_rules();
+        print_help();
+        return RET_OK;
+    }
+
+    if (count != 0 && clear) {
+        printf("Rules and the -c option cannot be combined!\n");
+        return RET_ERR;
+    }
+
+    fd = open(CMD_DEV_PATH, O_RDWR);
+    if (fd < 0) {
+        printf("Unable to open %s (%s)!\n", CMD_DEV_PATH, strerror(errno));
+        return RET_ERR;
+    }
+
+    memset(&table, 0, sizeof(table));
+    table.rules = (uintptr_t)rules;
+    table.count = count;
+    table.period_us = period;
+    if (ioctl(fd, PB_ZYBO_CMD_IOCTL_SET_RULES, &table) != 0) {
+        printf("Upload of rules failed (%s)!\n", strerror(errno));
+        goto cleanup;
+    }
+
+    if (clear)
+        printf("All rules were removed.\n");
+    else
+        printf("%u rule(s) uploaded, sampling period %u us.\n", count, period);
+
+    ret = RET_OK;
+    if (show)
+        ret = show_rules();
+
+cleanup:
+    close(fd);
+    return ret;
+}
@@ -19,18 +19,21 @@
 
 #include <stdio.h>
 #include <linux/ioctl.h>
-#include <linux/fcntl.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
 
-/* Declare IOCTL handlers */
-#define SW_IOCTL_MAGIC			'l'
-#define SW_IOCTL_GET_MASK		_IOR(SW_IOCTL_MAGIC, 0, int)
-#define SW_IOCTL_SET_MASK		_IOW(SW_IOCTL_MAGIC, 1, int)
-#define SW_IOCTL_GET_VALUE		_IOW(SW_IOCTL_MAGIC, 2, int)
+/* IOCTL handlers of the driver */
+#include "pb-zybo-ioctl.h"
 
 /* Some helping macros */
 #define RET_OK 0
@@ -67,6 +70,11 @@ static void print_help() {
     printf("\n\n");
     printf("\t-h = prints this help\n");
     printf("\t-d = device to open\n");
+    printf("\t-m = watch mode - auto (default), poll or sample\n");
+    printf("\t-i = sampling interval in us when poll isn't used (default 100, 0 = tight loop)\n");
+    printf("\t-t = watch time in seconds (default 0 = until CTRL + C)\n");
+    printf("\t-s = maximal allowed detection latency in us, the tool fails if it is exceeded\n");
+    printf("\t-q = don't print individual changes\n");
     return;
 }
 
@@ -86,14 +94,14 @@ static int ioctl_test_mask(int fd) {
     int mask_val;
 
     printf("Writing the mask value 0x%x\n", mask_test_val);
-    rc = ioctl(fd, SW_IOCTL_SET_MASK, mask_test_val);
+    rc = ioctl(fd, PB_ZYBO_SW_IOCTL_SET_MASK, mask_test_val);
     if(rc) {
         printf("Unable to set the MASK value!\n");
         return RET_ERR;
     }
 
     printf("Trying to read mask value ...\n");
-    rc = ioctl(fd, SW_IOCTL_GET_MASK, &mask_val);
+    rc = ioctl(fd, PB_ZYBO_SW_IOCTL_GET_MASK, &mask_val);
     if(rc) {
         printf("Unable to read the mask value!\n");
         return RET_ERR;
@@ -106,7 +114,7 @@ static int ioctl_test_mask(int fd) {
         return RET_ERR;
     }
 
-    rc = ioctl(fd, SW_IOCTL_SET_MASK, 0xf);
+    rc = ioctl(fd, PB_ZYBO_SW_IOCTL_SET_MASK, 0xf);
     if(rc) {
         printf("Unable to reset the MASK value!\n");
         return RET_ERR;
@@ -116,42 +124,422 @@ static int ioctl_test_mask(int fd) {
     return RET_OK;
 }
 
-static int ioctl_loop_read(int fd) {
+/* ==================================================================
+ 		Switch change watch
+   ================================================================== */
+
+/**
+ * @brief Watch modes of the loop read - the driver poll (epoll on the device) or
+ * sampling of the value in the application
+ * 
+ */
+enum watch_mode {
+    WATCH_AUTO,
+    WATCH_POLL,
+    WATCH_SAMPLE,
+};
+
+/* Log2 histogram buckets - < 1 us, [1, 2) us, [2, 4) us, ... */
+#define HIST_BUCKETS 32
+/* Width of the histogram bar */
+#define HIST_BAR 40
+/* Maximal number of stored latencies for percentiles */
+#define MAX_EVENTS (1 << 20)
+
+struct watch_conf {
+    enum watch_mode mode;
+    unsigned int interval_us;   /* Sampling interval, 0 = tight loop */
+    unsigned int duration_s;    /* Watch time, 0 = until CTRL + C */
+    unsigned int spec_us;       /* Maximal detection latency, 0 = no check */
+    int quiet;                  /* Don't print events */
+};
+
+struct watch_stats {
+    enum watch_mode mode;       /* Used mode */
+    uint64_t start_ns;
+    uint64_t end_ns;
+    unsigned long samples;      /* Application samples (sampling mode) */
+    unsigned long events;       /* Detected changes */
+    unsigned long missed;       /* Changes detected by the driver, but merged by the application */
+    unsigned long over_spec;    /* Events with the latency over the spec */
+
+    uint64_t lat_min;           /* Detection latency (ns) */
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t *lat;              /* Stored latencies for percentiles */
+    unsigned long lat_cnt;
+    uint64_t notify_sum;        /* Driver detection -> application (poll mode) */
+    uint64_t notify_max;
+
+    uint64_t last_event_ns;     /* Time of the last change */
+    unsigned long lat_hist[HIST_BUCKETS];
+    unsigned long gap_hist[HIST_BUCKETS];
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return va < vb ? -1 : va > vb;
+}
+
+/* Nearest-rank percentile of the sorted array */
+static uint64_t percentile(const uint64_t *sorted, unsigned long n, double p) {
+    unsigned long idx = (unsigned long)(p * n + 0.999999);
+    return sorted[idx > 0 ? idx - 1 : 0];
+}
+
+/* Histogram bucket of the time in ns */
+static int hist_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = 0;
+
+    while (us && b < HIST_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static int watch_expired(const struct watch_conf *conf, const struct watch_stats *st) {
+    if (sig_int) {
+        return 1;
+    }
+    return conf->duration_s && now_ns() - st->start_ns >= conf->duration_s * 1000000000ULL;
+}
+
+/**
+ * @brief Record the detected change
+ * 
+ * @param lat Detection latency - from the last sample with the old value to the moment
+ * when the application has the new value (the upper bound of the change -> application time)
+ * @param notify Driver detection -> application time (0 in the sampling mode)
+ * @param ts Time of the change detection
+ */
+static void watch_event(const struct watch_conf *conf, struct watch_stats *st, unsigned int val,
+    uint64_t lat, uint64_t notify, uint64_t ts) {
+    if (st->events == 0 || lat < st->lat_min) {
+        st->lat_min = lat;
+    }
+    if (lat > st->lat_max) {
+        st->lat_max = lat;
+    }
+    st->lat_sum += lat;
+    st->notify_sum += notify;
+    if (notify > st->notify_max) {
+        st->notify_max = notify;
+    }
+    if (st->lat && st->lat_cnt < MAX_EVENTS) {
+        st->lat[st->lat_cnt++] = lat;
+    }
+    st->lat_hist[hist_bucket(lat)]++;
+    if (st->events) {
+        st->gap_hist[hist_bucket(ts - st->last_event_ns)]++;
+    }
+    if (conf->spec_us && lat > conf->spec_us * 1000ULL) {
+        st->over_spec++;
+    }
+
+    if (!conf->quiet) {
+        printf("Value: 0x%x, latency %.1f us", val, lat / 1e3);
+        if (st->events) {
+            printf(", since the last change %.3f ms", (ts - st->last_event_ns) / 1e6);
+        }
+        printf("\n");
+    }
+
+    st->last_event_ns = ts;
+    st->events++;
+}
+
+/**
+ * @brief Register the device in the epoll set
+ * 
+ * @return int Epoll descriptor or -1 iff the driver doesn't support poll (errno is set)
+ */
+static int watch_poll_open(int fd) {
+    struct epoll_event ev;
+    struct pb_zybo_sw_event sw_ev;
+    int epfd, err;
+
+    /* Drivers without the poll support fail with EPERM, older drivers don't know the event */
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_EVENT, &sw_ev)) {
+        return -1;
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd < 0) {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+        err = errno;
+        close(epfd);
+        errno = err;
+        return -1;
+    }
+    return epfd;
+}
+
+/**
+ * @brief Wait for changes reported by the driver - the driver samples the switch value
+ * and wakes up the epoll wait. The event has times of the driver samples.
+ * 
+ */
+static int watch_poll(int fd, int epfd, const struct watch_conf *conf, struct watch_stats *st) {
+    struct epoll_event ev;
+    struct pb_zybo_sw_event sw_ev;
+    uint32_t last_seq;
+    uint64_t t;
+    int n;
+
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_EVENT, &sw_ev)) {
+        printf("Unable to read the switch event!\n");
+        return RET_ERR;
+    }
+    last_seq = sw_ev.seq;
+    printf("Initial value: 0x%x\n", sw_ev.value);
+
+    while (!watch_expired(conf, st)) {
+        /* The timeout checks the watch time */
+        n = epoll_wait(epfd, &ev, 1, 100);
+        if (n < 0 && errno != EINTR) {
+            printf("Unable to wait for the switch change!\n");
+            return RET_ERR;
+        }
+        if (n <= 0) {
+            continue;
+        }
+
+        if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_EVENT, &sw_ev)) {
+            printf("Unable to read the switch event!\n");
+            return RET_ERR;
+        }
+        t = now_ns();
+        if (sw_ev.seq == last_seq) {
+            continue;
+        }
+
+        st->missed += sw_ev.seq - last_seq - 1;
+        last_seq = sw_ev.seq;
+        watch_event(conf, st, sw_ev.value, t - sw_ev.prev_ns, t - sw_ev.ts_ns, sw_ev.ts_ns);
+    }
+    return RET_OK;
+}
+
+/**
+ * @brief Sample the switch value in the loop with the absolute deadlines (or without any
+ * sleep for the zero interval).
+ * 
+ */
+static int watch_sample(int fd, const struct watch_conf *conf, struct watch_stats *st) {
+    struct timespec next;
+    uint64_t t0, t1, prev, deadline;
+    int val, last;
+
+    if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &last)) {
+        printf("Unable to read the current switch value!\n");
+        return RET_ERR;
+    }
+    prev = now_ns();
+    printf("Initial value: 0x%x\n", last);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!watch_expired(conf, st)) {
+        if (conf->interval_us) {
+            next.tv_nsec += conf->interval_us * 1000L;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+
+        t0 = now_ns();
+        if (ioctl(fd, PB_ZYBO_SW_IOCTL_GET_VALUE, &val)) {
+            printf("Unable to read the current switch value!\n");
+            return RET_ERR;
+        }
+        t1 = now_ns();
+        st->samples++;
+
+        /* The change happened after the start of the previous sample */
+        if (val != last) {
+            watch_event(conf, st, val, t1 - prev, 0, t0);
+            last = val;
+        }
+        prev = t0;
+
+        /* Don't catch up missed deadlines (the process was preempted) */
+        deadline = (uint64_t)next.tv_sec * 1000000000ULL + next.tv_nsec;
+        if (conf->interval_us && t1 > deadline + conf->interval_us * 1000ULL) {
+            clock_gettime(CLOCK_MONOTONIC, &next);
+        }
+    }
+    return RET_OK;
+}
+
+static void print_hist(const char *title, const unsigned long *hist) {
+    unsigned long max = 0;
+    int b, first = -1, last = -1;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b]) {
+            first = first < 0 ? b : first;
+            last = b;
+            max = hist[b] > max ? hist[b] : max;
+        }
+    }
+
+    printf("%s:\n", title);
+    if (first < 0) {
+        printf("\t(no data)\n");
+        return;
+    }
+
+    for (b = first; b <= last; b++) {
+        char bar[HIST_BAR + 1];
+        int len = (int)(hist[b] * HIST_BAR / max);
+
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        if (b == 0) {
+            printf("\t%10s < %-10lu us : %8lu %s\n", "", 1UL, hist[b], bar);
+        } else {
+            printf("\t%10lu - %-10lu us : %8lu %s\n", 1UL << (b - 1), 1UL << b, hist[b], bar);
+        }
+    }
+}
+
+static void print_summary(const struct watch_conf *conf, struct watch_stats *st) {
+    double run = (st->end_ns - st->start_ns) / 1e9;
+
+    print_box("Switch watch summary");
+    if (st->mode == WATCH_POLL) {
+        printf("* Mode: poll (driver sampling)\n");
+    } else {
+        printf("* Mode: sampling each %u us\n", conf->interval_us);
+    }
+    printf("* Run time: %.3f s\n", run);
+    if (st->mode == WATCH_SAMPLE && st->samples) {
+        printf("* Samples: %lu (avg period %.1f us)\n", st->samples, run * 1e6 / st->samples);
+    }
+    printf("* Events: %lu", st->events);
+    if (st->mode == WATCH_POLL) {
+        printf(" (merged changes: %lu)", st->missed);
+    }
+    printf("\n");
+
+    if (st->events) {
+        printf("* Detection latency [us]: min %.1f, avg %.1f", st->lat_min / 1e3, st->lat_sum / 1e3 / st->events);
+        if (st->lat_cnt) {
+            qsort(st->lat, st->lat_cnt, sizeof(uint64_t), cmp_u64);
+            printf(", p50 %.1f, p99 %.1f", percentile(st->lat, st->lat_cnt, 0.50) / 1e3,
+                percentile(st->lat, st->lat_cnt, 0.99) / 1e3);
+        }
+        printf(", max %.1f\n", st->lat_max / 1e3);
+        if (st->mode == WATCH_POLL) {
+            printf("* Notification latency [us]: avg %.1f, max %.1f\n", st->notify_sum / 1e3 / st->events,
+                st->notify_max / 1e3);
+        }
+    }
+    if (conf->spec_us) {
+        printf("* Latency spec %u us: %lu events over the limit - %s\n", conf->spec_us, st->over_spec,
+            st->over_spec ? "FAIL" : "PASS");
+    }
+
+    print_hist("Detection latency histogram", st->lat_hist);
+    print_hist("Inter-event time histogram", st->gap_hist);
+}
+
+static int ioctl_loop_read(int fd, const struct watch_conf *conf) {
     print_box("Starting the loop read\n.");
     printf("* Press the CTRL + C if you want to end.\n");
-    int rc;
-    int sw_val;
+    struct watch_stats st;
+    int rc, epfd = -1;
 
-    // Register signal handler and run the loop
-    signal(SIGINT, sig_handler);
-    while(sig_int == 0) {
-        rc = ioctl(fd, SW_IOCTL_GET_VALUE, &sw_val);
-        if(rc) {
-            printf("Unable to read the current switch value!\n");
-            signal(SIGINT, SIG_DFL);
+    memset(&st, 0, sizeof(st));
+    st.lat = malloc(MAX_EVENTS * sizeof(uint64_t));
+
+    /* Use the driver poll, sample the value iff poll isn't supported */
+    st.mode = WATCH_SAMPLE;
+    if (conf->mode != WATCH_SAMPLE) {
+        epfd = watch_poll_open(fd);
+        if (epfd >= 0) {
+            st.mode = WATCH_POLL;
+        } else if (conf->mode == WATCH_POLL) {
+            printf("The driver doesn't support poll (%s)!\n", strerror(errno));
+            free(st.lat);
             return RET_ERR;
+        } else {
+            printf("* The driver doesn't support poll (%s), sampling each %u us.\n", strerror(errno),
+                conf->interval_us);
         }
+    }
 
-        printf("Current value: 0x%x\n", sw_val);
-        sleep(1);
+    // Register signal handler and run the loop
+    signal(SIGINT, sig_handler);
+    st.start_ns = now_ns();
+    if (st.mode == WATCH_POLL) {
+        rc = watch_poll(fd, epfd, conf, &st);
+        close(epfd);
+    } else {
+        rc = watch_sample(fd, conf, &st);
     }
-    // Unregister & end
+    st.end_ns = now_ns();
+
+    // End - the handler stays registered until the exit, a repeated CTRL + C doesn't
+    // interrupt the summary
     printf("Loop read has been finished.\n");
-    signal(SIGINT, SIG_DFL);
-    return RET_OK;
+    print_summary(conf, &st);
+    free(st.lat);
+
+    if (rc == RET_OK && st.over_spec) {
+        rc = RET_ERR;
+    }
+    return rc;
 }
 
 int main(int argc, char **argv) {
     /* Parse input arguments */
     int opt;
     const char* dev = NULL;
+    struct watch_conf conf = {
+        .mode = WATCH_AUTO,
+        .interval_us = 100,
+    };
 
-    while ((opt = getopt(argc, argv, "hd:" )) != -1) {
+    while ((opt = getopt(argc, argv, "hd:m:i:t:s:q" )) != -1) {
         switch (opt) {
             case 'h' : print_help(); break;
             case 'd' : dev = optarg; break;
+            case 'm' :
+                if (strcmp(optarg, "auto") == 0) {
+                    conf.mode = WATCH_AUTO;
+                } else if (strcmp(optarg, "poll") == 0) {
+                    conf.mode = WATCH_POLL;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    conf.mode = WATCH_SAMPLE;
+                } else {
+                    printf("Unknown watch mode %s\n", optarg);
+                    return RET_ERR;
+                }
+                break;
+            case 'i' : conf.interval_us = strtoul(optarg, NULL, 0); break;
+            case 't' : conf.duration_s = strtoul(optarg, NULL, 0); break;
+            case 's' : conf.spec_us = strtoul(optarg, NULL, 0); break;
+            case 'q' : conf.quiet = 1; break;
             default:
-                printf("Unknown option %s\n", optopt);
+                print_help();
                 return RET_ERR;
         }
     }
@@ -165,12 +553,12 @@ int main(int argc, char **argv) {
     printf("\t* Using the device: %s\n", dev);  
  
     int fd = open(dev, O_RDWR);
-    if (!fd) {
+    if (fd < 0) {
         printf("Unable to open the device %s\n", dev);
         return RET_ERR;
     }
     CHECK_FUNC(ioctl_test_mask(fd), close(fd));
-    CHECK_FUNC(ioctl_loop_read(fd), close(fd));
+    CHECK_FUNC(ioctl_loop_read(fd, &conf), close(fd));
     close(fd);
     fd = 0;
 
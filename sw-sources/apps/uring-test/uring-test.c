@@ -0,0 +1,352 @@
+/*  uring-test.c - Test of io_uring commands of the PB Zybo device drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "pb-zybo-cmd.h"
+
+/* Some helping macros */
+#define RET_OK 0
+#define RET_ERR 1
+#define RET_SKIP 77
+
+#define RING_ENTRIES 64
+#define DEFAULT_ITERATIONS 1000
+
+/* Minimal io_uring ring - the tool doesn't depend on liburing */
+struct ring {
+    int fd;
+    unsigned flags;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *sq_flags;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+};
+
+struct test_conf {
+    const char *led_path;
+    const char *rgb_path;
+    const char *sw_path;
+    unsigned long iterations;
+    unsigned long waits;
+    int sqpoll;
+};
+
+static void print_help() {
+    printf("Tool for testing of io_uring commands (IORING_OP_URING_CMD) of the drivers.\n");
+    printf("It works with real devices or with the mock devices on any kernel with io_uring.\n");
+    printf("\n\n");
+    printf("\t-h = prints this help\n");
+    printf("\t-l = LED device (default /dev/led_module-0)\n");
+    printf("\t-r = RGB LED device (default /dev/rgb-led-module-0)\n");
+    printf("\t-s = switch device (default /dev/switch_module-0)\n");
+    printf("\t-n = number of iterations (default %d)\n", DEFAULT_ITERATIONS);
+    printf("\t-w = number of switch changes to wait for (default 0)\n");
+    printf("\t-q = use the SQPOLL ring (no system calls during the submission)\n");
+    return;
+}
+
+static void print_box(const char* msg) {
+    printf("=====================================================\n");
+    printf("%s\n", msg);
+    printf("=====================================================\n");
+    return;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int ring_init(struct ring *r, int sqpoll) {
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    uint8_t *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000;
+    }
+
+    r->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (r->fd < 0) {
+        printf("Unable to create the io_uring (%s)!\n", strerror(errno));
+        return RET_SKIP;
+    }
+
+    r->flags = p.flags;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+        printf("Unable to map the io_uring (%s)!\n", strerror(errno));
+        return RET_ERR;
+    }
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->to_submit = 0;
+    return RET_OK;
+}
+
+/* Queue the PB Zybo command, the SQE is published with the next ring_submit */
+static void ring_queue(struct ring *r, int fd, uint32_t op, uint32_t arg, uint64_t user_data) {
+    unsigned tail = *r->sq_tail + r->to_submit;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    struct pb_zybo_uring_cmd *cmd = (struct pb_zybo_uring_cmd *)sqe->cmd;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd;
+    sqe->cmd_op = op;
+    sqe->user_data = user_data;
+    cmd->arg = arg;
+    cmd->resv = 0;
+    r->sq_array[idx] = idx;
+    r->to_submit++;
+}
+
+/* Publish queued SQEs and wait for at least min_complete CQEs */
+static int ring_submit(struct ring *r, unsigned min_complete) {
+    unsigned flags = 0;
+    int rc;
+
+    __atomic_store_n(r->sq_tail, *r->sq_tail + r->to_submit, __ATOMIC_RELEASE);
+    if (r->flags & IORING_SETUP_SQPOLL) {
+        /* The kernel thread consumes SQEs, enter only to wake it or to wait */
+        if (__atomic_load_n(r->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        r->to_submit = 0;
+        if (!flags && !min_complete)
+            return RET_OK;
+    }
+    if (min_complete)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    rc = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete, flags, NULL, 0);
+    r->to_submit = 0;
+    if (rc < 0) {
+        printf("io_uring_enter failed (%s)!\n", strerror(errno));
+        return RET_ERR;
+    }
+    return RET_OK;
+}
+
+/* Take one CQE, returns 0 iff the completion was available */
+static int ring_reap(struct ring *r, struct io_uring_cqe *out) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return -1;
+    *out = r->cqes[head & *r->cq_mask];
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int wait_cqe(struct ring *r, struct io_uring_cqe *cqe) {
+    while (ring_reap(r, cqe) != 0) {
+        if (ring_submit(r, 1) != RET_OK)
+            return RET_ERR;
+    }
+    return RET_OK;
+}
+
+/* Check that the driver implements the io_uring commands (read the switch value) */
+static int test_support(struct ring *r, int sw_fd) {
+    struct io_uring_cqe cqe;
+
+    ring_queue(r, sw_fd, PB_ZYBO_CMD_SW_GET, 0, 0);
+    if (ring_submit(r, 1) != RET_OK || wait_cqe(r, &cqe) != RET_OK)
+        return RET_ERR;
+
+    if (cqe.res == -EOPNOTSUPP || cqe.res == -EINVAL) {
+        printf("The kernel or the driver doesn't support io_uring commands (%s), skipping.\n",
+            strerror(-cqe.res));
+        return RET_SKIP;
+    }
+    if (cqe.res < 0) {
+        printf("Switch read failed (%s)!\n", strerror(-cqe.res));
+        return RET_ERR;
+    }
+    printf("Switch value 0x%x\n", cqe.res);
+    return RET_OK;
+}
+
+/* Queue LED set, RGB set and switch read per iteration and check all completions */
+static int test_commands(struct ring *r, int led_fd, int rgb_fd, int sw_fd, unsigned long iterations) {
+    struct io_uring_cqe cqe;
+    unsigned long i;
+    uint64_t start;
+    int j;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        ring_queue(r, led_fd, PB_ZYBO_CMD_LED_SET, i & 0xf, 1);
+        ring_queue(r, rgb_fd, PB_ZYBO_CMD_RGB_SET, i & 0xffffff, 2);
+        ring_queue(r, sw_fd, PB_ZYBO_CMD_SW_GET, 0, 3);
+        if (ring_submit(r, 3) != RET_OK)
+            return RET_ERR;
+
+        for (j = 0; j < 3; j++) {
+            if (wait_cqe(r, &cqe) != RET_OK)
+                return RET_ERR;
+            if (cqe.res < 0) {
+                printf("Command %llu failed (%s)!\n", (unsigned long long)cqe.user_data, strerror(-cqe.res));
+                return RET_ERR;
+            }
+        }
+    }
+    printf("%lu iterations (3 commands each), %llu ns per iteration\n", iterations,
+        (unsigned long long)((now_ns() - start) / iterations));
+    return RET_OK;
+}
+
+/* Wait for switch changes asynchronously - one pending command at a time */
+static int test_waits(struct ring *r, int sw_fd, unsigned long waits) {
+    struct io_uring_cqe cqe;
+    uint32_t last;
+    unsigned long i;
+
+    ring_queue(r, sw_fd, PB_ZYBO_CMD_SW_GET, 0, 0);
+    if (ring_submit(r, 1) != RET_OK || wait_cqe(r, &cqe) != RET_OK || cqe.res < 0)
+        return RET_ERR;
+    last = cqe.res;
+
+    for (i = 0; i < waits; i++) {
+        printf("Waiting for the switch change (current value 0x%x) ...\n", last);
+        ring_queue(r, sw_fd, PB_ZYBO_CMD_SW_WAIT, last, i);
+        if (ring_submit(r, 1) != RET_OK || wait_cqe(r, &cqe) != RET_OK)
+            return RET_ERR;
+        if (cqe.res < 0) {
+            printf("Switch wait failed (%s)!\n", strerror(-cqe.res));
+            return RET_ERR;
+        }
+        printf("Switch changed 0x%x -> 0x%x\n", last, cqe.res);
+        last = cqe.res;
+    }
+    return RET_OK;
+}
+
+int main(int argc, char** argv) {
+    struct test_conf conf = {
+        .led_path = "/dev/led_module-0",
+        .rgb_path = "/dev/rgb-led-module-0",
+        .sw_path = "/dev/switch_module-0",
+        .iterations = DEFAULT_ITERATIONS,
+        .waits = 0,
+        .sqpoll = 0,
+    };
+    int led_fd = -1, rgb_fd = -1, sw_fd = -1;
+    struct ring r;
+    int ret = RET_ERR;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hl:r:s:n:w:q")) != -1) {
+        switch (opt) {
+            case 'l':
+                conf.led_path = optarg;
+                break;
+            case 'r':
+                conf.rgb_path = optarg;
+                break;
+            case 's':
+                conf.sw_path = optarg;
+                break;
+            case 'n':
+                conf.iterations = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                conf.waits = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                conf.sqpoll = 1;
+                break;
+            case 'h':
+            default:
+                print_help();
+                return RET_OK;
+        }
+    }
+
+    led_fd = open(conf.led_path, O_RDWR);
+    rgb_fd = open(conf.rgb_path, O_RDWR);
+    sw_fd = open(conf.sw_path, O_RDWR);
+    if (led_fd < 0 || rgb_fd < 0 || sw_fd < 0) {
+        printf("Unable to open devices (%s)!\n", strerror(errno));
+        goto cleanup;
+    }
+
+    ret = ring_init(&r, conf.sqpoll);
+    if (ret != RET_OK)
+        goto cleanup;
+
+    print_box("Checking the io_uring command support");
+    ret = test_support(&r, sw_fd);
+    if (ret != RET_OK)
+        goto cleanup;
+
+    print_box(conf.sqpoll ? "Queued commands (SQPOLL)" : "Queued commands");
+    ret = test_commands(&r, led_fd, rgb_fd, sw_fd, conf.iterations);
+    if (ret != RET_OK)
+        goto cleanup;
+
+    if (conf.waits) {
+        print_box("Asynchronous switch-change waits");
+        ret = test_waits(&r, sw_fd, conf.waits);
+        if (ret != RET_OK)
+            goto cleanup;
+    }
+
+    print_box("All tests passed");
+
+cleanup:
+    if (led_fd >= 0)
+        close(led_fd);
+    if (rgb_fd >= 0)
+        close(rgb_fd);
+    if (sw_fd >= 0)
+        close(sw_fd);
+    return ret;
+}
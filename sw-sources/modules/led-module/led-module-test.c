@@ -0,0 +1,200 @@
+/*  led-module-test.c - KUnit tests of the Zybo base LED driver
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The file is included at the end of led-module.c, so static helpers can be tested
+ * directly. The LED register lives in a RAM window, no HW is needed. */
+
+#include <kunit/test.h>
+
+/* Size of the RAM window with the LED register */
+#define LED_TEST_WINDOW 64
+
+/**
+ * @brief Test context - the device with registers in RAM and the opened file
+ *
+ */
+struct led_test_ctx {
+	struct led_module_local *lp;
+	struct led_file_ctx *fctx;
+	u32 *regs;
+	struct file *file;
+};
+
+static u32 led_test_reg(struct led_test_ctx *tc) {
+	return tc->regs[LED_OFFSET / 4];
+}
+
+static int led_test_init(struct kunit *test) {
+	struct led_test_ctx *tc;
+	int rc;
+
+	tc = kunit_kzalloc(test, sizeof(*tc), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc);
+	tc->lp = kunit_kzalloc(test, sizeof(*tc->lp), GFP_KERNEL);
+	tc->fctx = kunit_kzalloc(test, sizeof(*tc->fctx), GFP_KERNEL);
+	tc->regs = kunit_kzalloc(test, LED_TEST_WINDOW, GFP_KERNEL);
+	tc->file = kunit_kzalloc(test, sizeof(*tc->file), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc->lp);
+	KUNIT_ASSERT_NOT_NULL(test, tc->fctx);
+	KUNIT_ASSERT_NOT_NULL(test, tc->regs);
+	KUNIT_ASSERT_NOT_NULL(test, tc->file);
+
+	/* Same state as after the probe */
+	tc->lp->led_io_conf.led_init_val = LED_INIT_VALUE;
+	tc->lp->led_io_conf.led_mask_val = LED_INIT_MASK;
+	rc = pb_zybo_test_dev_init(&tc->lp->pd, tc->regs, &led_module_regmap_config, tc->lp);
+	KUNIT_ASSERT_EQ(test, rc, 0);
+	KUNIT_ASSERT_EQ(test, pb_zybo_regcache_seed(&tc->lp->pd, LED_OFFSET), 0);
+
+	tc->fctx->lp = tc->lp;
+	tc->fctx->pf.pd = &tc->lp->pd;
+	tc->fctx->pf.can_write = true;
+	tc->file->private_data = tc->fctx;
+	test->priv = tc;
+	return 0;
+}
+
+static void led_test_exit(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+	pb_zybo_test_dev_exit(&tc->lp->pd);
+}
+
+static void led_test_write_mask(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	write_led_data(0xff, tc->lp, 0x0f);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x0fU);
+	write_led_data(0xa5, tc->lp, 0xf0);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0xa0U);
+	write_led_data(0xff, tc->lp, 0x00);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x00U);
+}
+
+static void led_test_write_keeps_upper_bits(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	/* Bits above the LED data (e.g., set by the PL) survive the update */
+	tc->regs[LED_OFFSET / 4] = 0x1200;
+	KUNIT_ASSERT_EQ(test, pb_zybo_regcache_seed(&tc->lp->pd, LED_OFFSET), 0);
+	write_led_data(0x05, tc->lp, LED_INIT_MASK);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x1205U);
+}
+
+static void led_test_write_elided(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+	unsigned long writes;
+
+	write_led_data(0x3, tc->lp, LED_INIT_MASK);
+	writes = tc->lp->pd.mmio_writes;
+
+	/* Values equal after masking don't touch the bus */
+	write_led_data(0x3, tc->lp, LED_INIT_MASK);
+	write_led_data(0xf3, tc->lp, LED_INIT_MASK);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_writes, writes);
+}
+
+static void led_test_write_stamp(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+	u64 before = ktime_get_ns();
+
+	/* Each update is stamped with the masked value */
+	write_led_data(0xf6, tc->lp, LED_INIT_MASK);
+	KUNIT_EXPECT_EQ(test, tc->lp->stamp.value, 0x6U);
+	KUNIT_EXPECT_EQ(test, tc->lp->stamp.seq, 1U);
+	KUNIT_EXPECT_GE(test, tc->lp->stamp.ts_ns, before);
+	KUNIT_EXPECT_LE(test, tc->lp->stamp.ts_ns, ktime_get_ns());
+
+	write_led_data(0x6, tc->lp, LED_INIT_MASK);
+	KUNIT_EXPECT_EQ(test, tc->lp->stamp.seq, 2U);
+}
+
+static void led_test_ioctl_mask(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_VALUE, 0xff), 0L);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), (u32)LED_INIT_MASK);
+
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_MASK, 0x3), 0L);
+	KUNIT_EXPECT_EQ(test, tc->lp->led_io_conf.led_mask_val, 0x3);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_VALUE, 0xe), 0L);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x2U);
+}
+
+static void led_test_ioctl_reset(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_INIT, 0xa), 0L);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_MASK, 0xc), 0L);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_RESET, 0), 0L);
+	/* The init value is masked too */
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x8U);
+}
+
+static void led_test_ioctl_shared_numbers(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	/* Numbers of pb-zybo-ioctl.h work as the original ones */
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, PB_ZYBO_LED_IOCTL_SET_MASK, 0x5), 0L);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, PB_ZYBO_LED_IOCTL_SET_VALUE, 0xf), 0L);
+	KUNIT_EXPECT_EQ(test, led_test_reg(tc), 0x5U);
+
+	/* Calls of other drivers are rejected */
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, PB_ZYBO_RGB_IOCTL_INIT, 0), (long)-ENOTTY);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, PB_ZYBO_SW_IOCTL_SET_MASK, 0x1), (long)-ENOTTY);
+	KUNIT_EXPECT_EQ(test, tc->lp->led_io_conf.led_mask_val, 0x5);
+}
+
+static void led_test_ioctl_no_perm(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	tc->fctx->pf.can_write = false;
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_INIT, 0xa), (long)-EPERM);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_MASK, 0x3), (long)-EPERM);
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, LED_IOCTL_SET_VALUE, 0xff), (long)-EPERM);
+	KUNIT_EXPECT_EQ(test, tc->lp->led_io_conf.led_mask_val, LED_INIT_MASK);
+}
+
+static void led_test_ioctl_unknown(struct kunit *test) {
+	struct led_test_ctx *tc = test->priv;
+
+	KUNIT_EXPECT_EQ(test, led_module_ioctl(tc->file, _IO(LED_IOCTL_MAGIC, 0x7f), 0), (long)-ENOTTY);
+	KUNIT_EXPECT_EQ(test, down_trylock(&tc->lp->pd.sem), 0);
+	up(&tc->lp->pd.sem);
+}
+
+static struct kunit_case led_module_test_cases[] = {
+	KUNIT_CASE(led_test_write_mask),
+	KUNIT_CASE(led_test_write_keeps_upper_bits),
+	KUNIT_CASE(led_test_write_elided),
+	KUNIT_CASE(led_test_write_stamp),
+	KUNIT_CASE(led_test_ioctl_mask),
+	KUNIT_CASE(led_test_ioctl_reset),
+	KUNIT_CASE(led_test_ioctl_shared_numbers),
+	KUNIT_CASE(led_test_ioctl_no_perm),
+	KUNIT_CASE(led_test_ioctl_unknown),
+	{}
+};
+
+static struct kunit_suite led_module_test_suite = {
+	.name = "pb-zybo-led",
+	.init = led_test_init,
+	.exit = led_test_exit,
+	.test_cases = led_module_test_cases,
+};
+kunit_test_suite(led_module_test_suite);
@@ -32,8 +32,13 @@
 #include <linux/of_address.h>
 #include <linux/of_device.h>
 #include <linux/of_platform.h>
+#include <linux/regmap.h>
 
-/* Declare IOCTL handlers */
+#include "pb-zybo-core.h"
+#include "pb-zybo-cmd.h"
+#include "pb-zybo-ioctl.h"
+
+/* Original IOCTL handlers (see pb-zybo-ioctl.h for current numbers) */
 #define LED_IOCTL_MAGIC				'l'
 #define LED_IOCTL_GET_INIT 			_IOR(LED_IOCTL_MAGIC, 0, int)
 #define LED_IOCTL_SET_INIT			_IOW(LED_IOCTL_MAGIC, 1, int)
@@ -55,6 +60,7 @@
 /* Helping constants */
 #define LED_INIT_VALUE 0x0
 #define LED_OFFSET 0x0
+#define LED_DATA_MASK 0xFF
 
 /**
  * @brief Structure with driver settings relate to the HW
@@ -75,33 +81,56 @@ struct led_module_local {
 	unsigned long 			mem_end;		/* End of IO memory */
 	void __iomem 			*base_addr;		/* Base address of iomaped region */
 
-	struct class			*sysclass;		/* sysfs class for the device */
-	struct device			*device;		/* Allocated device structure */
-
-	dev_t					devid;			/* Allocated device ID for MAJOR and MINOR */
-	struct semaphore 		sem;			/* Semaphore for the mutual access to read/write */
-	struct cdev   			cdev; 			/* Characted device structure */
+	struct pb_zybo_dev		pd;				/* Registered cdev, device and semaphore */
 
 	struct led_io_config	led_io_conf;	/* Configuration of the LED driver */
+	struct pb_zybo_out_stamp stamp;			/* Last LED update (PB_ZYBO_LED_IOCTL_GET_STAMP) */
+};
+
+/**
+ * @brief Per-open file context - the core part keeps the permission captured
+ * during the open for io_uring commands
+ * 
+ */
+struct led_file_ctx {
+	struct pb_zybo_file		pf;				/* Core part - CAP_SYS_ADMIN captured during the open */
+	struct led_module_local	*lp;			/* Parent device structure */
 };
 
 /**
  * @brief Initial method for data writing into the HW
  * 
  * @param led_data LED data to write
- * @param addr Destination address
+ * @param lp Local device structure
  * @param Mask used for the IO operation
  */
-static void write_led_data(u8 led_data, volatile void __iomem *addr, u8 mask) {
+static void write_led_data(u8 led_data, struct led_module_local *lp, u8 mask) {
 	/* The ARM version is using the WBM before any IO operation, the WMB is inserted
 	if you want to port it on different device */
 	u8 write_data = led_data & mask;
-	iowrite8(write_data, addr);
+
+	/* The register value is taken from the cache, unchanged values are not written */
+	regmap_update_bits(lp->pd.regmap, LED_OFFSET, LED_DATA_MASK, write_data);
 	#if !defined(CONFIG_ARM)
 	wmb();
 	#endif
+
+	/* Callers hold the device semaphore */
+	lp->stamp.value = write_data;
+	lp->stamp.seq++;
+	lp->stamp.ts_ns = ktime_get_ns();
 }
 
+/**
+ * @brief Register map of the device - the LED data register is cached
+ * 
+ */
+static const struct regmap_config led_module_regmap_config = {
+	.name = "led",
+	.max_register = LED_OFFSET,
+	.cache_type = REGCACHE_FLAT,
+};
+
 /* ==================================================================
  		Char device callbacks
    ================================================================== */
@@ -113,77 +142,97 @@ static void write_led_data(u8 led_data, volatile void __iomem *addr, u8 mask) {
 #endif
 
 static long led_module_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct led_file_ctx		*ctx;
 	struct led_module_local *lp;
 	struct led_io_config	*lc;
 	long rc;
 
-	lp = file->private_data;
+	ctx = file->private_data;
+	lp = ctx->lp;
 	lc = &lp->led_io_conf;
-	rc = 0;
+	pb_zybo_ioctl_enter(&lp->pd, cmd, arg);
 
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is being used by a different process.\n");
-		return -ERESTARTSYS;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
+		return rc;
 	}
 
-	IOCTL_DEBUG_PRINT(lp->device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
+	IOCTL_DEBUG_PRINT(lp->pd.device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
 	/* Generally, we allow to read data without a superuser account.
 	Writing is, on the other hand allowed to the owner of the device or
-	to a user which has the SYSADMIN capability.
+	to a user which has the SYSADMIN capability (checked once during the open).
 	
 	The we are returning the value by a pointer passed via the \p arg argument
 	*/
 	switch (cmd) {
 	case LED_IOCTL_GET_INIT:
+	case PB_ZYBO_LED_IOCTL_GET_INIT:
 		rc = put_user(lc->led_init_val, (int __user*) arg);
-		IOCTL_DEBUG_PRINT(lp->device, "Sending the init value 0x%x (rc = %ld)\n",lc->led_init_val,rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the init value 0x%x (rc = %ld)\n",lc->led_init_val,rc);
 		break;
 	case LED_IOCTL_SET_INIT:
-		if (!capable(CAP_SYS_ADMIN)) {
-			IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set the init value\n");
-			return -EPERM;
+	case PB_ZYBO_LED_IOCTL_SET_INIT:
+		if (!ctx->pf.can_write) {
+			IOCTL_DEBUG_PRINT(lp->pd.device,"User is not capable to set the init value\n");
+			rc = -EPERM;
+			break;
 		}
 		lc->led_init_val = arg;
 		rc = 0;
-		IOCTL_DEBUG_PRINT(lp->device, "Setting the init value 0x%x (rc = %ld)\n",lc->led_init_val,rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Setting the init value 0x%x (rc = %ld)\n",lc->led_init_val,rc);
 		break;
 	case LED_IOCTL_GET_MASK:
+	case PB_ZYBO_LED_IOCTL_GET_MASK:
 		rc = put_user(lc->led_mask_val, (int __user*) arg);
-		IOCTL_DEBUG_PRINT(lp->device, "Sending the mask value 0x%x (rc = %ld)\n",lc->led_mask_val,rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the mask value 0x%x (rc = %ld)\n",lc->led_mask_val,rc);
 		break;
 	case LED_IOCTL_SET_MASK:
-		if (!capable(CAP_SYS_ADMIN)) {
-			IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set the mask value\n");
-			return -EPERM;
+	case PB_ZYBO_LED_IOCTL_SET_MASK:
+		if (!ctx->pf.can_write) {
+			IOCTL_DEBUG_PRINT(lp->pd.device,"User is not capable to set the mask value\n");
+			rc = -EPERM;
+			break;
 		}
 		rc = 0;
 		lc->led_mask_val = arg;
-		IOCTL_DEBUG_PRINT(lp->device, "Setting the init value 0x%x (rc = %ld)\n",lc->led_mask_val,rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Setting the init value 0x%x (rc = %ld)\n",lc->led_mask_val,rc);
 		break;
 	case LED_IOCTL_SET_VALUE:
-		if (!capable(CAP_SYS_ADMIN)) {
-			IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set led value\n");
-			return -EPERM;
+	case PB_ZYBO_LED_IOCTL_SET_VALUE:
+		if (!ctx->pf.can_write) {
+			IOCTL_DEBUG_PRINT(lp->pd.device,"User is not capable to set led value\n");
+			rc = -EPERM;
+			break;
 		}
 		rc = 0;
-		IOCTL_DEBUG_PRINT(lp->device, "Received the led value 0x%lx (rc = %ld)\n",arg,rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Received the led value 0x%lx (rc = %ld)\n",arg,rc);
 		/* So far so good, set the LED based on value */
-		write_led_data(arg, lp->base_addr + LED_OFFSET, lc->led_mask_val);
+		write_led_data(arg, lp, lc->led_mask_val);
 
 		break;
 	case LED_IOCTL_RESET:
-		write_led_data(lc->led_init_val, lp->base_addr + LED_OFFSET, lc->led_mask_val);
-		IOCTL_DEBUG_PRINT(lp->device, "Resetting the LED value\n");
+	case PB_ZYBO_LED_IOCTL_RESET:
+		write_led_data(lc->led_init_val, lp, lc->led_mask_val);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Resetting the LED value\n");
 		rc = 0;
 		break;
+	case PB_ZYBO_LED_IOCTL_GET_STAMP:
+		rc = 0;
+		if (copy_to_user((void __user*) arg, &lp->stamp, sizeof(lp->stamp))) {
+			rc = -EFAULT;
+		}
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the update %u, value 0x%x (rc = %ld)\n", lp->stamp.seq, lp->stamp.value, rc);
+		break;
 	default:
-		dev_info(lp->device, "Invalid IOCTL cmd = 0x%08x\n", cmd);
+		dev_info(lp->pd.device, "Invalid IOCTL cmd = 0x%08x\n", cmd);
 		rc = -ENOTTY;
 		break;
 	}
 
-	IOCTL_DEBUG_PRINT(lp->device, "IOCTL Handler has been finished (rc = %ld)\n", rc);
-	up(&lp->sem);
+	IOCTL_DEBUG_PRINT(lp->pd.device, "IOCTL Handler has been finished (rc = %ld)\n", rc);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
 	return rc;
 }
 
@@ -194,15 +243,15 @@ static loff_t led_module_cdev_llseek(struct file *file, loff_t offset, int whenc
 	struct led_io_config *lc;
 	loff_t rc;
 
-	lp = file->private_data;
+	lp = ((struct led_file_ctx *)file->private_data)->lp;
 	lc = &lp->led_io_conf;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		return rc;
 	}
 
 	/* Restart the status and seek the offset based on whence */
-	write_led_data(lc->led_init_val, LED_OFFSET, lc->led_mask_val);
+	write_led_data(lc->led_init_val, lp, lc->led_mask_val);
 	switch (whence) {
 		case SEEK_SET: /* Set from the beginning */
 			rc = offset;
@@ -217,7 +266,8 @@ static loff_t led_module_cdev_llseek(struct file *file, loff_t offset, int whenc
 	}
 	
 	/* Put the semaphore up and return the new llseek value */
-	up(&lp->sem);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_LLSEEK, 0, rc);
 	return rc;
 }
 
@@ -238,11 +288,11 @@ static ssize_t led_module_cdev_write(struct file *file, const char __user *buff,
 	u8 drv_buff[BUFF_SIZE];
 
 	/* Try to lock the device, we need to exit if the process is waken up - we don't want to hang there */
-	lp = file->private_data;
+	lp = ((struct led_file_ctx *)file->private_data)->lp;
 	lc = &lp->led_io_conf;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		return rc;
 	}
 
 	/* Get the data, write them to the device and update offsets, etc */
@@ -254,7 +304,7 @@ static ssize_t led_module_cdev_write(struct file *file, const char __user *buff,
 	/* Copy data from the user space, the function returns 0 iff all data were copied from the
 	  user space */
 	if (copy_from_user(drv_buff, buff, to_copy)) {
-		dev_err(lp->device, "Cannot read data from the user space in cdev write routine.\n");
+		dev_err(lp->pd.device, "Cannot read data from the user space in cdev write routine.\n");
 		rc = -EFAULT;
 		goto cdev_write_out;
 	}
@@ -262,7 +312,7 @@ static ssize_t led_module_cdev_write(struct file *file, const char __user *buff,
 	for (idx = 0; idx < to_copy; idx++) {
 		/* Skip null charactets new lines and null characters */
 		if (drv_buff[idx] != '\0' &&  drv_buff[idx] != '\n') {
-			write_led_data(drv_buff[idx], lp->base_addr + LED_OFFSET, lc->led_mask_val);
+			write_led_data(drv_buff[idx], lp, lc->led_mask_val);
 		}
 
 		*f_pos += 1;
@@ -272,25 +322,34 @@ static ssize_t led_module_cdev_write(struct file *file, const char __user *buff,
 	rc = to_copy;
 
 	cdev_write_out: 
-		up(&lp->sem);
+		pb_zybo_up(&lp->pd);
 
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_WRITE, rc > 0 ? rc : 0, rc);
 	return rc;
 }
 
 static int led_module_cdev_open(struct inode *inode, struct file *filp) {
 	/* The driver there needs to check if the device was opened for writing, reading is not allowed there
 	because it doesn't make any sense to read how LEDs are shining. */
-	struct led_module_local *lp;
+	struct led_file_ctx *ctx;
+
+	/* Allocate the per-open context and store it into the file_private data for other calls */
+	ctx = kzalloc(sizeof(struct led_file_ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
 
-	/* Get the local structure and store it into the file_private data for other calls */
-	lp = container_of(inode->i_cdev, struct led_module_local, cdev);
-	filp->private_data = lp;
+	ctx->lp = container_of(inode->i_cdev, struct led_module_local, pd.cdev);
+	pb_zybo_file_init(&ctx->pf, &ctx->lp->pd);
+	filp->private_data = ctx;
 
 	return 0;
 }
 
 static int led_module_cdev_release(struct inode *inode, struct file *filp) {
-	/* Nothing special to do here ... */
+	/* Release the per-open context */
+	kfree(filp->private_data);
+	filp->private_data = NULL;
 	return 0;
 }
 
@@ -299,7 +358,7 @@ static int led_module_cdev_release(struct inode *inode, struct file *filp) {
  * kernel
  * 
  */
-struct file_operations fops = {
+static const struct file_operations fops = {
 	.owner = THIS_MODULE,
 	.llseek = led_module_cdev_llseek,
 	.read = led_module_cdev_read,
@@ -307,150 +366,124 @@ struct file_operations fops = {
 	.open = led_module_cdev_open,
 	.release = led_module_cdev_release,
 	.unlocked_ioctl = led_module_ioctl,
+#ifdef PB_ZYBO_HAS_URING_CMD
+	.uring_cmd = pb_zybo_uring_cmd,
+#endif
 };
 
-static int led_module_cdev_init(struct platform_device *pdev) {
-	int rc = 0;
-	struct device *dev = &pdev->dev;
-	struct led_module_local *lp = dev_get_drvdata(dev);
-	unsigned int n_major = 0;
-	unsigned int n_minor = 0;
-
-	dev_info(dev, "running the cdev init.\n");
-	/* Prepare the samaphore - one device is allowed to work with the
-	 led driver */
-	sema_init(&lp->sem, 1);
-
-	/* Dynamic allocation of Major number for the cdev */
-	rc = alloc_chrdev_region(&lp->devid, 0, 1, DRIVER_NAME);
-	if (rc < 0) {
-		dev_err(dev, "error during the MAJOR and MINOR allocation\n");
-		return rc;
-	}
-
-	n_major = MAJOR(lp->devid);
-	n_minor = MINOR(lp->devid);
-	dev_info(dev, "cdev init MAJOR=%d and MINOR=%d\n",n_major, n_minor);
-
-	/* create sysfs class to have easier access to it */
-    lp->sysclass = class_create(THIS_MODULE, DRIVER_SYSFS_CLASS);
-	if (IS_ERR(lp->sysclass)) {
-		dev_err(dev, "error during the sysfs class creation\n");
-		rc = -EFAULT;
-		goto cdev_add_err;
-	}
-
-	/* Register the cdev into the kernel */
-	cdev_init(&lp->cdev, &fops);
-	lp->cdev.owner = THIS_MODULE;
-
-	rc = cdev_add(&lp->cdev, lp->devid, 1);
-	if (rc < 0)  {
-		dev_err(dev, "error during the cdev_add operation");
-		goto cdev_release_sysfsclass;
-	}
+/**
+ * @brief Execute one batched command (/dev/pb-zybo-cmd), the device semaphore
+ * is held by the core
+ * 
+ * @param pd Device instance
+ * @param op Command operation
+ * @param arg Command argument
+ * @param val Output value
+ * @return long 0 iff the command was executed
+ */
+static long led_module_cmd_exec(struct pb_zybo_dev *pd, u32 op, u32 arg, u32 *val) {
+	struct led_module_local *lp = container_of(pd, struct led_module_local, pd);
 
-	/* Create a device in /dev and register it to the sysfs */
-	lp->device = device_create(lp->sysclass, dev, lp->devid, NULL, DEVICE_ID_STR, lp->devid);
-	if(IS_ERR(lp->device)) {
-		dev_err(dev, "error during the device creation.\n");
-		rc = -EFAULT;
-		goto cdev_del_device;
+	if (op != PB_ZYBO_CMD_LED_SET) {
+		return -EINVAL;
 	}
 
+	write_led_data(arg, lp, lp->led_io_conf.led_mask_val);
 	return 0;
-
-	/* Error handlers */
-	cdev_del_device:
-		cdev_del(&lp->cdev);
-	cdev_release_sysfsclass:
-		class_destroy(lp->sysclass);
-		lp->sysclass = NULL;
-	cdev_add_err:
-		unregister_chrdev_region(lp->devid, 1);
-	return rc;
 }
 
-static void led_module_cdev_exit(struct platform_device *pdev) {
-	/* Deallocate already allocated structures */
-	struct device *dev = &pdev->dev;
-	struct led_module_local *lp = dev_get_drvdata(dev);
-	dev_info(dev, "Running the cdev exit");
-	device_destroy(lp->sysclass, lp->devid);
-	cdev_del(&lp->cdev);
-	class_destroy(lp->sysclass);
-	lp->sysclass = NULL;
-	unregister_chrdev_region(lp->devid, 1);
+/**
+ * @brief Free the removed device after the last open file is closed
+ * 
+ * @param pd Device instance
+ */
+static void led_module_release(struct pb_zybo_dev *pd) {
+	kfree(container_of(pd, struct led_module_local, pd));
 }
 
+/**
+ * @brief Driver type registered in the pb-zybo core, it is shared by
+ * all LED device instances
+ * 
+ */
+static struct pb_zybo_type led_module_type = {
+	.name = DRIVER_SYSFS_CLASS,
+	.devname_fmt = DEVICE_ID_STR,
+	.fops = &fops,
+	.kind = PB_ZYBO_KIND_LED,
+	.cmd_exec = led_module_cmd_exec,
+	.release = led_module_release,
+};
+
 /* ==================================================================
  		Platform dependent callbacks
    ================================================================== */
 
 static int led_module_probe(struct platform_device *pdev) {
-	struct resource *r_mem; /* IO mem resources */
 	struct device *dev = &pdev->dev;
 	struct led_module_local *lp = NULL;
-	unsigned long mem_region_size = 0;
-
+	u64 start = ktime_get_ns();
+	bool loaded = false;
 	int rc = 0;
-	dev_info(dev, "Device Tree Probing\n");
-	/* Get iospace for the device */
-	r_mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	if (!r_mem) {
-		dev_err(dev, "invalid address\n");
-		return -ENODEV;
-	}
+
 	lp = (struct led_module_local *) kzalloc(sizeof(struct led_module_local), GFP_KERNEL);
 	if (!lp) {
 		dev_err(dev, "Cound not allocate led-module device\n");
 		return -ENOMEM;
 	}
 	dev_set_drvdata(dev, lp);
-	lp->mem_start = r_mem->start;
-	lp->mem_end = r_mem->end;
-	mem_region_size = lp->mem_end - lp->mem_start + 1;
 
 	/* Setup LED IO structure with default value */
 	lp->led_io_conf.led_init_val = LED_INIT_VALUE;
 	lp->led_io_conf.led_mask_val = LED_INIT_MASK;
 
-	/* Reserve the memory region acessed by the driver */
-	if (!request_mem_region(lp->mem_start,
-				mem_region_size,
-				DRIVER_NAME)) {
-		dev_err(dev, "Couldn't lock memory region at %p\n",
-			(void *)lp->mem_start);
-		rc = -EBUSY;
+	/* Reserve the memory region acessed by the driver and remap it to the virtual kernel space */
+	lp->base_addr = pb_zybo_ioremap(pdev, DRIVER_NAME, &lp->mem_start, &lp->mem_end);
+	if (IS_ERR(lp->base_addr)) {
+		rc = PTR_ERR(lp->base_addr);
 		goto mem_region_err;
 	}
 
-	/* Remap the IO space to the virtual kernel space */
-	lp->base_addr = ioremap(lp->mem_start, mem_region_size);
-	if (!lp->base_addr) {
-		dev_err(dev, "led-module: Could not allocate iomem\n");
-		rc = -EIO;
-		goto ioremap_err;
-	}
-
-	dev_info(dev,"led-module at 0x%08x mapped to 0x%08x \n",
+	dev_dbg(dev, "led-module at 0x%08x mapped to 0x%08x\n",
 		(unsigned int __force)lp->mem_start,
 		(unsigned int __force)lp->base_addr);
 
+	/* Register map with the cache loaded from the current LED value */
+	rc = pb_zybo_regmap_init(&lp->pd, dev, lp->base_addr, &led_module_regmap_config);
+	if (rc) {
+		goto regmap_err;
+	}
+
+	rc = pb_zybo_regcache_seed(&lp->pd, LED_OFFSET);
+	if (rc) {
+		dev_err(dev, "Unable to read the LED register.\n");
+		goto cdev_init_err;
+	}
+
+	/* The LED value is kept in the HW, take the mask and the init value of the previous driver */
+	loaded = pb_zybo_keep_state() &&
+		!pb_zybo_state_load(PB_ZYBO_KIND_LED, lp->mem_start, &lp->led_io_conf, sizeof(lp->led_io_conf));
+
+	pb_zybo_probe_done(&lp->pd, dev, start);
+
 	/* Register the CDEV, create device and sysfs */
-	rc = led_module_cdev_init(pdev);
+	rc = pb_zybo_dev_add(&led_module_type, &lp->pd, dev, lp);
 	if (rc < 0) {
 		dev_err(dev, "Unable to create a cdev.\n");
 		goto cdev_init_err;
 	}
-	
+
 	return 0;
 
 cdev_init_err:
-	led_module_cdev_exit(pdev);
-	iounmap(lp->base_addr);
-ioremap_err:
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
+	/* The loaded configuration is returned for the next probe */
+	if (loaded &&
+		pb_zybo_state_save(PB_ZYBO_KIND_LED, lp->mem_start, &lp->led_io_conf, sizeof(lp->led_io_conf))) {
+		dev_warn(dev, "Unable to store the LED configuration.\n");
+	}
+	pb_zybo_regmap_exit(&lp->pd);
+regmap_err:
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 mem_region_err:
 	kfree(lp);
 	dev_set_drvdata(dev, NULL);
@@ -460,14 +493,21 @@ mem_region_err:
 static int led_module_remove(struct platform_device *pdev) {
 	struct device *dev = &pdev->dev;
 	struct led_module_local *lp = dev_get_drvdata(dev);
-	dev_info(dev, "led-module is being removed.\n");
-	led_module_cdev_exit(pdev);
-	iounmap(lp->base_addr);
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
-	kfree(lp);
+	dev_dbg(dev, "led-module is being removed.\n");
+	pb_zybo_dev_del(&lp->pd);
+	if (pb_zybo_keep_state() &&
+		pb_zybo_state_save(PB_ZYBO_KIND_LED, lp->mem_start, &lp->led_io_conf, sizeof(lp->led_io_conf))) {
+		dev_warn(dev, "Unable to store the LED configuration.\n");
+	}
+	pb_zybo_regmap_exit(&lp->pd);
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 	dev_set_drvdata(dev, NULL);
+
+	/* Files which are still open keep the structure alive */
+	pb_zybo_dev_release(&lp->pd);
 	return 0;
 }
+PB_ZYBO_DEFINE_REMOVE(led_module_remove)
 
 /**
  * @brief This function is called during the 
@@ -479,8 +519,8 @@ static void led_module_shutdown(struct platform_device *pdev) {
 	struct led_module_local *lp = dev_get_drvdata(dev);
 	struct led_io_config	*lc = &lp->led_io_conf;
 
-	write_led_data(lc->led_init_val,  lp->base_addr + LED_OFFSET, lc->led_mask_val);
-	dev_info(&pdev->dev, "led-module is shutting down.\n");
+	write_led_data(lc->led_init_val, lp, lc->led_mask_val);
+	dev_dbg(&pdev->dev, "led-module is shutting down.\n");
 }
 
 static struct of_device_id led_module_of_match[] = {
@@ -495,11 +535,42 @@ static struct platform_driver led_module_driver = {
 		.of_match_table	= led_module_of_match,
 	},
 	.probe		= led_module_probe,
-	.remove		= led_module_remove,
+	.remove		= PB_ZYBO_REMOVE(led_module_remove),
 	.shutdown   = led_module_shutdown,
 };
 
-module_platform_driver(led_module_driver);
+static int __init led_module_init(void)
+{
+	int rc;
+
+	/* The driver type (class, minors) has to exist before the first probe */
+	rc = pb_zybo_type_register(&led_module_type);
+	if (rc) {
+		return rc;
+	}
+
+	/* Probe asynchronously unless the core is loaded with async_probe=0 */
+	led_module_driver.driver.probe_type = pb_zybo_probe_type();
+	rc = platform_driver_register(&led_module_driver);
+	if (rc) {
+		pb_zybo_type_unregister(&led_module_type);
+	}
+	return rc;
+}
+
+static void __exit led_module_exit(void)
+{
+	platform_driver_unregister(&led_module_driver);
+	pb_zybo_type_unregister(&led_module_type);
+}
+
+module_init(led_module_init);
+module_exit(led_module_exit);
+
+/* KUnit tests of static helpers (CONFIG_PB_ZYBO_KUNIT_TEST) */
+#if IS_ENABLED(CONFIG_PB_ZYBO_KUNIT_TEST)
+#include "led-module-test.c"
+#endif
 
 /* Standard module information, edit as appropriate */
 MODULE_LICENSE("GPL");
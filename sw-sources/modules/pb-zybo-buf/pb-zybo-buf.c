@@ -0,0 +1,511 @@
+/*  pb-zybo-buf.c - Physically contiguous DMA buffers shared by the PS and the PL
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+#include <linux/dma-map-ops.h>
+#else
+#include <linux/dma-noncoherent.h>
+#endif
+
+#include "pb-zybo-buf.h"
+
+/* Configuration related to driver names, etc */
+#define DRIVER_NAME "pb-zybo-buf"
+
+/* Maximal number of buffers of one open file (mmap offsets have to fit 32-bit page offsets) */
+#define PBBUF_MAX_IDS	1024
+
+/* Number of orders served by the page allocator - MAX_ORDER is inclusive since linux 6.4 and
+ * it was renamed to MAX_PAGE_ORDER in linux 6.8 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define PBBUF_PAGE_ORDERS	(MAX_PAGE_ORDER + 1)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define PBBUF_PAGE_ORDERS	(MAX_ORDER + 1)
+#else
+#define PBBUF_PAGE_ORDERS	MAX_ORDER
+#endif
+
+/* Limit of all allocated buffers */
+static unsigned int max_mb = 64;
+module_param(max_mb, uint, 0644);
+MODULE_PARM_DESC(max_mb, "Maximal size of all allocated buffers (MiB)");
+
+/**
+ * @brief One DMA buffer - it lives until it is freed and the last mapping is gone
+ *
+ */
+struct pbbuf {
+	struct kref		 ref;		/* Held by the ID of the file and by each mapping */
+	struct device	*dev;		/* Device of the DMA API */
+	size_t			 size;		/* Size in bytes (page aligned) */
+	bool			 cached;	/* Cached buffer with explicit cache syncs */
+	bool			 mapped;	/* Pages from the page allocator mapped by dma_map_page */
+	void			*vaddr;		/* Kernel address of the coherent buffer */
+	struct page		*page;		/* First page of the cached buffer */
+	dma_addr_t		 dma;		/* Bus address of the buffer */
+};
+
+/**
+ * @brief Per-open file context - buffers belong to the file which allocated them
+ *
+ */
+struct pbbuf_file {
+	struct mutex	lock;		/* Protects the ID table */
+	struct idr		bufs;		/* Allocated buffers */
+};
+
+/* Device of the DMA API and the total size of allocated buffers */
+static struct platform_device *pbbuf_pdev;
+static atomic_long_t pbbuf_total = ATOMIC_LONG_INIT(0);
+
+/* ==================================================================
+ 		Buffer allocation
+   ================================================================== */
+
+/**
+ * @brief Check if the DMA of the device is cache coherent (the coherent buffer is cached then)
+ *
+ */
+static bool pbbuf_dma_coherent(struct device *dev) {
+#if defined(CONFIG_ARM) && LINUX_VERSION_CODE < KERNEL_VERSION(5, 19, 0)
+	/* ARM used its own DMA operations before the switch to dma-direct */
+	return dev->archdata.dma_coherent;
+#else
+	return dev_is_dma_coherent(dev);
+#endif
+}
+
+/**
+ * @brief Allocate the cached buffer - contiguous pages mapped for the DMA in both
+ * directions. dma_alloc_pages of the direct DMA takes big buffers from CMA, the page
+ * allocator is used otherwise and it limits the buffer to one block of the largest order.
+ *
+ * @param buf Buffer to allocate
+ * @return int 0 iff everything was fine, -EINVAL if the buffer is too big for the page allocator
+ */
+static int pbbuf_alloc_cached(struct pbbuf *buf) {
+	unsigned int order = get_order(buf->size);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+	buf->page = dma_alloc_pages(buf->dev, buf->size, &buf->dma, DMA_BIDIRECTIONAL,
+		GFP_KERNEL | __GFP_NOWARN);
+#endif
+	if (!buf->page) {
+		/* DMA operations without dma_alloc_pages (or without free CMA) - the page allocator
+		 * and the mapping */
+		if (order >= PBBUF_PAGE_ORDERS) {
+			return -EINVAL;
+		}
+
+		buf->page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+		if (!buf->page) {
+			return -ENOMEM;
+		}
+
+		buf->dma = dma_map_page(buf->dev, buf->page, 0, buf->size, DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(buf->dev, buf->dma)) {
+			__free_pages(buf->page, order);
+			buf->page = NULL;
+			return -ENOMEM;
+		}
+		buf->mapped = true;
+	}
+
+	/* No stale data in the user mapping, the buffer is owned by the device after the allocation */
+	memset(page_address(buf->page), 0, buf->size);
+	dma_sync_single_for_device(buf->dev, buf->dma, buf->size, DMA_BIDIRECTIONAL);
+	return 0;
+}
+
+/**
+ * @brief Allocate the non-cached (coherent) buffer, large buffers come from CMA
+ *
+ * @param buf Buffer to allocate
+ * @return int 0 iff everything was fine
+ */
+static int pbbuf_alloc_coherent(struct pbbuf *buf) {
+	buf->vaddr = dma_alloc_coherent(buf->dev, buf->size, &buf->dma, GFP_KERNEL);
+	return buf->vaddr ? 0 : -ENOMEM;
+}
+
+static void pbbuf_release(struct kref *ref) {
+	struct pbbuf *buf = container_of(ref, struct pbbuf, ref);
+
+	if (!buf->cached) {
+		dma_free_coherent(buf->dev, buf->size, buf->vaddr, buf->dma);
+	} else if (buf->mapped) {
+		dma_unmap_page(buf->dev, buf->dma, buf->size, DMA_BIDIRECTIONAL);
+		__free_pages(buf->page, get_order(buf->size));
+	} else {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+		dma_free_pages(buf->dev, buf->size, buf->page, buf->dma, DMA_BIDIRECTIONAL);
+#endif
+	}
+
+	atomic_long_sub(buf->size, &pbbuf_total);
+	kfree(buf);
+}
+
+static void pbbuf_put(struct pbbuf *buf) {
+	kref_put(&buf->ref, pbbuf_release);
+}
+
+/**
+ * @brief Fill the user structure with the buffer description
+ *
+ */
+static void pbbuf_info(const struct pbbuf *buf, u32 id, struct pb_zybo_buf_alloc *info) {
+	info->size = buf->size;
+	info->flags = buf->cached ? PB_ZYBO_BUF_CACHED : 0;
+	info->id = id;
+	info->dma_addr = buf->dma;
+	info->mmap_offset = (u64)id * PB_ZYBO_BUF_MAX_SIZE;
+	info->out_flags = buf->cached ? PB_ZYBO_BUF_F_CACHED : 0;
+	if (pbbuf_dma_coherent(buf->dev)) {
+		info->out_flags |= PB_ZYBO_BUF_F_DMA_COHERENT;
+	}
+	info->resv = 0;
+}
+
+/* ==================================================================
+ 		Mapping
+   ================================================================== */
+
+static void pbbuf_vm_open(struct vm_area_struct *vma) {
+	struct pbbuf *buf = vma->vm_private_data;
+	kref_get(&buf->ref);
+}
+
+static void pbbuf_vm_close(struct vm_area_struct *vma) {
+	pbbuf_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct pbbuf_vm_ops = {
+	.open = pbbuf_vm_open,
+	.close = pbbuf_vm_close,
+};
+
+static int pbbuf_mmap(struct file *file, struct vm_area_struct *vma) {
+	struct pbbuf_file *fctx = file->private_data;
+	u64 off = (u64)vma->vm_pgoff << PAGE_SHIFT;
+	size_t len = vma->vm_end - vma->vm_start;
+	struct pbbuf *buf;
+	int rc;
+
+	/* The buffer is selected by the offset and it is mapped from its beginning */
+	if (off & (PB_ZYBO_BUF_MAX_SIZE - 1)) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&fctx->lock);
+	buf = idr_find(&fctx->bufs, div64_u64(off, PB_ZYBO_BUF_MAX_SIZE));
+	if (!buf || len > buf->size) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (buf->cached) {
+		rc = remap_pfn_range(vma, vma->vm_start, page_to_pfn(buf->page), len, vma->vm_page_prot);
+	} else {
+		/* Non-cached (or write-combined) attributes are selected by the DMA API */
+		vma->vm_pgoff = 0;
+		rc = dma_mmap_coherent(buf->dev, vma, buf->vaddr, buf->dma, buf->size);
+	}
+	if (rc) {
+		goto out;
+	}
+
+	vma->vm_private_data = buf;
+	vma->vm_ops = &pbbuf_vm_ops;
+	kref_get(&buf->ref);
+
+out:
+	mutex_unlock(&fctx->lock);
+	return rc;
+}
+
+/* ==================================================================
+ 		Char device callbacks
+   ================================================================== */
+
+static long pbbuf_ioctl_alloc(struct pbbuf_file *fctx, void __user *uarg) {
+	struct pb_zybo_buf_alloc req;
+	struct pbbuf *buf;
+	size_t size;
+	int id;
+	int rc;
+
+	if (copy_from_user(&req, uarg, sizeof(req))) {
+		return -EFAULT;
+	}
+	if ((req.flags & ~PB_ZYBO_BUF_CACHED) || !req.size || req.size > PB_ZYBO_BUF_MAX_SIZE) {
+		return -EINVAL;
+	}
+
+	size = PAGE_ALIGN(req.size);
+	if (atomic_long_add_return(size, &pbbuf_total) > (long)max_mb << 20) {
+		atomic_long_sub(size, &pbbuf_total);
+		return -ENOMEM;
+	}
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf) {
+		atomic_long_sub(size, &pbbuf_total);
+		return -ENOMEM;
+	}
+	kref_init(&buf->ref);
+	buf->dev = &pbbuf_pdev->dev;
+	buf->size = size;
+	buf->cached = req.flags & PB_ZYBO_BUF_CACHED;
+
+	rc = buf->cached ? pbbuf_alloc_cached(buf) : pbbuf_alloc_coherent(buf);
+	if (rc) {
+		dev_dbg(buf->dev, "Allocation of %zu bytes failed.\n", size);
+		atomic_long_sub(size, &pbbuf_total);
+		kfree(buf);
+		return rc;
+	}
+
+	mutex_lock(&fctx->lock);
+	id = idr_alloc(&fctx->bufs, buf, 0, PBBUF_MAX_IDS, GFP_KERNEL);
+	mutex_unlock(&fctx->lock);
+	if (id < 0) {
+		pbbuf_put(buf);
+		return id;
+	}
+
+	pbbuf_info(buf, id, &req);
+	if (copy_to_user(uarg, &req, sizeof(req))) {
+		mutex_lock(&fctx->lock);
+		idr_remove(&fctx->bufs, id);
+		mutex_unlock(&fctx->lock);
+		pbbuf_put(buf);
+		return -EFAULT;
+	}
+	return 0;
+}
+
+static long pbbuf_ioctl_free(struct pbbuf_file *fctx, u32 __user *uarg) {
+	struct pbbuf *buf;
+	u32 id;
+
+	if (get_user(id, uarg)) {
+		return -EFAULT;
+	}
+
+	/* Existing mappings keep the buffer until they are unmapped */
+	mutex_lock(&fctx->lock);
+	buf = idr_remove(&fctx->bufs, id);
+	mutex_unlock(&fctx->lock);
+	if (!buf) {
+		return -ENOENT;
+	}
+
+	pbbuf_put(buf);
+	return 0;
+}
+
+static long pbbuf_ioctl_sync(struct pbbuf_file *fctx, void __user *uarg) {
+	static const enum dma_data_direction dirs[] = {
+		[PB_ZYBO_BUF_DIR_BIDIR] = DMA_BIDIRECTIONAL,
+		[PB_ZYBO_BUF_DIR_TO_DEV] = DMA_TO_DEVICE,
+		[PB_ZYBO_BUF_DIR_FROM_DEV] = DMA_FROM_DEVICE,
+	};
+	struct pb_zybo_buf_sync req;
+	struct pbbuf *buf;
+	long rc = 0;
+	u64 size;
+
+	if (copy_from_user(&req, uarg, sizeof(req))) {
+		return -EFAULT;
+	}
+	if (req.dir >= ARRAY_SIZE(dirs) ||
+		(req.op != PB_ZYBO_BUF_SYNC_FOR_DEVICE && req.op != PB_ZYBO_BUF_SYNC_FOR_CPU)) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&fctx->lock);
+	buf = idr_find(&fctx->bufs, req.id);
+	if (!buf) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	size = req.size ? req.size : buf->size - min_t(u64, req.offset, buf->size);
+	if (req.offset >= buf->size || size > buf->size - req.offset) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	/* Coherent buffers don't need any maintenance */
+	if (!buf->cached) {
+		goto out;
+	}
+
+	if (req.op == PB_ZYBO_BUF_SYNC_FOR_DEVICE) {
+		dma_sync_single_range_for_device(buf->dev, buf->dma, req.offset, size, dirs[req.dir]);
+	} else {
+		dma_sync_single_range_for_cpu(buf->dev, buf->dma, req.offset, size, dirs[req.dir]);
+	}
+
+out:
+	mutex_unlock(&fctx->lock);
+	return rc;
+}
+
+static long pbbuf_ioctl_info(struct pbbuf_file *fctx, void __user *uarg) {
+	struct pb_zybo_buf_alloc req;
+	struct pbbuf *buf;
+
+	if (copy_from_user(&req, uarg, sizeof(req))) {
+		return -EFAULT;
+	}
+
+	mutex_lock(&fctx->lock);
+	buf = idr_find(&fctx->bufs, req.id);
+	if (buf) {
+		pbbuf_info(buf, req.id, &req);
+	}
+	mutex_unlock(&fctx->lock);
+	if (!buf) {
+		return -ENOENT;
+	}
+
+	return copy_to_user(uarg, &req, sizeof(req)) ? -EFAULT : 0;
+}
+
+static long pbbuf_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct pbbuf_file *fctx = file->private_data;
+
+	switch (cmd) {
+	case PB_ZYBO_BUF_IOCTL_ALLOC:
+		return pbbuf_ioctl_alloc(fctx, (void __user *)arg);
+	case PB_ZYBO_BUF_IOCTL_FREE:
+		return pbbuf_ioctl_free(fctx, (u32 __user *)arg);
+	case PB_ZYBO_BUF_IOCTL_SYNC:
+		return pbbuf_ioctl_sync(fctx, (void __user *)arg);
+	case PB_ZYBO_BUF_IOCTL_INFO:
+		return pbbuf_ioctl_info(fctx, (void __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int pbbuf_open(struct inode *inode, struct file *filp) {
+	struct pbbuf_file *fctx;
+
+	fctx = kzalloc(sizeof(*fctx), GFP_KERNEL);
+	if (!fctx) {
+		return -ENOMEM;
+	}
+
+	mutex_init(&fctx->lock);
+	idr_init(&fctx->bufs);
+	filp->private_data = fctx;
+	return 0;
+}
+
+static int pbbuf_release_file(struct inode *inode, struct file *filp) {
+	struct pbbuf_file *fctx = filp->private_data;
+	struct pbbuf *buf;
+	int id;
+
+	/* Mapped buffers are released by the last unmap */
+	idr_for_each_entry(&fctx->bufs, buf, id) {
+		pbbuf_put(buf);
+	}
+	idr_destroy(&fctx->bufs);
+	kfree(fctx);
+	return 0;
+}
+
+static const struct file_operations pbbuf_fops = {
+	.owner = THIS_MODULE,
+	.open = pbbuf_open,
+	.release = pbbuf_release_file,
+	.unlocked_ioctl = pbbuf_ioctl,
+	.mmap = pbbuf_mmap,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice pbbuf_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = DRIVER_NAME,
+	.fops = &pbbuf_fops,
+};
+
+/* ==================================================================
+ 		Module init & exit
+   ================================================================== */
+
+static int __init pb_zybo_buf_init(void)
+{
+	struct platform_device_info info = {
+		.name = DRIVER_NAME,
+		.id = PLATFORM_DEVID_NONE,
+		.dma_mask = DMA_BIT_MASK(32),
+	};
+	int rc;
+
+	/* The device of the DMA API - 32-bit bus addresses are reachable by the PL (HP/ACP ports) */
+	pbbuf_pdev = platform_device_register_full(&info);
+	if (IS_ERR(pbbuf_pdev)) {
+		return PTR_ERR(pbbuf_pdev);
+	}
+
+	pbbuf_misc.parent = &pbbuf_pdev->dev;
+	rc = misc_register(&pbbuf_misc);
+	if (rc) {
+		platform_device_unregister(pbbuf_pdev);
+		return rc;
+	}
+
+	dev_dbg(&pbbuf_pdev->dev, "DMA buffers are %scoherent\n",
+		pbbuf_dma_coherent(&pbbuf_pdev->dev) ? "" : "not ");
+	return 0;
+}
+
+static void __exit pb_zybo_buf_exit(void)
+{
+	/* Open files hold the module, so all buffers are released here */
+	misc_deregister(&pbbuf_misc);
+	platform_device_unregister(pbbuf_pdev);
+}
+
+module_init(pb_zybo_buf_init);
+module_exit(pb_zybo_buf_exit);
+
+/* Standard module information, edit as appropriate */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Pavel Benacek");
+MODULE_DESCRIPTION("pb-zybo-buf - physically contiguous DMA buffers shared by the PS and the PL");
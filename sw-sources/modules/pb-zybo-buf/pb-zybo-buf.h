@@ -0,0 +1,79 @@
+/*  pb-zybo-buf.h - Interface of the PB Zybo DMA buffer module
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The header is shared by the kernel and the user space (/dev/pb-zybo-buf) */
+
+#ifndef __PB_ZYBO_BUF_H__
+#define __PB_ZYBO_BUF_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Allocation flags */
+#define PB_ZYBO_BUF_CACHED			0x1	/* Cached mapping, the user space syncs caches via SYNC */
+
+/* Output flags of the buffer */
+#define PB_ZYBO_BUF_F_CACHED		0x1	/* The buffer was allocated with PB_ZYBO_BUF_CACHED */
+#define PB_ZYBO_BUF_F_DMA_COHERENT	0x2	/* The platform is DMA coherent - the non-cached buffer is cached */
+
+/* Buffers of one open file are mapped at the offset id * PB_ZYBO_BUF_MAX_SIZE */
+#define PB_ZYBO_BUF_MAX_SIZE		(256UL << 20)
+
+/* Cache synchronization - ownership transfer and the direction of the PL transfer */
+#define PB_ZYBO_BUF_SYNC_FOR_DEVICE	1	/* CPU writes are done, the PL accesses the buffer */
+#define PB_ZYBO_BUF_SYNC_FOR_CPU	2	/* PL writes are done, the CPU accesses the buffer */
+
+#define PB_ZYBO_BUF_DIR_BIDIR		0	/* The PL reads and writes the buffer */
+#define PB_ZYBO_BUF_DIR_TO_DEV		1	/* The PL reads the buffer */
+#define PB_ZYBO_BUF_DIR_FROM_DEV	2	/* The PL writes the buffer */
+
+/**
+ * @brief Buffer allocation (and the buffer info)
+ *
+ */
+struct pb_zybo_buf_alloc {
+	__u64 size;			/* Requested size (rounded up to pages) */
+	__u32 flags;		/* Allocation flags PB_ZYBO_BUF_* */
+	__u32 id;			/* Buffer ID (output, input of INFO) */
+	__u64 dma_addr;		/* Bus address for the PL programming (output) */
+	__u64 mmap_offset;	/* Offset of the buffer for mmap (output) */
+	__u32 out_flags;	/* PB_ZYBO_BUF_F_* flags (output) */
+	__u32 resv;
+};
+
+/**
+ * @brief Cache synchronization of the buffer range
+ *
+ */
+struct pb_zybo_buf_sync {
+	__u32 id;			/* Buffer ID */
+	__u16 op;			/* PB_ZYBO_BUF_SYNC_* */
+	__u16 dir;			/* PB_ZYBO_BUF_DIR_* */
+	__u64 offset;		/* Start of the range in the buffer */
+	__u64 size;			/* Size of the range (0 = up to the end of the buffer) */
+};
+
+/* Supported IOCTL handlers */
+#define PB_ZYBO_BUF_IOCTL_MAGIC		'z'
+#define PB_ZYBO_BUF_IOCTL_ALLOC		_IOWR(PB_ZYBO_BUF_IOCTL_MAGIC, 0x60, struct pb_zybo_buf_alloc)
+#define PB_ZYBO_BUF_IOCTL_FREE		_IOW(PB_ZYBO_BUF_IOCTL_MAGIC, 0x61, __u32)
+#define PB_ZYBO_BUF_IOCTL_SYNC		_IOW(PB_ZYBO_BUF_IOCTL_MAGIC, 0x62, struct pb_zybo_buf_sync)
+#define PB_ZYBO_BUF_IOCTL_INFO		_IOWR(PB_ZYBO_BUF_IOCTL_MAGIC, 0x63, struct pb_zybo_buf_alloc)
+
+#endif /* __PB_ZYBO_BUF_H__ */
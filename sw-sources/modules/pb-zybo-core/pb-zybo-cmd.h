@@ -0,0 +1,114 @@
+/*  pb-zybo-cmd.h - Batched command interface of the PB Zybo device drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The header is shared by the kernel and the user space (/dev/pb-zybo-cmd) */
+
+#ifndef __PB_ZYBO_CMD_H__
+#define __PB_ZYBO_CMD_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Supported operations */
+#define PB_ZYBO_CMD_LED_SET			1	/* Set the LED value (arg = value)				*/
+#define PB_ZYBO_CMD_RGB_SET			2	/* Set the RGB color (arg = 0xRRGGBB)			*/
+#define PB_ZYBO_CMD_RGB_PERIOD_SET	3	/* Set the PWM period (arg = clocks)			*/
+#define PB_ZYBO_CMD_SW_GET			4	/* Read the switch value (val = value)			*/
+#define PB_ZYBO_CMD_DELAY			5	/* Wait (arg = microseconds)					*/
+#define PB_ZYBO_CMD_SW_WAIT			6	/* Wait until the switch value differs from arg
+										   (io_uring only, val = new value)			*/
+
+/* Maximal number of commands in one submission and maximal delay */
+#define PB_ZYBO_CMD_MAX				256
+#define PB_ZYBO_CMD_MAX_DELAY_US	10000
+
+/**
+ * @brief One command - the completion (val, res) is written back
+ * 
+ */
+struct pb_zybo_cmd {
+	__u16 op;		/* Operation PB_ZYBO_CMD_* */
+	__u16 dev;		/* Instance index of the target device (MINOR number) */
+	__u32 arg;		/* Input argument */
+	__u32 val;		/* Output value */
+	__s32 res;		/* Result of the command (0 or -errno) */
+};
+
+/**
+ * @brief One submission of commands
+ * 
+ */
+struct pb_zybo_cmd_batch {
+	__u64 cmds;		/* User pointer to the array of struct pb_zybo_cmd */
+	__u32 count;	/* Number of commands in the array */
+	__u32 done;		/* Number of successfully executed commands (output) */
+};
+
+/**
+ * @brief Payload of the io_uring command (IORING_OP_URING_CMD) submitted directly
+ * to the LED, RGB or switch device - sqe->cmd_op carries the PB_ZYBO_CMD_* operation.
+ * The CQE result is the read value (PB_ZYBO_CMD_SW_GET, PB_ZYBO_CMD_SW_WAIT), 0 or -errno.
+ * 
+ */
+struct pb_zybo_uring_cmd {
+	__u32 arg;		/* Input argument */
+	__u32 resv;		/* Reserved, set to 0 */
+};
+
+/* Reaction rules - trigger types */
+#define PB_ZYBO_RULE_MATCH			1	/* Fires when (switch & mask) becomes equal to value	*/
+#define PB_ZYBO_RULE_TOGGLE			2	/* Fires when any of switch bits in mask changes		*/
+
+/* Maximal number of rules and the range of the sampling period */
+#define PB_ZYBO_RULES_MAX			32
+#define PB_ZYBO_RULES_MIN_PERIOD_US	100
+#define PB_ZYBO_RULES_MAX_PERIOD_US	1000000
+
+/**
+ * @brief One reaction rule - the core samples the switch device and executes the action
+ * (PB_ZYBO_CMD_LED_SET, PB_ZYBO_CMD_RGB_SET or PB_ZYBO_CMD_RGB_PERIOD_SET) when the
+ * trigger fires
+ * 
+ */
+struct pb_zybo_rule {
+	__u16 type;		/* Trigger type PB_ZYBO_RULE_* */
+	__u16 sw_dev;	/* Instance index of the switch device (MINOR number) */
+	__u32 mask;		/* Switch bits of the trigger */
+	__u32 value;	/* Expected value of masked bits (PB_ZYBO_RULE_MATCH) */
+	__u16 op;		/* Action operation PB_ZYBO_CMD_* */
+	__u16 dev;		/* Instance index of the action device (MINOR number) */
+	__u32 arg;		/* Action argument */
+};
+
+/**
+ * @brief Table of reaction rules, the upload replaces all active rules
+ * 
+ */
+struct pb_zybo_rule_table {
+	__u64 rules;		/* User pointer to the array of struct pb_zybo_rule */
+	__u32 count;		/* Number of rules in the array, 0 removes all rules */
+	__u32 period_us;	/* Sampling period of switch devices (microseconds) */
+};
+
+/* Supported IOCTL handlers */
+#define PB_ZYBO_CMD_IOCTL_MAGIC		'z'
+#define PB_ZYBO_CMD_IOCTL_SUBMIT	_IOWR(PB_ZYBO_CMD_IOCTL_MAGIC, 0x40, struct pb_zybo_cmd_batch)
+#define PB_ZYBO_CMD_IOCTL_SET_RULES	_IOW(PB_ZYBO_CMD_IOCTL_MAGIC, 0x41, struct pb_zybo_rule_table)
+
+#endif /* __PB_ZYBO_CMD_H__ */
@@ -0,0 +1,1956 @@
+/*  pb-zybo-core.c - Shared core of the PB Zybo device drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/idr.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/capability.h>
+#include <linux/delay.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/regmap.h>
+#include <linux/platform_device.h>
+#include <linux/io.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/bitmap.h>
+#include <linux/overflow.h>
+
+#include "pb-zybo-core.h"
+#include "pb-zybo-cmd.h"
+
+/* Create the tracepoints, drivers are using them via the exported symbols */
+#define CREATE_TRACE_POINTS
+#include "pb-zybo-trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_ioctl_enter);
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_ioctl_exit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_sem_wait);
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_op);
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_mmio_write);
+EXPORT_TRACEPOINT_SYMBOL_GPL(pb_zybo_mmio_read);
+
+/* Registry of driver types (by kind) - protects also the device instances of each type */
+static DEFINE_MUTEX(pb_zybo_registry_lock);
+static struct pb_zybo_type *pb_zybo_kinds[PB_ZYBO_KIND_COUNT];
+
+/* ==================================================================
+ 		Statistics
+   ================================================================== */
+
+/**
+ * @brief Sum the per-CPU statistics of the device instance
+ * 
+ * @param pd Device instance
+ * @param sum Output structure with summed values
+ */
+void pb_zybo_stats_sum(struct pb_zybo_dev *pd, struct pb_zybo_stats *sum) {
+	const struct pb_zybo_stats *st;
+	struct pb_zybo_stats snap;
+	unsigned int start;
+	int cpu;
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(pd->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&st->syncp);
+			snap = *st;
+		} while (u64_stats_fetch_retry(&st->syncp, start));
+
+		for (i = 0; i < PB_ZYBO_OP_COUNT; i++) {
+			sum->ops[i] += snap.ops[i];
+			sum->bytes[i] += snap.bytes[i];
+		}
+		sum->sem_acquired += snap.sem_acquired;
+		sum->sem_waits += snap.sem_waits;
+		sum->sem_wait_ns += snap.sem_wait_ns;
+		sum->sem_restarts += snap.sem_restarts;
+		sum->sem_eagain += snap.sem_eagain;
+	}
+}
+EXPORT_SYMBOL_GPL(pb_zybo_stats_sum);
+
+/* Helping macro which declares the read-only sysfs attribute with one summed counter */
+#define PB_ZYBO_STATS_ATTR(_name, _field)								\
+static ssize_t _name##_show(struct device *dev,						\
+	struct device_attribute *attr, char *buf) {						\
+	struct pb_zybo_stats sum;										\
+	pb_zybo_stats_sum(dev_get_drvdata(dev), &sum);					\
+	return sprintf(buf, "%llu\n", (unsigned long long)sum._field);	\
+}																	\
+static DEVICE_ATTR_RO(_name)
+
+PB_ZYBO_STATS_ATTR(ioctl_ops, ops[PB_ZYBO_OP_IOCTL]);
+PB_ZYBO_STATS_ATTR(read_ops, ops[PB_ZYBO_OP_READ]);
+PB_ZYBO_STATS_ATTR(write_ops, ops[PB_ZYBO_OP_WRITE]);
+PB_ZYBO_STATS_ATTR(llseek_ops, ops[PB_ZYBO_OP_LLSEEK]);
+PB_ZYBO_STATS_ATTR(cmd_ops, ops[PB_ZYBO_OP_CMD]);
+PB_ZYBO_STATS_ATTR(read_bytes, bytes[PB_ZYBO_OP_READ]);
+PB_ZYBO_STATS_ATTR(write_bytes, bytes[PB_ZYBO_OP_WRITE]);
+PB_ZYBO_STATS_ATTR(sem_acquired, sem_acquired);
+PB_ZYBO_STATS_ATTR(sem_waits, sem_waits);
+PB_ZYBO_STATS_ATTR(sem_wait_ns, sem_wait_ns);
+PB_ZYBO_STATS_ATTR(sem_restarts, sem_restarts);
+PB_ZYBO_STATS_ATTR(sem_eagain, sem_eagain);
+
+static ssize_t probe_ns_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct pb_zybo_dev *pd = dev_get_drvdata(dev);
+	return sprintf(buf, "%llu\n", (unsigned long long)pd->probe_ns);
+}
+static DEVICE_ATTR_RO(probe_ns);
+
+static struct attribute *pb_zybo_stats_attrs[] = {
+	&dev_attr_ioctl_ops.attr,
+	&dev_attr_read_ops.attr,
+	&dev_attr_write_ops.attr,
+	&dev_attr_llseek_ops.attr,
+	&dev_attr_cmd_ops.attr,
+	&dev_attr_read_bytes.attr,
+	&dev_attr_write_bytes.attr,
+	&dev_attr_sem_acquired.attr,
+	&dev_attr_sem_waits.attr,
+	&dev_attr_sem_wait_ns.attr,
+	&dev_attr_sem_restarts.attr,
+	&dev_attr_sem_eagain.attr,
+	&dev_attr_probe_ns.attr,
+	NULL,
+};
+
+static const struct attribute_group pb_zybo_stats_group = {
+	.name = "stats",
+	.attrs = pb_zybo_stats_attrs,
+};
+
+/* ==================================================================
+ 		Register map
+   ================================================================== */
+
+/**
+ * @brief Reserve and map the register region of the platform device. Devices of the
+ * pb-zybo-mock module pass their RAM window in the platform data instead.
+ * 
+ * @param pdev Platform device
+ * @param name Name of the reserved region (driver name)
+ * @param start Start of the region (output)
+ * @param end End of the region (output)
+ * @return void __iomem* Mapped region or the IOMEM_ERR_PTR
+ */
+void __iomem *pb_zybo_ioremap(struct platform_device *pdev, const char *name,
+	unsigned long *start, unsigned long *end) {
+	const struct pb_zybo_mock_pdata *mock = dev_get_platdata(&pdev->dev);
+	struct device *dev = &pdev->dev;
+	struct resource *r_mem;
+	void __iomem *base;
+
+	if (mock) {
+		*start = 0;
+		*end = mock->size - 1;
+		return mock->regs;
+	}
+
+	r_mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	if (!r_mem) {
+		dev_err(dev, "invalid address\n");
+		return IOMEM_ERR_PTR(-ENODEV);
+	}
+
+	*start = r_mem->start;
+	*end = r_mem->end;
+	if (!request_mem_region(*start, *end - *start + 1, name)) {
+		dev_err(dev, "Couldn't lock memory region at %p\n", (void *)*start);
+		return IOMEM_ERR_PTR(-EBUSY);
+	}
+
+	base = ioremap(*start, *end - *start + 1);
+	if (!base) {
+		dev_err(dev, "%s: Could not allocate iomem\n", name);
+		release_mem_region(*start, *end - *start + 1);
+		return IOMEM_ERR_PTR(-EIO);
+	}
+
+	return base;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_ioremap);
+
+/**
+ * @brief Unmap and release the region mapped by pb_zybo_ioremap
+ * 
+ */
+void pb_zybo_iounmap(struct platform_device *pdev, void __iomem *base,
+	unsigned long start, unsigned long end) {
+	if (dev_get_platdata(&pdev->dev)) {
+		return;
+	}
+
+	iounmap(base);
+	release_mem_region(start, end - start + 1);
+}
+EXPORT_SYMBOL_GPL(pb_zybo_iounmap);
+
+/* Bus callbacks of the register map - all accesses go through the traced and timed helpers */
+static int pb_zybo_regmap_read(void *ctx, unsigned int reg, unsigned int *val) {
+	struct pb_zybo_dev *pd = ctx;
+
+	if (pd->mock && pd->mock->read_delay_ns) {
+		ndelay(pd->mock->read_delay_ns);
+	}
+
+	*val = pb_zybo_ioread32(pd, pd->regs, reg);
+	pd->mmio_reads++;
+	return 0;
+}
+
+static int pb_zybo_regmap_write(void *ctx, unsigned int reg, unsigned int val) {
+	struct pb_zybo_dev *pd = ctx;
+
+	if (pd->mock && pd->mock->write_delay_ns) {
+		ndelay(pd->mock->write_delay_ns);
+	}
+
+	pb_zybo_iowrite32(pd, val, pd->regs, reg);
+	pd->mmio_writes++;
+
+	if (pd->mock && pd->mock->write_hook) {
+		pd->mock->write_hook(pd->mock->hook_priv, reg, val);
+	}
+	return 0;
+}
+
+/**
+ * @brief Create the register map of the device instance - 32-bit registers with
+ * the stride of 4 bytes. The driver describes the register layout and the cache in
+ * the configuration (max_register, writeable_reg, volatile_reg, cache_type). It can
+ * be called before pb_zybo_dev_add.
+ * 
+ * @param pd Device instance
+ * @param dev Parent device (typically the platform device, it names the regmap debugfs)
+ * @param base Mapped register region
+ * @param cfg Register map configuration of the driver
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_regmap_init(struct pb_zybo_dev *pd, struct device *dev, void __iomem *base,
+	const struct regmap_config *cfg) {
+	struct regmap_config conf = *cfg;
+	struct regmap *map;
+
+	conf.reg_bits = 32;
+	conf.val_bits = 32;
+	conf.reg_stride = 4;
+	conf.fast_io = true;
+	conf.reg_read = pb_zybo_regmap_read;
+	conf.reg_write = pb_zybo_regmap_write;
+
+	pd->regs = base;
+	pd->mock = dev_get_platdata(dev);
+	pd->mmio_reads = 0;
+	pd->mmio_writes = 0;
+	map = regmap_init(dev, NULL, pd, &conf);
+	if (IS_ERR(map)) {
+		dev_err(dev, "Unable to create the register map.\n");
+		pd->regmap = NULL;
+		return PTR_ERR(map);
+	}
+
+	pd->regmap = map;
+	pd->regcache = cfg->cache_type != REGCACHE_NONE;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_regmap_init);
+
+/**
+ * @brief Destroy the register map of the device instance
+ * 
+ * @param pd Device instance
+ */
+void pb_zybo_regmap_exit(struct pb_zybo_dev *pd) {
+	if (pd->regmap) {
+		regmap_exit(pd->regmap);
+		pd->regmap = NULL;
+	}
+}
+EXPORT_SYMBOL_GPL(pb_zybo_regmap_exit);
+
+/**
+ * @brief Load the current HW value of the register into the cache. It is used
+ * for registers which are not written during the probe, so the first update
+ * isn't elided against an unknown HW value.
+ * 
+ * @param pd Device instance
+ * @param reg Register offset
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_regcache_seed(struct pb_zybo_dev *pd, unsigned int reg) {
+	unsigned int val;
+	int rc;
+
+	regcache_cache_bypass(pd->regmap, true);
+	rc = regmap_read(pd->regmap, reg, &val);
+	regcache_cache_bypass(pd->regmap, false);
+	if (rc) {
+		return rc;
+	}
+
+	regcache_cache_only(pd->regmap, true);
+	rc = regmap_write(pd->regmap, reg, val);
+	regcache_cache_only(pd->regmap, false);
+	return rc;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_regcache_seed);
+
+/**
+ * @brief Write all cached registers into the HW again (e.g., after the reset of
+ * the programmable logic)
+ * 
+ * @param pd Device instance
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_regcache_restore(struct pb_zybo_dev *pd) {
+	int rc;
+
+	if (!pd->regmap) {
+		return -ENODEV;
+	}
+
+	if (!pd->regcache) {
+		return -EOPNOTSUPP;
+	}
+
+	rc = pb_zybo_down(pd, NULL);
+	if (rc) {
+		return rc;
+	}
+
+	regcache_mark_dirty(pd->regmap);
+	rc = regcache_sync(pd->regmap);
+	pb_zybo_up(pd);
+	return rc;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_regcache_restore);
+
+static ssize_t mmio_reads_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct pb_zybo_dev *pd = dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(pd->mmio_reads));
+}
+static DEVICE_ATTR_RO(mmio_reads);
+
+static ssize_t mmio_writes_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct pb_zybo_dev *pd = dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(pd->mmio_writes));
+}
+static DEVICE_ATTR_RO(mmio_writes);
+
+static ssize_t regcache_sync_store(struct device *dev, struct device_attribute *attr,
+	const char *buf, size_t count) {
+	int rc = pb_zybo_regcache_restore(dev_get_drvdata(dev));
+	return rc ? rc : count;
+}
+static DEVICE_ATTR_WO(regcache_sync);
+
+static struct attribute *pb_zybo_regmap_attrs[] = {
+	&dev_attr_mmio_reads.attr,
+	&dev_attr_mmio_writes.attr,
+	&dev_attr_regcache_sync.attr,
+	NULL,
+};
+
+static const struct attribute_group pb_zybo_regmap_group = {
+	.name = "regmap",
+	.attrs = pb_zybo_regmap_attrs,
+};
+
+/* Attribute groups added by the core to each device */
+static const struct attribute_group *pb_zybo_core_groups[] = {
+	&pb_zybo_stats_group,
+	&pb_zybo_regmap_group,
+	NULL,
+};
+
+/**
+ * @brief Prepare the NULL terminated list of driver groups followed by the core groups
+ * 
+ * @param type Driver type
+ * @return int 0 iff everything was fine
+ */
+static int pb_zybo_type_init_groups(struct pb_zybo_type *type) {
+	const struct attribute_group **groups;
+	int n_drv = 0;
+	int n_core = ARRAY_SIZE(pb_zybo_core_groups) - 1;
+	int i;
+
+	while (type->groups && type->groups[n_drv]) {
+		n_drv++;
+	}
+
+	groups = kcalloc(n_drv + n_core + 1, sizeof(*groups), GFP_KERNEL);
+	if (!groups) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < n_drv; i++) {
+		groups[i] = type->groups[i];
+	}
+	for (i = 0; i < n_core; i++) {
+		groups[n_drv + i] = pb_zybo_core_groups[i];
+	}
+
+	type->all_groups = groups;
+	return 0;
+}
+
+/* ==================================================================
+ 		MMIO latency histograms (debugfs)
+   ================================================================== */
+
+/* Root debugfs directory of all pb-zybo devices */
+static struct dentry *pb_zybo_dbg_root;
+
+static int pb_zybo_mmio_hist_show(struct seq_file *s, void *data) {
+	struct pb_zybo_dev *pd = s->private;
+	int reg;
+	int b;
+
+	seq_puts(s, "# offset  latency_ns  count\n");
+	for (reg = 0; reg < PB_ZYBO_HIST_REGS; reg++) {
+		for (b = 0; b < PB_ZYBO_HIST_BUCKETS; b++) {
+			long cnt = atomic_long_read(&pd->hist->cnt[reg][b]);
+			if (cnt == 0) {
+				continue;
+			}
+
+			seq_printf(s, "0x%04x  [%llu, %llu)  %ld\n", reg * 4,
+				b ? 1ULL << (b - 1) : 0ULL, 1ULL << b, cnt);
+		}
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pb_zybo_mmio_hist);
+
+static ssize_t pb_zybo_mmio_reset_write(struct file *file, const char __user *buff,
+	size_t count, loff_t *f_pos) {
+	struct pb_zybo_dev *pd = file->private_data;
+	int reg;
+	int b;
+
+	/* Any write clears all histograms, accesses which run during the reset may be kept */
+	for (reg = 0; reg < PB_ZYBO_HIST_REGS; reg++) {
+		for (b = 0; b < PB_ZYBO_HIST_BUCKETS; b++) {
+			atomic_long_set(&pd->hist->cnt[reg][b], 0);
+		}
+	}
+	return count;
+}
+
+static const struct file_operations pb_zybo_mmio_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = pb_zybo_mmio_reset_write,
+	.llseek = noop_llseek,
+};
+
+/**
+ * @brief Create the debugfs directory of the device instance with MMIO histograms
+ * 
+ * @param pd Device instance
+ */
+static void pb_zybo_dev_debugfs_init(struct pb_zybo_dev *pd) {
+	pd->dbg_dir = debugfs_create_dir(dev_name(pd->device), pb_zybo_dbg_root);
+	debugfs_create_bool("mmio_timing", 0600, pd->dbg_dir, &pd->hist->enabled);
+	debugfs_create_file("mmio_hist", 0400, pd->dbg_dir, pd, &pb_zybo_mmio_hist_fops);
+	debugfs_create_file("mmio_hist_reset", 0200, pd->dbg_dir, pd, &pb_zybo_mmio_reset_fops);
+}
+
+/* ==================================================================
+ 		Probe type
+   ================================================================== */
+
+static bool async_probe = true;
+module_param(async_probe, bool, 0444);
+MODULE_PARM_DESC(async_probe, "Probe pb-zybo devices asynchronously (0 = synchronous probe for comparison)");
+
+/**
+ * @brief Get the probe type of pb-zybo drivers - the probe runs asynchronously, so the
+ * module init (and the boot) doesn't wait for device instances. Drivers set it before the
+ * registration of the platform driver.
+ * 
+ * @return enum probe_type Probe type of platform drivers
+ */
+enum probe_type pb_zybo_probe_type(void) {
+	return async_probe ? PROBE_PREFER_ASYNCHRONOUS : PROBE_FORCE_SYNCHRONOUS;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_probe_type);
+
+/* ==================================================================
+ 		State handover
+   ================================================================== */
+
+static bool keep_state;
+module_param(keep_state, bool, 0644);
+MODULE_PARM_DESC(keep_state, "Keep the HW state across remove/probe of drivers (reload without output glitches)");
+
+/**
+ * @brief Snapshot of the driver state stored by the remove and taken by the next probe of
+ * the same device (kind and the physical address of the register window)
+ * 
+ */
+struct pb_zybo_state {
+	struct list_head	list;
+	enum pb_zybo_kind	kind;
+	unsigned long		start;		/* Physical address of the device */
+	size_t				len;		/* Size of the driver data */
+	u8					data[];
+};
+
+/* Snapshots live in the core, so they survive the reload of driver modules */
+static DEFINE_MUTEX(pb_zybo_state_lock);
+static LIST_HEAD(pb_zybo_states);
+
+/**
+ * @brief Check if drivers keep the HW state - the remove doesn't reset the device and
+ * the probe adopts the current register values instead of the initialization
+ * 
+ * @return bool True iff the state is kept
+ */
+bool pb_zybo_keep_state(void) {
+	return READ_ONCE(keep_state);
+}
+EXPORT_SYMBOL_GPL(pb_zybo_keep_state);
+
+static struct pb_zybo_state *pb_zybo_state_find(enum pb_zybo_kind kind, unsigned long start) {
+	struct pb_zybo_state *st;
+
+	list_for_each_entry(st, &pb_zybo_states, list) {
+		if (st->kind == kind && st->start == start) {
+			return st;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Store the driver state for the next probe, the older snapshot of the
+ * device is replaced
+ * 
+ * @param kind Driver kind
+ * @param start Physical address of the device
+ * @param data Driver data
+ * @param len Size of the driver data
+ * @return int 0 iff the snapshot was stored
+ */
+int pb_zybo_state_save(enum pb_zybo_kind kind, unsigned long start, const void *data, size_t len) {
+	struct pb_zybo_state *st, *old;
+
+	st = kmalloc(struct_size(st, data, len), GFP_KERNEL);
+	if (!st) {
+		return -ENOMEM;
+	}
+
+	st->kind = kind;
+	st->start = start;
+	st->len = len;
+	memcpy(st->data, data, len);
+
+	mutex_lock(&pb_zybo_state_lock);
+	old = pb_zybo_state_find(kind, start);
+	if (old) {
+		list_del(&old->list);
+		kfree(old);
+	}
+	list_add(&st->list, &pb_zybo_states);
+	mutex_unlock(&pb_zybo_state_lock);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_state_save);
+
+/**
+ * @brief Take the stored driver state, the snapshot is removed. The snapshot of
+ * a different size (e.g., from the older driver version) is dropped.
+ * 
+ * @param kind Driver kind
+ * @param start Physical address of the device
+ * @param data Output driver data
+ * @param len Size of the driver data
+ * @return int 0 iff the snapshot was loaded, -ENOENT if there is no usable snapshot
+ */
+int pb_zybo_state_load(enum pb_zybo_kind kind, unsigned long start, void *data, size_t len) {
+	struct pb_zybo_state *st;
+	int rc = -ENOENT;
+
+	mutex_lock(&pb_zybo_state_lock);
+	st = pb_zybo_state_find(kind, start);
+	if (st) {
+		if (st->len == len) {
+			memcpy(data, st->data, len);
+			rc = 0;
+		}
+		list_del(&st->list);
+		kfree(st);
+	}
+	mutex_unlock(&pb_zybo_state_lock);
+	return rc;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_state_load);
+
+static void pb_zybo_state_free_all(void) {
+	struct pb_zybo_state *st, *tmp;
+
+	mutex_lock(&pb_zybo_state_lock);
+	list_for_each_entry_safe(st, tmp, &pb_zybo_states, list) {
+		list_del(&st->list);
+		kfree(st);
+	}
+	mutex_unlock(&pb_zybo_state_lock);
+}
+
+/* ==================================================================
+ 		Driver type management
+   ================================================================== */
+
+/* The owner argument of class_create was removed in linux 6.4 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+#define pb_zybo_class_create(name)	class_create(name)
+#else
+#define pb_zybo_class_create(name)	class_create(THIS_MODULE, name)
+#endif
+
+/**
+ * @brief Register the driver type - allocate the chrdev region for all
+ * instances and create the sysfs class. This is typically called from the module init
+ * function before the platform driver is registered.
+ * 
+ * @param type Driver type to register
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_type_register(struct pb_zybo_type *type) {
+	int rc;
+
+	/* Open files can outlive the remove, the driver frees instances in the release callback */
+	if (!type->release) {
+		pr_err("pb-zybo-core: %s has no release callback\n", type->name);
+		return -EINVAL;
+	}
+
+	/* Dynamic allocation of Major number and the pool of minors */
+	rc = alloc_chrdev_region(&type->base_devid, 0, PB_ZYBO_MAX_MINORS, type->name);
+	if (rc < 0) {
+		pr_err("pb-zybo-core: error during the MAJOR and MINOR allocation for %s\n", type->name);
+		return rc;
+	}
+
+	/* One sysfs class is shared by all instances of the type */
+	type->sysclass = pb_zybo_class_create(type->name);
+	if (IS_ERR(type->sysclass)) {
+		pr_err("pb-zybo-core: error during the sysfs class creation for %s\n", type->name);
+		rc = PTR_ERR(type->sysclass);
+		type->sysclass = NULL;
+		unregister_chrdev_region(type->base_devid, PB_ZYBO_MAX_MINORS);
+		return rc;
+	}
+
+	rc = pb_zybo_type_init_groups(type);
+	if (rc) {
+		class_destroy(type->sysclass);
+		type->sysclass = NULL;
+		unregister_chrdev_region(type->base_devid, PB_ZYBO_MAX_MINORS);
+		return rc;
+	}
+
+	idr_init(&type->devs);
+
+	/* Types with the command callback can be used via /dev/pb-zybo-cmd */
+	if (type->kind != PB_ZYBO_KIND_NONE && type->cmd_exec) {
+		mutex_lock(&pb_zybo_registry_lock);
+		pb_zybo_kinds[type->kind] = type;
+		mutex_unlock(&pb_zybo_registry_lock);
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_type_register);
+
+/**
+ * @brief Unregister the driver type, all device instances have to be already removed
+ * 
+ * @param type Driver type to unregister
+ */
+void pb_zybo_type_unregister(struct pb_zybo_type *type) {
+	mutex_lock(&pb_zybo_registry_lock);
+	if (pb_zybo_kinds[type->kind] == type) {
+		pb_zybo_kinds[type->kind] = NULL;
+	}
+	mutex_unlock(&pb_zybo_registry_lock);
+
+	idr_destroy(&type->devs);
+	kfree(type->all_groups);
+	type->all_groups = NULL;
+	class_destroy(type->sysclass);
+	type->sysclass = NULL;
+	unregister_chrdev_region(type->base_devid, PB_ZYBO_MAX_MINORS);
+}
+EXPORT_SYMBOL_GPL(pb_zybo_type_unregister);
+
+/* ==================================================================
+ 		Device instance management
+   ================================================================== */
+
+static void pb_zybo_uring_dev_init(struct pb_zybo_dev *pd);
+static void pb_zybo_uring_dev_flush(struct pb_zybo_dev *pd);
+
+/**
+ * @brief Get the minor number of the device instance within its driver type
+ * 
+ */
+static unsigned int pb_zybo_dev_minor(const struct pb_zybo_dev *pd) {
+	return MINOR(pd->devid) - MINOR(pd->type->base_devid);
+}
+
+/**
+ * @brief Release of the instance kobject - the cdev and the driver dropped their
+ * references, so no file can reach the instance anymore
+ * 
+ */
+static void pb_zybo_dev_kobj_release(struct kobject *kobj) {
+	struct pb_zybo_dev *pd = container_of(kobj, struct pb_zybo_dev, kobj);
+
+	free_percpu(pd->stats);
+	pd->stats = NULL;
+	kfree(pd->hist);
+	pd->hist = NULL;
+	pd->type->release(pd);
+}
+
+static struct kobj_type pb_zybo_dev_ktype = {
+	.release = pb_zybo_dev_kobj_release,
+};
+
+/**
+ * @brief Add one device instance - take a free minor number, register the cdev
+ * and create the device in /dev and sysfs.
+ * 
+ * @param type Registered driver type
+ * @param pd Device instance to initialize
+ * @param parent Parent device (typically the platform device)
+ * @param drvdata Driver data of the created device (see pb_zybo_dev_get_drvdata)
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_dev_add(struct pb_zybo_type *type, struct pb_zybo_dev *pd,
+	struct device *parent, void *drvdata) {
+	int rc;
+	int minor;
+	int cpu;
+
+	/* Prepare the samaphore - one process is allowed to work with the device */
+	sema_init(&pd->sem, 1);
+	refcount_set(&pd->users, 1);
+	init_completion(&pd->released);
+	pb_zybo_uring_dev_init(pd);
+	pd->type = type;
+	pd->device = NULL;
+	pd->drvdata = drvdata;
+	pd->gone = false;
+
+	pd->stats = alloc_percpu(struct pb_zybo_stats);
+	if (!pd->stats) {
+		dev_err(parent, "Could not allocate statistics\n");
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		u64_stats_init(&per_cpu_ptr(pd->stats, cpu)->syncp);
+	}
+
+	pd->hist = kzalloc(sizeof(struct pb_zybo_mmio_hist), GFP_KERNEL);
+	if (!pd->hist) {
+		dev_err(parent, "Could not allocate MMIO histograms\n");
+		rc = -ENOMEM;
+		goto err_free_stats;
+	}
+
+	/* The minor is reserved now, the instance is published at the end of the init */
+	mutex_lock(&pb_zybo_registry_lock);
+	minor = idr_alloc(&type->devs, NULL, 0, PB_ZYBO_MAX_MINORS, GFP_KERNEL);
+	mutex_unlock(&pb_zybo_registry_lock);
+	if (minor < 0) {
+		dev_err(parent, "No free minor number for %s\n", type->name);
+		rc = minor;
+		goto err_free_hist;
+	}
+
+	pd->devid = MKDEV(MAJOR(type->base_devid), MINOR(type->base_devid) + minor);
+	dev_dbg(parent, "cdev init MAJOR=%d and MINOR=%d\n", MAJOR(pd->devid), MINOR(pd->devid));
+
+	/* Register the cdev into the kernel */
+	cdev_init(&pd->cdev, type->fops);
+	pd->cdev.owner = type->fops->owner;
+
+	/* Open files keep the instance alive through the cdev (see pb_zybo_dev_release) */
+	kobject_init(&pd->kobj, &pb_zybo_dev_ktype);
+	cdev_set_parent(&pd->cdev, &pd->kobj);
+
+	rc = cdev_add(&pd->cdev, pd->devid, 1);
+	if (rc < 0) {
+		dev_err(parent, "Error during the cdev_add operation.\n");
+		goto err_free_minor;
+	}
+
+	/* Create a device in /dev and register it to the sysfs */
+	pd->device = device_create_with_groups(type->sysclass, parent, pd->devid, pd,
+		type->all_groups, type->devname_fmt, pd->devid);
+	if (IS_ERR(pd->device)) {
+		dev_err(parent, "Error during the device creation.\n");
+		rc = PTR_ERR(pd->device);
+		pd->device = NULL;
+		goto err_cdev_del;
+	}
+
+	pb_zybo_dev_debugfs_init(pd);
+
+	mutex_lock(&pb_zybo_registry_lock);
+	idr_replace(&type->devs, pd, minor);
+	mutex_unlock(&pb_zybo_registry_lock);
+	return 0;
+
+err_cdev_del:
+	cdev_del(&pd->cdev);
+err_free_minor:
+	mutex_lock(&pb_zybo_registry_lock);
+	idr_remove(&type->devs, minor);
+	mutex_unlock(&pb_zybo_registry_lock);
+err_free_hist:
+	kfree(pd->hist);
+	pd->hist = NULL;
+err_free_stats:
+	free_percpu(pd->stats);
+	pd->stats = NULL;
+	return rc;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_dev_add);
+
+/**
+ * @brief Pin the published device instance, the registry lock has to be held. The pinned
+ * instance stays alive after the registry lock is dropped.
+ * 
+ * @param pd Device instance found in the registry
+ */
+static void pb_zybo_dev_pin(struct pb_zybo_dev *pd) {
+	refcount_inc(&pd->users);
+}
+
+/**
+ * @brief Drop the pin taken by pb_zybo_dev_pin
+ * 
+ * @param pd Device instance
+ */
+static void pb_zybo_dev_put(struct pb_zybo_dev *pd) {
+	if (refcount_dec_and_test(&pd->users)) {
+		complete(&pd->released);
+	}
+}
+
+/**
+ * @brief Remove the device instance and return its minor number to the pool. The call
+ * waits until pins of running command batches are dropped.
+ * 
+ * @param pd Device instance to remove
+ */
+void pb_zybo_dev_del(struct pb_zybo_dev *pd) {
+	struct pb_zybo_type *type = pd->type;
+
+	/* Unpublish the instance first, then wait for users which pinned it before */
+	mutex_lock(&pb_zybo_registry_lock);
+	idr_remove(&type->devs, pb_zybo_dev_minor(pd));
+	mutex_unlock(&pb_zybo_registry_lock);
+	pb_zybo_dev_put(pd);
+	wait_for_completion(&pd->released);
+
+	debugfs_remove_recursive(pd->dbg_dir);
+	pd->dbg_dir = NULL;
+	device_destroy(type->sysclass, pd->devid);
+	cdev_del(&pd->cdev);
+	pb_zybo_uring_dev_flush(pd);
+
+	/* Wait for the running file operation, files opened before cdev_del fail in pb_zybo_down
+	 * from now on. Their statistics are freed with the instance in pb_zybo_dev_release. */
+	down(&pd->sem);
+	pd->gone = true;
+	up(&pd->sem);
+	pd->device = NULL;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_dev_del);
+
+/**
+ * @brief Drop the driver reference of the instance removed by pb_zybo_dev_del, it is
+ * called at the end of the remove instead of freeing the instance. The release
+ * callback is called now or after the last open file is closed. The instance which failed
+ * in pb_zybo_dev_add isn't referenced by the core and the driver frees it directly.
+ * 
+ * @param pd Device instance
+ */
+void pb_zybo_dev_release(struct pb_zybo_dev *pd) {
+	kobject_put(&pd->kobj);
+}
+EXPORT_SYMBOL_GPL(pb_zybo_dev_release);
+
+/* ==================================================================
+ 		Batched commands (/dev/pb-zybo-cmd)
+   ================================================================== */
+
+/**
+ * @brief Get the kind of the device which executes the command
+ * 
+ * @param op Command operation
+ * @return enum pb_zybo_kind Kind of the target device (PB_ZYBO_KIND_NONE for core commands)
+ */
+static enum pb_zybo_kind pb_zybo_cmd_kind(u16 op) {
+	switch (op) {
+	case PB_ZYBO_CMD_LED_SET:
+		return PB_ZYBO_KIND_LED;
+	case PB_ZYBO_CMD_RGB_SET:
+	case PB_ZYBO_CMD_RGB_PERIOD_SET:
+		return PB_ZYBO_KIND_RGB;
+	case PB_ZYBO_CMD_SW_GET:
+		return PB_ZYBO_KIND_SWITCH;
+	default:
+		return PB_ZYBO_KIND_NONE;
+	}
+}
+
+/**
+ * @brief Execute one command under the device semaphore. The non-blocking call (io_uring
+ * inline submission, SQPOLL thread) returns -EAGAIN for the busy device.
+ * 
+ * @param pd Target device
+ * @param op Command operation
+ * @param arg Command argument
+ * @param val Output value
+ * @param nonblock Don't wait for the busy device
+ * @return long 0 iff the command was executed
+ */
+static long pb_zybo_cmd_exec_one(struct pb_zybo_dev *pd, u32 op, u32 arg, u32 *val,
+	bool nonblock) {
+	long rc;
+
+	rc = pb_zybo_down_flags(pd, nonblock);
+	if (rc) {
+		return rc;
+	}
+
+	rc = pd->type->cmd_exec(pd, op, arg, val);
+	pb_zybo_op_done(pd, PB_ZYBO_OP_CMD, 0, rc);
+	pb_zybo_up(pd);
+	return rc;
+}
+
+/**
+ * @brief Compare device instances - semaphores of the batch are always taken in the
+ * same order (kind, minor), so two batches cannot deadlock.
+ * 
+ */
+static int pb_zybo_cmd_dev_cmp(const void *a, const void *b) {
+	const struct pb_zybo_dev *da = *(const struct pb_zybo_dev **)a;
+	const struct pb_zybo_dev *db = *(const struct pb_zybo_dev **)b;
+
+	if (da->type->kind != db->type->kind) {
+		return da->type->kind - db->type->kind;
+	}
+	return MINOR(da->devid) - MINOR(db->devid);
+}
+
+/**
+ * @brief Wait between commands of the batch - short delays spin, longer delays sleep
+ * (udelay isn't usable for milliseconds on ARM)
+ * 
+ * @param us Delay in microseconds
+ */
+static void pb_zybo_cmd_delay(u32 us) {
+	if (us <= 10) {
+		udelay(us);
+	} else {
+		usleep_range(us, us + us / 8);
+	}
+}
+
+/**
+ * @brief Execute one submission - resolve and pin target devices, take each semaphore once,
+ * run commands in order and release semaphores. The registry lock is held only during the
+ * resolution, so a long batch doesn't block other batches, probes and removes. The execution
+ * stops at the first failed command, the rest of commands is marked with -ECANCELED.
+ * 
+ * @param file Opened /dev/pb-zybo-cmd file
+ * @param cmds Kernel copy of commands
+ * @param count Number of commands
+ * @param done Number of successfully executed commands
+ * @return long 0 iff all commands were executed
+ */
+static long pb_zybo_cmd_run(struct file *file, struct pb_zybo_cmd *cmds, u32 count, u32 *done) {
+	struct pb_zybo_dev **targets;
+	struct pb_zybo_dev **pinned;
+	const struct pb_zybo_file *pf = file->private_data;
+	bool can_write = pf->can_write;
+	int n_pinned = 0;
+	int n_locked = 0;
+	long rc = 0;
+	u32 i;
+	int j;
+
+	*done = 0;
+	targets = kcalloc(count, sizeof(*targets), GFP_KERNEL);
+	pinned = kcalloc(count, sizeof(*pinned), GFP_KERNEL);
+	if (!targets || !pinned) {
+		rc = -ENOMEM;
+		goto cmd_free;
+	}
+
+	for (i = 0; i < count; i++) {
+		cmds[i].res = -ECANCELED;
+		cmds[i].val = 0;
+	}
+
+	/* Resolve and pin all targets before the execution */
+	mutex_lock(&pb_zybo_registry_lock);
+	for (i = 0; i < count; i++) {
+		enum pb_zybo_kind kind = pb_zybo_cmd_kind(cmds[i].op);
+		struct pb_zybo_type *type;
+
+		if (kind == PB_ZYBO_KIND_NONE) {
+			if (cmds[i].op != PB_ZYBO_CMD_DELAY || cmds[i].arg > PB_ZYBO_CMD_MAX_DELAY_US) {
+				cmds[i].res = -EINVAL;
+				rc = -EINVAL;
+				break;
+			}
+			continue;
+		}
+
+		if (cmds[i].op != PB_ZYBO_CMD_SW_GET && !can_write) {
+			cmds[i].res = -EPERM;
+			rc = -EPERM;
+			break;
+		}
+
+		type = pb_zybo_kinds[kind];
+		targets[i] = type ? idr_find(&type->devs, cmds[i].dev) : NULL;
+		if (!targets[i]) {
+			cmds[i].res = -ENODEV;
+			rc = -ENODEV;
+			break;
+		}
+
+		/* Each device is pinned and locked once */
+		for (j = 0; j < n_pinned; j++) {
+			if (pinned[j] == targets[i]) {
+				break;
+			}
+		}
+		if (j == n_pinned) {
+			pb_zybo_dev_pin(targets[i]);
+			pinned[n_pinned++] = targets[i];
+		}
+	}
+	mutex_unlock(&pb_zybo_registry_lock);
+	if (rc) {
+		goto cmd_unpin;
+	}
+
+	sort(pinned, n_pinned, sizeof(*pinned), pb_zybo_cmd_dev_cmp, NULL);
+	for (n_locked = 0; n_locked < n_pinned; n_locked++) {
+		rc = pb_zybo_down(pinned[n_locked], file);
+		if (rc) {
+			goto cmd_release;
+		}
+	}
+
+	/* One lock pass - execute commands in order */
+	for (i = 0; i < count; i++) {
+		struct pb_zybo_dev *pd = targets[i];
+		u32 val = 0;
+
+		if (!pd) {
+			pb_zybo_cmd_delay(cmds[i].arg);
+			cmds[i].res = 0;
+		} else {
+			cmds[i].res = pd->type->cmd_exec(pd, cmds[i].op, cmds[i].arg, &val);
+			cmds[i].val = val;
+			pb_zybo_op_done(pd, PB_ZYBO_OP_CMD, 0, cmds[i].res);
+		}
+
+		if (cmds[i].res) {
+			rc = cmds[i].res;
+			break;
+		}
+		(*done)++;
+	}
+
+cmd_release:
+	for (j = n_locked - 1; j >= 0; j--) {
+		pb_zybo_up(pinned[j]);
+	}
+cmd_unpin:
+	for (j = 0; j < n_pinned; j++) {
+		pb_zybo_dev_put(pinned[j]);
+	}
+cmd_free:
+	kfree(pinned);
+	kfree(targets);
+	return rc;
+}
+
+static long pb_zybo_cmd_submit(struct file *file, unsigned long arg) {
+	struct pb_zybo_cmd_batch batch;
+	struct pb_zybo_cmd *cmds;
+	void __user *ucmds;
+	long rc;
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+		return -EFAULT;
+	}
+
+	if (batch.count == 0 || batch.count > PB_ZYBO_CMD_MAX) {
+		return -EINVAL;
+	}
+
+	ucmds = u64_to_user_ptr(batch.cmds);
+	cmds = memdup_user(ucmds, batch.count * sizeof(*cmds));
+	if (IS_ERR(cmds)) {
+		return PTR_ERR(cmds);
+	}
+
+	rc = pb_zybo_cmd_run(file, cmds, batch.count, &batch.done);
+
+	/* Completions are written back even if the batch failed */
+	if (copy_to_user(ucmds, cmds, batch.count * sizeof(*cmds)) ||
+		copy_to_user((void __user *)arg, &batch, sizeof(batch))) {
+		rc = -EFAULT;
+	}
+
+	kfree(cmds);
+	return rc;
+}
+
+static long pb_zybo_rules_set(struct file *file, unsigned long arg);
+
+static long pb_zybo_cmd_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	switch (cmd) {
+	case PB_ZYBO_CMD_IOCTL_SUBMIT:
+		return pb_zybo_cmd_submit(file, arg);
+	case PB_ZYBO_CMD_IOCTL_SET_RULES:
+		return pb_zybo_rules_set(file, arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int pb_zybo_cmd_open(struct inode *inode, struct file *filp) {
+	struct pb_zybo_file *pf;
+
+	/* The permission is checked once here, setters require the SYSADMIN capability. The file
+	 * isn't bound to one device instance. */
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if (!pf) {
+		return -ENOMEM;
+	}
+
+	pb_zybo_file_init(pf, NULL);
+	filp->private_data = pf;
+	return 0;
+}
+
+static int pb_zybo_cmd_release(struct inode *inode, struct file *filp) {
+	kfree(filp->private_data);
+	filp->private_data = NULL;
+	return 0;
+}
+
+static const struct file_operations pb_zybo_cmd_fops = {
+	.owner = THIS_MODULE,
+	.open = pb_zybo_cmd_open,
+	.release = pb_zybo_cmd_release,
+	.unlocked_ioctl = pb_zybo_cmd_ioctl,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice pb_zybo_cmd_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "pb-zybo-cmd",
+	.fops = &pb_zybo_cmd_fops,
+};
+
+/* ==================================================================
+ 		Reaction rules
+   ================================================================== */
+
+/**
+ * @brief Runtime state of one rule, it is owned by the rule thread
+ * 
+ */
+struct pb_zybo_rule_state {
+	struct pb_zybo_rule	rule;
+	u32					last;		/* Last evaluated switch value */
+	bool				valid;		/* The last value is known */
+	unsigned long		hits;		/* Number of executed actions */
+	unsigned long		errors;		/* Number of failed actions */
+};
+
+/**
+ * @brief Active table of rules. The rule thread samples referenced switches once per
+ * period, samples are reported back by switch drivers (pb_zybo_sw_sample) and changed
+ * values are evaluated by the same thread right after the sampling.
+ * 
+ */
+struct pb_zybo_rules {
+	struct task_struct			*task;		/* Sampling and evaluation thread */
+	u32							 period_us;	/* Sampling period of referenced switches */
+	u32							 count;
+	DECLARE_BITMAP(watched, PB_ZYBO_MAX_MINORS);	/* Switches referenced by rules */
+	DECLARE_BITMAP(known, PB_ZYBO_MAX_MINORS);		/* The switch value was reported */
+	DECLARE_BITMAP(pending, PB_ZYBO_MAX_MINORS);	/* The reported value wasn't evaluated */
+	u32							 sw_val[PB_ZYBO_MAX_MINORS];	/* Last reported values */
+	struct pb_zybo_rule_state	 st[];
+};
+
+/* Serializes uploads, the lock order is rules -> registry -> device semaphore */
+static DEFINE_MUTEX(pb_zybo_rules_lock);
+/* Protects the active table pointer and reported values, it is taken by the sampling path */
+static DEFINE_SPINLOCK(pb_zybo_rules_ev_lock);
+static struct pb_zybo_rules *pb_zybo_rules;
+
+/**
+ * @brief Find the device instance of the given kind, the registry lock has to be held
+ * 
+ */
+static struct pb_zybo_dev *pb_zybo_rules_dev(enum pb_zybo_kind kind, u16 minor) {
+	struct pb_zybo_type *type = pb_zybo_kinds[kind];
+
+	return type ? idr_find(&type->devs, minor) : NULL;
+}
+
+/**
+ * @brief Record the switch sample for rules. Called with the event lock of the switch
+ * driver held - the change found by the rule thread is evaluated after the sampling,
+ * changes found by other readers (poll, IOCTL) wake the thread.
+ * 
+ * @param pd Switch device
+ * @param val Sampled value
+ */
+static void pb_zybo_rules_sample(struct pb_zybo_dev *pd, u32 val) {
+	struct pb_zybo_rules *rules;
+	unsigned int minor;
+
+	/* Unpublished instances (KUnit fixture) don't have a minor number */
+	if (!pd->type) {
+		return;
+	}
+
+	minor = pb_zybo_dev_minor(pd);
+	spin_lock(&pb_zybo_rules_ev_lock);
+	rules = pb_zybo_rules;
+	if (rules && minor < PB_ZYBO_MAX_MINORS && test_bit(minor, rules->watched) &&
+		(!test_bit(minor, rules->known) || rules->sw_val[minor] != val)) {
+		rules->sw_val[minor] = val;
+		__set_bit(minor, rules->known);
+		__set_bit(minor, rules->pending);
+		if (rules->task != current) {
+			wake_up_process(rules->task);
+		}
+	}
+	spin_unlock(&pb_zybo_rules_ev_lock);
+}
+
+/**
+ * @brief Evaluate the trigger of the rule with the new switch value
+ * 
+ * @return bool True iff the action has to be executed
+ */
+static bool pb_zybo_rules_fired(const struct pb_zybo_rule_state *st, u32 val) {
+	const struct pb_zybo_rule *rule = &st->rule;
+
+	switch (rule->type) {
+	case PB_ZYBO_RULE_MATCH:
+		/* Edge of the condition, the first sample fires when the condition holds */
+		if ((val & rule->mask) != rule->value) {
+			return false;
+		}
+		return !st->valid || (st->last & rule->mask) != rule->value;
+	case PB_ZYBO_RULE_TOGGLE:
+		return st->valid && ((st->last ^ val) & rule->mask);
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Execute the action of the rule - the target is pinned and the registry lock
+ * is dropped before the device semaphore is taken
+ * 
+ * @return int 0 iff the action was executed
+ */
+static int pb_zybo_rules_exec(const struct pb_zybo_rule *rule) {
+	struct pb_zybo_dev *pd;
+	u32 out;
+	int rc;
+
+	mutex_lock(&pb_zybo_registry_lock);
+	pd = pb_zybo_rules_dev(pb_zybo_cmd_kind(rule->op), rule->dev);
+	if (pd) {
+		pb_zybo_dev_pin(pd);
+	}
+	mutex_unlock(&pb_zybo_registry_lock);
+	if (!pd) {
+		return -ENODEV;
+	}
+
+	rc = pb_zybo_cmd_exec_one(pd, rule->op, rule->arg, &out, false);
+	pb_zybo_dev_put(pd);
+	return rc;
+}
+
+/**
+ * @brief Evaluate reported changes - triggers of changed switches are evaluated and
+ * actions executed in the order of rules. Actions of missing devices are errors.
+ * 
+ */
+static void pb_zybo_rules_eval(struct pb_zybo_rules *rules) {
+	DECLARE_BITMAP(pending, PB_ZYBO_MAX_MINORS);
+	u32 sw_val[PB_ZYBO_MAX_MINORS];
+	u32 i;
+
+	spin_lock(&pb_zybo_rules_ev_lock);
+	bitmap_copy(pending, rules->pending, PB_ZYBO_MAX_MINORS);
+	bitmap_zero(rules->pending, PB_ZYBO_MAX_MINORS);
+	memcpy(sw_val, rules->sw_val, sizeof(sw_val));
+	spin_unlock(&pb_zybo_rules_ev_lock);
+
+	for (i = 0; i < rules->count; i++) {
+		struct pb_zybo_rule_state *st = &rules->st[i];
+		u32 val;
+
+		if (!test_bit(st->rule.sw_dev, pending)) {
+			continue;
+		}
+
+		val = sw_val[st->rule.sw_dev];
+		if (pb_zybo_rules_fired(st, val)) {
+			if (!pb_zybo_rules_exec(&st->rule)) {
+				WRITE_ONCE(st->hits, st->hits + 1);
+			} else {
+				WRITE_ONCE(st->errors, st->errors + 1);
+			}
+		}
+
+		st->last = val;
+		st->valid = true;
+	}
+}
+
+/**
+ * @brief Take one sample of each switch referenced by rules. Samples are reported back
+ * by drivers through pb_zybo_sw_sample, switches added later are sampled once they are
+ * published in the registry.
+ * 
+ */
+static void pb_zybo_rules_sample_all(struct pb_zybo_rules *rules) {
+	struct pb_zybo_type *type;
+	struct pb_zybo_dev *pd;
+	unsigned int minor;
+
+	/* Removed instances leave the registry first, so the lock keeps the device valid */
+	mutex_lock(&pb_zybo_registry_lock);
+	type = pb_zybo_kinds[PB_ZYBO_KIND_SWITCH];
+	if (type && type->sample) {
+		for_each_set_bit(minor, rules->watched, PB_ZYBO_MAX_MINORS) {
+			pd = idr_find(&type->devs, minor);
+			if (pd) {
+				type->sample(pd);
+			}
+		}
+	}
+	mutex_unlock(&pb_zybo_registry_lock);
+}
+
+/**
+ * @brief Check for reported changes which weren't evaluated yet
+ * 
+ */
+static bool pb_zybo_rules_pending(struct pb_zybo_rules *rules) {
+	bool pending;
+
+	spin_lock(&pb_zybo_rules_ev_lock);
+	pending = !bitmap_empty(rules->pending, PB_ZYBO_MAX_MINORS);
+	spin_unlock(&pb_zybo_rules_ev_lock);
+	return pending;
+}
+
+/**
+ * @brief Rule thread - switches are sampled on absolute hrtimer deadlines, so the period
+ * isn't rounded to jiffies, and rules are evaluated inline right after the sampling.
+ * Actions take device semaphores, therefore they run here and not in the timer callback.
+ * 
+ */
+static int pb_zybo_rules_thread(void *data) {
+	struct pb_zybo_rules *rules = data;
+	ktime_t next = ktime_get();
+	ktime_t now;
+
+	while (!kthread_should_stop()) {
+		now = ktime_get();
+		if (!ktime_before(now, next)) {
+			pb_zybo_rules_sample_all(rules);
+			next = ktime_add_us(next, rules->period_us);
+			/* Overrun - the next deadline is one period from now, samples aren't bunched */
+			if (!ktime_after(next, now)) {
+				next = ktime_add_us(now, rules->period_us);
+			}
+		}
+		pb_zybo_rules_eval(rules);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop() && !pb_zybo_rules_pending(rules)) {
+			schedule_hrtimeout_range(&next, 0, HRTIMER_MODE_ABS);
+		}
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/**
+ * @brief Unpublish and release the active table, the rules lock has to be held
+ * 
+ */
+static void pb_zybo_rules_stop(void) {
+	struct pb_zybo_rules *rules = pb_zybo_rules;
+
+	if (!rules) {
+		return;
+	}
+
+	spin_lock(&pb_zybo_rules_ev_lock);
+	pb_zybo_rules = NULL;
+	spin_unlock(&pb_zybo_rules_ev_lock);
+	kthread_stop(rules->task);
+	kfree(rules);
+}
+
+/**
+ * @brief Check the uploaded rule
+ * 
+ * @return int 0 iff the rule is valid
+ */
+static int pb_zybo_rules_check(const struct pb_zybo_rule *rule) {
+	switch (rule->op) {
+	case PB_ZYBO_CMD_LED_SET:
+	case PB_ZYBO_CMD_RGB_SET:
+	case PB_ZYBO_CMD_RGB_PERIOD_SET:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (rule->sw_dev >= PB_ZYBO_MAX_MINORS) {
+		return -EINVAL;
+	}
+
+	switch (rule->type) {
+	case PB_ZYBO_RULE_MATCH:
+		return (rule->value & ~rule->mask) ? -EINVAL : 0;
+	case PB_ZYBO_RULE_TOGGLE:
+		return rule->mask ? 0 : -EINVAL;
+	default:
+		return -EINVAL;
+	}
+}
+
+/**
+ * @brief Replace the table of reaction rules. Referenced switches are sampled by the rule
+ * thread with the period of the table and changes are evaluated in the kernel, so
+ * reactions don't wait for the user space.
+ * 
+ * @param file Opened /dev/pb-zybo-cmd file
+ * @param arg User pointer to struct pb_zybo_rule_table
+ * @return long 0 iff the table was uploaded
+ */
+static long pb_zybo_rules_set(struct file *file, unsigned long arg) {
+	struct pb_zybo_rule_table table;
+	struct pb_zybo_rules *rules;
+	struct pb_zybo_rule *urules;
+	const struct pb_zybo_file *pf = file->private_data;
+	u32 i;
+	long rc;
+
+	if (!pf->can_write) {
+		return -EPERM;
+	}
+
+	if (copy_from_user(&table, (void __user *)arg, sizeof(table))) {
+		return -EFAULT;
+	}
+
+	if (table.count == 0) {
+		mutex_lock(&pb_zybo_rules_lock);
+		pb_zybo_rules_stop();
+		mutex_unlock(&pb_zybo_rules_lock);
+		return 0;
+	}
+
+	if (table.count > PB_ZYBO_RULES_MAX || table.period_us < PB_ZYBO_RULES_MIN_PERIOD_US ||
+		table.period_us > PB_ZYBO_RULES_MAX_PERIOD_US) {
+		return -EINVAL;
+	}
+
+	urules = memdup_user(u64_to_user_ptr(table.rules), table.count * sizeof(*urules));
+	if (IS_ERR(urules)) {
+		return PTR_ERR(urules);
+	}
+
+	rules = kzalloc(struct_size(rules, st, table.count), GFP_KERNEL);
+	if (!rules) {
+		rc = -ENOMEM;
+		goto rules_free_user;
+	}
+
+	rules->period_us = table.period_us;
+	rules->count = table.count;
+	for (i = 0; i < table.count; i++) {
+		rc = pb_zybo_rules_check(&urules[i]);
+		if (rc) {
+			goto rules_free;
+		}
+		rules->st[i].rule = urules[i];
+		__set_bit(urules[i].sw_dev, rules->watched);
+	}
+
+	rules->task = kthread_create(pb_zybo_rules_thread, rules, "pb-zybo-rules");
+	if (IS_ERR(rules->task)) {
+		rc = PTR_ERR(rules->task);
+		goto rules_free;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	/* Reactions shouldn't wait behind normal tasks */
+	sched_set_fifo_low(rules->task);
+#endif
+
+	mutex_lock(&pb_zybo_rules_lock);
+	pb_zybo_rules_stop();
+	spin_lock(&pb_zybo_rules_ev_lock);
+	pb_zybo_rules = rules;
+	spin_unlock(&pb_zybo_rules_ev_lock);
+	wake_up_process(rules->task);
+	mutex_unlock(&pb_zybo_rules_lock);
+
+	kfree(urules);
+	return 0;
+
+rules_free:
+	kfree(rules);
+rules_free_user:
+	kfree(urules);
+	return rc;
+}
+
+static int pb_zybo_rules_show(struct seq_file *s, void *data) {
+	u32 i;
+
+	mutex_lock(&pb_zybo_rules_lock);
+	if (!pb_zybo_rules) {
+		seq_puts(s, "# no rules\n");
+		goto show_unlock;
+	}
+
+	seq_printf(s, "# period %u us\n", pb_zybo_rules->period_us);
+	seq_puts(s, "# type  switch  mask  value  op  dev  arg  hits  errors\n");
+	for (i = 0; i < pb_zybo_rules->count; i++) {
+		const struct pb_zybo_rule_state *st = &pb_zybo_rules->st[i];
+
+		seq_printf(s, "%s  %u  0x%x  0x%x  %u  %u  0x%x  %lu  %lu\n",
+			st->rule.type == PB_ZYBO_RULE_MATCH ? "match" : "toggle",
+			st->rule.sw_dev, st->rule.mask, st->rule.value, st->rule.op,
+			st->rule.dev, st->rule.arg, READ_ONCE(st->hits), READ_ONCE(st->errors));
+	}
+
+show_unlock:
+	mutex_unlock(&pb_zybo_rules_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pb_zybo_rules);
+
+/* ==================================================================
+ 		io_uring commands (.uring_cmd)
+   ================================================================== */
+
+#ifdef PB_ZYBO_HAS_URING_CMD
+
+/**
+ * @brief Private data of the queued switch-change wait, stored in the io_uring command
+ * 
+ */
+struct pb_zybo_uring_pdu {
+	struct list_head	 node;	/* Entry in the list of pending waits */
+	struct io_uring_cmd	*cmd;	/* Owning io_uring command */
+	u32					 last;	/* Last value known by the application */
+	int					 res;	/* CQE result */
+};
+
+static struct pb_zybo_uring_pdu *pb_zybo_uring_pdu(struct io_uring_cmd *ioucmd) {
+	BUILD_BUG_ON(sizeof(struct pb_zybo_uring_pdu) > sizeof_field(struct io_uring_cmd, pdu));
+	return (struct pb_zybo_uring_pdu *)ioucmd->pdu;
+}
+
+static void pb_zybo_uring_complete(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+	io_uring_cmd_done(ioucmd, pb_zybo_uring_pdu(ioucmd)->res, 0, issue_flags);
+}
+
+/**
+ * @brief Complete waits with a value different from the sampled one. It is called for
+ * each sample of the switch driver (see pb_zybo_sw_sample), the completion runs in the
+ * task context of the ring.
+ * 
+ * @param pd Switch device
+ * @param val Sampled value
+ */
+static void pb_zybo_uring_sample(struct pb_zybo_dev *pd, u32 val) {
+	struct pb_zybo_uring_pdu *pdu, *tmp;
+
+	if (list_empty_careful(&pd->uring_waits)) {
+		return;
+	}
+
+	spin_lock(&pd->uring_lock);
+	list_for_each_entry_safe(pdu, tmp, &pd->uring_waits, node) {
+		if (val == pdu->last) {
+			continue;
+		}
+		list_del(&pdu->node);
+		pdu->res = val;
+		io_uring_cmd_complete_in_task(pdu->cmd, pb_zybo_uring_complete);
+	}
+	spin_unlock(&pd->uring_lock);
+}
+
+/**
+ * @brief Check if the switch device has pending waits
+ * 
+ */
+static bool pb_zybo_uring_pending(struct pb_zybo_dev *pd) {
+	return !list_empty_careful(&pd->uring_waits);
+}
+
+/**
+ * @brief Queue the switch-change wait - the command is completed immediately if the
+ * current value already differs from the value known by the application. Queued waits
+ * are completed by samples of the switch driver.
+ * 
+ * @return int Current value or -EIOCBQUEUED for the queued wait
+ */
+static int pb_zybo_uring_wait(struct pb_zybo_dev *pd, struct io_uring_cmd *ioucmd, u32 last,
+	unsigned int issue_flags) {
+	struct pb_zybo_uring_pdu *pdu = pb_zybo_uring_pdu(ioucmd);
+	u32 val = 0;
+	long rc;
+
+	if (!pd->type->watch) {
+		return -EOPNOTSUPP;
+	}
+
+	rc = pb_zybo_cmd_exec_one(pd, PB_ZYBO_CMD_SW_GET, 0, &val,
+		issue_flags & IO_URING_F_NONBLOCK);
+	if (rc) {
+		return rc;
+	}
+	if (val != last) {
+		return val;
+	}
+
+	/* Allow the cancellation when the ring is closed before the switch change */
+	io_uring_cmd_mark_cancelable(ioucmd, issue_flags);
+
+	pdu->cmd = ioucmd;
+	pdu->last = last;
+	pdu->res = -ENODEV;
+	spin_lock(&pd->uring_lock);
+	if (pd->uring_closed) {
+		spin_unlock(&pd->uring_lock);
+		io_uring_cmd_complete_in_task(ioucmd, pb_zybo_uring_complete);
+		return -EIOCBQUEUED;
+	}
+	list_add_tail(&pdu->node, &pd->uring_waits);
+	spin_unlock(&pd->uring_lock);
+
+	/* A change between the read above and the queueing is caught by this sample */
+	pd->type->watch(pd);
+	return -EIOCBQUEUED;
+}
+
+/**
+ * @brief Cancel the pending wait (the ring is going away)
+ * 
+ */
+static void pb_zybo_uring_cancel(struct pb_zybo_dev *pd, struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags) {
+	struct pb_zybo_uring_pdu *pdu;
+	bool found = false;
+
+	spin_lock(&pd->uring_lock);
+	list_for_each_entry(pdu, &pd->uring_waits, node) {
+		if (pdu->cmd == ioucmd) {
+			list_del(&pdu->node);
+			found = true;
+			break;
+		}
+	}
+	spin_unlock(&pd->uring_lock);
+
+	/* The wait which is being completed by the sample isn't in the list */
+	if (found) {
+		io_uring_cmd_done(ioucmd, -ECANCELED, 0, issue_flags);
+	}
+}
+
+/**
+ * @brief The .uring_cmd callback of the LED, RGB and switch devices. Commands use
+ * the same operations as the batched interface, sqe->cmd_op is the PB_ZYBO_CMD_*
+ * operation and the payload is struct pb_zybo_uring_cmd. The file context of the
+ * driver starts with struct pb_zybo_file.
+ * 
+ * @param ioucmd io_uring command
+ * @param issue_flags Issue flags passed by io_uring
+ * @return int CQE result, -EIOCBQUEUED for the asynchronous completion
+ */
+int pb_zybo_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+	const struct pb_zybo_file *pf = ioucmd->file->private_data;
+	struct pb_zybo_dev *pd = pf->pd;
+	const struct pb_zybo_uring_cmd *ucmd = io_uring_sqe_cmd(ioucmd->sqe);
+	u32 op = ioucmd->cmd_op;
+	u32 arg = READ_ONCE(ucmd->arg);
+	u32 val = 0;
+	long rc;
+
+	if (issue_flags & IO_URING_F_CANCEL) {
+		pb_zybo_uring_cancel(pd, ioucmd, issue_flags);
+		return 0;
+	}
+
+	if (!pd->type->cmd_exec) {
+		return -EOPNOTSUPP;
+	}
+
+	if (op == PB_ZYBO_CMD_SW_WAIT && pd->type->kind == PB_ZYBO_KIND_SWITCH) {
+		return pb_zybo_uring_wait(pd, ioucmd, arg, issue_flags);
+	}
+
+	if (pb_zybo_cmd_kind(op) != pd->type->kind) {
+		return -EINVAL;
+	}
+
+	/* Setters require the same capability as the IOCTL calls (captured during the open) */
+	if (op != PB_ZYBO_CMD_SW_GET && !pf->can_write) {
+		return -EPERM;
+	}
+
+	rc = pb_zybo_cmd_exec_one(pd, op, arg, &val, issue_flags & IO_URING_F_NONBLOCK);
+	return rc ? rc : val;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_uring_cmd);
+
+static void pb_zybo_uring_dev_init(struct pb_zybo_dev *pd) {
+	spin_lock_init(&pd->uring_lock);
+	INIT_LIST_HEAD(&pd->uring_waits);
+	pd->uring_closed = false;
+}
+
+/**
+ * @brief Complete pending waits of the removed device, it is called after the cdev
+ * is deleted and new waits fail with -ENODEV
+ * 
+ */
+static void pb_zybo_uring_dev_flush(struct pb_zybo_dev *pd) {
+	struct pb_zybo_uring_pdu *pdu, *tmp;
+
+	spin_lock(&pd->uring_lock);
+	pd->uring_closed = true;
+	list_for_each_entry_safe(pdu, tmp, &pd->uring_waits, node) {
+		list_del(&pdu->node);
+		pdu->res = -ENODEV;
+		io_uring_cmd_complete_in_task(pdu->cmd, pb_zybo_uring_complete);
+	}
+	spin_unlock(&pd->uring_lock);
+}
+
+#else
+
+static void pb_zybo_uring_dev_init(struct pb_zybo_dev *pd) {}
+static void pb_zybo_uring_dev_flush(struct pb_zybo_dev *pd) {}
+static void pb_zybo_uring_sample(struct pb_zybo_dev *pd, u32 val) {}
+static bool pb_zybo_uring_pending(struct pb_zybo_dev *pd) { return false; }
+
+#endif /* PB_ZYBO_HAS_URING_CMD */
+
+/* ==================================================================
+ 		Switch change detection
+   ================================================================== */
+
+/**
+ * @brief Report the sampled value of the switch device. The switch driver calls it for
+ * each sample with its event lock held, so values are reported in the sampling order.
+ * 
+ * @param pd Switch device
+ * @param val Sampled value
+ */
+void pb_zybo_sw_sample(struct pb_zybo_dev *pd, u32 val) {
+	pb_zybo_uring_sample(pd, val);
+	pb_zybo_rules_sample(pd, val);
+}
+EXPORT_SYMBOL_GPL(pb_zybo_sw_sample);
+
+/**
+ * @brief Get the sampling period which the core needs from the switch device - pending
+ * io_uring waits use the default period of the driver. Switches referenced by rules
+ * are sampled by the rule thread (type->sample).
+ * 
+ * @param pd Switch device
+ * @param def_ms Default sampling period of the driver
+ * @return unsigned int Sampling period in ms, 0 iff the core doesn't need samples
+ */
+unsigned int pb_zybo_sw_watch_ms(struct pb_zybo_dev *pd, unsigned int def_ms) {
+	return pb_zybo_uring_pending(pd) ? def_ms : 0;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_sw_watch_ms);
+
+/* ==================================================================
+ 		KUnit fixture
+   ================================================================== */
+
+#if IS_ENABLED(CONFIG_PB_ZYBO_KUNIT_TEST)
+
+/**
+ * @brief Initialize the device instance for KUnit tests of drivers. Registers are backed
+ * by the RAM window and the instance isn't published (no cdev, class device or minor), so
+ * tests can call driver helpers and file operations directly.
+ * 
+ * @param pd Device instance
+ * @param regs RAM window with registers (at least max_register + 4 bytes)
+ * @param cfg Register map configuration of the driver
+ * @param drvdata Driver data of the instance
+ * @return int 0 iff everything was fine
+ */
+int pb_zybo_test_dev_init(struct pb_zybo_dev *pd, void *regs, const struct regmap_config *cfg,
+	void *drvdata) {
+	struct device *dev;
+	int cpu;
+	int rc;
+
+	dev = root_device_register("pb-zybo-test");
+	if (IS_ERR(dev)) {
+		return PTR_ERR(dev);
+	}
+
+	sema_init(&pd->sem, 1);
+	pb_zybo_uring_dev_init(pd);
+	pd->device = dev;
+	pd->drvdata = drvdata;
+	pd->gone = false;
+	pd->stats = alloc_percpu(struct pb_zybo_stats);
+	if (!pd->stats) {
+		rc = -ENOMEM;
+		goto err_unregister;
+	}
+	for_each_possible_cpu(cpu) {
+		u64_stats_init(&per_cpu_ptr(pd->stats, cpu)->syncp);
+	}
+
+	rc = pb_zybo_regmap_init(pd, dev, (void __force __iomem *)regs, cfg);
+	if (rc) {
+		goto err_free_stats;
+	}
+	return 0;
+
+err_free_stats:
+	free_percpu(pd->stats);
+	pd->stats = NULL;
+err_unregister:
+	root_device_unregister(dev);
+	pd->device = NULL;
+	return rc;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_test_dev_init);
+
+/**
+ * @brief Release the device instance initialized by pb_zybo_test_dev_init
+ * 
+ * @param pd Device instance
+ */
+void pb_zybo_test_dev_exit(struct pb_zybo_dev *pd) {
+	pb_zybo_regmap_exit(pd);
+	free_percpu(pd->stats);
+	pd->stats = NULL;
+	root_device_unregister(pd->device);
+	pd->device = NULL;
+}
+EXPORT_SYMBOL_GPL(pb_zybo_test_dev_exit);
+
+#endif /* CONFIG_PB_ZYBO_KUNIT_TEST */
+
+/* ==================================================================
+ 		Module init & exit
+   ================================================================== */
+
+static int __init pb_zybo_core_init(void)
+{
+	int rc;
+
+	pb_zybo_dbg_root = debugfs_create_dir("pb-zybo", NULL);
+	debugfs_create_file("rules", 0400, pb_zybo_dbg_root, NULL, &pb_zybo_rules_fops);
+	rc = misc_register(&pb_zybo_cmd_dev);
+	if (rc) {
+		pr_err("pb-zybo-core: unable to register the pb-zybo-cmd device\n");
+		debugfs_remove_recursive(pb_zybo_dbg_root);
+		pb_zybo_dbg_root = NULL;
+	}
+	return rc;
+}
+
+static void __exit pb_zybo_core_exit(void)
+{
+	misc_deregister(&pb_zybo_cmd_dev);
+	mutex_lock(&pb_zybo_rules_lock);
+	pb_zybo_rules_stop();
+	mutex_unlock(&pb_zybo_rules_lock);
+	debugfs_remove_recursive(pb_zybo_dbg_root);
+	pb_zybo_dbg_root = NULL;
+	pb_zybo_state_free_all();
+}
+
+module_init(pb_zybo_core_init);
+module_exit(pb_zybo_core_exit);
+
+/* Standard module information, edit as appropriate */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Pavel Benacek");
+MODULE_DESCRIPTION("pb-zybo-core - shared core of the PB Zybo device drivers");
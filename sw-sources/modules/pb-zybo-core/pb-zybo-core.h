@@ -0,0 +1,536 @@
+/*  pb-zybo-core.h - Shared core of the PB Zybo device drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PB_ZYBO_CORE_H__
+#define __PB_ZYBO_CORE_H__
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/idr.h>
+#include <linux/semaphore.h>
+#include <linux/ktime.h>
+#include <linux/io.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+#include <linux/regmap.h>
+#include <linux/capability.h>
+#include <linux/atomic.h>
+#include <linux/refcount.h>
+#include <linux/completion.h>
+#include <linux/kobject.h>
+
+/* io_uring commands (.uring_cmd) are provided on kernels with the stable in-kernel API */
+#if IS_ENABLED(CONFIG_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#define PB_ZYBO_HAS_URING_CMD
+#include <linux/io_uring/cmd.h>
+#endif
+
+/* Maximal number of instances (minors) of one driver type */
+#define PB_ZYBO_MAX_MINORS 32
+
+/* MMIO latency histograms - 32-bit registers (offset / 4) and log2 buckets in ns */
+#define PB_ZYBO_HIST_REGS		32
+#define PB_ZYBO_HIST_BUCKETS	32
+
+/**
+ * @brief Operation types passed to the stats and tracing hooks
+ * 
+ */
+enum pb_zybo_op {
+	PB_ZYBO_OP_IOCTL = 0,
+	PB_ZYBO_OP_READ,
+	PB_ZYBO_OP_WRITE,
+	PB_ZYBO_OP_LLSEEK,
+	PB_ZYBO_OP_CMD,
+	PB_ZYBO_OP_COUNT
+};
+
+/**
+ * @brief Kind of the driver type - used to route the batched commands
+ * (/dev/pb-zybo-cmd) to the device instances
+ * 
+ */
+enum pb_zybo_kind {
+	PB_ZYBO_KIND_NONE = 0,
+	PB_ZYBO_KIND_LED,
+	PB_ZYBO_KIND_RGB,
+	PB_ZYBO_KIND_SWITCH,
+	PB_ZYBO_KIND_COUNT
+};
+
+struct pb_zybo_dev;
+struct platform_device;
+
+/**
+ * @brief Platform data of devices instantiated by the pb-zybo-mock module - registers
+ * are backed by RAM instead of the AXI address space
+ * 
+ */
+struct pb_zybo_mock_pdata {
+	void __iomem	*regs;				/* RAM register window */
+	resource_size_t	 size;				/* Size of the window */
+	unsigned int	 read_delay_ns;		/* Injected latency of each register read */
+	unsigned int	 write_delay_ns;	/* Injected latency of each register write */
+
+	/* Called after each register write, e.g., the LED to switch loopback (optional) */
+	void (*write_hook)(void *priv, u32 offset, u32 val);
+	void			*hook_priv;
+};
+
+/**
+ * @brief Driver type - one static instance per driver. The core owns the sysfs class
+ * and the pool of minor numbers shared by all instances of the type.
+ * 
+ */
+struct pb_zybo_type {
+	const char *name;						/* Name of the sysfs class and chrdev region */
+	const char *devname_fmt;				/* Format of the device name in /dev */
+	const struct file_operations *fops;		/* CDEV callbacks of the driver */
+	const struct attribute_group **groups;	/* Device sysfs attributes (can be NULL) */
+
+	/* Batched commands - the callback is called with the device semaphore held (optional) */
+	enum pb_zybo_kind kind;
+	long (*cmd_exec)(struct pb_zybo_dev *pd, u32 op, u32 arg, u32 *val);
+
+	/* Switch devices - sample the value now and keep sampling while pb_zybo_sw_watch_ms
+	 * is non-zero, the callback doesn't sleep (optional) */
+	void (*watch)(struct pb_zybo_dev *pd);
+	/* Switch devices - take one sample and report it by pb_zybo_sw_sample, it is called
+	 * by the rule thread with the registry lock held and doesn't sleep (optional) */
+	int (*sample)(struct pb_zybo_dev *pd);
+
+	/* Free the removed instance after the last open file is closed (mandatory) - the driver
+	 * drops its reference by pb_zybo_dev_release instead of freeing the instance in remove */
+	void (*release)(struct pb_zybo_dev *pd);
+
+	/* Private data filled by the core */
+	struct class	*sysclass;		/* sysfs class for the driver type */
+	dev_t			 base_devid;	/* First device ID of the allocated region */
+	struct idr		 devs;			/* Pool of minor numbers, maps minor to device instance */
+	const struct attribute_group **all_groups;	/* Driver groups followed by core groups */
+};
+
+/**
+ * @brief Per-CPU operation and lock statistics of one device instance. Counters are
+ * updated on the local CPU only and summed during the sysfs read.
+ * 
+ */
+struct pb_zybo_stats {
+	u64 ops[PB_ZYBO_OP_COUNT];		/* Number of finished operations by type */
+	u64 bytes[PB_ZYBO_OP_COUNT];	/* Number of transferred bytes by type */
+	u64 sem_acquired;				/* Semaphore acquisitions */
+	u64 sem_waits;					/* Acquisitions which had to wait (contention) */
+	u64 sem_wait_ns;				/* Total wait time in nanoseconds */
+	u64 sem_restarts;				/* Waits interrupted by a signal (-ERESTARTSYS) */
+	u64 sem_eagain;					/* Busy device with O_NONBLOCK (-EAGAIN) */
+	struct u64_stats_sync syncp;	/* Consistent 64-bit reads on 32-bit CPUs */
+};
+
+/**
+ * @brief MMIO latency histograms of one device instance. The bucket \p i counts accesses
+ * which took [2^(i-1), 2^i) ns. Counters are atomic - switch reads don't take the device
+ * semaphore and the reset can run during updates.
+ * 
+ */
+struct pb_zybo_mmio_hist {
+	bool enabled;		/* Timing is enabled (debugfs) */
+	atomic_long_t cnt[PB_ZYBO_HIST_REGS][PB_ZYBO_HIST_BUCKETS];
+};
+
+/**
+ * @brief One registered device instance - embedded in the local structure of the driver
+ * 
+ */
+struct pb_zybo_dev {
+	struct pb_zybo_type	*type;		/* Driver type of the instance */
+	struct device		*device;	/* Allocated device structure */
+	dev_t				 devid;		/* Assigned device ID */
+	struct cdev			 cdev;		/* Character device structure */
+	struct semaphore	 sem;		/* Semaphore for the access serialization */
+	void				*drvdata;	/* Driver data passed to pb_zybo_dev_add */
+	refcount_t			 users;		/* Pins of the core (batches, rules), see pb_zybo_dev_del */
+	struct completion	 released;	/* The last pin was dropped */
+	struct kobject		 kobj;		/* Parent of the cdev, open files keep the instance alive */
+	bool				 gone;		/* Removed by pb_zybo_dev_del, protected by the semaphore */
+
+	struct pb_zybo_stats __percpu *stats;	/* Per-CPU statistics */
+	struct pb_zybo_mmio_hist	*hist;		/* MMIO latency histograms */
+	struct dentry				*dbg_dir;	/* Device debugfs directory */
+
+	void __iomem		*regs;			/* Mapped registers used by the register map */
+	struct regmap		*regmap;		/* Register map (see pb_zybo_regmap_init) */
+	bool				 regcache;		/* The register map has a cache */
+	const struct pb_zybo_mock_pdata *mock;	/* RAM-backed mock device (NULL for the HW) */
+	unsigned long		 mmio_reads;	/* Bus reads issued by the register map */
+	unsigned long		 mmio_writes;	/* Bus writes issued by the register map */
+	u64					 probe_ns;		/* Duration of the driver probe (see pb_zybo_probe_done) */
+
+#ifdef PB_ZYBO_HAS_URING_CMD
+	spinlock_t			 uring_lock;	/* Protects the list of pending waits */
+	struct list_head	 uring_waits;	/* Pending io_uring switch-change waits */
+	bool				 uring_closed;	/* The device was removed, new waits fail */
+#endif
+};
+
+/**
+ * @brief Core part of the per-open file context. Drivers which use pb_zybo_uring_cmd keep
+ * it at the beginning of their file context (file->private_data).
+ * 
+ */
+struct pb_zybo_file {
+	struct pb_zybo_dev	*pd;		/* Opened device instance (NULL for /dev/pb-zybo-cmd) */
+	bool				 can_write;	/* CAP_SYS_ADMIN captured during the open */
+};
+
+/**
+ * @brief Initialize the core part of the file context, the permission is checked once
+ * during the open (not on every call)
+ * 
+ * @param pf Core part of the file context
+ * @param pd Opened device instance
+ */
+static inline void pb_zybo_file_init(struct pb_zybo_file *pf, struct pb_zybo_dev *pd) {
+	pf->pd = pd;
+	pf->can_write = capable(CAP_SYS_ADMIN);
+}
+
+int pb_zybo_type_register(struct pb_zybo_type *type);
+void pb_zybo_type_unregister(struct pb_zybo_type *type);
+
+int pb_zybo_dev_add(struct pb_zybo_type *type, struct pb_zybo_dev *pd,
+	struct device *parent, void *drvdata);
+void pb_zybo_dev_del(struct pb_zybo_dev *pd);
+void pb_zybo_dev_release(struct pb_zybo_dev *pd);
+void pb_zybo_stats_sum(struct pb_zybo_dev *pd, struct pb_zybo_stats *sum);
+
+enum probe_type pb_zybo_probe_type(void);
+
+/* Handover of the driver state across remove/probe (keep_state=1) */
+bool pb_zybo_keep_state(void);
+int pb_zybo_state_save(enum pb_zybo_kind kind, unsigned long start, const void *data, size_t len);
+int pb_zybo_state_load(enum pb_zybo_kind kind, unsigned long start, void *data, size_t len);
+
+/* The remove callback of platform drivers returns void since linux 6.11, drivers keep
+ * the int variant and register it via PB_ZYBO_REMOVE(fn) after PB_ZYBO_DEFINE_REMOVE(fn) */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+#define PB_ZYBO_DEFINE_REMOVE(fn) \
+	static void fn##_void(struct platform_device *pdev) { fn(pdev); }
+#define PB_ZYBO_REMOVE(fn)	fn##_void
+#else
+#define PB_ZYBO_DEFINE_REMOVE(fn)
+#define PB_ZYBO_REMOVE(fn)	fn
+#endif
+
+#if IS_ENABLED(CONFIG_PB_ZYBO_KUNIT_TEST)
+/* Unpublished device instance with registers in RAM for KUnit tests of drivers */
+int pb_zybo_test_dev_init(struct pb_zybo_dev *pd, void *regs, const struct regmap_config *cfg,
+	void *drvdata);
+void pb_zybo_test_dev_exit(struct pb_zybo_dev *pd);
+#endif
+
+void __iomem *pb_zybo_ioremap(struct platform_device *pdev, const char *name,
+	unsigned long *start, unsigned long *end);
+void pb_zybo_iounmap(struct platform_device *pdev, void __iomem *base,
+	unsigned long start, unsigned long end);
+int pb_zybo_regmap_init(struct pb_zybo_dev *pd, struct device *dev, void __iomem *base,
+	const struct regmap_config *cfg);
+void pb_zybo_regmap_exit(struct pb_zybo_dev *pd);
+int pb_zybo_regcache_seed(struct pb_zybo_dev *pd, unsigned int reg);
+int pb_zybo_regcache_restore(struct pb_zybo_dev *pd);
+
+/* Change detection of switch devices - the driver reports each sample, the core completes
+ * io_uring waits, evaluates rules and tells the driver how long the sampling is needed */
+void pb_zybo_sw_sample(struct pb_zybo_dev *pd, u32 val);
+unsigned int pb_zybo_sw_watch_ms(struct pb_zybo_dev *pd, unsigned int def_ms);
+
+#ifdef PB_ZYBO_HAS_URING_CMD
+/* Shared .uring_cmd callback of all drivers (commands are executed by cmd_exec) */
+int pb_zybo_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+#endif
+
+/**
+ * @brief Get the driver data of the device created by the core (typically used
+ * in sysfs attributes of the driver)
+ * 
+ * @param dev Device created by pb_zybo_dev_add
+ * @return void* Driver data passed to pb_zybo_dev_add
+ */
+static inline void *pb_zybo_dev_get_drvdata(struct device *dev) {
+	struct pb_zybo_dev *pd = dev_get_drvdata(dev);
+	return pd->drvdata;
+}
+
+/**
+ * @brief Record the duration of the driver probe, it is called right before pb_zybo_dev_add,
+ * so the value is valid once the device appears in /dev and sysfs
+ * 
+ * @param pd Device instance
+ * @param dev Probed (parent) device
+ * @param start Timestamp (ktime_get_ns) taken at the beginning of the probe
+ */
+static inline void pb_zybo_probe_done(struct pb_zybo_dev *pd, struct device *dev, u64 start) {
+	pd->probe_ns = ktime_get_ns() - start;
+	dev_dbg(dev, "probed in %llu ns\n", pd->probe_ns);
+}
+
+#include "pb-zybo-trace.h"
+
+/* ==================================================================
+ 		Statistics
+   ================================================================== */
+
+/**
+ * @brief Account the semaphore acquisition on the local CPU
+ * 
+ * @param pd Device instance
+ * @param rc Return code of the acquisition
+ * @param waited The semaphore was contended
+ * @param wait_ns Wait time in nanoseconds
+ */
+static inline void pb_zybo_stats_sem(struct pb_zybo_dev *pd, int rc, bool waited, u64 wait_ns) {
+	struct pb_zybo_stats *st = get_cpu_ptr(pd->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	if (rc == 0) {
+		st->sem_acquired++;
+	} else if (rc == -EAGAIN) {
+		st->sem_eagain++;
+	} else {
+		st->sem_restarts++;
+	}
+
+	if (waited) {
+		st->sem_waits++;
+		st->sem_wait_ns += wait_ns;
+	}
+	u64_stats_update_end(&st->syncp);
+	put_cpu_ptr(pd->stats);
+}
+
+/**
+ * @brief Account the finished operation on the local CPU
+ * 
+ * @param pd Device instance
+ * @param op Operation type
+ * @param bytes Number of transferred bytes
+ */
+static inline void pb_zybo_stats_op(struct pb_zybo_dev *pd, enum pb_zybo_op op, size_t bytes) {
+	struct pb_zybo_stats *st = get_cpu_ptr(pd->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	st->ops[op]++;
+	st->bytes[op] += bytes;
+	u64_stats_update_end(&st->syncp);
+	put_cpu_ptr(pd->stats);
+}
+
+/* ==================================================================
+ 		Common hooks
+   ================================================================== */
+
+/**
+ * @brief Check the device after the semaphore was acquired. Files opened before
+ * the remove outlive the HW access of the driver, the semaphore is released and
+ * -ENODEV is returned for the removed device.
+ * 
+ * @param pd Device instance
+ * @return int 0 iff the device is still present
+ */
+static inline int pb_zybo_down_check(struct pb_zybo_dev *pd) {
+	if (unlikely(pd->gone)) {
+		up(&pd->sem);
+		return -ENODEV;
+	}
+	return 0;
+}
+
+/**
+ * @brief Acquire the device semaphore. The non-blocking caller doesn't queue on
+ * the semaphore, -EAGAIN is returned if the device is busy. The free semaphore is
+ * taken by one trylock, the wait time is measured only if the semaphore is contended.
+ * 
+ * @param pd Device instance
+ * @param nonblock Don't wait for the busy device
+ * @return int 0 iff the semaphore was acquired, -ENODEV if the device was removed
+ */
+static inline int pb_zybo_down_flags(struct pb_zybo_dev *pd, bool nonblock) {
+	u64 wait_ns;
+	int rc = 0;
+
+	/* Fast path - the semaphore is free */
+	if (!down_trylock(&pd->sem)) {
+		pb_zybo_stats_sem(pd, 0, false, 0);
+		trace_pb_zybo_sem_wait(pd->devid, 0, 0);
+		return pb_zybo_down_check(pd);
+	}
+
+	if (nonblock) {
+		pb_zybo_stats_sem(pd, -EAGAIN, false, 0);
+		trace_pb_zybo_sem_wait(pd->devid, 0, -EAGAIN);
+		return -EAGAIN;
+	}
+
+	wait_ns = ktime_get_ns();
+	if (down_interruptible(&pd->sem)) {
+		dev_err(pd->device, "Cannot acquire the device, it is used by a different process.\n");
+		rc = -ERESTARTSYS;
+	}
+	wait_ns = ktime_get_ns() - wait_ns;
+
+	pb_zybo_stats_sem(pd, rc, true, wait_ns);
+	trace_pb_zybo_sem_wait(pd->devid, wait_ns, rc);
+	return rc ? rc : pb_zybo_down_check(pd);
+}
+
+/**
+ * @brief Acquire the device semaphore. Files opened with O_NONBLOCK don't
+ * queue on the semaphore, -EAGAIN is returned if the device is busy.
+ * 
+ * @param pd Device instance
+ * @param file Opened file (NULL for the blocking access)
+ * @return int 0 iff the semaphore was acquired
+ */
+static inline int pb_zybo_down(struct pb_zybo_dev *pd, const struct file *file) {
+	return pb_zybo_down_flags(pd, file && (file->f_flags & O_NONBLOCK));
+}
+
+/**
+ * @brief Release the device semaphore
+ * 
+ * @param pd Device instance
+ */
+static inline void pb_zybo_up(struct pb_zybo_dev *pd) {
+	up(&pd->sem);
+}
+
+/**
+ * @brief Hook called at the end of each file operation. This is the place where
+ * the stats and tracing of all drivers are attached.
+ * 
+ * @param pd Device instance
+ * @param op Operation type
+ * @param bytes Number of transferred bytes
+ * @param rc Return code of the operation
+ */
+static inline void pb_zybo_op_done(struct pb_zybo_dev *pd, enum pb_zybo_op op,
+	size_t bytes, long rc) {
+	pb_zybo_stats_op(pd, op, bytes);
+	trace_pb_zybo_op(pd->devid, op, bytes, rc);
+}
+
+/**
+ * @brief Hook called at the beginning of each IOCTL call
+ * 
+ * @param pd Device instance
+ * @param cmd IOCTL command
+ * @param arg IOCTL argument
+ */
+static inline void pb_zybo_ioctl_enter(struct pb_zybo_dev *pd, unsigned int cmd,
+	unsigned long arg) {
+	trace_pb_zybo_ioctl_enter(pd->devid, cmd, arg);
+}
+
+/**
+ * @brief Hook called at the end of each IOCTL call
+ * 
+ * @param pd Device instance
+ * @param cmd IOCTL command
+ * @param rc Return code of the IOCTL call
+ */
+static inline void pb_zybo_ioctl_exit(struct pb_zybo_dev *pd, unsigned int cmd, long rc) {
+	trace_pb_zybo_ioctl_exit(pd->devid, cmd, rc);
+	pb_zybo_op_done(pd, PB_ZYBO_OP_IOCTL, 0, rc);
+}
+
+/* ==================================================================
+ 		Register access
+   ================================================================== */
+
+/**
+ * @brief Start the optional timing of the register access
+ * 
+ * @param pd Device instance
+ * @return u64 Start timestamp, 0 iff the timing is disabled
+ */
+static inline u64 pb_zybo_mmio_start(const struct pb_zybo_dev *pd) {
+	if (pd->hist && READ_ONCE(pd->hist->enabled)) {
+		return ktime_get_ns();
+	}
+	return 0;
+}
+
+/**
+ * @brief Finish the optional timing and account the access into the register histogram
+ * 
+ * @param pd Device instance
+ * @param offset Register offset
+ * @param start Start timestamp from pb_zybo_mmio_start
+ */
+static inline void pb_zybo_mmio_end(struct pb_zybo_dev *pd, u32 offset, u64 start) {
+	u32 reg = offset / 4;
+	int bucket;
+
+	if (!start || reg >= PB_ZYBO_HIST_REGS) {
+		return;
+	}
+
+	bucket = min(fls64(ktime_get_ns() - start), PB_ZYBO_HIST_BUCKETS - 1);
+	atomic_long_inc(&pd->hist->cnt[reg][bucket]);
+}
+
+/**
+ * @brief Write 32 bits into the device register
+ * 
+ * @param pd Device instance
+ * @param val Value to write
+ * @param base Base address of the mapped region
+ * @param offset Register offset
+ */
+static inline void pb_zybo_iowrite32(struct pb_zybo_dev *pd, u32 val, void __iomem *base, u32 offset) {
+	u64 start = pb_zybo_mmio_start(pd);
+
+	trace_pb_zybo_mmio_write(pd->devid, offset, val, 32);
+	iowrite32(val, base + offset);
+	pb_zybo_mmio_end(pd, offset, start);
+}
+
+/**
+ * @brief Read 32 bits from the device register
+ * 
+ * @param pd Device instance
+ * @param base Base address of the mapped region
+ * @param offset Register offset
+ * @return u32 Read value
+ */
+static inline u32 pb_zybo_ioread32(struct pb_zybo_dev *pd, void __iomem *base, u32 offset) {
+	u64 start = pb_zybo_mmio_start(pd);
+	u32 val = ioread32(base + offset);
+
+	pb_zybo_mmio_end(pd, offset, start);
+	trace_pb_zybo_mmio_read(pd->devid, offset, val, 32);
+	return val;
+}
+
+#endif /* __PB_ZYBO_CORE_H__ */
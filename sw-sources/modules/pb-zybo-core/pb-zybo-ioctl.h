@@ -0,0 +1,81 @@
+/*  pb-zybo-ioctl.h - IOCTL interface of the PB Zybo LED, RGB LED and switch drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The header is shared by the kernel and the user space (/dev/led_module-*, /dev/rgb-led-module-*
+ * and /dev/switch_module-*). Each driver has its own range of the 'z' magic, so the call of the
+ * wrong device fails with -ENOTTY. The original 'l' numbers (same for all drivers) are still
+ * accepted by drivers. */
+
+#ifndef __PB_ZYBO_IOCTL_H__
+#define __PB_ZYBO_IOCTL_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PB_ZYBO_IOCTL_MAGIC			'z'
+
+/* LED driver (0x10 - 0x1f), setters take the value in the argument */
+#define PB_ZYBO_LED_IOCTL_GET_INIT		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x10, __u32)
+#define PB_ZYBO_LED_IOCTL_SET_INIT		_IO(PB_ZYBO_IOCTL_MAGIC, 0x11)
+#define PB_ZYBO_LED_IOCTL_GET_MASK		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x12, __u32)
+#define PB_ZYBO_LED_IOCTL_SET_MASK		_IO(PB_ZYBO_IOCTL_MAGIC, 0x13)
+#define PB_ZYBO_LED_IOCTL_SET_VALUE		_IO(PB_ZYBO_IOCTL_MAGIC, 0x14)
+#define PB_ZYBO_LED_IOCTL_RESET			_IO(PB_ZYBO_IOCTL_MAGIC, 0x15)
+#define PB_ZYBO_LED_IOCTL_GET_STAMP		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x16, struct pb_zybo_out_stamp)
+
+/* RGB LED driver (0x20 - 0x2f), values are passed by the pointer to __u32,
+ * the color is encoded as 0xRRGGBB */
+#define PB_ZYBO_RGB_IOCTL_GET_VAL		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x20, __u32)
+#define PB_ZYBO_RGB_IOCTL_SET_VAL		_IOW(PB_ZYBO_IOCTL_MAGIC, 0x21, __u32)
+#define PB_ZYBO_RGB_IOCTL_SET_PERIOD	_IOW(PB_ZYBO_IOCTL_MAGIC, 0x22, __u32)
+#define PB_ZYBO_RGB_IOCTL_GET_PERIOD	_IOR(PB_ZYBO_IOCTL_MAGIC, 0x23, __u32)
+#define PB_ZYBO_RGB_IOCTL_INIT			_IO(PB_ZYBO_IOCTL_MAGIC, 0x24)
+#define PB_ZYBO_RGB_IOCTL_GET_STAMP		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x25, struct pb_zybo_out_stamp)
+
+/* Switch driver (0x30 - 0x3f), the mask setter takes the value in the argument */
+#define PB_ZYBO_SW_IOCTL_GET_MASK		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x30, __u32)
+#define PB_ZYBO_SW_IOCTL_SET_MASK		_IO(PB_ZYBO_IOCTL_MAGIC, 0x31)
+#define PB_ZYBO_SW_IOCTL_GET_VALUE		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x32, __u32)
+#define PB_ZYBO_SW_IOCTL_GET_EVENT		_IOR(PB_ZYBO_IOCTL_MAGIC, 0x33, struct pb_zybo_sw_event)
+
+/* Last change of the switch value detected by the driver sampling (poll/epoll on the device
+ * reports POLLIN until the file reads the value). Times are CLOCK_MONOTONIC in ns - the
+ * sample which detected the change and the previous sample which still had the old value,
+ * the change itself happened between them. */
+struct pb_zybo_sw_event {
+	__u32 value;	/* Switch value after the change (masked) */
+	__u32 seq;		/* Number of detected changes */
+	__u64 ts_ns;	/* Time of the sample which detected the change */
+	__u64 prev_ns;	/* Time of the previous sample with the old value */
+};
+
+/* Last output update of the LED or RGB LED driver. The time is CLOCK_MONOTONIC in ns taken
+ * after the register write, so the reaction of the application can be measured up to the HW. */
+struct pb_zybo_out_stamp {
+	__u32 value;	/* Written value (LED value or the 0xRRGGBB color) */
+	__u32 seq;		/* Number of output updates */
+	__u64 ts_ns;	/* Time after the register write */
+};
+
+/* Device node prefixes, instances are named <prefix>-<number> */
+#define PB_ZYBO_LED_DEV_PREFIX			"/dev/led_module"
+#define PB_ZYBO_RGB_DEV_PREFIX			"/dev/rgb-led-module"
+#define PB_ZYBO_SW_DEV_PREFIX			"/dev/switch_module"
+
+#endif /* __PB_ZYBO_IOCTL_H__ */
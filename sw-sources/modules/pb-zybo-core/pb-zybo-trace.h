@@ -0,0 +1,155 @@
+/*  pb-zybo-trace.h - Tracepoints of the PB Zybo device drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The header is included from pb-zybo-core.h (enum pb_zybo_op has to be declared),
+ * tracepoints are created in pb-zybo-core.c and exported to the drivers. */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pb_zybo
+
+#if !defined(_PB_ZYBO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PB_ZYBO_TRACE_H
+
+#include <linux/types.h>
+#include <linux/kdev_t.h>
+#include <linux/tracepoint.h>
+
+TRACE_DEFINE_ENUM(PB_ZYBO_OP_IOCTL);
+TRACE_DEFINE_ENUM(PB_ZYBO_OP_READ);
+TRACE_DEFINE_ENUM(PB_ZYBO_OP_WRITE);
+TRACE_DEFINE_ENUM(PB_ZYBO_OP_LLSEEK);
+TRACE_DEFINE_ENUM(PB_ZYBO_OP_CMD);
+
+#define show_pb_zybo_op(op)						\
+	__print_symbolic(op,						\
+		{ PB_ZYBO_OP_IOCTL,		"ioctl" },		\
+		{ PB_ZYBO_OP_READ,		"read" },		\
+		{ PB_ZYBO_OP_WRITE,		"write" },		\
+		{ PB_ZYBO_OP_LLSEEK,	"llseek" },		\
+		{ PB_ZYBO_OP_CMD,		"cmd" })
+
+TRACE_EVENT(pb_zybo_ioctl_enter,
+	TP_PROTO(dev_t devid, unsigned int cmd, unsigned long arg),
+	TP_ARGS(devid, cmd, arg),
+	TP_STRUCT__entry(
+		__field(dev_t,			devid)
+		__field(unsigned int,	cmd)
+		__field(unsigned long,	arg)
+	),
+	TP_fast_assign(
+		__entry->devid = devid;
+		__entry->cmd = cmd;
+		__entry->arg = arg;
+	),
+	TP_printk("dev=%d:%d cmd=0x%08x arg=0x%lx",
+		MAJOR(__entry->devid), MINOR(__entry->devid), __entry->cmd, __entry->arg)
+);
+
+TRACE_EVENT(pb_zybo_ioctl_exit,
+	TP_PROTO(dev_t devid, unsigned int cmd, long rc),
+	TP_ARGS(devid, cmd, rc),
+	TP_STRUCT__entry(
+		__field(dev_t,			devid)
+		__field(unsigned int,	cmd)
+		__field(long,			rc)
+	),
+	TP_fast_assign(
+		__entry->devid = devid;
+		__entry->cmd = cmd;
+		__entry->rc = rc;
+	),
+	TP_printk("dev=%d:%d cmd=0x%08x rc=%ld",
+		MAJOR(__entry->devid), MINOR(__entry->devid), __entry->cmd, __entry->rc)
+);
+
+TRACE_EVENT(pb_zybo_sem_wait,
+	TP_PROTO(dev_t devid, u64 wait_ns, int rc),
+	TP_ARGS(devid, wait_ns, rc),
+	TP_STRUCT__entry(
+		__field(dev_t,	devid)
+		__field(u64,	wait_ns)
+		__field(int,	rc)
+	),
+	TP_fast_assign(
+		__entry->devid = devid;
+		__entry->wait_ns = wait_ns;
+		__entry->rc = rc;
+	),
+	TP_printk("dev=%d:%d wait_ns=%llu rc=%d",
+		MAJOR(__entry->devid), MINOR(__entry->devid), __entry->wait_ns, __entry->rc)
+);
+
+TRACE_EVENT(pb_zybo_op,
+	TP_PROTO(dev_t devid, int op, size_t bytes, long rc),
+	TP_ARGS(devid, op, bytes, rc),
+	TP_STRUCT__entry(
+		__field(dev_t,	devid)
+		__field(int,	op)
+		__field(size_t,	bytes)
+		__field(long,	rc)
+	),
+	TP_fast_assign(
+		__entry->devid = devid;
+		__entry->op = op;
+		__entry->bytes = bytes;
+		__entry->rc = rc;
+	),
+	TP_printk("dev=%d:%d op=%s bytes=%zu rc=%ld",
+		MAJOR(__entry->devid), MINOR(__entry->devid), show_pb_zybo_op(__entry->op),
+		__entry->bytes, __entry->rc)
+);
+
+DECLARE_EVENT_CLASS(pb_zybo_mmio,
+	TP_PROTO(dev_t devid, u32 offset, u32 val, u8 width),
+	TP_ARGS(devid, offset, val, width),
+	TP_STRUCT__entry(
+		__field(dev_t,	devid)
+		__field(u32,	offset)
+		__field(u32,	val)
+		__field(u8,		width)
+	),
+	TP_fast_assign(
+		__entry->devid = devid;
+		__entry->offset = offset;
+		__entry->val = val;
+		__entry->width = width;
+	),
+	TP_printk("dev=%d:%d offset=0x%x val=0x%x width=%u",
+		MAJOR(__entry->devid), MINOR(__entry->devid), __entry->offset,
+		__entry->val, __entry->width)
+);
+
+DEFINE_EVENT(pb_zybo_mmio, pb_zybo_mmio_write,
+	TP_PROTO(dev_t devid, u32 offset, u32 val, u8 width),
+	TP_ARGS(devid, offset, val, width)
+);
+
+DEFINE_EVENT(pb_zybo_mmio, pb_zybo_mmio_read,
+	TP_PROTO(dev_t devid, u32 offset, u32 val, u8 width),
+	TP_ARGS(devid, offset, val, width)
+);
+
+#endif /* _PB_ZYBO_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pb-zybo-trace
+#include <trace/define_trace.h>
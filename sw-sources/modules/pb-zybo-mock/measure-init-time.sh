@@ -0,0 +1,180 @@
+#!/bin/sh
+# -------------------------------------------------------------------------------
+#  PROJECT: Zybo Base
+# -------------------------------------------------------------------------------
+#  AUTHORS: Pavel Benacek <pavel.benacek@gmail.com>
+#  LICENSE: The MIT License (MIT), please read LICENSE file
+#  WEBSITE: https://github.com/benycze/zybo-base
+# -------------------------------------------------------------------------------
+#
+# Measurement of the init time of pb-zybo modules with the mock register backend.
+#
+#   measure-init-time.sh qemu <images-dir> [qemu args]
+#       Boot the xilinx-zynq-a9 QEMU machine with PetaLinux images (zImage, system.dtb,
+#       rootfs.cpio.gz) and the initcall_debug kernel parameter.
+#
+#   measure-init-time.sh guest [-s] [-m module-dir] [-n devices]
+#       Run in the guest (or on the board). Loads the core, drivers and pb-zybo-mock,
+#       reports the init time of each module, the probe time of each device and the time
+#       until all device nodes exist. The -s option loads the core with async_probe=0
+#       (synchronous probe, the state before the asynchronous probe).
+#
+#   measure-init-time.sh compare <before> <after>
+#       Compare two reports of the guest mode.
+#
+# Example:
+#   guest# ./measure-init-time.sh guest -s > before.txt
+#   guest# ./measure-init-time.sh guest > after.txt
+#   guest# ./measure-init-time.sh compare before.txt after.txt
+
+set -e
+
+CLASSES="led_module switch_module rgb-led-module"
+READY_TIMEOUT_US=10000000
+
+usage() {
+    sed -n '/^# Measurement/,/^#   guest# .*compare/p' "$0" | sed 's/^# \{0,1\}//'
+    exit 1
+}
+
+# Monotonic time in microseconds (busybox date may not support %N)
+now_us() {
+    ns=$(date +%s%N 2>/dev/null)
+    case "$ns" in
+        *N|"")
+            awk '{ printf "%d\n", $1 * 1000000 }' /proc/uptime ;;
+        *)
+            echo $((ns / 1000)) ;;
+    esac
+}
+
+# Find the module file in the module directory or in the installed modules
+module_path() {
+    if [ -n "$MODDIR" ]; then
+        find "$MODDIR" -name "$1.ko" | head -n 1
+    else
+        find /lib/modules/$(uname -r) -name "$1.ko" | head -n 1
+    fi
+}
+
+load_module() {
+    path=$(module_path "$1")
+    if [ -z "$path" ]; then
+        echo "Module $1 not found!" >&2
+        exit 1
+    fi
+    shift
+    insmod "$path" "$@"
+}
+
+unload_all() {
+    for m in pb_zybo_mock rgb_led_module switch_module led_module pb_zybo_core; do
+        rmmod "$m" 2>/dev/null || true
+    done
+}
+
+count_devices() {
+    n=0
+    for c in $CLASSES; do
+        for d in /dev/$c-*; do
+            [ -e "$d" ] && n=$((n + 1))
+        done
+    done
+    echo $n
+}
+
+run_guest() {
+    async=1
+    devices=3
+    while getopts "sm:n:" opt; do
+        case $opt in
+            s) async=0 ;;
+            m) MODDIR=$OPTARG ;;
+            n) devices=$OPTARG ;;
+            *) usage ;;
+        esac
+    done
+
+    if [ "$(id -u)" != "0" ]; then
+        echo "The guest mode has to be run as root!" >&2
+        exit 1
+    fi
+
+    unload_all
+    echo 1 > /sys/module/kernel/parameters/initcall_debug
+    dmesg -c > /dev/null
+
+    start=$(now_us)
+    load_module pb-zybo-core async_probe=$async
+    for m in led-module switch-module rgb-led-module; do
+        load_module $m
+    done
+    load_module pb-zybo-mock
+    loaded=$(now_us)
+
+    # Devices exist when their nodes are created (the probe can still run after insmod)
+    while [ "$(count_devices)" -lt "$devices" ]; do
+        if [ $(( $(now_us) - start )) -gt $READY_TIMEOUT_US ]; then
+            echo "Devices were not created in time!" >&2
+            exit 1
+        fi
+        usleep 100 2>/dev/null || sleep 0.001
+    done
+    ready=$(now_us)
+    echo 0 > /sys/module/kernel/parameters/initcall_debug
+
+    echo "# pb-zybo init time (async_probe=$async)"
+    dmesg | sed -n 's/.*initcall .* \[\([a-z_]*\)\] returned .* after \([0-9]*\) usecs.*/init_us \1 \2/p'
+    for c in $CLASSES; do
+        for d in /sys/class/$c/*; do
+            [ -r "$d/stats/probe_ns" ] || continue
+            echo "probe_us $(basename $d) $(( $(cat $d/stats/probe_ns) / 1000 ))"
+        done
+    done
+    echo "insmod_us total $((loaded - start))"
+    echo "ready_us total $((ready - start))"
+}
+
+run_compare() {
+    [ $# -eq 2 ] || usage
+    awk '
+        FNR == 1 { file++ }
+        /^#/ { next }
+        { key = $1 " " $2; val[file, key] = $3; if (!(key in seen)) { seen[key] = 1; keys[n++] = key } }
+        END {
+            printf "%-36s %12s %12s %10s\n", "metric", "before", "after", "change"
+            for (i = 0; i < n; i++) {
+                k = keys[i]; b = val[1, k]; a = val[2, k]
+                ch = (b > 0 && a != "") ? sprintf("%+.1f%%", (a - b) * 100 / b) : "n/a"
+                printf "%-36s %12s %12s %10s\n", k, b, a, ch
+            }
+        }' "$1" "$2"
+}
+
+run_qemu() {
+    [ $# -ge 1 ] || usage
+    images=$1
+    shift
+    for f in zImage system.dtb rootfs.cpio.gz; do
+        if [ ! -f "$images/$f" ]; then
+            echo "$images/$f not found (run petalinux-build first)!" >&2
+            exit 1
+        fi
+    done
+
+    # The PL is not emulated, the mock module provides the devices
+    exec qemu-system-arm -M xilinx-zynq-a9 -m 1024 -nographic \
+        -serial null -serial mon:stdio \
+        -kernel "$images/zImage" -dtb "$images/system.dtb" -initrd "$images/rootfs.cpio.gz" \
+        -append "console=ttyPS0,115200 earlycon root=/dev/ram0 rw initcall_debug" "$@"
+}
+
+mode=$1
+[ -n "$mode" ] || usage
+shift
+case $mode in
+    qemu) run_qemu "$@" ;;
+    guest) run_guest "$@" ;;
+    compare) run_compare "$@" ;;
+    *) usage ;;
+esac
@@ -0,0 +1,290 @@
+/*  pb-zybo-mock.c - RAM-backed mock devices of the PB Zybo drivers
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/platform_device.h>
+#include <linux/debugfs.h>
+#include <linux/workqueue.h>
+#include <linux/io.h>
+
+#include "pb-zybo-core.h"
+
+/* Size of the register window of one mock device */
+#define MOCK_REGS_SIZE			PAGE_SIZE
+/* Maximal injected latency of one register access */
+#define MOCK_MAX_DELAY_NS		100000
+/* Switch data register and the number of switches */
+#define MOCK_SW_DATA_REG		0x0
+#define MOCK_SW_MASK			0xf
+/* LED data register */
+#define MOCK_LED_DATA_REG		0x0
+
+/* Number of instantiated devices */
+static unsigned int leds = 1;
+module_param(leds, uint, 0444);
+MODULE_PARM_DESC(leds, "Number of pb,ledmodule-1.0 devices");
+
+static unsigned int switches = 1;
+module_param(switches, uint, 0444);
+MODULE_PARM_DESC(switches, "Number of pb,swmodule-1.0 devices");
+
+static unsigned int rgbs = 1;
+module_param(rgbs, uint, 0444);
+MODULE_PARM_DESC(rgbs, "Number of pb,rgb-led-module-1.0 devices");
+
+/* Latency injection */
+static unsigned int read_latency_ns;
+module_param(read_latency_ns, uint, 0444);
+MODULE_PARM_DESC(read_latency_ns, "Injected latency of each register read (ns)");
+
+static unsigned int write_latency_ns;
+module_param(write_latency_ns, uint, 0444);
+MODULE_PARM_DESC(write_latency_ns, "Injected latency of each register write (ns)");
+
+/* Simulated switch events */
+static unsigned int sw_event_ms;
+module_param(sw_event_ms, uint, 0644);
+MODULE_PARM_DESC(sw_event_ms, "Period of simulated switch changes (ms), 0 = disabled");
+
+/* LED to switch loopback */
+static bool loopback;
+module_param(loopback, bool, 0444);
+MODULE_PARM_DESC(loopback, "LED values are written to switches of the device with the same index");
+
+/**
+ * @brief One named register of the mock device (exported to debugfs)
+ *
+ */
+struct mock_reg {
+	const char *name;
+	u32 offset;
+};
+
+/**
+ * @brief Kind of the mock device - the compatible string of the real IP and
+ * the name of the platform driver which binds the device
+ *
+ */
+struct mock_kind {
+	const char *compatible;
+	const char *drv_name;
+	const struct mock_reg *regs;
+	unsigned int *count;
+};
+
+static const struct mock_reg mock_gpio_regs[] = {
+	{ "data", 0x0 },
+	{ NULL, 0 },
+};
+
+static const struct mock_reg mock_pwm_regs[] = {
+	{ "ctrl", 0x0 },
+	{ "period", 0x8 },
+	{ "duty_b", 0x40 },
+	{ "duty_g", 0x44 },
+	{ "duty_r", 0x48 },
+	{ NULL, 0 },
+};
+
+static const struct mock_kind mock_kinds[] = {
+	{ "pb,ledmodule-1.0", "led_module", mock_gpio_regs, &leds },
+	{ "pb,swmodule-1.0", "switch_module", mock_gpio_regs, &switches },
+	{ "pb,rgb-led-module-1.0", "rgb-led-module", mock_pwm_regs, &rgbs },
+};
+
+/**
+ * @brief One instantiated mock device
+ *
+ */
+struct mock_dev {
+	const struct mock_kind *kind;
+	struct platform_device *pdev;
+	void *regs;					/* RAM register window */
+	struct dentry *dbg_dir;
+};
+
+static struct mock_dev *mock_devs;
+static unsigned int mock_ndevs;
+static struct dentry *mock_dbg_root;
+static struct delayed_work mock_sw_work;
+
+/**
+ * @brief Simulate the user who is flipping switches - the switch value of all mock
+ * switch devices is incremented.
+ *
+ */
+static void mock_sw_event(struct work_struct *work) {
+	unsigned int period = READ_ONCE(sw_event_ms);
+	unsigned int i;
+
+	if (period) {
+		for (i = 0; i < mock_ndevs; i++) {
+			u32 *data = mock_devs[i].regs + MOCK_SW_DATA_REG;
+
+			if (mock_devs[i].kind->count != &switches) {
+				continue;
+			}
+			WRITE_ONCE(*data, (READ_ONCE(*data) + 1) & MOCK_SW_MASK);
+		}
+	}
+
+	/* The period can be changed (enabled) at runtime via the module parameter */
+	schedule_delayed_work(&mock_sw_work, msecs_to_jiffies(period ? period : 1000));
+}
+
+/**
+ * @brief Loopback of the LED data register into the switch data register (the LED
+ * output wired to the switch input), so the reaction of applications to switch
+ * changes can be measured without the board.
+ *
+ * @param priv Switch device with the same index as the LED device
+ */
+static void mock_loopback_write(void *priv, u32 offset, u32 val) {
+	struct mock_dev *sw = priv;
+	void *regs = READ_ONCE(sw->regs);
+
+	if (offset == MOCK_LED_DATA_REG && regs) {
+		WRITE_ONCE(*(u32 *)(regs + MOCK_SW_DATA_REG), val & MOCK_SW_MASK);
+	}
+}
+
+/**
+ * @brief Create the debugfs directory with one file per register - the test can
+ * read the values written by the driver and inject switch values.
+ *
+ */
+static void mock_dev_debugfs(struct mock_dev *md) {
+	const struct mock_reg *reg;
+
+	md->dbg_dir = debugfs_create_dir(dev_name(&md->pdev->dev), mock_dbg_root);
+	for (reg = md->kind->regs; reg->name; reg++) {
+		debugfs_create_x32(reg->name, 0644, md->dbg_dir, md->regs + reg->offset);
+	}
+}
+
+static int mock_dev_add(struct mock_dev *md, const struct mock_kind *kind, unsigned int idx) {
+	struct pb_zybo_mock_pdata pdata = { 0 };
+	void *regs;
+
+	md->kind = kind;
+	regs = vzalloc(MOCK_REGS_SIZE);
+	if (!regs) {
+		return -ENOMEM;
+	}
+	/* The window can be used by the loopback hook of the LED device which already exists */
+	WRITE_ONCE(md->regs, regs);
+
+	pdata.regs = (void __force __iomem *)md->regs;
+	pdata.size = MOCK_REGS_SIZE;
+	pdata.read_delay_ns = min(read_latency_ns, (unsigned int)MOCK_MAX_DELAY_NS);
+	pdata.write_delay_ns = min(write_latency_ns, (unsigned int)MOCK_MAX_DELAY_NS);
+
+	/* Switch devices follow LED devices in the array (see mock_kinds) */
+	if (loopback && kind->count == &leds && idx < switches) {
+		pdata.write_hook = mock_loopback_write;
+		pdata.hook_priv = &mock_devs[leds + idx];
+	}
+
+	/* The device is matched by the driver name, the platform data carries the window */
+	md->pdev = platform_device_register_data(NULL, kind->drv_name, PLATFORM_DEVID_AUTO,
+		&pdata, sizeof(pdata));
+	if (IS_ERR(md->pdev)) {
+		pr_err("pb-zybo-mock: unable to create the %s device\n", kind->compatible);
+		WRITE_ONCE(md->regs, NULL);
+		vfree(regs);
+		return PTR_ERR(md->pdev);
+	}
+
+	mock_dev_debugfs(md);
+	pr_info("pb-zybo-mock: %s device %s created\n", kind->compatible, dev_name(&md->pdev->dev));
+	return 0;
+}
+
+static void mock_dev_del(struct mock_dev *md) {
+	debugfs_remove_recursive(md->dbg_dir);
+	platform_device_unregister(md->pdev);
+}
+
+static void mock_cleanup(void) {
+	unsigned int i;
+
+	cancel_delayed_work_sync(&mock_sw_work);
+	/* Windows are freed after all devices are removed, the loopback hook of the LED
+	 * device writes into the window of the switch device */
+	for (i = mock_ndevs; i > 0; i--) {
+		mock_dev_del(&mock_devs[i - 1]);
+	}
+	for (i = 0; i < mock_ndevs; i++) {
+		vfree(mock_devs[i].regs);
+	}
+	mock_ndevs = 0;
+	kfree(mock_devs);
+	mock_devs = NULL;
+	debugfs_remove_recursive(mock_dbg_root);
+	mock_dbg_root = NULL;
+}
+
+static int __init pb_zybo_mock_init(void)
+{
+	unsigned int total = 0;
+	unsigned int i, j;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(mock_kinds); i++) {
+		total += *mock_kinds[i].count;
+	}
+
+	mock_devs = kcalloc(total, sizeof(*mock_devs), GFP_KERNEL);
+	if (total && !mock_devs) {
+		return -ENOMEM;
+	}
+
+	INIT_DELAYED_WORK(&mock_sw_work, mock_sw_event);
+	mock_dbg_root = debugfs_create_dir("pb-zybo-mock", NULL);
+	for (i = 0; i < ARRAY_SIZE(mock_kinds); i++) {
+		for (j = 0; j < *mock_kinds[i].count; j++) {
+			rc = mock_dev_add(&mock_devs[mock_ndevs], &mock_kinds[i], j);
+			if (rc) {
+				mock_cleanup();
+				return rc;
+			}
+			mock_ndevs++;
+		}
+	}
+
+	schedule_delayed_work(&mock_sw_work, msecs_to_jiffies(sw_event_ms ? sw_event_ms : 1000));
+	return 0;
+}
+
+static void __exit pb_zybo_mock_exit(void)
+{
+	mock_cleanup();
+}
+
+module_init(pb_zybo_mock_init);
+module_exit(pb_zybo_mock_exit);
+
+/* Standard module information, edit as appropriate */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Pavel Benacek");
+MODULE_DESCRIPTION("pb-zybo-mock - RAM-backed mock devices of the PB Zybo drivers");
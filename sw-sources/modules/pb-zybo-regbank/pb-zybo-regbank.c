@@ -0,0 +1,795 @@
+/*  pb-zybo-regbank.c - Generic driver of AXI register banks described in the device tree
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/io.h>
+#include <linux/slab.h>
+#include <linux/platform_device.h>
+#include <linux/property.h>
+#include <linux/ioctl.h>
+#include <linux/capability.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/uaccess.h>
+#include <linux/of_device.h>
+#include <linux/regmap.h>
+#include <linux/rwsem.h>
+
+#include "pb-zybo-core.h"
+#include "pb-zybo-regbank.h"
+
+/* Configuration related to driver names, etc */
+#define DRIVER_NAME "pb-regbank"
+#define DRIVER_SYSFS_CLASS "pb_regbank"
+#define DEVICE_ID_STR "regbank-%d"
+
+/* Device tree properties with the register layout */
+#define PROP_REG_NAMES		"pb,reg-names"
+#define PROP_REG_OFFSETS	"pb,reg-offsets"
+#define PROP_REG_WIDTHS		"pb,reg-widths"
+#define PROP_REG_ACCESS		"pb,reg-access"
+
+/* Default width and access mode of the register */
+#define REG_DEFAULT_WIDTH	32
+#define REG_DEFAULT_ACCESS	PB_ZYBO_REGBANK_RW
+
+/**
+ * @brief One register of the bank
+ *
+ */
+struct regbank_reg {
+	const char	*name;		/* Register name (device tree string) */
+	u32			offset;		/* Byte offset */
+	u32			mask;		/* Mask of valid value bits */
+	u8			width;		/* Width in bits */
+	u8			access;		/* Access mode PB_ZYBO_REGBANK_* */
+};
+
+/**
+ * @brief Statistics of register writes
+ *
+ */
+struct regbank_stats {
+	unsigned long writes;	/* Register writes issued to the register map */
+	unsigned long elided;	/* Writes of the cached value which were skipped */
+};
+
+/**
+ * @brief Local structure with private module data used in all
+ * calls
+ *
+ */
+struct regbank_local {
+	unsigned long			mem_start;		/* Start of IO memory */
+	unsigned long			mem_end;		/* End of IO memory */
+	void __iomem			*base_addr;		/* Base address of iomaped region */
+
+	struct pb_zybo_dev		pd;				/* Registered cdev, device and semaphore */
+
+	u32						nregs;			/* Number of registers */
+	struct regbank_reg		*regs;			/* Register layout from the device tree */
+	u8						*acc_by_word;	/* Access mode indexed by offset / 4 (0 = no register) */
+	u32						max_offset;		/* Offset of the last register */
+	struct regbank_stats	stats;
+
+	struct rw_semaphore		remove_lock;	/* Reads (shared) against the remove (exclusive) */
+	bool					dead;			/* The device was removed, protected by remove_lock */
+};
+
+/**
+ * @brief Context of one opened file
+ *
+ */
+struct regbank_file_ctx {
+	struct pb_zybo_file		pf;				/* Core part - CAP_SYS_ADMIN captured during the open */
+	struct regbank_local	*lp;			/* Parent device structure */
+};
+
+/* ==================================================================
+ 		Register layout
+   ================================================================== */
+
+static const char * const regbank_access_names[] = {
+	[PB_ZYBO_REGBANK_RO] = "ro",
+	[PB_ZYBO_REGBANK_WO] = "wo",
+	[PB_ZYBO_REGBANK_RW] = "rw",
+	[PB_ZYBO_REGBANK_RWC] = "rwc",
+};
+
+static int regbank_parse_access(const char *str) {
+	int i;
+
+	for (i = PB_ZYBO_REGBANK_RO; i < ARRAY_SIZE(regbank_access_names); i++) {
+		if (!strcmp(str, regbank_access_names[i])) {
+			return i;
+		}
+	}
+	return -EINVAL;
+}
+
+/**
+ * @brief Check if the register value is kept in the register map cache (reads without the HW access)
+ *
+ */
+static bool regbank_is_cached(u8 access) {
+	return access == PB_ZYBO_REGBANK_WO || access == PB_ZYBO_REGBANK_RWC;
+}
+
+static void regbank_free_layout(struct regbank_local *lp) {
+	kfree(lp->regs);
+	kfree(lp->acc_by_word);
+	lp->regs = NULL;
+	lp->acc_by_word = NULL;
+}
+
+/**
+ * @brief Read the register layout from device properties (names, offsets, widths and
+ * access modes). Widths and access modes are optional, registers are 32-bit "rw" by default.
+ *
+ * @param lp Local device structure
+ * @param dev Platform device
+ * @return int 0 iff the layout is valid
+ */
+static int regbank_parse_layout(struct regbank_local *lp, struct device *dev) {
+	unsigned long size = lp->mem_end - lp->mem_start + 1;
+	const char **names = NULL;
+	const char **access = NULL;
+	u32 *offsets = NULL;
+	u32 *widths = NULL;
+	int n, i;
+	int rc;
+
+	n = device_property_read_string_array(dev, PROP_REG_NAMES, NULL, 0);
+	if (n <= 0 || n > PB_ZYBO_REGBANK_MAX_REGS) {
+		dev_err(dev, "%s has to contain 1 - %d registers\n", PROP_REG_NAMES,
+			PB_ZYBO_REGBANK_MAX_REGS);
+		return -EINVAL;
+	}
+
+	names = kcalloc(n, sizeof(*names), GFP_KERNEL);
+	access = kcalloc(n, sizeof(*access), GFP_KERNEL);
+	offsets = kcalloc(n, sizeof(*offsets), GFP_KERNEL);
+	widths = kcalloc(n, sizeof(*widths), GFP_KERNEL);
+	lp->regs = kcalloc(n, sizeof(*lp->regs), GFP_KERNEL);
+	if (!names || !access || !offsets || !widths || !lp->regs) {
+		rc = -ENOMEM;
+		goto parse_out;
+	}
+
+	rc = -EINVAL;
+	if (device_property_read_string_array(dev, PROP_REG_NAMES, names, n) != n ||
+		device_property_count_u32(dev, PROP_REG_OFFSETS) != n ||
+		device_property_read_u32_array(dev, PROP_REG_OFFSETS, offsets, n)) {
+		dev_err(dev, "%s and %s have to have the same length\n", PROP_REG_NAMES, PROP_REG_OFFSETS);
+		goto parse_out;
+	}
+
+	if (device_property_present(dev, PROP_REG_WIDTHS) &&
+		(device_property_count_u32(dev, PROP_REG_WIDTHS) != n ||
+		device_property_read_u32_array(dev, PROP_REG_WIDTHS, widths, n))) {
+		dev_err(dev, "%s has to have %d items\n", PROP_REG_WIDTHS, n);
+		goto parse_out;
+	}
+
+	if (device_property_present(dev, PROP_REG_ACCESS) &&
+		device_property_read_string_array(dev, PROP_REG_ACCESS, access, n) != n) {
+		dev_err(dev, "%s has to have %d items\n", PROP_REG_ACCESS, n);
+		goto parse_out;
+	}
+
+	lp->max_offset = 0;
+	for (i = 0; i < n; i++) {
+		struct regbank_reg *reg = &lp->regs[i];
+		int acc = access[i] ? regbank_parse_access(access[i]) : REG_DEFAULT_ACCESS;
+
+		reg->name = names[i];
+		reg->offset = offsets[i];
+		reg->width = widths[i] ? widths[i] : REG_DEFAULT_WIDTH;
+		if (acc < 0 || !IS_ALIGNED(reg->offset, 4) || reg->offset + 4 > size ||
+			widths[i] > 32 || strlen(reg->name) >= PB_ZYBO_REGBANK_NAME_LEN) {
+			dev_err(dev, "invalid description of the register %s\n", reg->name);
+			goto parse_out;
+		}
+		reg->access = acc;
+		reg->mask = GENMASK(reg->width - 1, 0);
+		lp->max_offset = max(lp->max_offset, reg->offset);
+	}
+
+	/* Access modes by the register offset, they are used by the register map callbacks */
+	lp->acc_by_word = kzalloc(lp->max_offset / 4 + 1, GFP_KERNEL);
+	if (!lp->acc_by_word) {
+		rc = -ENOMEM;
+		goto parse_out;
+	}
+
+	for (i = 0; i < n; i++) {
+		u8 *acc = &lp->acc_by_word[lp->regs[i].offset / 4];
+
+		if (*acc) {
+			dev_err(dev, "register %s overlaps another register\n", lp->regs[i].name);
+			goto parse_out;
+		}
+		*acc = lp->regs[i].access;
+	}
+
+	lp->nregs = n;
+	rc = 0;
+
+parse_out:
+	if (rc) {
+		regbank_free_layout(lp);
+	}
+	kfree(names);
+	kfree(access);
+	kfree(offsets);
+	kfree(widths);
+	return rc;
+}
+
+/* Register map callbacks - the layout decides about accesses and the cache */
+static u8 regbank_reg_access(struct device *dev, unsigned int reg) {
+	struct regbank_local *lp = dev_get_drvdata(dev);
+
+	return reg <= lp->max_offset ? lp->acc_by_word[reg / 4] : 0;
+}
+
+static bool regbank_writeable_reg(struct device *dev, unsigned int reg) {
+	u8 acc = regbank_reg_access(dev, reg);
+
+	return acc && acc != PB_ZYBO_REGBANK_RO;
+}
+
+static bool regbank_readable_reg(struct device *dev, unsigned int reg) {
+	u8 acc = regbank_reg_access(dev, reg);
+
+	return acc && acc != PB_ZYBO_REGBANK_WO;
+}
+
+static bool regbank_volatile_reg(struct device *dev, unsigned int reg) {
+	return !regbank_is_cached(regbank_reg_access(dev, reg));
+}
+
+/* ==================================================================
+ 		Register access
+   ================================================================== */
+
+/**
+ * @brief Read the register without the device semaphore - cached registers are read from
+ * the register map cache, others from the HW. The remove lock has to be held.
+ *
+ * @param lp Local device structure
+ * @param idx Register index
+ * @param val Read value
+ * @return int 0 iff the value was read
+ */
+static int regbank_read_reg(struct regbank_local *lp, u32 idx, u32 *val) {
+	const struct regbank_reg *reg;
+	unsigned int hw_val;
+	int rc;
+
+	if (idx >= lp->nregs) {
+		return -EINVAL;
+	}
+
+	reg = &lp->regs[idx];
+	rc = regmap_read(lp->pd.regmap, reg->offset, &hw_val);
+
+	/* The write only register which was never written isn't cached and cannot be read */
+	if (rc == -EIO && reg->access == PB_ZYBO_REGBANK_WO) {
+		return -ENODATA;
+	}
+	if (rc) {
+		return rc;
+	}
+
+	*val = hw_val & reg->mask;
+	return 0;
+}
+
+/**
+ * @brief Read the register, readers don't wait for the device semaphore of writers. Files
+ * opened before the remove get -ENODEV after the registers were unmapped.
+ *
+ * @param lp Local device structure
+ * @param idx Register index
+ * @param val Read value
+ * @return int 0 iff the value was read
+ */
+static int regbank_read(struct regbank_local *lp, u32 idx, u32 *val) {
+	int rc = -ENODEV;
+
+	down_read(&lp->remove_lock);
+	if (!lp->dead) {
+		rc = regbank_read_reg(lp, idx, val);
+	}
+	up_read(&lp->remove_lock);
+	return rc;
+}
+
+/**
+ * @brief Write the register, the device semaphore has to be held. Writes of the
+ * unchanged value into cached registers are skipped.
+ *
+ * @param lp Local device structure
+ * @param idx Register index
+ * @param val Value to write
+ * @return int 0 iff the value was written
+ */
+static int regbank_write(struct regbank_local *lp, u32 idx, u32 val) {
+	const struct regbank_reg *reg;
+	unsigned int cur;
+	int rc;
+
+	if (idx >= lp->nregs) {
+		return -EINVAL;
+	}
+
+	reg = &lp->regs[idx];
+	if (reg->access == PB_ZYBO_REGBANK_RO) {
+		return -EACCES;
+	}
+	if (val & ~reg->mask) {
+		return -EINVAL;
+	}
+
+	/* The cache read fails for the write only register which was never written */
+	if (regbank_is_cached(reg->access) &&
+		!regmap_read(lp->pd.regmap, reg->offset, &cur) && (cur & reg->mask) == val) {
+		WRITE_ONCE(lp->stats.elided, lp->stats.elided + 1);
+		return 0;
+	}
+
+	rc = regmap_write(lp->pd.regmap, reg->offset, val);
+	if (rc) {
+		return rc;
+	}
+
+	WRITE_ONCE(lp->stats.writes, lp->stats.writes + 1);
+	return 0;
+}
+
+/**
+ * @brief Execute the batch of register operations in order. The device is locked once
+ * if the batch contains writes, the execution stops at the first failed operation.
+ *
+ * @param file Opened device file
+ * @param lp Local device structure
+ * @param ops Kernel copy of operations
+ * @param count Number of operations
+ * @param done Number of successfully executed operations
+ * @return long 0 iff all operations were executed
+ */
+static long regbank_batch_run(struct file *file, struct regbank_local *lp,
+	struct pb_zybo_regbank_op *ops, u32 count, u32 *done) {
+	const struct regbank_file_ctx *ctx = file->private_data;
+	bool writes = false;
+	long rc = 0;
+	u32 i;
+
+	*done = 0;
+	for (i = 0; i < count; i++) {
+		ops[i].res = -ECANCELED;
+		if (ops[i].op == PB_ZYBO_REGBANK_OP_WRITE) {
+			writes = true;
+		} else if (ops[i].op != PB_ZYBO_REGBANK_OP_READ) {
+			ops[i].res = -EINVAL;
+			return -EINVAL;
+		}
+	}
+
+	if (writes) {
+		if (!ctx->pf.can_write) {
+			return -EPERM;
+		}
+		rc = pb_zybo_down(&lp->pd, file);
+		if (rc) {
+			return rc;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (ops[i].op == PB_ZYBO_REGBANK_OP_WRITE) {
+			ops[i].res = regbank_write(lp, ops[i].index, ops[i].value);
+		} else {
+			ops[i].res = regbank_read(lp, ops[i].index, &ops[i].value);
+		}
+
+		if (ops[i].res) {
+			rc = ops[i].res;
+			break;
+		}
+		(*done)++;
+	}
+
+	if (writes) {
+		pb_zybo_up(&lp->pd);
+	}
+	return rc;
+}
+
+static long regbank_batch(struct file *file, struct regbank_local *lp, unsigned long arg) {
+	struct pb_zybo_regbank_batch batch;
+	struct pb_zybo_regbank_op *ops;
+	void __user *uops;
+	long rc;
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch))) {
+		return -EFAULT;
+	}
+
+	if (batch.count == 0 || batch.count > PB_ZYBO_REGBANK_MAX_OPS) {
+		return -EINVAL;
+	}
+
+	uops = u64_to_user_ptr(batch.ops);
+	ops = memdup_user(uops, batch.count * sizeof(*ops));
+	if (IS_ERR(ops)) {
+		return PTR_ERR(ops);
+	}
+
+	rc = regbank_batch_run(file, lp, ops, batch.count, &batch.done);
+
+	/* Completions are written back even if the batch failed */
+	if (copy_to_user(uops, ops, batch.count * sizeof(*ops)) ||
+		copy_to_user((void __user *)arg, &batch, sizeof(batch))) {
+		rc = -EFAULT;
+	}
+
+	kfree(ops);
+	return rc;
+}
+
+/* ==================================================================
+ 		Sysfs attributes
+   ================================================================== */
+
+static ssize_t layout_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct regbank_local *lp = pb_zybo_dev_get_drvdata(dev);
+	ssize_t len = 0;
+	u32 i;
+
+	for (i = 0; i < lp->nregs; i++) {
+		const struct regbank_reg *reg = &lp->regs[i];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %s 0x%04x %u %s\n", i, reg->name,
+			reg->offset, reg->width, regbank_access_names[reg->access]);
+	}
+	return len;
+}
+static DEVICE_ATTR_RO(layout);
+
+static ssize_t reg_writes_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct regbank_local *lp = pb_zybo_dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(lp->stats.writes));
+}
+static DEVICE_ATTR_RO(reg_writes);
+
+static ssize_t reg_writes_elided_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct regbank_local *lp = pb_zybo_dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(lp->stats.elided));
+}
+static DEVICE_ATTR_RO(reg_writes_elided);
+
+static struct attribute *regbank_attrs[] = {
+	&dev_attr_layout.attr,
+	&dev_attr_reg_writes.attr,
+	&dev_attr_reg_writes_elided.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(regbank);
+
+/* ==================================================================
+ 		Char device callbacks
+   ================================================================== */
+
+static long regbank_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct regbank_file_ctx *ctx = file->private_data;
+	struct regbank_local *lp = ctx->lp;
+	struct pb_zybo_regbank_val rv;
+	struct pb_zybo_regbank_reg ri;
+	long rc;
+
+	pb_zybo_ioctl_enter(&lp->pd, cmd, arg);
+
+	/* Reads don't take the device semaphore, writes are serialized */
+	switch (cmd) {
+	case PB_ZYBO_REGBANK_IOCTL_COUNT:
+		rc = put_user(lp->nregs, (__u32 __user *)arg);
+		break;
+	case PB_ZYBO_REGBANK_IOCTL_REG_INFO:
+		if (copy_from_user(&ri, (void __user *)arg, sizeof(ri))) {
+			rc = -EFAULT;
+			break;
+		}
+		if (ri.index >= lp->nregs) {
+			rc = -EINVAL;
+			break;
+		}
+		ri.offset = lp->regs[ri.index].offset;
+		ri.width = lp->regs[ri.index].width;
+		ri.access = lp->regs[ri.index].access;
+		ri.resv = 0;
+		strscpy(ri.name, lp->regs[ri.index].name, sizeof(ri.name));
+		rc = copy_to_user((void __user *)arg, &ri, sizeof(ri)) ? -EFAULT : 0;
+		break;
+	case PB_ZYBO_REGBANK_IOCTL_READ:
+		if (copy_from_user(&rv, (void __user *)arg, sizeof(rv))) {
+			rc = -EFAULT;
+			break;
+		}
+		rc = regbank_read(lp, rv.index, &rv.value);
+		if (!rc && copy_to_user((void __user *)arg, &rv, sizeof(rv))) {
+			rc = -EFAULT;
+		}
+		break;
+	case PB_ZYBO_REGBANK_IOCTL_WRITE:
+		if (!ctx->pf.can_write) {
+			rc = -EPERM;
+			break;
+		}
+		if (copy_from_user(&rv, (void __user *)arg, sizeof(rv))) {
+			rc = -EFAULT;
+			break;
+		}
+		rc = pb_zybo_down(&lp->pd, file);
+		if (rc) {
+			break;
+		}
+		rc = regbank_write(lp, rv.index, rv.value);
+		pb_zybo_up(&lp->pd);
+		break;
+	case PB_ZYBO_REGBANK_IOCTL_BATCH:
+		rc = regbank_batch(file, lp, arg);
+		break;
+	default:
+		rc = -ENOTTY;
+		break;
+	}
+
+	pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
+	return rc;
+}
+
+static int regbank_cdev_open(struct inode *inode, struct file *filp) {
+	struct regbank_file_ctx *ctx;
+
+	/* Allocate the per-open context and store it into the file_private data for other calls.
+	The permission is checked once here, not on every write. */
+	ctx = kzalloc(sizeof(struct regbank_file_ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
+
+	ctx->lp = container_of(inode->i_cdev, struct regbank_local, pd.cdev);
+	pb_zybo_file_init(&ctx->pf, &ctx->lp->pd);
+	filp->private_data = ctx;
+	return 0;
+}
+
+static int regbank_cdev_release(struct inode *inode, struct file *filp) {
+	/* Release the per-open context */
+	kfree(filp->private_data);
+	filp->private_data = NULL;
+	return 0;
+}
+
+/**
+ * @brief Structure with CDEV callbacks used by the
+ * kernel
+ *
+ */
+static const struct file_operations fops = {
+	.owner = THIS_MODULE,
+	.llseek = noop_llseek,
+	.open = regbank_cdev_open,
+	.release = regbank_cdev_release,
+	.unlocked_ioctl = regbank_ioctl,
+};
+
+/**
+ * @brief Free the removed device and its layout after the last open file is closed
+ *
+ * @param pd Device instance
+ */
+static void regbank_release(struct pb_zybo_dev *pd) {
+	struct regbank_local *lp = container_of(pd, struct regbank_local, pd);
+
+	regbank_free_layout(lp);
+	kfree(lp);
+}
+
+/**
+ * @brief Driver type registered in the pb-zybo core, it is shared by
+ * all register banks
+ *
+ */
+static struct pb_zybo_type regbank_type = {
+	.name = DRIVER_SYSFS_CLASS,
+	.devname_fmt = DEVICE_ID_STR,
+	.fops = &fops,
+	.groups = regbank_groups,
+	.release = regbank_release,
+};
+
+/* ==================================================================
+ 		Platform dependent callbacks
+   ================================================================== */
+
+/**
+ * @brief Load current values of cached read/write registers, so reads and the elision
+ * of unchanged writes work from the first access
+ *
+ */
+static int regbank_seed(struct regbank_local *lp) {
+	u32 i;
+	int rc;
+
+	for (i = 0; i < lp->nregs; i++) {
+		if (lp->regs[i].access != PB_ZYBO_REGBANK_RWC) {
+			continue;
+		}
+
+		rc = pb_zybo_regcache_seed(&lp->pd, lp->regs[i].offset);
+		if (rc) {
+			return rc;
+		}
+	}
+	return 0;
+}
+
+static int regbank_probe(struct platform_device *pdev) {
+	struct device *dev = &pdev->dev;
+	struct regmap_config conf = {
+		.name = "regbank",
+		.writeable_reg = regbank_writeable_reg,
+		.readable_reg = regbank_readable_reg,
+		.volatile_reg = regbank_volatile_reg,
+		.cache_type = REGCACHE_RBTREE,
+	};
+	struct regbank_local *lp;
+	u64 start = ktime_get_ns();
+	int rc;
+
+	lp = kzalloc(sizeof(*lp), GFP_KERNEL);
+	if (!lp) {
+		dev_err(dev, "Cound not allocate pb-regbank device\n");
+		return -ENOMEM;
+	}
+	dev_set_drvdata(dev, lp);
+	init_rwsem(&lp->remove_lock);
+
+	/* Reserve the memory region acessed by the driver and remap it to the virtual kernel space */
+	lp->base_addr = pb_zybo_ioremap(pdev, DRIVER_NAME, &lp->mem_start, &lp->mem_end);
+	if (IS_ERR(lp->base_addr)) {
+		rc = PTR_ERR(lp->base_addr);
+		goto mem_region_err;
+	}
+
+	rc = regbank_parse_layout(lp, dev);
+	if (rc) {
+		goto layout_err;
+	}
+
+	/* Register map described by the layout - write only and "rwc" registers are cached */
+	conf.max_register = lp->max_offset;
+	rc = pb_zybo_regmap_init(&lp->pd, dev, lp->base_addr, &conf);
+	if (rc) {
+		goto regmap_err;
+	}
+
+	rc = regbank_seed(lp);
+	if (rc) {
+		dev_err(dev, "Unable to read cached registers.\n");
+		goto cdev_init_err;
+	}
+
+	pb_zybo_probe_done(&lp->pd, dev, start);
+
+	/* Register the CDEV, create device and sysfs */
+	rc = pb_zybo_dev_add(&regbank_type, &lp->pd, dev, lp);
+	if (rc < 0) {
+		dev_err(dev, "Unable to create a cdev.\n");
+		goto cdev_init_err;
+	}
+
+	dev_dbg(dev, "register bank with %u registers\n", lp->nregs);
+	return 0;
+
+cdev_init_err:
+	pb_zybo_regmap_exit(&lp->pd);
+regmap_err:
+	regbank_free_layout(lp);
+layout_err:
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
+mem_region_err:
+	kfree(lp);
+	dev_set_drvdata(dev, NULL);
+	return rc;
+}
+
+static int regbank_remove(struct platform_device *pdev) {
+	struct device *dev = &pdev->dev;
+	struct regbank_local *lp = dev_get_drvdata(dev);
+
+	pb_zybo_dev_del(&lp->pd);
+
+	/* Wait for running reads, reads of files which are still open fail from now on */
+	down_write(&lp->remove_lock);
+	lp->dead = true;
+	up_write(&lp->remove_lock);
+
+	pb_zybo_regmap_exit(&lp->pd);
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
+	dev_set_drvdata(dev, NULL);
+
+	/* Files which are still open keep the structure and the layout alive */
+	pb_zybo_dev_release(&lp->pd);
+	return 0;
+}
+PB_ZYBO_DEFINE_REMOVE(regbank_remove)
+
+static struct of_device_id regbank_of_match[] = {
+	{ .compatible = "pb,regbank-1.0", },
+	{ /* end of list */ },
+};
+
+static struct platform_driver regbank_driver = {
+	.driver = {
+		.name = DRIVER_NAME,
+		.owner = THIS_MODULE,
+		.of_match_table	= regbank_of_match,
+	},
+	.probe		= regbank_probe,
+	.remove		= PB_ZYBO_REMOVE(regbank_remove),
+};
+
+static int __init regbank_init(void)
+{
+	int rc;
+
+	/* The driver type (class, minors) has to exist before the first probe */
+	rc = pb_zybo_type_register(&regbank_type);
+	if (rc) {
+		return rc;
+	}
+
+	/* Probe asynchronously unless the core is loaded with async_probe=0 */
+	regbank_driver.driver.probe_type = pb_zybo_probe_type();
+	rc = platform_driver_register(&regbank_driver);
+	if (rc) {
+		pb_zybo_type_unregister(&regbank_type);
+	}
+	return rc;
+}
+
+static void __exit regbank_exit(void)
+{
+	platform_driver_unregister(&regbank_driver);
+	pb_zybo_type_unregister(&regbank_type);
+}
+
+module_init(regbank_init);
+module_exit(regbank_exit);
+
+/* Standard module information, edit as appropriate */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Pavel Benacek");
+MODULE_DESCRIPTION("pb-zybo-regbank - generic driver of device tree described AXI register banks");
@@ -0,0 +1,95 @@
+/*  pb-zybo-regbank.h - Interface of the generic PB Zybo register-bank driver
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The header is shared by the kernel and the user space (/dev/regbank-*) */
+
+#ifndef __PB_ZYBO_REGBANK_H__
+#define __PB_ZYBO_REGBANK_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Access modes of registers (pb,reg-access property) */
+#define PB_ZYBO_REGBANK_RO			1	/* "ro"  - read only, the value is read from the HW	*/
+#define PB_ZYBO_REGBANK_WO			2	/* "wo"  - write only, reads return the last write	*/
+#define PB_ZYBO_REGBANK_RW			3	/* "rw"  - read/write, the value is read from the HW	*/
+#define PB_ZYBO_REGBANK_RWC			4	/* "rwc" - read/write owned by the CPU, cached		*/
+
+/* Maximal number of registers of one bank, operations in one batch and the name length */
+#define PB_ZYBO_REGBANK_MAX_REGS	64
+#define PB_ZYBO_REGBANK_MAX_OPS		256
+#define PB_ZYBO_REGBANK_NAME_LEN	32
+
+/* Operations of the batch */
+#define PB_ZYBO_REGBANK_OP_READ		1
+#define PB_ZYBO_REGBANK_OP_WRITE	2
+
+/**
+ * @brief Description of one register
+ *
+ */
+struct pb_zybo_regbank_reg {
+	__u32 index;							/* Register index (input) */
+	__u32 offset;							/* Byte offset in the bank */
+	__u8  width;							/* Width of the value in bits (1 - 32) */
+	__u8  access;							/* Access mode PB_ZYBO_REGBANK_* */
+	__u16 resv;
+	char  name[PB_ZYBO_REGBANK_NAME_LEN];	/* Register name from the device tree */
+};
+
+/**
+ * @brief Access of one register
+ *
+ */
+struct pb_zybo_regbank_val {
+	__u32 index;	/* Register index */
+	__u32 value;	/* Written value or the read value (output) */
+};
+
+/**
+ * @brief One operation of the batch - the completion (value, res) is written back
+ *
+ */
+struct pb_zybo_regbank_op {
+	__u16 op;		/* Operation PB_ZYBO_REGBANK_OP_* */
+	__u16 index;	/* Register index */
+	__u32 value;	/* Written value or the read value (output) */
+	__s32 res;		/* Result of the operation (0 or -errno) */
+	__u32 resv;
+};
+
+/**
+ * @brief Batch of register operations
+ *
+ */
+struct pb_zybo_regbank_batch {
+	__u64 ops;		/* User pointer to the array of struct pb_zybo_regbank_op */
+	__u32 count;	/* Number of operations in the array */
+	__u32 done;		/* Number of successfully executed operations (output) */
+};
+
+/* Supported IOCTL handlers */
+#define PB_ZYBO_REGBANK_IOCTL_MAGIC		'z'
+#define PB_ZYBO_REGBANK_IOCTL_COUNT		_IOR(PB_ZYBO_REGBANK_IOCTL_MAGIC, 0x50, __u32)
+#define PB_ZYBO_REGBANK_IOCTL_REG_INFO	_IOWR(PB_ZYBO_REGBANK_IOCTL_MAGIC, 0x51, struct pb_zybo_regbank_reg)
+#define PB_ZYBO_REGBANK_IOCTL_READ		_IOWR(PB_ZYBO_REGBANK_IOCTL_MAGIC, 0x52, struct pb_zybo_regbank_val)
+#define PB_ZYBO_REGBANK_IOCTL_WRITE		_IOW(PB_ZYBO_REGBANK_IOCTL_MAGIC, 0x53, struct pb_zybo_regbank_val)
+#define PB_ZYBO_REGBANK_IOCTL_BATCH		_IOWR(PB_ZYBO_REGBANK_IOCTL_MAGIC, 0x54, struct pb_zybo_regbank_batch)
+
+#endif /* __PB_ZYBO_REGBANK_H__ */
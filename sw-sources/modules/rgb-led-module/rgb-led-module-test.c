@@ -0,0 +1,386 @@
+/*  rgb-led-module-test.c - KUnit tests of the Zybo base RGB LED driver
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The file is included at the end of rgb-led-module.c, so static helpers can be tested
+ * directly. Registers live in a RAM window, no HW is needed. */
+
+#include <kunit/test.h>
+#include <linux/ktime.h>
+
+/* Size of the RAM window with PWM registers */
+#define RGB_TEST_WINDOW		256
+/* Number of iterations of microbenchmarks */
+#define RGB_BENCH_SCALE_OPS	1000000
+#define RGB_BENCH_PARSE_OPS	100000
+/* Sanity limit of the benchmark results (catches pathological regressions only) */
+#define RGB_BENCH_MAX_NS	10000
+
+/**
+ * @brief Test context - the device with registers in RAM and the opened file
+ *
+ */
+struct rgb_test_ctx {
+	struct rgb_led_module_local *lp;
+	u32 *regs;
+	struct rgb_led_file_ctx *fctx;
+	struct file *file;
+};
+
+static u32 rgb_test_duty(struct rgb_test_ctx *tc, int ch) {
+	return tc->regs[(PWM_AXI_DUTY_REG_OFFSET + ch * PWM_AXI_DUTY_REG_STRIDE) / 4];
+}
+
+static int rgb_test_init(struct kunit *test) {
+	struct rgb_test_ctx *tc;
+	int rc;
+
+	tc = kunit_kzalloc(test, sizeof(*tc), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc);
+	tc->lp = kunit_kzalloc(test, sizeof(*tc->lp), GFP_KERNEL);
+	tc->regs = kunit_kzalloc(test, RGB_TEST_WINDOW, GFP_KERNEL);
+	tc->fctx = kunit_kzalloc(test, sizeof(*tc->fctx), GFP_KERNEL);
+	tc->file = kunit_kzalloc(test, sizeof(*tc->file), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc->lp);
+	KUNIT_ASSERT_NOT_NULL(test, tc->regs);
+	KUNIT_ASSERT_NOT_NULL(test, tc->fctx);
+	KUNIT_ASSERT_NOT_NULL(test, tc->file);
+
+	rc = pb_zybo_test_dev_init(&tc->lp->pd, tc->regs, &rgb_led_module_regmap_config, tc->lp);
+	KUNIT_ASSERT_EQ(test, rc, 0);
+
+	/* Same state as after the probe */
+	tc->lp->period = PWM_PERIOD_CLK;
+	init_device(tc->lp);
+
+	tc->fctx->lp = tc->lp;
+	tc->fctx->pf.pd = &tc->lp->pd;
+	tc->fctx->pf.can_write = true;
+	tc->file->private_data = tc->fctx;
+	test->priv = tc;
+	return 0;
+}
+
+static void rgb_test_exit(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	pb_zybo_test_dev_exit(&tc->lp->pd);
+}
+
+/* ==================================================================
+ 		RGB encoding
+   ================================================================== */
+
+static void rgb_test_encode_decode(struct kunit *test) {
+	static const u32 vals[] = {0x000000, 0xffffff, 0x123456, 0xff0000, 0x00ff00, 0x0000ff, 0x010203};
+	struct rgb_val rgb;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(vals); i++) {
+		rgb = decode_rgb(vals[i]);
+		KUNIT_EXPECT_EQ(test, rgb.r, (vals[i] >> 16) & 0xff);
+		KUNIT_EXPECT_EQ(test, rgb.g, (vals[i] >> 8) & 0xff);
+		KUNIT_EXPECT_EQ(test, rgb.b, vals[i] & 0xff);
+		KUNIT_EXPECT_EQ(test, encode_rgb(&rgb), vals[i]);
+	}
+}
+
+static void rgb_test_decode_upper_byte(struct kunit *test) {
+	struct rgb_val rgb = decode_rgb(0xab123456);
+
+	/* The upper byte isn't a part of the color */
+	KUNIT_EXPECT_EQ(test, encode_rgb(&rgb), 0x123456U);
+}
+
+static void rgb_test_encode_all_channels(struct kunit *test) {
+	struct rgb_val rgb, back;
+	u32 c;
+
+	for (c = 0; c <= 0xff; c++) {
+		rgb.r = c;
+		rgb.g = 0xff - c;
+		rgb.b = c ^ 0x5a;
+		back = decode_rgb(encode_rgb(&rgb));
+		KUNIT_EXPECT_EQ(test, back.r, rgb.r);
+		KUNIT_EXPECT_EQ(test, back.g, rgb.g);
+		KUNIT_EXPECT_EQ(test, back.b, rgb.b);
+	}
+}
+
+/* ==================================================================
+ 		PWM scaling
+   ================================================================== */
+
+static void rgb_test_pwm_scale(struct kunit *test) {
+	static const int periods[] = {PWM_PERIOD_CLK, 2048, 8192, 65536, 1 << 20, 4095, 10000};
+	u32 prev, cur;
+	int i, val;
+
+	for (i = 0; i < ARRAY_SIZE(periods); i++) {
+		int period = periods[i];
+		u32 step = period / PWM_MAX_DIV / 256;
+
+		KUNIT_EXPECT_EQ(test, pwm_scale_rgb(period, 0, PWM_MAX_DIV), 0U);
+		prev = 0;
+		for (val = 0; val <= 0xff; val++) {
+			cur = pwm_scale_rgb(period, val, PWM_MAX_DIV);
+			/* Linear in the value, never above the enabled fraction of the period */
+			KUNIT_EXPECT_EQ(test, cur, step * val);
+			KUNIT_EXPECT_LE(test, cur, (u32)(period / PWM_MAX_DIV));
+			KUNIT_EXPECT_GE(test, cur, prev);
+			prev = cur;
+		}
+	}
+
+	/* Default period - full color is 510 clocks of 4096 */
+	KUNIT_EXPECT_EQ(test, pwm_scale_rgb(PWM_PERIOD_CLK, 0xff, PWM_MAX_DIV), 510U);
+}
+
+static void rgb_test_pwm_scale_short_period(struct kunit *test) {
+	/* The scale step is rounded down, periods shorter than 256 * PWM_MAX_DIV turn the LED off */
+	KUNIT_EXPECT_EQ(test, pwm_scale_rgb(256 * PWM_MAX_DIV - 1, 0xff, PWM_MAX_DIV), 0U);
+	KUNIT_EXPECT_EQ(test, pwm_scale_rgb(256 * PWM_MAX_DIV, 0xff, PWM_MAX_DIV), 0xffU);
+	KUNIT_EXPECT_EQ(test, pwm_scale_rgb(0, 0xff, PWM_MAX_DIV), 0U);
+}
+
+/* ==================================================================
+ 		Text parser
+   ================================================================== */
+
+static void rgb_test_parse_valid(struct kunit *test) {
+	struct rgb_val rgb;
+
+	KUNIT_ASSERT_EQ(test, parse_rgb("0xAA 0xBB 0xCC\n", &rgb), 0);
+	KUNIT_EXPECT_EQ(test, rgb.r, 0xaaU);
+	KUNIT_EXPECT_EQ(test, rgb.g, 0xbbU);
+	KUNIT_EXPECT_EQ(test, rgb.b, 0xccU);
+
+	KUNIT_ASSERT_EQ(test, parse_rgb("0x01 0x02 0x03\n", &rgb), 0);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&rgb), 0x010203U);
+
+	/* The 0x prefix is optional and the whitespace is flexible */
+	KUNIT_ASSERT_EQ(test, parse_rgb("ff   00   7f   \n", &rgb), 0);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&rgb), 0xff007fU);
+}
+
+static void rgb_test_parse_short(struct kunit *test) {
+	struct rgb_val rgb;
+
+	/* The trailing new line is a part of the minimal length */
+	KUNIT_EXPECT_EQ(test, parse_rgb("0xAA 0xBB 0xCC", &rgb), -ENODATA);
+	KUNIT_EXPECT_EQ(test, parse_rgb("", &rgb), -ENODATA);
+	KUNIT_EXPECT_EQ(test, parse_rgb("0x1 0x2 0x3\n", &rgb), -ENODATA);
+}
+
+static void rgb_test_parse_invalid(struct kunit *test) {
+	struct rgb_val rgb;
+
+	KUNIT_EXPECT_EQ(test, parse_rgb("zzzzzzzzzzzzzzzz\n", &rgb), -EINVAL);
+	KUNIT_EXPECT_EQ(test, parse_rgb("0xAA 0xBB      \n", &rgb), -EINVAL);
+	KUNIT_EXPECT_EQ(test, parse_rgb("0xAA, 0xBB, 0xCC\n", &rgb), -EINVAL);
+}
+
+/* ==================================================================
+ 		IOCTL dispatch
+   ================================================================== */
+
+static void rgb_test_ioctl_unknown(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+
+	KUNIT_EXPECT_EQ(test, rgb_module_ioctl(tc->file, _IO(LED_IOCTL_MAGIC, 0x7f), 0), (long)-ENOTTY);
+	/* The semaphore was released */
+	KUNIT_EXPECT_EQ(test, down_trylock(&tc->lp->pd.sem), 0);
+	up(&tc->lp->pd.sem);
+}
+
+static void rgb_test_ioctl_no_perm(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+
+	tc->fctx->pf.can_write = false;
+	KUNIT_EXPECT_EQ(test, rgb_module_ioctl(tc->file, LED_IOCTL_SET_VAL, 0), (long)-EPERM);
+	KUNIT_EXPECT_EQ(test, rgb_module_ioctl(tc->file, LED_IOCTL_SET_PERIOD, 0), (long)-EPERM);
+}
+
+static void rgb_test_ioctl_init(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	struct rgb_val rgb = decode_rgb(0xff8001);
+	int ch;
+
+	set_rgb_config(&rgb, tc->lp);
+	KUNIT_EXPECT_EQ(test, rgb_test_duty(tc, 2), pwm_scale_rgb(PWM_PERIOD_CLK, 0xff, PWM_MAX_DIV));
+	KUNIT_EXPECT_EQ(test, rgb_test_duty(tc, 1), pwm_scale_rgb(PWM_PERIOD_CLK, 0x80, PWM_MAX_DIV));
+	KUNIT_EXPECT_EQ(test, rgb_test_duty(tc, 0), pwm_scale_rgb(PWM_PERIOD_CLK, 0x01, PWM_MAX_DIV));
+
+	/* Reset turns off all channels and enables the PWM */
+	tc->regs[PWM_AXI_CTRL_REG_OFFSET / 4] = PWM_AXI_DISABLE_CMD;
+	KUNIT_EXPECT_EQ(test, rgb_module_ioctl(tc->file, LED_IOCTL_INIT, 0), 0L);
+	for (ch = 0; ch < PWM_CHANNELS; ch++) {
+		KUNIT_EXPECT_EQ(test, rgb_test_duty(tc, ch), 0U);
+	}
+	KUNIT_EXPECT_EQ(test, tc->regs[PWM_AXI_CTRL_REG_OFFSET / 4], (u32)PWM_AXI_ENABLE_CMD);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&tc->lp->rgbval), 0U);
+
+	/* Registers which drifted from the cache are rewritten too */
+	tc->regs[PWM_AXI_DUTY_REG_OFFSET / 4] = 0x1234;
+	tc->regs[PWM_AXI_PERIOD_REG_OFFSET / 4] = 0;
+	KUNIT_EXPECT_EQ(test, rgb_module_ioctl(tc->file, LED_IOCTL_INIT, 0), 0L);
+	KUNIT_EXPECT_EQ(test, rgb_test_duty(tc, 0), 0U);
+	KUNIT_EXPECT_EQ(test, tc->regs[PWM_AXI_PERIOD_REG_OFFSET / 4], (u32)PWM_PERIOD_CLK);
+}
+
+static void rgb_test_write_elided(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	struct rgb_val rgb = decode_rgb(0x102030);
+	unsigned long writes;
+
+	set_rgb_config(&rgb, tc->lp);
+	writes = tc->lp->pd.mmio_writes;
+
+	/* The same color doesn't touch the bus */
+	set_rgb_config(&rgb, tc->lp);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_writes, writes);
+
+	/* One channel change is one register write */
+	rgb.g = 0x21;
+	set_rgb_config(&rgb, tc->lp);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_writes, writes + 1);
+}
+
+static void rgb_test_write_stamp(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	struct rgb_val rgb = decode_rgb(0x0a0b0c);
+	u32 seq = tc->lp->stamp.seq;
+	u64 before = ktime_get_ns();
+
+	/* The probe (init_device) is the first update */
+	set_rgb_config(&rgb, tc->lp);
+	KUNIT_EXPECT_EQ(test, tc->lp->stamp.value, 0x0a0b0cU);
+	KUNIT_EXPECT_EQ(test, tc->lp->stamp.seq, seq + 1);
+	KUNIT_EXPECT_GE(test, tc->lp->stamp.ts_ns, before);
+	KUNIT_EXPECT_LE(test, tc->lp->stamp.ts_ns, ktime_get_ns());
+}
+
+static void rgb_test_adopt(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	struct rgb_val rgb = decode_rgb(0xff8001);
+	unsigned long writes;
+
+	/* The color is computed from duty cycles written by the previous driver */
+	set_rgb_config(&rgb, tc->lp);
+	tc->lp->rgbval = decode_rgb(0);
+	tc->lp->period = 0;
+	writes = tc->lp->pd.mmio_writes;
+	KUNIT_ASSERT_EQ(test, adopt_device(tc->lp), 0);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&tc->lp->rgbval), 0xff8001U);
+	KUNIT_EXPECT_EQ(test, tc->lp->period, (u32)PWM_PERIOD_CLK);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_writes, writes);
+
+	/* The disabled PWM isn't adopted */
+	tc->regs[PWM_AXI_CTRL_REG_OFFSET / 4] = PWM_AXI_DISABLE_CMD;
+	KUNIT_EXPECT_NE(test, adopt_device(tc->lp), 0);
+}
+
+static void rgb_test_adopt_snapshot(struct kunit *test) {
+	struct rgb_test_ctx *tc = test->priv;
+	struct rgb_val rgb = decode_rgb(0x123456);
+
+	/* The snapshot keeps the exact color and the period which wasn't applied yet */
+	set_rgb_config(&rgb, tc->lp);
+	tc->lp->period = PWM_PERIOD_CLK * 2;
+	handover_device(tc->lp->pd.device, tc->lp);
+	tc->lp->rgbval = decode_rgb(0);
+	tc->lp->period = 0;
+	KUNIT_ASSERT_EQ(test, adopt_device(tc->lp), 0);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&tc->lp->rgbval), 0x123456U);
+	KUNIT_EXPECT_EQ(test, tc->lp->period, (u32)PWM_PERIOD_CLK * 2);
+
+	/* The snapshot which doesn't match the HW is ignored */
+	handover_device(tc->lp->pd.device, tc->lp);
+	rgb = decode_rgb(0x000080);
+	set_rgb_config(&rgb, tc->lp);
+	KUNIT_ASSERT_EQ(test, adopt_device(tc->lp), 0);
+	KUNIT_EXPECT_EQ(test, encode_rgb(&tc->lp->rgbval), 0x000080U);
+}
+
+/* ==================================================================
+ 		Microbenchmarks
+   ================================================================== */
+
+static void rgb_bench_pwm_scale(struct kunit *test) {
+	u32 sink = 0;
+	u64 start, ns;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < RGB_BENCH_SCALE_OPS; i++) {
+		sink += pwm_scale_rgb(PWM_PERIOD_CLK + (i & 0xfff), i & 0xff, PWM_MAX_DIV);
+	}
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "pwm_scale_rgb: %llu ns/op (%d ops, sum 0x%x)\n",
+		div_u64(ns, RGB_BENCH_SCALE_OPS), RGB_BENCH_SCALE_OPS, sink);
+	KUNIT_EXPECT_LT(test, div_u64(ns, RGB_BENCH_SCALE_OPS), (u64)RGB_BENCH_MAX_NS);
+}
+
+static void rgb_bench_parse(struct kunit *test) {
+	static const char * const texts[] = {"0xAA 0xBB 0xCC\n", "0x01 0x02 0x03\n", "0xff 0x00 0x7f\n"};
+	struct rgb_val rgb;
+	u32 sink = 0;
+	u64 start, ns;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < RGB_BENCH_PARSE_OPS; i++) {
+		if (parse_rgb(texts[i % ARRAY_SIZE(texts)], &rgb) == 0) {
+			sink += encode_rgb(&rgb);
+		}
+	}
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "parse_rgb: %llu ns/op (%d ops, sum 0x%x)\n",
+		div_u64(ns, RGB_BENCH_PARSE_OPS), RGB_BENCH_PARSE_OPS, sink);
+	KUNIT_EXPECT_LT(test, div_u64(ns, RGB_BENCH_PARSE_OPS), (u64)RGB_BENCH_MAX_NS);
+}
+
+static struct kunit_case rgb_led_module_test_cases[] = {
+	KUNIT_CASE(rgb_test_encode_decode),
+	KUNIT_CASE(rgb_test_decode_upper_byte),
+	KUNIT_CASE(rgb_test_encode_all_channels),
+	KUNIT_CASE(rgb_test_pwm_scale),
+	KUNIT_CASE(rgb_test_pwm_scale_short_period),
+	KUNIT_CASE(rgb_test_parse_valid),
+	KUNIT_CASE(rgb_test_parse_short),
+	KUNIT_CASE(rgb_test_parse_invalid),
+	KUNIT_CASE(rgb_test_ioctl_unknown),
+	KUNIT_CASE(rgb_test_ioctl_no_perm),
+	KUNIT_CASE(rgb_test_ioctl_init),
+	KUNIT_CASE(rgb_test_write_elided),
+	KUNIT_CASE(rgb_test_write_stamp),
+	KUNIT_CASE(rgb_test_adopt),
+	KUNIT_CASE(rgb_test_adopt_snapshot),
+	KUNIT_CASE(rgb_bench_pwm_scale),
+	KUNIT_CASE(rgb_bench_parse),
+	{}
+};
+
+static struct kunit_suite rgb_led_module_test_suite = {
+	.name = "pb-zybo-rgb-led",
+	.init = rgb_test_init,
+	.exit = rgb_test_exit,
+	.test_cases = rgb_led_module_test_cases,
+};
+kunit_test_suite(rgb_led_module_test_suite);
@@ -28,10 +28,16 @@
 #include <linux/cdev.h>
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
+#include <linux/device.h>
 
 #include <linux/of_address.h>
 #include <linux/of_device.h>
 #include <linux/of_platform.h>
+#include <linux/regmap.h>
+
+#include "pb-zybo-core.h"
+#include "pb-zybo-cmd.h"
+#include "pb-zybo-ioctl.h"
 
 /* Configuration related to driver names, etc */
 #define DRIVER_NAME "rgb-led-module"
@@ -45,11 +51,14 @@
 #define PWM_AXI_CTRL_REG_OFFSET 	0
 #define PWM_AXI_PERIOD_REG_OFFSET 	8
 #define PWM_AXI_DUTY_REG_OFFSET 	64
+#define PWM_AXI_DUTY_REG_STRIDE 	4
+#define PWM_CHANNELS 				3
 
 #define PWM_AXI_ENABLE_CMD  1
 #define PWM_AXI_DISABLE_CMD 0
+#define PWM_AXI_REG_MASK	0xFFFFFFFF
 
-/* Supported IOCTL handlers */
+/* Original IOCTL handlers (see pb-zybo-ioctl.h for current numbers) */
 #define LED_IOCTL_MAGIC			'l'
 #define LED_IOCTL_GET_VAL		_IOR(LED_IOCTL_MAGIC, 0, unsigned long)
 #define LED_IOCTL_SET_VAL		_IOW(LED_IOCTL_MAGIC, 1, unsigned long)
@@ -98,6 +107,16 @@ static u32 encode_rgb(const struct rgb_val *val) {
 	return r | g | b;
 }
 
+/**
+ * @brief Counters of PWM register updates - updates of unchanged values are
+ * elided by the register map
+ * 
+ */
+struct rgb_pwm_stats {
+	unsigned long writes;		/* Number of issued register writes */
+	unsigned long elided;		/* Number of skipped register writes */
+};
+
 /**
  * @brief Local structure with temporal device data
  * 
@@ -107,16 +126,34 @@ struct rgb_led_module_local {
 	unsigned long mem_end;
 	void __iomem *base_addr;
 
-	struct class	*sysclass;		/* sysfs class for the device */
-	struct device	*device;		/* Allocated device structure */
-	dev_t			 devid;			/* Assigned device ID */
-	struct cdev		 cdev;			/* Characted device structure */
+	struct pb_zybo_dev	pd;			/* Registered cdev, device and semaphore */
 
-	struct semaphore 	sem;		/* Semaphore for the access serialization */
 	struct rgb_val		rgbval;		/* Current set RGB value */
 	u32	period;						/* PWM period value */
+	struct rgb_pwm_stats pwm_stats;	/* PWM register update counters */
+	bool hw_synced;					/* The register cache matches the HW */
+	struct pb_zybo_out_stamp stamp;	/* Last color update (PB_ZYBO_RGB_IOCTL_GET_STAMP) */
+};
+
+/**
+ * @brief Driver state handed over to the next probe (keep_state=1)
+ * 
+ */
+struct rgb_led_state {
+	struct rgb_val	rgbval;		/* Current set RGB value */
+	u32				period;		/* PWM period value (also not applied yet) */
+};
+
+/**
+ * @brief Per-open file context - every opened file has its own parse buffers
+ * and permissions, so concurrent writers don't mix their partial text.
+ * 
+ */
+struct rgb_led_file_ctx {
+	struct pb_zybo_file pf;				/* Core part - CAP_SYS_ADMIN captured during the open */
+	struct rgb_led_module_local *lp;	/* Parent device structure */
 
-	char wr_buf[BUFF_SIZE];			/* Device buffer */
+	char wr_buf[BUFF_SIZE];			/* Device write buffer */
 	char rd_buff[BUFF_SIZE];		/* Device read buffer */
 };
 
@@ -139,67 +176,112 @@ static u32 pwm_scale_rgb(int period, int val, int pwm_max_on) {
 	return ret;
 }
 
+/**
+ * @brief Parse the RGB value in the text format "0xRR 0xGG 0xBB"
+ * 
+ * @param buf Zero terminated text written by the user
+ * @param val Parsed RGB value
+ * @return int 0 iff the value was parsed, -ENODATA if the text is too short
+ */
+static int parse_rgb(const char *buf, struct rgb_val *val) {
+	if (strnlen(buf, BUFF_SIZE) < BUFF_CONF_STR_LEN) {
+		return -ENODATA;
+	}
+
+	if (sscanf(buf, "%x %x %x\n", &val->r, &val->g, &val->b) != 3) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * @brief Update one PWM register - the old value is taken from the register cache
+ * and the HW is written iff the value differs (or the cache doesn't match the HW yet)
+ * 
+ * @param lp Structure with the RGB device configuration
+ * @param reg Register offset
+ * @param val Value to set
+ */
+static void set_pwm_reg(struct rgb_led_module_local *lp, u32 reg, u32 val) {
+	bool changed = false;
+
+	regmap_update_bits_base(lp->pd.regmap, reg, PWM_AXI_REG_MASK, val, &changed,
+		false, !lp->hw_synced);
+	if (changed) {
+		lp->pwm_stats.writes++;
+	} else {
+		lp->pwm_stats.elided++;
+	}
+}
+
 /**
  * @brief Setup one part of the color - PWM duty cycle configuration
  * 
+ * @param val Duty cycle value to set
+ * @param lp Structure with the RGB device configuration
+ * @param ch PWM channel (0 = B, 1 = G, 2 = R)
  */
-static void set_pwm_duty(const u32 val, void __iomem  *base) {
-	void __iomem *addr = base + PWM_AXI_DUTY_REG_OFFSET;
-	iowrite32(val, addr);
+static void set_pwm_duty(const u32 val, struct rgb_led_module_local *lp, int ch) {
+	set_pwm_reg(lp, PWM_AXI_DUTY_REG_OFFSET + ch * PWM_AXI_DUTY_REG_STRIDE, val);
 }
 
 /**
  * @brief Set the pwm period value
  * 
  * @param period Period value to set
- * @param base Base address value
+ * @param lp Structure with the RGB device configuration
  */
-static void set_pwm_period(const u32 period, void __iomem *base) {
-	iowrite32(period, base + PWM_AXI_PERIOD_REG_OFFSET);
+static void set_pwm_period(const u32 period, struct rgb_led_module_local *lp) {
+	set_pwm_reg(lp, PWM_AXI_PERIOD_REG_OFFSET, period);
 }
 
 /**
- * @brief Set the rgb configuration into the device
+ * @brief Set the rgb configuration into the device. Registers are written
+ * iff the value differs from the cached one.
  * 
  * @param val Structure with RGB configuration 
  * @param base Base value address
  */
 static void set_rgb_config(const struct rgb_val *val, struct rgb_led_module_local *lp) {
-	/* Re-scale the RGB values regarding the PWM configuration */
-	struct rgb_val rs_val = {
-		pwm_scale_rgb(lp->period, val->r, PWM_MAX_DIV),
+	int i;
+
+	/* Re-scale the RGB values regarding the PWM configuration, each RGB part has its own
+	configuration - each pwm duty cycle is shifted by 4 bytes (B, G, R order) */
+	const u32 duty[PWM_CHANNELS] = {
+		pwm_scale_rgb(lp->period, val->b, PWM_MAX_DIV),
 		pwm_scale_rgb(lp->period, val->g, PWM_MAX_DIV),
-		pwm_scale_rgb(lp->period, val->b, PWM_MAX_DIV)
+		pwm_scale_rgb(lp->period, val->r, PWM_MAX_DIV)
 	};
 
-	/* Each RGB part has its own configuration  - each pwm duty cycle is shifted by
-	4 bytes*/
-	set_pwm_duty(rs_val.b, lp->base_addr);
-	set_pwm_duty(rs_val.g, lp->base_addr + 4);
-	set_pwm_duty(rs_val.r, lp->base_addr + 8);
-
-	set_pwm_period(lp->period, lp->base_addr);
+	for (i = 0; i < PWM_CHANNELS; i++) {
+		set_pwm_duty(duty[i], lp, i);
+	}
+	set_pwm_period(lp->period, lp);
 
 	/* Update the RGB configuration */
+	lp->hw_synced = true;
 	lp->rgbval = *val;
+	lp->stamp.value = encode_rgb(val);
+	lp->stamp.seq++;
+	lp->stamp.ts_ns = ktime_get_ns();
 }
 
 /**
  * @brief Enable the PWM device
  * 
- * @param base Base value address
+ * @param lp Structure with the RGB device configuration
  */
-static void enable_device(void __iomem *base) {
-	iowrite32(PWM_AXI_ENABLE_CMD, base + PWM_AXI_CTRL_REG_OFFSET);
+static void enable_device(struct rgb_led_module_local *lp) {
+	regmap_write(lp->pd.regmap, PWM_AXI_CTRL_REG_OFFSET, PWM_AXI_ENABLE_CMD);
 }
 
 /**
  * @brief Disable the PWM device
  * 
- * @param base Base value address
+ * @param lp Structure with the RGB device configuration
  */
-static void disable_device(void __iomem *base) {
-	iowrite32(PWM_AXI_DISABLE_CMD, base + PWM_AXI_CTRL_REG_OFFSET);
+static void disable_device(struct rgb_led_module_local *lp) {
+	regmap_write(lp->pd.regmap, PWM_AXI_CTRL_REG_OFFSET, PWM_AXI_DISABLE_CMD);
 }
 
 /**
@@ -214,13 +296,15 @@ static void reset_device_config(struct rgb_led_module_local *lp) {
 
 /**
  * @brief Initialize the device - this function is typically called during the
- * module probe call.
+ * module probe call and by the INIT IOCTL. All registers are written, the HW
+ * can differ from the register cache (e.g., after the bitstream reload).
  * 
  * @param lp Structure with the RGB device configuration
  */
 static void init_device(struct rgb_led_module_local *lp) {
+	lp->hw_synced = false;
 	reset_device_config(lp);
-	enable_device(lp->base_addr);
+	enable_device(lp);
 }
 
 /**
@@ -231,9 +315,135 @@ static void init_device(struct rgb_led_module_local *lp) {
  */
 static void deinit_device(struct rgb_led_module_local *lp) {
 	reset_device_config(lp);
-	disable_device(lp->base_addr);
+	disable_device(lp);
 }
 
+/**
+ * @brief Adopt the running device - current PWM registers are loaded into the register
+ * cache and the configuration is taken from the stored snapshot (or computed from duty
+ * cycles). Nothing is written into the HW.
+ * 
+ * @param lp Structure with the RGB device configuration
+ * @return int 0 iff the device was adopted, it has to be initialized otherwise
+ */
+static int adopt_device(struct rgb_led_module_local *lp) {
+	struct rgb_led_state st;
+	unsigned int ctrl, period, duty[PWM_CHANNELS];
+	bool have_state;
+	u32 scale;
+	int i, rc;
+
+	have_state = pb_zybo_state_load(PB_ZYBO_KIND_RGB, lp->mem_start, &st, sizeof(st)) == 0;
+
+	rc = pb_zybo_regcache_seed(&lp->pd, PWM_AXI_CTRL_REG_OFFSET);
+	if (!rc) {
+		rc = pb_zybo_regcache_seed(&lp->pd, PWM_AXI_PERIOD_REG_OFFSET);
+	}
+	for (i = 0; i < PWM_CHANNELS && !rc; i++) {
+		rc = pb_zybo_regcache_seed(&lp->pd, PWM_AXI_DUTY_REG_OFFSET + i * PWM_AXI_DUTY_REG_STRIDE);
+	}
+	if (rc) {
+		return rc;
+	}
+
+	/* Values are served from the cache now */
+	regmap_read(lp->pd.regmap, PWM_AXI_CTRL_REG_OFFSET, &ctrl);
+	regmap_read(lp->pd.regmap, PWM_AXI_PERIOD_REG_OFFSET, &period);
+	for (i = 0; i < PWM_CHANNELS; i++) {
+		regmap_read(lp->pd.regmap, PWM_AXI_DUTY_REG_OFFSET + i * PWM_AXI_DUTY_REG_STRIDE, &duty[i]);
+	}
+	if (ctrl != PWM_AXI_ENABLE_CMD || period == 0) {
+		return -ENODEV;
+	}
+
+	/* The snapshot is used iff it matches the HW (the PL wasn't reloaded in the meantime) */
+	if (have_state &&
+		duty[0] == pwm_scale_rgb(period, st.rgbval.b, PWM_MAX_DIV) &&
+		duty[1] == pwm_scale_rgb(period, st.rgbval.g, PWM_MAX_DIV) &&
+		duty[2] == pwm_scale_rgb(period, st.rgbval.r, PWM_MAX_DIV)) {
+		lp->rgbval = st.rgbval;
+		lp->period = st.period;
+	} else {
+		scale = pwm_scale_rgb(period, 1, PWM_MAX_DIV);
+		lp->rgbval.b = scale ? min(duty[0] / scale, 0xffU) : 0;
+		lp->rgbval.g = scale ? min(duty[1] / scale, 0xffU) : 0;
+		lp->rgbval.r = scale ? min(duty[2] / scale, 0xffU) : 0;
+		lp->period = period;
+	}
+
+	lp->hw_synced = true;
+	return 0;
+}
+
+/**
+ * @brief Store the configuration for the next probe, the HW keeps running
+ * 
+ * @param dev Platform device
+ * @param lp Structure with the RGB device configuration
+ */
+static void handover_device(struct device *dev, struct rgb_led_module_local *lp) {
+	struct rgb_led_state st = {
+		.rgbval = lp->rgbval,
+		.period = lp->period,
+	};
+
+	if (pb_zybo_state_save(PB_ZYBO_KIND_RGB, lp->mem_start, &st, sizeof(st))) {
+		dev_warn(dev, "Unable to store the RGB state, it will be read from the HW.\n");
+	}
+}
+
+/**
+ * @brief Writable (and cached) PWM registers
+ * 
+ */
+static bool rgb_led_module_writeable_reg(struct device *dev, unsigned int reg) {
+	switch (reg) {
+	case PWM_AXI_CTRL_REG_OFFSET:
+	case PWM_AXI_PERIOD_REG_OFFSET:
+	case PWM_AXI_DUTY_REG_OFFSET ... PWM_AXI_DUTY_REG_OFFSET +
+		(PWM_CHANNELS - 1) * PWM_AXI_DUTY_REG_STRIDE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Register map of the device - all PWM registers are cached, read-back is
+ * served from the cache
+ * 
+ */
+static const struct regmap_config rgb_led_module_regmap_config = {
+	.name = "pwm",
+	.max_register = PWM_AXI_DUTY_REG_OFFSET + (PWM_CHANNELS - 1) * PWM_AXI_DUTY_REG_STRIDE,
+	.writeable_reg = rgb_led_module_writeable_reg,
+	.readable_reg = rgb_led_module_writeable_reg,
+	.cache_type = REGCACHE_FLAT,
+};
+
+/* ==================================================================
+ 		Sysfs attributes
+   ================================================================== */
+
+static ssize_t reg_writes_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct rgb_led_module_local *lp = pb_zybo_dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(lp->pwm_stats.writes));
+}
+static DEVICE_ATTR_RO(reg_writes);
+
+static ssize_t reg_writes_elided_show(struct device *dev, struct device_attribute *attr, char *buf) {
+	struct rgb_led_module_local *lp = pb_zybo_dev_get_drvdata(dev);
+	return sprintf(buf, "%lu\n", READ_ONCE(lp->pwm_stats.elided));
+}
+static DEVICE_ATTR_RO(reg_writes_elided);
+
+static struct attribute *rgb_led_module_attrs[] = {
+	&dev_attr_reg_writes.attr,
+	&dev_attr_reg_writes_elided.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(rgb_led_module);
+
 /* ==================================================================
  		Char device callbacks
    ================================================================== */
@@ -245,20 +455,41 @@ static void deinit_device(struct rgb_led_module_local *lp) {
 #endif
 
 static long rgb_module_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+	struct rgb_led_file_ctx *ctx;
 	struct rgb_led_module_local *lp;
 	long rc;
 	unsigned long tmp_val;
+	u32 usr_val;
 	struct rgb_val rgb_val;
 
-	lp = file->private_data;
+	ctx = file->private_data;
+	lp = ctx->lp;
 	rc = 0;
+	pb_zybo_ioctl_enter(&lp->pd, cmd, arg);
+
+	/* Setters are checked before the lock so the rejected call doesn't touch the semaphore,
+	user data are fetched there too - the page fault cannot block other users */
+	if (cmd == LED_IOCTL_SET_VAL || cmd == LED_IOCTL_SET_PERIOD ||
+		cmd == PB_ZYBO_RGB_IOCTL_SET_VAL || cmd == PB_ZYBO_RGB_IOCTL_SET_PERIOD) {
+		if (!ctx->pf.can_write) {
+			IOCTL_DEBUG_PRINT(lp->pd.device,"User is not capable to set led value\n");
+			rc = -EPERM;
+			goto rgb_ioctl_end;
+		}
+
+		rc = get_user(usr_val, (u32 __user*) arg);
+		if (rc != 0) {
+			IOCTL_DEBUG_PRINT(lp->pd.device,"Cannot copy value from user space.\n");
+			goto rgb_ioctl_end;
+		}
+	}
 
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is being used by a different process.\n");
-		return -ERESTARTSYS;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		goto rgb_ioctl_end;
 	}
 
-	IOCTL_DEBUG_PRINT(lp->device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
+	IOCTL_DEBUG_PRINT(lp->pd.device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
 	/* Generally, we allow to read data without a superuser account.
 	Writing is, on the other hand allowed to the owner of the device or
 	to a user which has the SYSADMIN capability.
@@ -267,78 +498,75 @@ static long rgb_module_ioctl(struct file *file, unsigned int cmd, unsigned long
 	*/
 	switch (cmd) {
 	case LED_IOCTL_GET_VAL:
+	case PB_ZYBO_RGB_IOCTL_GET_VAL:
 		tmp_val = encode_rgb(&lp->rgbval);
 		rc = put_user(tmp_val, (u32 __user*) arg);
-		IOCTL_DEBUG_PRINT(lp->device, "Sending the RGB value 0x%lx (rc = %ld)\n", tmp_val, rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the RGB value 0x%lx (rc = %ld)\n", tmp_val, rc);
 		break;
 
 	case LED_IOCTL_SET_VAL:
-		if (!capable(CAP_SYS_ADMIN)) {
-			IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set led value\n");
-			return -EPERM;
-		}
-
-		rc = get_user(tmp_val, (u32 __user*) arg);
-		if (rc != 0) {
-			IOCTL_DEBUG_PRINT(lp->device,"Cannot copy value from user space.\n");
-			break;
-		}
-
-		rgb_val = decode_rgb(tmp_val);
+	case PB_ZYBO_RGB_IOCTL_SET_VAL:
+		rgb_val = decode_rgb(usr_val);
 		set_rgb_config(&rgb_val, lp);
-		IOCTL_DEBUG_PRINT(lp->device, "Setting the RGB value 0x%x (rc = %ld)\n", encode_rgb(&rgb_val), rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Setting the RGB value 0x%x (rc = %ld)\n", encode_rgb(&rgb_val), rc);
 		break;
 
 	case LED_IOCTL_GET_PERIOD:
+	case PB_ZYBO_RGB_IOCTL_GET_PERIOD:
 		rc = put_user(lp->period, (u32 __user*) arg);
-		IOCTL_DEBUG_PRINT(lp->device, "Sending the RGB value 0x%x (rc = %ld)\n", lp->period, rc);
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the RGB value 0x%x (rc = %ld)\n", lp->period, rc);
 		break;
 
 	case LED_IOCTL_SET_PERIOD:
-		if (!capable(CAP_SYS_ADMIN)) {
-			IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set led value\n");
-			return -EPERM;
-		}
-		
-		rc = get_user(lp->period, (u32 __user*) arg);
-		if (rc != 0) {
-			IOCTL_DEBUG_PRINT(lp->device,"Cannot copy value from user space.\n");
-			break;
-		}
-
-		IOCTL_DEBUG_PRINT(lp->device, "Setting the period value 0x%x (rc = %ld)\n", lp->period, rc);
+	case PB_ZYBO_RGB_IOCTL_SET_PERIOD:
+		lp->period = usr_val;
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Setting the period value 0x%x (rc = %ld)\n", lp->period, rc);
 		break;
 
 	case LED_IOCTL_INIT:
-		IOCTL_DEBUG_PRINT(lp->device, "Reseting the device to initial values");
+	case PB_ZYBO_RGB_IOCTL_INIT:
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Reseting the device to initial values");
 		init_device(lp);
 		break;
 
+	case PB_ZYBO_RGB_IOCTL_GET_STAMP:
+		if (copy_to_user((void __user*) arg, &lp->stamp, sizeof(lp->stamp))) {
+			rc = -EFAULT;
+		}
+		IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the update %u, color 0x%x (rc = %ld)\n", lp->stamp.seq, lp->stamp.value, rc);
+		break;
+
 	default:
-		dev_info(lp->device, "Invalid ioctl cmd = 0x%08x\n", cmd);
+		dev_info(lp->pd.device, "Invalid ioctl cmd = 0x%08x\n", cmd);
 		rc = -ENOTTY;
 		break;
 	}
 
-	IOCTL_DEBUG_PRINT(lp->device, "IOCTL Handler has been finished (rc = %ld)\n", rc);
-	up(&lp->sem);
+	IOCTL_DEBUG_PRINT(lp->pd.device, "IOCTL Handler has been finished (rc = %ld)\n", rc);
+	pb_zybo_up(&lp->pd);
+
+rgb_ioctl_end:
+	pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
 	return rc;
 }
 
 static loff_t rgb_module_cdev_llseek(struct file *file, loff_t offset, int whence) {
 	/* Seeking in our case resets the device to default state because it doesn't remember 
 	all passed data */
+	struct rgb_led_file_ctx *ctx;
 	struct rgb_led_module_local *lp;
 	loff_t rc;
 
-	lp = file->private_data;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
+	ctx = file->private_data;
+	lp = ctx->lp;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		return rc;
 	}
 
 	/* Restart the status and seek the offset based on whence */
 	reset_device_config(lp);
+	memset(ctx->wr_buf, 0, BUFF_SIZE);
 	switch (whence) {
 		case SEEK_SET: /* Set from the beginning */
 			rc = offset;
@@ -353,43 +581,47 @@ static loff_t rgb_module_cdev_llseek(struct file *file, loff_t offset, int whenc
 	}
 	
 	/* Put the semaphore up and return the new llseek value */
-	up(&lp->sem);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_LLSEEK, 0, rc);
 	return rc;
 }
 
 static ssize_t rgb_module_cdev_read(struct file *file, char __user *buff, size_t count, loff_t *f_pos) {
 	/* The read function will be much easier because the only thing it needs to do is to create the
-	 * output string iff the current offset is 0.
+	 * output string iff the current offset is 0. Only the RGB snapshot is taken under the lock,
+	 * the string lives in the per-open context.
 	 */
-	size_t rc;
+	ssize_t rc;
+	struct rgb_led_file_ctx *ctx;
 	struct rgb_led_module_local *lp;
-	const struct rgb_val *rgb_val;
+	struct rgb_val rgb_val;
 	char *buff_start;
 	size_t to_send;
 
-	/* Acquire the lock and prepare data */
-	buff_start = NULL;
-	lp = file->private_data;
-	rgb_val = &lp->rgbval;
-	rc = 0;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		rc = -ERESTARTSYS;
-		goto rgb_read_end;
+	ctx = file->private_data;
+	lp = ctx->lp;
+	if (*f_pos >= BUFF_SIZE) {
+		return 0;
 	}
 
 	if (*f_pos == 0) {
-		snprintf(lp->rd_buff, BUFF_SIZE, "0x%x 0x%x 0x%x\n",
-			rgb_val->r, rgb_val->g, rgb_val->b);
+		rc = pb_zybo_down(&lp->pd, file);
+		if (rc) {
+			return rc;
+		}
+		rgb_val = lp->rgbval;
+		pb_zybo_up(&lp->pd);
+
+		snprintf(ctx->rd_buff, BUFF_SIZE, "0x%x 0x%x 0x%x\n",
+			rgb_val.r, rgb_val.g, rgb_val.b);
 	}
 
 	/* Send data to the user */
-	buff_start = lp->rd_buff + *f_pos;
-	to_send = strnlen(buff_start, BUFF_SIZE);
+	buff_start = ctx->rd_buff + *f_pos;
+	to_send = strnlen(buff_start, BUFF_SIZE - *f_pos);
 	if (to_send == 0) {
 		/* Nothing to send to the user */
-		rc = 0;
-		goto rgb_read_end;
+		return 0;
 	}
 
 	/* Check amount of data to send and correct it regarding the size of dest. buffer */
@@ -399,101 +631,99 @@ static ssize_t rgb_module_cdev_read(struct file *file, char __user *buff, size_t
 
 	/* Send data and move the pointer */
 	if (copy_to_user(buff, buff_start, to_send)) {
-		dev_err(lp->device, "Cannot write data to the user space in cdev read routine.\n");
-		rc = -EFAULT;
-		goto rgb_read_end;
+		dev_err(lp->pd.device, "Cannot write data to the user space in cdev read routine.\n");
+		return -EFAULT;
 	}
 
-	rc = to_send;
 	*f_pos += to_send;
-
-rgb_read_end:
-	up(&lp->sem);
-	return rc;
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_READ, to_send, to_send);
+	return to_send;
 }
 
 static ssize_t rgb_module_cdev_write(struct file *file, const char __user *buff, size_t count, loff_t *f_pos) {
 	/* Write into the device means that we need to extract the passed HEX value of RGB
 	 * and set it via the device dependent calls. No defferred work is required here because we
-	 * are writing one value only 
+	 * are writing one value only. The text is collected in the per-open context, the
+	 * semaphore is taken only for the device update.
 	 */
 	size_t to_copy;
-	size_t rc;
+	ssize_t rc;
 	size_t rem_buff;
-	int matched;
-	int str_len;
 	char *buff_start;
+	struct rgb_led_file_ctx *ctx;
 	struct rgb_led_module_local *lp;
 	struct rgb_val rgb_conf;
 
-	/* Get the semaphore and receive user data */
-	lp = file->private_data;
-	rc = 0;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
-	}
+	ctx = file->private_data;
+	lp = ctx->lp;
 
 	/* Check the buffer size and set the correct data count to acquire, also don't forget to 
-	 * move the buffer pointer to the next free part
+	 * move the buffer pointer to the next free part. The last byte is kept for the terminating zero.
 	 */
-	rem_buff = BUFF_SIZE - *f_pos;
+	if (*f_pos >= BUFF_SIZE - 1) {
+		return -ENOSPC;
+	}
+
+	rem_buff = BUFF_SIZE - 1 - *f_pos;
 	if (count > rem_buff) {
 		to_copy = rem_buff;
 	} else {
 		to_copy = count;
 	}
 
-	buff_start = lp->wr_buf + *f_pos;
+	buff_start = ctx->wr_buf + *f_pos;
 	if (copy_from_user(buff_start, buff, to_copy)) {
-		dev_err(lp->device, "Cannot read data from the user space in cdev write routine.\n");
-		rc = -EFAULT;
-		goto rgb_write_end;
+		dev_err(lp->pd.device, "Cannot read data from the user space in cdev write routine.\n");
+		return -EFAULT;
 	}
 
 	/* Parse input if we have enough of data  - format is 0xAA 0xBB 0xCC */
-	rc = to_copy;
-	str_len = strnlen(lp->wr_buf, BUFF_SIZE);
-	if (str_len < BUFF_CONF_STR_LEN) {
+	rc = parse_rgb(ctx->wr_buf, &rgb_conf);
+	if (rc == -ENODATA) {
 		/* Don't have enough data - skip to end*/
-		dev_err(lp->device, "Don't have enought of data! The format is: 0xAA 0xBB 0xCC \n");
-		rc = -EINVAL;
-		goto rgb_write_end;
-	}
-
-	/* Match Input data and configure the device */
-	matched = sscanf(lp->wr_buf, "%x %x %x\n",
-		&rgb_conf.r, &rgb_conf.g, &rgb_conf.b);
-
-	if (matched != 3) {
+		dev_err(lp->pd.device, "Don't have enought of data! The format is: 0xAA 0xBB 0xCC \n");
+		return -EINVAL;
+	} else if (rc) {
 		/* Invalid format of config data */
-		dev_err(lp->device, "Invalid format of configuration data. Allowed format is: 0xAA 0xBB 0xCC \n");
-		rc = -EINVAL;
-		goto rgb_write_end;
+		dev_err(lp->pd.device, "Invalid format of configuration data. Allowed format is: 0xAA 0xBB 0xCC \n");
+		return -EINVAL;
 	}
 
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		return rc;
+	}
 	set_rgb_config(&rgb_conf, lp);
+	pb_zybo_up(&lp->pd);
 
 	/* Shift the file pointer offset */
+	rc = to_copy;
 	*f_pos += rc;
-
-rgb_write_end:
-	up(&lp->sem);
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_WRITE, rc, rc);
 	return rc;
 }
 
 static int rgb_module_cdev_open(struct inode *inode, struct file *filp) {
-	struct rgb_led_module_local *lp;
+	struct rgb_led_file_ctx *ctx;
+
+	/* Allocate the per-open context and store it into the file_private data for other calls.
+	The permission is checked once here, not on every call. */
+	ctx = kzalloc(sizeof(struct rgb_led_file_ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
 
-	/* Get the local structure and store it into the file_private data for other calls */
-	lp = container_of(inode->i_cdev, struct rgb_led_module_local, cdev);
-	filp->private_data = lp;
+	ctx->lp = container_of(inode->i_cdev, struct rgb_led_module_local, pd.cdev);
+	pb_zybo_file_init(&ctx->pf, &ctx->lp->pd);
+	filp->private_data = ctx;
 
 	return 0;
 }
 
 static int rgb_module_cdev_release(struct inode *inode, struct file *filp) {
-	/* Nothing special to do here ... */
+	/* Release the per-open context */
+	kfree(filp->private_data);
+	filp->private_data = NULL;
 	return 0;
 }
 
@@ -502,7 +732,7 @@ static int rgb_module_cdev_release(struct inode *inode, struct file *filp) {
  * kernel
  * 
  */
-struct file_operations fops = {
+static const struct file_operations fops = {
 	.owner = THIS_MODULE,
 	.llseek = rgb_module_cdev_llseek,
 	.read = rgb_module_cdev_read,
@@ -510,149 +740,127 @@ struct file_operations fops = {
 	.open = rgb_module_cdev_open,
 	.release = rgb_module_cdev_release,
 	.unlocked_ioctl = rgb_module_ioctl,
+#ifdef PB_ZYBO_HAS_URING_CMD
+	.uring_cmd = pb_zybo_uring_cmd,
+#endif
 };
 
-static int rgb_module_cdev_init(struct platform_device *pdev) {
-	int rc = 0;
-	struct device *dev = &pdev->dev;
-	struct rgb_led_module_local *lp = dev_get_drvdata(dev);
-	unsigned int n_major = 0;
-	unsigned int n_minor = 0;
-
-	dev_info(dev, "Running the cdev init.\n");
-	/* Prepare the samaphore - one device is allowed to work with the
-	 led driver */
-	sema_init(&lp->sem, 1);
-
-	/* Dynamic allocation of Major number for the cdev */
-	rc = alloc_chrdev_region(&lp->devid, 0, 1, DRIVER_NAME);
-	if (rc < 0) {
-		dev_err(dev, "Error during the MAJOR and MINOR allocation\n");
-		return rc;
-	}
-
-	n_major = MAJOR(lp->devid);
-	n_minor = MINOR(lp->devid);
-	dev_info(dev, "cdev init MAJOR=%d and MINOR=%d\n",n_major, n_minor);
-
-	/* create sysfs class to have easier access to it */
-    lp->sysclass = class_create(THIS_MODULE, DRIVER_SYSFS_CLASS);
-	if (IS_ERR(lp->sysclass)) {
-		dev_err(dev, "Error during the sysfs class creation\n");
-		rc = -EFAULT;
-		goto cdev_add_err;
-	}
+/**
+ * @brief Execute one batched command (/dev/pb-zybo-cmd), the device semaphore
+ * is held by the core
+ * 
+ * @param pd Device instance
+ * @param op Command operation
+ * @param arg Command argument
+ * @param val Output value
+ * @return long 0 iff the command was executed
+ */
+static long rgb_led_module_cmd_exec(struct pb_zybo_dev *pd, u32 op, u32 arg, u32 *val) {
+	struct rgb_led_module_local *lp = container_of(pd, struct rgb_led_module_local, pd);
+	struct rgb_val rgb_val;
 
-	/* Register the cdev into the kernel */
-	cdev_init(&lp->cdev, &fops);
-	lp->cdev.owner = THIS_MODULE;
+	switch (op) {
+	case PB_ZYBO_CMD_RGB_SET:
+		rgb_val = decode_rgb(arg);
+		set_rgb_config(&rgb_val, lp);
+		return 0;
 
-	rc = cdev_add(&lp->cdev, lp->devid, 1);
-	if (rc < 0)  {
-		dev_err(dev, "Error during the cdev_add operation");
-		goto cdev_release_sysfsclass;
-	}
+	case PB_ZYBO_CMD_RGB_PERIOD_SET:
+		lp->period = arg;
+		return 0;
 
-	/* Create a device in /dev and register it to the sysfs */
-	lp->device = device_create(lp->sysclass, dev, lp->devid, NULL, DEVICE_ID_STR, lp->devid);
-	if(IS_ERR(lp->device)) {
-		dev_err(dev, "Error during the device creation.\n");
-		rc = -EFAULT;
-		goto cdev_del_device;
+	default:
+		return -EINVAL;
 	}
-
-	return 0;
-
-	/* Error handlers */
-	cdev_del_device:
-		cdev_del(&lp->cdev);
-	cdev_release_sysfsclass:
-		class_destroy(lp->sysclass);
-		lp->sysclass = NULL;
-	cdev_add_err:
-		unregister_chrdev_region(lp->devid, 1);
-	return rc;
 }
 
-static void rgb_module_cdev_exit(struct platform_device *pdev) {
-	/* Deallocate already allocated structures */
-	struct device *dev = &pdev->dev;
-	struct rgb_led_module_local *lp = dev_get_drvdata(dev);
-	dev_info(dev, "Running the cdev exit.\n");
-	device_destroy(lp->sysclass, lp->devid);
-	cdev_del(&lp->cdev);
-	class_destroy(lp->sysclass);
-	lp->sysclass = NULL;
-	unregister_chrdev_region(lp->devid, 1);
+/**
+ * @brief Free the removed device after the last open file is closed
+ * 
+ * @param pd Device instance
+ */
+static void rgb_led_module_release(struct pb_zybo_dev *pd) {
+	kfree(container_of(pd, struct rgb_led_module_local, pd));
 }
 
+/**
+ * @brief Driver type registered in the pb-zybo core, it is shared by
+ * all RGB device instances
+ * 
+ */
+static struct pb_zybo_type rgb_led_module_type = {
+	.name = DRIVER_SYSFS_CLASS,
+	.devname_fmt = DEVICE_ID_STR,
+	.fops = &fops,
+	.groups = rgb_led_module_groups,
+	.kind = PB_ZYBO_KIND_RGB,
+	.cmd_exec = rgb_led_module_cmd_exec,
+	.release = rgb_led_module_release,
+};
+
 /* ==================================================================
  		Platform dependent callbacks
    ================================================================== */
 
 static int rgb_led_module_probe(struct platform_device *pdev) {
-	struct resource *r_mem; /* IO mem resources */
 	struct device *dev = &pdev->dev;
 	struct rgb_led_module_local *lp = NULL;
-
+	u64 start = ktime_get_ns();
+	bool adopted = false;
 	int rc = 0;
-	dev_info(dev, "Device Tree Probing\n");
-	/* Get iospace for the device */
-	r_mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	if (!r_mem) {
-		dev_err(dev, "Invalid address\n");
-		return -ENODEV;
-	}
-	lp = (struct rgb_led_module_local *) kmalloc(sizeof(struct rgb_led_module_local), GFP_KERNEL);
+
+	lp = (struct rgb_led_module_local *) kzalloc(sizeof(struct rgb_led_module_local), GFP_KERNEL);
 	if (!lp) {
 		dev_err(dev, "Could not allocate rgb-led-module device\n");
 		return -ENOMEM;
 	}
 
 	dev_set_drvdata(dev, lp);
-	lp->mem_start = r_mem->start;
-	lp->mem_end = r_mem->end;
-
-	if (!request_mem_region(lp->mem_start,
-				lp->mem_end - lp->mem_start + 1,
-				DRIVER_NAME)) {
-		dev_err(dev, "Couldn't lock memory region at %p\n",
-			(void *)lp->mem_start);
-		rc = -EBUSY;
+
+	lp->base_addr = pb_zybo_ioremap(pdev, DRIVER_NAME, &lp->mem_start, &lp->mem_end);
+	if (IS_ERR(lp->base_addr)) {
+		rc = PTR_ERR(lp->base_addr);
 		goto err_region_req;
 	}
 
-	lp->base_addr = ioremap(lp->mem_start, lp->mem_end - lp->mem_start + 1);
-	if (!lp->base_addr) {
-		dev_err(dev, "rgb-led-module: Could not allocate iomem\n");
-		rc = -EIO;
-		goto err_remap;
+	rc = pb_zybo_regmap_init(&lp->pd, dev, lp->base_addr, &rgb_led_module_regmap_config);
+	if (rc) {
+		goto err_regmap;
 	}
 
-	/* Initialize the device with default values */
-	lp->sysclass = NULL;
-	lp->device = NULL;
+	/* Initialize the device with default values, all registers are written. The running
+	device is adopted without any write if the state is kept across the reload. */
 	lp->period = PWM_PERIOD_CLK;
-	init_device(lp);
+	lp->hw_synced = false;
+	adopted = pb_zybo_keep_state() && !adopt_device(lp);
+	if (!adopted) {
+		init_device(lp);
+	}
+
+	pb_zybo_probe_done(&lp->pd, dev, start);
 
 	/* Initialize the character device */
-	rc = rgb_module_cdev_init(pdev);
+	rc = pb_zybo_dev_add(&rgb_led_module_type, &lp->pd, dev, lp);
 	if (rc) {
 		dev_err(dev, "Unable to create a cdev.\n");
 		goto err_cdev_init;
 	}
-	
-	dev_info(dev,"rgb-led-module at 0x%08x mapped to 0x%08x\n",
+
+	dev_dbg(dev, "rgb-led-module at 0x%08x mapped to 0x%08x\n",
 		(unsigned int __force)lp->mem_start,
 		(unsigned int __force)lp->base_addr);
-
 	return 0;
 
 err_cdev_init:
-	rgb_module_cdev_exit(pdev);
-	iounmap(lp->base_addr);
-err_remap:
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
+	/* The adopted device keeps running, the snapshot is returned for the next probe */
+	if (adopted) {
+		handover_device(dev, lp);
+	} else {
+		deinit_device(lp);
+	}
+	pb_zybo_regmap_exit(&lp->pd);
+err_regmap:
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 err_region_req:
 	kfree(lp);
 	dev_set_drvdata(dev, NULL);
@@ -662,22 +870,29 @@ err_region_req:
 static int rgb_led_module_remove(struct platform_device *pdev) {
 	struct device *dev = &pdev->dev;
 	struct rgb_led_module_local *lp = dev_get_drvdata(dev);
-	rgb_module_cdev_exit(pdev);
-	deinit_device(lp);
-	iounmap(lp->base_addr);
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
-	kfree(lp);
+	pb_zybo_dev_del(&lp->pd);
+	if (pb_zybo_keep_state()) {
+		handover_device(dev, lp);
+	} else {
+		deinit_device(lp);
+	}
+	pb_zybo_regmap_exit(&lp->pd);
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 	dev_set_drvdata(dev, NULL);
-	dev_info(&pdev->dev, "rgb-led-module is being removed.\n");
+	dev_dbg(&pdev->dev, "rgb-led-module is being removed.\n");
+
+	/* Files which are still open keep the structure alive */
+	pb_zybo_dev_release(&lp->pd);
 	return 0;
 }
+PB_ZYBO_DEFINE_REMOVE(rgb_led_module_remove)
 
 static void rgb_led_module_shutdown(struct platform_device *pdev) {
 	struct device *dev = &pdev->dev;
 	struct rgb_led_module_local *lp = dev_get_drvdata(dev);
 
 	deinit_device(lp);
-	dev_info(&pdev->dev, "rgb-led-module is shutting down.\n");
+	dev_dbg(&pdev->dev, "rgb-led-module is shutting down.\n");
 }
 
 static struct of_device_id rgb_led_module_of_match[] = {
@@ -693,12 +908,42 @@ static struct platform_driver rgb_led_module_driver = {
 		.of_match_table	= rgb_led_module_of_match,
 	},
 	.probe		= rgb_led_module_probe,
-	.remove		= rgb_led_module_remove,
+	.remove		= PB_ZYBO_REMOVE(rgb_led_module_remove),
 	.shutdown   = rgb_led_module_shutdown,
 };
 
+static int __init rgb_led_module_init(void)
+{
+	int rc;
 
-module_platform_driver(rgb_led_module_driver);
+	/* The driver type (class, minors) has to exist before the first probe */
+	rc = pb_zybo_type_register(&rgb_led_module_type);
+	if (rc) {
+		return rc;
+	}
+
+	/* Probe asynchronously unless the core is loaded with async_probe=0 */
+	rgb_led_module_driver.driver.probe_type = pb_zybo_probe_type();
+	rc = platform_driver_register(&rgb_led_module_driver);
+	if (rc) {
+		pb_zybo_type_unregister(&rgb_led_module_type);
+	}
+	return rc;
+}
+
+static void __exit rgb_led_module_exit(void)
+{
+	platform_driver_unregister(&rgb_led_module_driver);
+	pb_zybo_type_unregister(&rgb_led_module_type);
+}
+
+module_init(rgb_led_module_init);
+module_exit(rgb_led_module_exit);
+
+/* KUnit tests of static helpers (CONFIG_PB_ZYBO_KUNIT_TEST) */
+#if IS_ENABLED(CONFIG_PB_ZYBO_KUNIT_TEST)
+#include "rgb-led-module-test.c"
+#endif
 
 /* Standard module information, edit as appropriate */
 MODULE_LICENSE("GPL");
@@ -0,0 +1,187 @@
+/*  switch-module-test.c - KUnit tests of the Zybo base switch driver
+
+* Copyright (C) 2020 Pavel Benacek
+*
+*   This program is free software; you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation; either version 2 of the License, or
+*   (at your option) any later version.
+
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License along
+*   with this program. If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/* The file is included at the end of switch-module.c, so static helpers can be tested
+ * directly. The switch register lives in a RAM window, no HW is needed. */
+
+#include <kunit/test.h>
+
+/* Size of the RAM window with the switch register */
+#define SWITCH_TEST_WINDOW 64
+
+/**
+ * @brief Test context - the device with registers in RAM and the opened file
+ *
+ */
+struct switch_test_ctx {
+	struct switch_module_local *lp;
+	struct switch_file_ctx *fctx;
+	u32 *regs;
+	struct file *file;
+};
+
+static int switch_test_init(struct kunit *test) {
+	struct switch_test_ctx *tc;
+	int rc;
+
+	tc = kunit_kzalloc(test, sizeof(*tc), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc);
+	tc->lp = kunit_kzalloc(test, sizeof(*tc->lp), GFP_KERNEL);
+	tc->fctx = kunit_kzalloc(test, sizeof(*tc->fctx), GFP_KERNEL);
+	tc->regs = kunit_kzalloc(test, SWITCH_TEST_WINDOW, GFP_KERNEL);
+	tc->file = kunit_kzalloc(test, sizeof(*tc->file), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tc->lp);
+	KUNIT_ASSERT_NOT_NULL(test, tc->fctx);
+	KUNIT_ASSERT_NOT_NULL(test, tc->regs);
+	KUNIT_ASSERT_NOT_NULL(test, tc->file);
+
+	/* Same state as after the probe */
+	tc->lp->mask = SWITCH_INIT_MASK;
+	rc = pb_zybo_test_dev_init(&tc->lp->pd, tc->regs, &switch_module_regmap_config, tc->lp);
+	KUNIT_ASSERT_EQ(test, rc, 0);
+	switch_module_event_init(tc->lp);
+
+	tc->fctx->lp = tc->lp;
+	tc->fctx->pf.pd = &tc->lp->pd;
+	tc->fctx->pf.can_write = true;
+	tc->file->private_data = tc->fctx;
+	test->priv = tc;
+	return 0;
+}
+
+static void switch_test_exit(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+	cancel_delayed_work_sync(&tc->lp->poll_work);
+	pb_zybo_test_dev_exit(&tc->lp->pd);
+}
+
+static void switch_test_read_mask(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+
+	tc->regs[SWITCH_DATA_REG / 4] = 0xffffffff;
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), SWITCH_INIT_MASK);
+
+	tc->regs[SWITCH_DATA_REG / 4] = 0xa;
+	tc->lp->mask = 0x3;
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), 0x2);
+
+	tc->lp->mask = 0;
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), 0);
+}
+
+static void switch_test_read_volatile(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+	unsigned long reads = tc->lp->pd.mmio_reads;
+
+	/* Every read goes to the HW, the switch value isn't cached */
+	tc->regs[SWITCH_DATA_REG / 4] = 0x1;
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), 0x1);
+	tc->regs[SWITCH_DATA_REG / 4] = 0x4;
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), 0x4);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_reads, reads + 2);
+}
+
+static void switch_test_ioctl_mask(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+
+	tc->regs[SWITCH_DATA_REG / 4] = 0xf;
+	KUNIT_EXPECT_EQ(test, switch_module_ioctl(tc->file, SW_IOCTL_SET_MASK, 0x5), 0L);
+	KUNIT_EXPECT_EQ(test, tc->lp->mask, 0x5);
+	KUNIT_EXPECT_EQ(test, read_device(tc->lp), 0x5);
+}
+
+static void switch_test_ioctl_no_perm(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+
+	tc->fctx->pf.can_write = false;
+	KUNIT_EXPECT_EQ(test, switch_module_ioctl(tc->file, SW_IOCTL_SET_MASK, 0x5), (long)-EPERM);
+	KUNIT_EXPECT_EQ(test, tc->lp->mask, SWITCH_INIT_MASK);
+}
+
+static void switch_test_ioctl_unknown(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+
+	KUNIT_EXPECT_EQ(test, switch_module_ioctl(tc->file, _IO(SW_IOCTL_MAGIC, 0x7f), 0), (long)-ENOTTY);
+	KUNIT_EXPECT_EQ(test, down_trylock(&tc->lp->pd.sem), 0);
+	up(&tc->lp->pd.sem);
+}
+
+static void switch_test_event(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+	struct pb_zybo_sw_event ev;
+
+	/* Samples without the change don't create events */
+	tc->regs[SWITCH_DATA_REG / 4] = 0x0;
+	switch_module_sample(tc->lp, &ev);
+	KUNIT_EXPECT_EQ(test, ev.seq, 0U);
+	KUNIT_EXPECT_EQ(test, switch_module_cdev_poll(tc->file, NULL), (__poll_t)0);
+
+	/* The change is reported until the file reads the value */
+	tc->regs[SWITCH_DATA_REG / 4] = 0x3;
+	KUNIT_EXPECT_EQ(test, switch_module_cdev_poll(tc->file, NULL), (__poll_t)(EPOLLIN | EPOLLRDNORM));
+	switch_module_sample(tc->lp, &ev);
+	KUNIT_EXPECT_EQ(test, ev.seq, 1U);
+	KUNIT_EXPECT_EQ(test, ev.value, 0x3U);
+	KUNIT_EXPECT_LE(test, ev.prev_ns, ev.ts_ns);
+
+	tc->fctx->seen = ev.seq;
+	KUNIT_EXPECT_EQ(test, switch_module_cdev_poll(tc->file, NULL), (__poll_t)0);
+
+	/* Masked bits are not changes */
+	tc->regs[SWITCH_DATA_REG / 4] = 0x13;
+	KUNIT_EXPECT_EQ(test, switch_module_cdev_poll(tc->file, NULL), (__poll_t)0);
+}
+
+static void switch_test_dead(struct kunit *test) {
+	struct switch_test_ctx *tc = test->priv;
+	struct pb_zybo_sw_event ev;
+	unsigned long reads = tc->lp->pd.mmio_reads;
+
+	/* The removed device isn't sampled and the sampling work can't be armed again */
+	spin_lock(&tc->lp->ev_lock);
+	tc->lp->dead = true;
+	spin_unlock(&tc->lp->ev_lock);
+
+	KUNIT_EXPECT_EQ(test, switch_module_sample(tc->lp, &ev), -ENODEV);
+	KUNIT_EXPECT_EQ(test, switch_module_cdev_poll(tc->file, NULL), (__poll_t)(EPOLLHUP | EPOLLERR));
+	switch_module_watch(&tc->lp->pd);
+	KUNIT_EXPECT_FALSE(test, delayed_work_pending(&tc->lp->poll_work));
+	KUNIT_EXPECT_EQ(test, switch_module_core_sample(&tc->lp->pd), -ENODEV);
+	KUNIT_EXPECT_EQ(test, switch_module_ioctl(tc->file, PB_ZYBO_SW_IOCTL_GET_VALUE, 0), (long)-ENODEV);
+	KUNIT_EXPECT_EQ(test, tc->lp->pd.mmio_reads, reads);
+}
+
+static struct kunit_case switch_module_test_cases[] = {
+	KUNIT_CASE(switch_test_read_mask),
+	KUNIT_CASE(switch_test_read_volatile),
+	KUNIT_CASE(switch_test_ioctl_mask),
+	KUNIT_CASE(switch_test_ioctl_no_perm),
+	KUNIT_CASE(switch_test_ioctl_unknown),
+	KUNIT_CASE(switch_test_event),
+	KUNIT_CASE(switch_test_dead),
+	{}
+};
+
+static struct kunit_suite switch_module_test_suite = {
+	.name = "pb-zybo-switch",
+	.init = switch_test_init,
+	.exit = switch_test_exit,
+	.test_cases = switch_module_test_cases,
+};
+kunit_test_suite(switch_module_test_suite);
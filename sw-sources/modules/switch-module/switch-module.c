@@ -28,12 +28,20 @@
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
 #include <linux/capability.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <linux/of_address.h>
 #include <linux/of_device.h>
 #include <linux/of_platform.h>
+#include <linux/regmap.h>
 
-/* Declare IOCTL handlers */
+#include "pb-zybo-core.h"
+#include "pb-zybo-cmd.h"
+#include "pb-zybo-ioctl.h"
+
+/* Original IOCTL handlers (see pb-zybo-ioctl.h for current numbers) */
 #define SW_IOCTL_MAGIC			'l'
 #define SW_IOCTL_GET_MASK		_IOR(SW_IOCTL_MAGIC, 0, int)
 #define SW_IOCTL_SET_MASK		_IOW(SW_IOCTL_MAGIC, 1, int)
@@ -49,6 +57,11 @@
 
 /* Initial values */
 #define SWITCH_INIT_MASK 0xf
+#define SWITCH_DATA_REG 0x0
+
+static unsigned int poll_ms = 10;
+module_param(poll_ms, uint, 0644);
+MODULE_PARM_DESC(poll_ms, "Sampling period of the switch value while poll/epoll waiters are present (ms)");
 
 /**
  * @brief Local device structure which is accessible in all
@@ -61,27 +74,176 @@ struct switch_module_local {
 	unsigned long mem_end;
 	void __iomem *base_addr;
 
-	/* Device info */
-	dev_t devid;
-	struct device *device;
-	struct class *sysclass;
-	struct cdev cdev;
+	/* Device info - registered cdev, device and semaphore */
+	struct pb_zybo_dev pd;
 
 	/* Local device data */
-	struct semaphore sem;
 	u8 mask; /* Mask applied to switch values */
 	char loc_buff[BUFF_SIZE];
+
+	/* Change detection for poll/epoll - the device has no interrupt, the value
+	 * is sampled while somebody waits */
+	spinlock_t ev_lock;					/* Protects the event and the last sample time */
+	struct pb_zybo_sw_event ev;			/* Last detected change */
+	u64 last_ns;						/* Time of the last sample */
+	wait_queue_head_t waitq;			/* Poll waiters */
+	struct delayed_work poll_work;		/* Sampling while waiters are present */
+	bool dead;							/* The device was removed, protected by ev_lock */
+};
+
+/**
+ * @brief Per-open file context - the sequence number of the last change read
+ * by the file, the file is readable (POLLIN) while a newer change exists.
+ * 
+ */
+struct switch_file_ctx {
+	struct pb_zybo_file pf;			/* Core part - CAP_SYS_ADMIN captured during the open */
+	struct switch_module_local *lp;	/* Parent device structure */
+	u32 seen;						/* Last change sequence number read by the file */
 };
 
 /**
  * @brief Read data from the device \p addr and apply the mask
  * 
  */
-static u8 read_device(const struct switch_module_local *m) {
-	u8 rd = ioread8(m->base_addr);
+static u8 read_device(struct switch_module_local *m) {
+	unsigned int rd = 0;
+
+	regmap_read(m->pd.regmap, SWITCH_DATA_REG, &rd);
 	return rd & m->mask;
 }
 
+/**
+ * @brief Read the masked value and record the change - waiters are woken up when the value
+ * differs from the last sample. It doesn't need the device semaphore, so it is called from
+ * the sampling work, the rule thread of the core and the poll callback too. Each sample is reported to the core, which
+ * completes io_uring waits and evaluates reaction rules.
+ * 
+ * @param lp Device
+ * @param ev Copy of the current event (can be NULL)
+ * @return int 0 iff the value was sampled, -ENODEV for the removed device
+ */
+static int switch_module_sample(struct switch_module_local *lp, struct pb_zybo_sw_event *ev) {
+	u64 now = ktime_get_ns();
+	bool changed = false;
+	u8 val;
+
+	/* The register map uses the spinlock (fast_io), the read is done under the event lock
+	 * so it can't race with the unmap in the remove */
+	spin_lock(&lp->ev_lock);
+	if (lp->dead) {
+		spin_unlock(&lp->ev_lock);
+		return -ENODEV;
+	}
+
+	val = read_device(lp);
+	if (val != lp->ev.value) {
+		lp->ev.value = val;
+		lp->ev.seq++;
+		lp->ev.ts_ns = now;
+		lp->ev.prev_ns = lp->last_ns;
+		changed = true;
+	}
+	lp->last_ns = now;
+	if (ev) {
+		*ev = lp->ev;
+	}
+	pb_zybo_sw_sample(&lp->pd, val);
+	spin_unlock(&lp->ev_lock);
+
+	if (changed) {
+		wake_up_interruptible_poll(&lp->waitq, EPOLLIN | EPOLLRDNORM);
+	}
+	return 0;
+}
+
+/**
+ * @brief Schedule the sampling work unless the device was removed - the remove cancels
+ * the work after the device is marked dead, so nobody can arm it again
+ * 
+ * @param lp Device
+ * @param ms Delay of the sample
+ * @param now Move the already scheduled work to the given delay (mod_delayed_work)
+ */
+static void switch_module_arm(struct switch_module_local *lp, unsigned int ms, bool now) {
+	spin_lock(&lp->ev_lock);
+	if (!lp->dead) {
+		if (now) {
+			mod_delayed_work(system_wq, &lp->poll_work, msecs_to_jiffies(ms));
+		} else {
+			schedule_delayed_work(&lp->poll_work, msecs_to_jiffies(ms));
+		}
+	}
+	spin_unlock(&lp->ev_lock);
+}
+
+/**
+ * @brief Get the sampling period - poll/epoll waiters (epoll waits stay registered until
+ * the file is removed from the set) and users of the core (io_uring waits) need samples
+ * 
+ * @return unsigned int Period in ms, 0 iff nobody needs samples
+ */
+static unsigned int switch_module_period_ms(struct switch_module_local *lp) {
+	unsigned int def_ms = max(poll_ms, 1U);
+	unsigned int ms = pb_zybo_sw_watch_ms(&lp->pd, def_ms);
+
+	if (wq_has_sleeper(&lp->waitq) && (ms == 0 || ms > def_ms)) {
+		ms = def_ms;
+	}
+	return ms;
+}
+
+/**
+ * @brief Sample the switch value, the work is rescheduled while somebody needs samples
+ * 
+ */
+static void switch_module_poll_work(struct work_struct *work) {
+	struct switch_module_local *lp = container_of(to_delayed_work(work), struct switch_module_local, poll_work);
+	unsigned int ms;
+
+	if (switch_module_sample(lp, NULL)) {
+		return;
+	}
+
+	ms = switch_module_period_ms(lp);
+	if (ms) {
+		switch_module_arm(lp, ms, false);
+	}
+}
+
+/**
+ * @brief Initialize the change detection, the first sample isn't a change
+ * 
+ */
+static void switch_module_event_init(struct switch_module_local *lp) {
+	spin_lock_init(&lp->ev_lock);
+	init_waitqueue_head(&lp->waitq);
+	INIT_DELAYED_WORK(&lp->poll_work, switch_module_poll_work);
+	lp->ev.value = read_device(lp);
+	lp->last_ns = ktime_get_ns();
+}
+
+static bool switch_module_writeable_reg(struct device *dev, unsigned int reg) {
+	return false;
+}
+
+static bool switch_module_volatile_reg(struct device *dev, unsigned int reg) {
+	return true;
+}
+
+/**
+ * @brief Register map of the device - the switch data register is read-only and
+ * volatile, so every read goes to the HW
+ * 
+ */
+static const struct regmap_config switch_module_regmap_config = {
+	.name = "switch",
+	.max_register = SWITCH_DATA_REG,
+	.writeable_reg = switch_module_writeable_reg,
+	.volatile_reg = switch_module_volatile_reg,
+	.cache_type = REGCACHE_NONE,
+};
+
 /* ==================================================================
  		Character device callbacks
    ================================================================== */
@@ -94,43 +256,68 @@ static u8 read_device(const struct switch_module_local *m) {
 
 static long switch_module_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
 	long rc;
+	struct switch_file_ctx *ctx;
 	struct switch_module_local *lp;
-	u8 tmp_val;
+	struct pb_zybo_sw_event ev;
 
 	/* Setup initial values and acquire the lock */
 	rc = 0;
-	lp = file->private_data;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is being used by a different process.\n");
-		return -ERESTARTSYS;
+	ctx = file->private_data;
+	lp = ctx->lp;
+	pb_zybo_ioctl_enter(&lp->pd, cmd, arg);
+
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
+		return rc;
 	}
 
-	IOCTL_DEBUG_PRINT(lp->device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
+	IOCTL_DEBUG_PRINT(lp->pd.device, "IOCTL Handler has been called - cmd = 0x%x , arg = 0x%lx\n", cmd, arg);
 	switch (cmd) {
 		case SW_IOCTL_GET_MASK:
+		case PB_ZYBO_SW_IOCTL_GET_MASK:
 			rc = put_user(lp->mask, (int __user*) arg);
-			IOCTL_DEBUG_PRINT(lp->device, "Sending the mask value 0x%x (rc = %ld)\n", lp->mask, rc);
+			IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the mask value 0x%x (rc = %ld)\n", lp->mask, rc);
 			break;
 		case SW_IOCTL_SET_MASK:
-			if (!capable(CAP_SYS_ADMIN)) {
-				IOCTL_DEBUG_PRINT(lp->device,"User is not capable to set the mask value\n");
-				return -EPERM;
+		case PB_ZYBO_SW_IOCTL_SET_MASK:
+			if (!ctx->pf.can_write) {
+				IOCTL_DEBUG_PRINT(lp->pd.device,"User is not capable to set the mask value\n");
+				rc = -EPERM;
+				break;
 			}
 			lp->mask = arg;
-			IOCTL_DEBUG_PRINT(lp->device, "Sending the mask value 0x%x (rc = %ld)\n", lp->mask, rc);
+			IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the mask value 0x%x (rc = %ld)\n", lp->mask, rc);
 			break;
 		case SW_IOCTL_GET_VALUE:
-			tmp_val = read_device(lp);
-			rc = put_user(tmp_val, (int __user*) arg);
-			IOCTL_DEBUG_PRINT(lp->device, "Sending the current value 0x%x (rc = %ld)\n", tmp_val, rc);
+		case PB_ZYBO_SW_IOCTL_GET_VALUE:
+			rc = switch_module_sample(lp, &ev);
+			if (rc) {
+				break;
+			}
+			ctx->seen = ev.seq;
+			rc = put_user(ev.value, (int __user*) arg);
+			IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the current value 0x%x (rc = %ld)\n", ev.value, rc);
+			break;
+		case PB_ZYBO_SW_IOCTL_GET_EVENT:
+			rc = switch_module_sample(lp, &ev);
+			if (rc) {
+				break;
+			}
+			ctx->seen = ev.seq;
+			if (copy_to_user((void __user*) arg, &ev, sizeof(ev))) {
+				rc = -EFAULT;
+			}
+			IOCTL_DEBUG_PRINT(lp->pd.device, "Sending the event %u, value 0x%x (rc = %ld)\n", ev.seq, ev.value, rc);
 			break;
 		default:
-			dev_info(lp->device, "Invalid ioctl cmd = 0x%08x\n", cmd);
+			dev_info(lp->pd.device, "Invalid ioctl cmd = 0x%08x\n", cmd);
 			rc = -ENOTTY;
 			break;
 	}
 
-	up(&lp->sem);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_ioctl_exit(&lp->pd, cmd, rc);
 	return rc;
 }
 
@@ -138,10 +325,10 @@ static loff_t switch_module_cdev_llseek(struct file *file, loff_t offset, int wh
 	struct switch_module_local *lp;
 	loff_t rc;
 
-	lp = file->private_data;
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
+	lp = ((struct switch_file_ctx *)file->private_data)->lp;
+	rc = pb_zybo_down(&lp->pd, file);
+	if (rc) {
+		return rc;
 	}
 
 	/* Restart the status and seek the offset based on whence */
@@ -159,20 +346,23 @@ static loff_t switch_module_cdev_llseek(struct file *file, loff_t offset, int wh
 	}
 	
 	/* Put the semaphore up and return the new llseek value */
-	up(&lp->sem);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_LLSEEK, 0, rc);
 	return rc;
 }
 
 static ssize_t switch_module_cdev_read(struct file *file, char __user *buff, size_t count, loff_t *f_pos) {
+	struct switch_file_ctx *ctx;
 	struct switch_module_local *lp;
+	struct pb_zybo_sw_event ev;
 	ssize_t ret;
-	u8 tmp_data;
 	char* bf_start;
 
 
 	/* Structure initilization */
 	ret = 0;
-	lp = file->private_data;
+	ctx = file->private_data;
+	lp = ctx->lp;
 
 	/* Check if we are done (could be numbers from 0 to 15) */
 	if (*f_pos > 1) {
@@ -180,15 +370,20 @@ static ssize_t switch_module_cdev_read(struct file *file, char __user *buff, siz
 	}
 
 	/* Acquire the lock */
-	if (down_interruptible(&lp->sem)) {
-		dev_err(lp->device, "Cannot acquire the device, it is used by a different process.\n");
-		return -ERESTARTSYS;
+	ret = pb_zybo_down(&lp->pd, file);
+	if (ret) {
+		return ret;
 	}
 
 	/* Read data from the device iff the starting offset is 0 */
 	if (*f_pos == 0) {
-		tmp_data = read_device(lp);
-		snprintf(lp->loc_buff, BUFF_SIZE, "%d\n",tmp_data);
+		ret = switch_module_sample(lp, &ev);
+		if (ret) {
+			pb_zybo_up(&lp->pd);
+			return ret;
+		}
+		ctx->seen = ev.seq;
+		snprintf(lp->loc_buff, BUFF_SIZE, "%d\n", ev.value);
 	}
 
 	/* Send the data based on on offset */
@@ -196,7 +391,7 @@ static ssize_t switch_module_cdev_read(struct file *file, char __user *buff, siz
 	ret = strnlen(bf_start, BUFF_SIZE);
 	if (ret == 0) {
 		/* We don't have nothing to send */
-		up(&lp->sem);
+		pb_zybo_up(&lp->pd);
 		return 0;
 	}
 
@@ -207,12 +402,13 @@ static ssize_t switch_module_cdev_read(struct file *file, char __user *buff, siz
 
 	/* Send data to user and shift the file pointer */
 	if (copy_to_user(buff, bf_start, ret)) {
-		up(&lp->sem);
+		pb_zybo_up(&lp->pd);
 		return -EFAULT;
 	}
 
 	*f_pos += ret;
-	up(&lp->sem);
+	pb_zybo_up(&lp->pd);
+	pb_zybo_op_done(&lp->pd, PB_ZYBO_OP_READ, ret, ret);
 	return ret;
 }
 
@@ -221,18 +417,48 @@ static ssize_t switch_module_cdev_write(struct file *file, const char __user *bu
 	return -EINVAL;
 }
 
+/**
+ * @brief Poll callback - the file is readable when the value changed since the last
+ * read of the file. Sampling runs each poll_ms while waiters are present, files of
+ * the removed device are hung up.
+ * 
+ */
+static __poll_t switch_module_cdev_poll(struct file *file, poll_table *wait) {
+	struct switch_file_ctx *ctx = file->private_data;
+	struct switch_module_local *lp = ctx->lp;
+	struct pb_zybo_sw_event ev;
+
+	poll_wait(file, &lp->waitq, wait);
+	if (switch_module_sample(lp, &ev)) {
+		return EPOLLHUP | EPOLLERR;
+	}
+	switch_module_arm(lp, poll_ms, false);
+
+	return ev.seq != READ_ONCE(ctx->seen) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
 static int switch_module_cdev_open(struct inode *inode, struct file *filp) {
 	/* The device can be opened for reading only, write is not allowed because we cannot
 	 * move the switch using the write operation */
-	struct switch_module_local *lp;
+	struct switch_file_ctx *ctx;
+
+	/* Allocate the per-open context and store it into the private data pointer inside the fs ops,
+	 * changes before the open are not reported */
+	ctx = kzalloc(sizeof(struct switch_file_ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
 
-	/* Get the parent container and store it into the private data pointer inside the fs ops */
-	lp = container_of(inode->i_cdev, struct switch_module_local, cdev);
-	filp->private_data = lp;
+	ctx->lp = container_of(inode->i_cdev, struct switch_module_local, pd.cdev);
+	pb_zybo_file_init(&ctx->pf, &ctx->lp->pd);
+	spin_lock(&ctx->lp->ev_lock);
+	ctx->seen = ctx->lp->ev.seq;
+	spin_unlock(&ctx->lp->ev_lock);
+	filp->private_data = ctx;
 
 	/* Check we opened the device read only */
 	//if ((filp->f_flags & O_ACCMODE) != O_RDONLY) {
-	//	dev_err(lp->device, "Device can be opened in the read-only mode.\n");
+	//	dev_err(lp->pd.device, "Device can be opened in the read-only mode.\n");
 	//	return -EPERM;
 	//}
 
@@ -240,115 +466,112 @@ static int switch_module_cdev_open(struct inode *inode, struct file *filp) {
 }
 
 static int switch_module_cdev_release(struct inode *inode, struct file *filp) {
-	/* Nothing special needs to be done in the release mode */
+	/* Release the per-open context */
+	kfree(filp->private_data);
 	filp->private_data = NULL;
 	return 0;
 }
 
-static struct file_operations fops = {
+static const struct file_operations fops = {
 	.owner = THIS_MODULE,
 	.llseek = switch_module_cdev_llseek,
 	.read = switch_module_cdev_read,
 	.write = switch_module_cdev_write,
 	.open = switch_module_cdev_open,
 	.release = switch_module_cdev_release,
+	.poll = switch_module_cdev_poll,
 	.unlocked_ioctl = switch_module_ioctl,
+#ifdef PB_ZYBO_HAS_URING_CMD
+	.uring_cmd = pb_zybo_uring_cmd,
+#endif
 };
 
-static int switch_module_cdev_init(struct platform_device *pdev) {
-	int rc = 0;
-	struct device *dev = &pdev->dev;
-	struct switch_module_local *lp = dev_get_drvdata(dev);
-	unsigned int n_major = 0;
-	unsigned int n_minor = 0;
-
-	/* Initialize the semaphore */
-	sema_init(&lp->sem, 1);
-
-	/* Allocate MAJOR and MINOR numbers */
-	rc = alloc_chrdev_region(&lp->devid, 0, 1, DRIVER_NAME);
-	if (rc < 0) {
-		dev_err(dev, "Unable to allocate the major and minor numbers");
-		return rc;
-	}
-
-	n_major = MAJOR(lp->devid);
-	n_minor = MINOR(lp->devid);
-	dev_info(dev, "cdev init MAJOR=%d and MINOR=%d\n",n_major, n_minor);
+/**
+ * @brief Execute one batched command (/dev/pb-zybo-cmd), the device semaphore
+ * is held by the core
+ * 
+ * @param pd Device instance
+ * @param op Command operation
+ * @param arg Command argument
+ * @param val Output value
+ * @return long 0 iff the command was executed
+ */
+static long switch_module_cmd_exec(struct pb_zybo_dev *pd, u32 op, u32 arg, u32 *val) {
+	struct switch_module_local *lp = container_of(pd, struct switch_module_local, pd);
+	struct pb_zybo_sw_event ev;
+	int rc;
 
-	/* Create the sysfs class */
-    lp->sysclass = class_create(THIS_MODULE, DRIVER_SYSFS_CLASS);
-	if (IS_ERR(lp->sysclass)) {
-		dev_err(dev, "Error during the sysfs class creation\n");
-		rc = -EFAULT;
-		goto err_dealloc_chrdev;
+	if (op != PB_ZYBO_CMD_SW_GET) {
+		return -EINVAL;
 	}
 
-	/* Create device and register it in the sysfs */
-	lp->device = device_create(lp->sysclass, dev, lp->devid, NULL, DEVICE_ID_STR, lp->devid);
-	if (IS_ERR(lp->device)) {
-		dev_err(dev, "Error during the device creation.\n");
-		rc = -EFAULT;
-		goto err_class_create;
+	rc = switch_module_sample(lp, &ev);
+	if (rc) {
+		return rc;
 	}
 
-	/* Register the character device */
-	dev_info(dev, "Registering the cdev.\n");
-	cdev_init(&lp->cdev, &fops);
-	lp->cdev.owner = THIS_MODULE;
-
-	rc = cdev_add(&lp->cdev, lp->devid, 1);
-	if (rc < 0)  {
-		dev_err(dev, "Error during the cdev_add operation.\n");
-		goto err_create_device;
-	}
-	
-	dev_info(dev, "cdev init done!\n");
+	*val = ev.value;
 	return 0;
+}
 
-err_create_device:
-	device_destroy(lp->sysclass, lp->devid);
-err_class_create:
-	class_destroy(lp->sysclass);
-err_dealloc_chrdev:
-	unregister_chrdev_region(lp->devid, 1);
-	lp->devid = 0;
-	return rc;
+/**
+ * @brief Start the sampling for the core (the first sample is taken immediately)
+ * 
+ * @param pd Device instance
+ */
+static void switch_module_watch(struct pb_zybo_dev *pd) {
+	struct switch_module_local *lp = container_of(pd, struct switch_module_local, pd);
+
+	switch_module_arm(lp, 0, true);
 }
 
-static void switch_module_cdev_exit(struct platform_device *pdev) {
-	/* Deallocate already allocated structures */
-	struct device *dev = &pdev->dev;
-	struct switch_module_local *lp = dev_get_drvdata(dev);
+/**
+ * @brief Take one sample for the rule thread of the core
+ * 
+ * @param pd Device instance
+ * @return int 0 iff the device was sampled
+ */
+static int switch_module_core_sample(struct pb_zybo_dev *pd) {
+	return switch_module_sample(container_of(pd, struct switch_module_local, pd), NULL);
+}
 
-	dev_info(dev, "Running the cdev exit handler.\n");
-	cdev_del(&lp->cdev);
-	device_destroy(lp->sysclass, lp->devid);
-	class_destroy(lp->sysclass);
-	unregister_chrdev_region(lp->devid, 1);
-	lp->devid = 0;
-	lp->sysclass = NULL;
-	lp->device = NULL;
+/**
+ * @brief Free the removed device after the last open file is closed
+ * 
+ * @param pd Device instance
+ */
+static void switch_module_release(struct pb_zybo_dev *pd) {
+	kfree(container_of(pd, struct switch_module_local, pd));
 }
 
+/**
+ * @brief Driver type registered in the pb-zybo core, it is shared by
+ * all switch device instances
+ * 
+ */
+static struct pb_zybo_type switch_module_type = {
+	.name = DRIVER_SYSFS_CLASS,
+	.devname_fmt = DEVICE_ID_STR,
+	.fops = &fops,
+	.kind = PB_ZYBO_KIND_SWITCH,
+	.cmd_exec = switch_module_cmd_exec,
+	.watch = switch_module_watch,
+	.sample = switch_module_core_sample,
+	.release = switch_module_release,
+};
+
 /* ==================================================================
  		Platform dependent callbacks
    ================================================================== */
    
 static int switch_module_probe(struct platform_device *pdev) {
-	struct resource *r_mem; /* IO mem resources */
 	struct device *dev = &pdev->dev;
 	struct switch_module_local *lp = NULL;
-
+	u64 start = ktime_get_ns();
 	int rc = 0;
-	/* Get iospace for the device and allocate the local device structure */
-	r_mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	if (!r_mem) {
-		dev_err(dev, "invalid address\n");
-		return -ENODEV;
-	}
 
-	lp = (struct switch_module_local *) kmalloc(sizeof(struct switch_module_local), GFP_KERNEL);
+	/* Allocate the local device structure */
+	lp = (struct switch_module_local *) kzalloc(sizeof(struct switch_module_local), GFP_KERNEL);
 	if (!lp) {
 		dev_err(dev, "Cound not allocate switch-module device\n");
 		return -ENOMEM;
@@ -356,45 +579,39 @@ static int switch_module_probe(struct platform_device *pdev) {
 
 	/* Add the local structure to private data section */
 	dev_set_drvdata(dev, lp);
-	lp->mem_start = r_mem->start;
-	lp->mem_end = r_mem->end;
 	lp->mask = SWITCH_INIT_MASK;
 
-	/* Allocate the region exclusively for the device */
-	if (!request_mem_region(lp->mem_start,
-				lp->mem_end - lp->mem_start + 1,
-				DRIVER_NAME)) {
-		dev_err(dev, "Couldn't lock memory region at %p\n",
-			(void *)lp->mem_start);
-		rc = -EBUSY;
+	/* Allocate the region exclusively for the device and map it to kernel virtual space */
+	lp->base_addr = pb_zybo_ioremap(pdev, DRIVER_NAME, &lp->mem_start, &lp->mem_end);
+	if (IS_ERR(lp->base_addr)) {
+		rc = PTR_ERR(lp->base_addr);
 		goto err_region;
 	}
 
-	/* Map the IO space to kernel virtual space */
-	lp->base_addr = ioremap(lp->mem_start, lp->mem_end - lp->mem_start + 1);
-	if (!lp->base_addr) {
-		dev_err(dev, "switch-module: Could not allocate iomem\n");
-		rc = -EIO;
-		goto err_release;
+	rc = pb_zybo_regmap_init(&lp->pd, dev, lp->base_addr, &switch_module_regmap_config);
+	if (rc) {
+		goto err_regmap;
 	}
+	switch_module_event_init(lp);
+
+	pb_zybo_probe_done(&lp->pd, dev, start);
 
 	/* Initialize the chardevice */
-	if (switch_module_cdev_init(pdev)) {
+	rc = pb_zybo_dev_add(&switch_module_type, &lp->pd, dev, lp);
+	if (rc) {
 		dev_err(dev, "switch-module: Could not initialize characted device\n");
-		rc = -EFAULT;
 		goto cdev_init_err;
 	}
 
-	dev_info(dev,"switch-module at 0x%08x mapped to 0x%08x\n",
+	dev_dbg(dev, "switch-module at 0x%08x mapped to 0x%08x\n",
 		(unsigned int __force)lp->mem_start,
 		(unsigned int __force)lp->base_addr);
 	return 0;
 
 cdev_init_err:
-	switch_module_cdev_exit(pdev);
-	iounmap(lp->base_addr);
-err_release:
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
+	pb_zybo_regmap_exit(&lp->pd);
+err_regmap:
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 err_region:
 	kfree(lp);
 	dev_set_drvdata(dev, NULL);
@@ -405,14 +622,26 @@ static int switch_module_remove(struct platform_device *pdev) {
 	struct device *dev = &pdev->dev;
 	struct switch_module_local *lp = dev_get_drvdata(dev);
 
-	dev_info(dev, "Removing the switch module.\n");
-	switch_module_cdev_exit(pdev);
-	iounmap(lp->base_addr);
-	release_mem_region(lp->mem_start, lp->mem_end - lp->mem_start + 1);
-	kfree(lp);
+	dev_dbg(dev, "Removing the switch module.\n");
+
+	/* Hang up open files first - poll waiters are woken up and nobody arms the sampling
+	 * work after it is cancelled */
+	spin_lock(&lp->ev_lock);
+	lp->dead = true;
+	spin_unlock(&lp->ev_lock);
+	wake_up_interruptible_poll(&lp->waitq, EPOLLHUP | EPOLLERR);
+	cancel_delayed_work_sync(&lp->poll_work);
+
+	pb_zybo_dev_del(&lp->pd);
+	pb_zybo_regmap_exit(&lp->pd);
+	pb_zybo_iounmap(pdev, lp->base_addr, lp->mem_start, lp->mem_end);
 	dev_set_drvdata(dev, NULL);
+
+	/* Files which are still open keep the structure (wait queue, context) alive */
+	pb_zybo_dev_release(&lp->pd);
 	return 0;
 }
+PB_ZYBO_DEFINE_REMOVE(switch_module_remove)
 
 
 static struct of_device_id switch_module_of_match[] = {
@@ -427,25 +656,44 @@ static struct platform_driver switch_module_driver = {
 		.of_match_table	= switch_module_of_match,
 	},
 	.probe		= switch_module_probe,
-	.remove		= switch_module_remove,
+	.remove		= PB_ZYBO_REMOVE(switch_module_remove),
 };
 
 static int __init switch_module_init(void)
 {
-	printk(KERN_INFO "switch-module driver - platform registration.\n");
-	return platform_driver_register(&switch_module_driver);
+	int rc;
+
+	/* The driver type (class, minors) has to exist before the first probe */
+	rc = pb_zybo_type_register(&switch_module_type);
+	if (rc) {
+		return rc;
+	}
+
+	/* Probe asynchronously unless the core is loaded with async_probe=0 */
+	switch_module_driver.driver.probe_type = pb_zybo_probe_type();
+	rc = platform_driver_register(&switch_module_driver);
+	if (rc) {
+		pb_zybo_type_unregister(&switch_module_type);
+	}
+	return rc;
 }
 
 
 static void __exit switch_module_exit(void)
 {
 	platform_driver_unregister(&switch_module_driver);
+	pb_zybo_type_unregister(&switch_module_type);
 	printk(KERN_ALERT "switch-module driver - platform unregistration.\n");
 }
 
 module_init(switch_module_init);
 module_exit(switch_module_exit);
 
+/* KUnit tests of static helpers (CONFIG_PB_ZYBO_KUNIT_TEST) */
+#if IS_ENABLED(CONFIG_PB_ZYBO_KUNIT_TEST)
+#include "switch-module-test.c"
+#endif
+
 /* Standard module information, edit as appropriate */
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Pavel Benacek");